@@ -32,11 +32,15 @@
 
 /* A surface that draws into the bytes of an NSBitmapImageRep.  Cairo keeps
  * its own buffer, in its own pixel layout, and the drawing is written back to
- * the representation when the surface is flushed.
+ * the representation when the surface is flushed.  Only the area drawn into
+ * since the last flush is written back.
  */
 @interface CairoBitmapSurface : CairoSurface
 {
   NSBitmapImageRep *_rep;
+  BOOL _nonpremultiplied;
+  BOOL _needsRead;       /* the representation is not taken up yet */
+  NSRect _dirty;         /* drawn into since the last flush, in pixels */
 }
 
 /* Whether a representation is in a layout this surface can write back to. */
@@ -38,9 +38,22 @@
 	cairo_scaled_font_t *_scaled;
 }
 
+/* Fills in the advancements of count glyphs, measuring all those that
+   aren't cached yet at once. */
+- (void) getAdvancements: (NSSize *)advancements
+               forGlyphs: (const NSGlyph *)glyphs
+                   count: (unsigned int)count;
+
 - (void) drawGlyphs: (const NSGlyph*)glyphs
 	     length: (int)length 
 	         on: (cairo_t*)ct;
+
+/* The extents, in the user space of ct, of the glyphs drawn there by
+   -drawGlyphs:length:on: from the current point. */
+- (void) getExtents: (cairo_text_extents_t *)extents
+	   ofGlyphs: (const NSGlyph*)glyphs
+	     length: (int)length
+	         on: (cairo_t*)ct;
 @end
 
 #endif
@@ -0,0 +1,61 @@
+/*
+   CairoPixelConversion.h
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CairoPixelConversion_h
+#define CairoPixelConversion_h
+
+#include <stdint.h>
+
+/* Conversions of rows of pixels between the layouts of NSBitmapImageRep and
+ * of cairo image surfaces.  A representation holds a pixel as bytes, red
+ * first, with the alpha last if there is one; cairo holds it as a native
+ * word with the alpha (or nothing, for RGB24) in the top byte and blue in
+ * the bottom one.  Both hold premultiplied colours unless said otherwise.
+ *
+ * Each call converts wide pixels.  The conversions between four byte
+ * layouts may be done in place, with from and to the same memory.
+ * Vectorized versions are used when the CPU has them; they give the same
+ * results as the plain ones, bit for bit.
+ */
+
+/* Premultiplied RGBA to ARGB32. */
+void GSCairoRGBAToARGB32(const unsigned char *from, uint32_t *to, int wide);
+
+/* ARGB32 to premultiplied RGBA. */
+void GSCairoARGB32ToRGBA(const uint32_t *from, unsigned char *to, int wide);
+
+/* RGB to RGB24, with the unused top byte 0. */
+void GSCairoRGBToRGB24(const unsigned char *from, uint32_t *to, int wide);
+
+/* Non-premultiplied RGBA to ARGB32: each colour c becomes c * a / 255,
+   rounded to the nearest. */
+void GSCairoPremultiplyRGBAToARGB32(const unsigned char *from, uint32_t *to,
+                                    int wide);
+
+/* ARGB32 to non-premultiplied RGBA: each colour c becomes
+   (c * 255 + a / 2) / a, at most 255, and 0 where a is 0. */
+void GSCairoUnpremultiplyARGB32ToRGBA(const uint32_t *from, unsigned char *to,
+                                      int wide);
+
+#endif
@@ -44,9 +44,23 @@
 
 - (void) handleExposeRect: (NSRect)rect;
 
+/* Show what -handleExposeRect: collected, for a surface that collects the
+ * rects instead of showing each one as it comes.
+ */
+- (void) present;
+
 /* Write out anything the surface is holding back from its destination. */
 - (void) flush;
 
+/* Told before drawing that may change the pixels within rect, in pixels of
+ * the surface with the origin at its top left.  With replacing YES the
+ * drawing sets every pixel of rect whatever was there before.
+ */
+- (void) willDrawRect: (NSRect)rect replacing: (BOOL)replacing;
+
+/* Told before the pixels of the surface are read. */
+- (void) willRead;
+
 - (BOOL) isDrawingToScreen;
 
 @end
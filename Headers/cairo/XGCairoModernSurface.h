@@ -26,11 +26,16 @@
 #define XGCairoXModernSurface_h
 
 #include "cairo/CairoSurface.h"
+#include "x11/XGServerWindow.h"
 
-@interface XGCairoModernSurface : CairoSurface
+@interface XGCairoModernSurface : CairoSurface <GSBatchedExposeDriver>
 {
   @private
     cairo_surface_t *_windowSurface;
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 10, 0)
+    cairo_region_t *_pending;   /* exposed since the last present */
+    BOOL _batched;              /* wait for -present to show _pending */
+#endif
 }
 @end
 
@@ -0,0 +1,89 @@
+/*
+   FCFontCatalogue.h
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef FCFontCatalogue_h
+#define FCFontCatalogue_h
+
+#include <stdint.h>
+#include <Foundation/Foundation.h>
+
+/*
+  The font catalogue keeps the result of enumerating the fontconfig fonts
+  in a file, so that applications don't have to list and describe every
+  installed font each time they start. The file is memory-mapped, and the
+  fonts are looked up in it directly, by family or through a hash table of
+  their names.
+
+  A catalogue carries a stamp computed from the fontconfig version and the
+  modification times of fontconfig's configuration files, font directories
+  and cache directories. It is only used while the stamp matches; when
+  fontconfig reports a change, the fonts are enumerated again and the
+  catalogue is rewritten.
+*/
+
+typedef struct FCFontCatalogue FCFontCatalogue;
+
+typedef struct
+{
+  const char *name;     /* the PostScript name the font is known by */
+  const char *style;
+  const char *family;
+  const char *pattern;  /* the listed pattern, for FcNameParse() */
+  float weight;
+  unsigned int traits;
+} FCCatalogueFont;
+
+/* The stamp of the current fontconfig configuration. */
+uint64_t FCFontCatalogueStamp(void);
+
+/* The path of the user's catalogue file, or nil if there is no user
+   library directory. */
+NSString *FCFontCataloguePath(void);
+
+/* Maps the catalogue at path. Returns NULL if there is none, if it is
+   damaged, or if it was written for another stamp. */
+FCFontCatalogue *FCFontCatalogueOpen(NSString *path, uint64_t stamp);
+void FCFontCatalogueClose(FCFontCatalogue *catalogue);
+
+unsigned int FCFontCatalogueFontCount(FCFontCatalogue *catalogue);
+unsigned int FCFontCatalogueFamilyCount(FCFontCatalogue *catalogue);
+
+/* Returns the name of family i, and the range of fonts that are in it,
+   already in the order of the font panel. */
+const char *FCFontCatalogueFamily(FCFontCatalogue *catalogue, unsigned int i,
+                                  unsigned int *first, unsigned int *count);
+BOOL FCFontCatalogueFont(FCFontCatalogue *catalogue, unsigned int i,
+                         FCCatalogueFont *font);
+
+/* Returns the index of the font called name, or -1. */
+int FCFontCatalogueLookup(FCFontCatalogue *catalogue, const char *name);
+
+/* Writes a catalogue. families maps each family name to its array of font
+   descriptions ([name, style, weight, traits], as the font enumerators use
+   them, in the order to keep), and patterns maps each font name to its
+   unparsed fontconfig pattern. */
+BOOL FCFontCatalogueWrite(NSString *path, uint64_t stamp,
+                          NSDictionary *families, NSDictionary *patterns);
+
+#endif
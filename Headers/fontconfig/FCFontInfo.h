@@ -30,6 +30,7 @@
 
 #include <GNUstepGUI/GSFontInfo.h>
 #include "fontconfig/FCFaceInfo.h"
+#include "gsc/GSGlyphMetricsCache.h"
 
 @interface FCFontInfo : GSFontInfo
 {
@@ -39,8 +40,7 @@
 	CGFloat lineHeight;
 
 	unsigned int _cacheSize;
-	unsigned int *_cachedGlyphs;
-	NSSize *_cachedSizes;
+	GSGlyphMetricsCache *_metrics;
 }
 
 - (void) setCacheSize:(unsigned int)size;
@@ -0,0 +1,74 @@
+/* -*-objc-*-
+   GSGlyphMetricsCache - glyph metrics cache shared by font instances
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _GSGlyphMetricsCache_h_INCLUDE
+#define _GSGlyphMetricsCache_h_INCLUDE
+
+#include <Foundation/NSGeometry.h>
+#include <AppKit/NSFont.h>
+
+@class NSString;
+
+/*
+A cache of the advancement and bounding rectangle of glyphs. Font instances
+with the same face, size and matrix share one cache: they get it with
+GSGlyphMetricsCacheForKey(), using a key that identifies all three, and give
+it back with GSGlyphMetricsCacheRelease().
+
+The cache is set-associative, with four glyphs per set and the least
+recently used glyph of a set replaced first, so glyphs that happen to map to
+the same set don't keep evicting each other the way they did in the old
+direct-mapped caches. Since font instances used on different threads may
+share a cache, each cache has a lock, taken for every lookup and update.
+*/
+typedef struct GSGlyphMetricsCache_s GSGlyphMetricsCache;
+
+/* The number of glyphs a cache holds unless the caller asks for another
+size, from the GSGlyphMetricsCacheSize default (1024 if it isn't set). */
+unsigned int GSGlyphMetricsCacheDefaultSize(void);
+
+/* Returns the cache for key, creating one for about size glyphs if there is
+none yet. The size is rounded up to a whole number of sets. */
+GSGlyphMetricsCache *GSGlyphMetricsCacheForKey(NSString *key,
+                                               unsigned int size);
+void GSGlyphMetricsCacheRelease(GSGlyphMetricsCache *cache);
+
+/* These return NO, and count a miss, if the metric isn't in the cache. */
+BOOL GSGlyphMetricsCacheGetAdvancement(GSGlyphMetricsCache *cache,
+                                       NSGlyph glyph, NSSize *advancement);
+BOOL GSGlyphMetricsCacheGetBoundingRect(GSGlyphMetricsCache *cache,
+                                        NSGlyph glyph, NSRect *rect);
+
+void GSGlyphMetricsCacheSetAdvancement(GSGlyphMetricsCache *cache,
+                                       NSGlyph glyph, NSSize advancement);
+void GSGlyphMetricsCacheSetBoundingRect(GSGlyphMetricsCache *cache,
+                                        NSGlyph glyph, NSRect rect);
+
+/* The number of lookups that were answered from cache, and of those that
+weren't. With a NULL cache, the totals of all caches there have been. */
+void GSGlyphMetricsCacheGetStatistics(GSGlyphMetricsCache *cache,
+                                      unsigned long *hits,
+                                      unsigned long *misses);
+
+#endif
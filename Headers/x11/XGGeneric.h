@@ -111,7 +111,8 @@ static char *atom_names[] = {
   "_GNUSTEP_WM_ATTR",
   "_GNUSTEP_TITLEBAR_STATE",
   "_GNUSTEP_FRAME_OFFSETS",
-  "WM_IGNORE_FOCUS_EVENTS"
+  "WM_IGNORE_FOCUS_EVENTS",
+  "_GNUSTEP_SMOOTH_SCROLL"
  };
 
 /*
@@ -187,6 +188,7 @@ static char *atom_names[] = {
 #define _GNUSTEP_TITLEBAR_STATE_ATOM           atoms[67]
 #define _GNUSTEP_FRAME_OFFSETS_ATOM            atoms[68]
 #define WM_IGNORE_FOCUS_EVENTS_ATOM            atoms[69]
+#define _GNUSTEP_SMOOTH_SCROLL_ATOM            atoms[70]
 
 /*
  * Frame offsets for window inside parent decoration window.
@@ -237,6 +239,8 @@ struct XGGeneric {
   int			lMouseMask;
   int			mMouseMask;
   int			rMouseMask;
+  // XInput2 major opcode, 0 when smooth scrolling is not used.
+  int			xiOpcode;
   Window		appRootWindow;
   void			*cachedWindow;	// last gswindow_device_t used.
   Offsets		offsets[16];
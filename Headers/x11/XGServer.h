@@ -124,6 +124,33 @@ typedef struct MonitorDevice {
 - (BOOL) setPreeditSpot: (NSPoint *)p;
 @end
 
+/*
+ * Counts of the X events read, of those processed (the others were
+ * compressed, coalesced or filtered by the input method), and of the times
+ * processing stopped to let the run loop do other work.  Any argument may
+ * be NULL.
+ */
+@interface XGServer (EventStatistics)
+- (void) getEventsReceived: (unsigned long *)received
+                 delivered: (unsigned long *)delivered
+                    yields: (unsigned long *)yields;
+@end
+
+/*
+ * Motion events that arrive faster than they are processed are compressed
+ * into one NSEvent.  This returns the positions of the compressed events
+ * for such an event, oldest first and ending with the position of the event
+ * itself, and their timestamps.  Either array may be NULL.  At most count
+ * positions (the most recent) are returned; 0 if the event is not a recent
+ * motion event.
+ */
+@interface XGServer (MotionHistory)
+- (NSUInteger) motionHistoryForEvent: (NSEvent *)event
+                           locations: (NSPoint *)locations
+                          timestamps: (NSTimeInterval *)timestamps
+                               count: (NSUInteger)count;
+@end
+
 @interface XGServer (TimeKeeping)
 - (void) setLastTime: (Time)last;
 - (Time) lastTime;
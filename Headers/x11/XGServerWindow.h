@@ -31,6 +31,7 @@
 #include <X11/Xmd.h>		// warning
 #undef BOOL
 #include <x11/XGServer.h>
+#include <x11/xexposed.h>
 
 /*
  * WindowMaker window manager interaction
@@ -77,9 +78,18 @@ typedef struct {
 /* Graphics Driver protocol. Setup in [NSGraphicsContext-contextDevice:] */
 enum {
   GDriverHandlesBacking = 1,
-  GDriverHandlesExpose = 2
+  GDriverHandlesExpose = 2,
+  /* The driver only collects the rects it is asked to handle, and shows
+     them when asked to present. */
+  GDriverBatchesExpose = 4
 };
 
+/* A driver that sets GDriverBatchesExpose is sent -present once the
+   server has collected the rects for a frame. */
+@protocol GSBatchedExposeDriver
+- (void) present;
+@end
+
 typedef struct _gswindow_device_t {
   Display               *display;      /* Display this window is on */
   Window                ident;         /* Window handle */
@@ -104,7 +114,8 @@ typedef struct _gswindow_device_t {
   Drawable              alpha_buffer;  /* Alpha buffer. Managed by gdriver
 					  will be freed if HandlesBacking=0 */
   BOOL			is_exposed;
-  NSMutableArray	*exposedRects; /* List of exposure event rects */
+  XExposedRegion	exposed;       /* Exposure event rects, in X
+					  coordinates */
   Region		region;	       /* Used between several expose events */
   XWMHints		gen_hints;
   XSizeHints		siz_hints;
@@ -131,6 +142,7 @@ typedef struct _gswindow_device_t {
 @interface XGServer (DPSWindow)
 + (gswindow_device_t *) _windowForXWindow: (Window)xWindow;
 + (gswindow_device_t *) _windowForXParent: (Window)xWindow;
++ (void) _setXParent: (Window)xParent forWindow: (gswindow_device_t *)window;
 + (gswindow_device_t *) _windowWithTag: (int)windowNumber;
 - (void) _addExposedRectangle: (XRectangle)rectangle : (int)win : (BOOL) ignoreBacking;
 - (void) _processExposedRectangles: (int)win;
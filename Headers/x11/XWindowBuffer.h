@@ -62,6 +62,21 @@ struct XWindowBuffer_depth_info_s
   int byte_order;
 };
 
+/* The damaged parts of a window buffer that still have to be sent to the
+X server. Rectangles are merged when the area that would be sent twice or
+needlessly is small, or when there is no room left for another one, so
+two small updates far apart stay two small uploads. */
+#define XWINDOWBUFFER_MAX_DAMAGE 8
+
+struct XWindowBuffer_damage_s
+{
+  int num_rects;
+  struct
+  {
+    int x, y, w, h;
+  } rects[XWINDOWBUFFER_MAX_DAMAGE];
+};
+
 /*
 XWindowBuffer maintains an XImage for a window. Each ARTGState that
 renders to that window uses the same XWindowBuffer (and thus the same
@@ -84,6 +99,18 @@ that there's only one XWindowBuffer for each window. */
   int use_shm;
   XShmSegmentInfo shminfo;
 
+  /* With XWindowBufferDoubleBuffer, the X server reads from two more
+  shared images in turn. The damaged parts of the buffer are copied to
+  one that the server isn't reading before each put, so neither drawing
+  into the buffer nor the next put waits for the server to finish with the
+  last one. Each front image also keeps the damage that was put from the
+  other one since it was last used, and gets it copied with its own. */
+  XImage *front_ximage[2];
+  XShmSegmentInfo front_shminfo[2];
+  struct XWindowBuffer_damage_s front_stale[2];
+  int front_busy[2];   /* A put from it waits for its ShmCompletion. */
+  int front_last;      /* The one the last put was from. */
+
 
   struct XWindowBuffer_depth_info_s DI;
 
@@ -92,12 +119,16 @@ that there's only one XWindowBuffer for each window. */
   again. The pending updates are stored here, and when we get the
   ShmCompletion event, we handle them. */
   int pending_put;     /* There are pending updates */
-  struct
-  {
-    int x, y, w, h;
-  } pending_rect; /* in this rectangle. */
+  struct XWindowBuffer_damage_s pending_damage; /* in these rectangles. */
+
+  int pending_event;   /* We're waiting for the ShmCompletion event, and
+                          have no front image to put from meanwhile. */
 
-  int pending_event;   /* We're waiting for the ShmCompletion event. */
+  /* Bytes of image data sent to the X server by the last flush, and by
+  all flushes so far. */
+  unsigned long flush_bytes;
+  unsigned long long total_bytes;
+  unsigned long num_flushes;
 
 
   /* This is for the ugly shape-hack */
@@ -141,6 +172,15 @@ created.
 */
 -(void) needsAlpha;
 
+/*
+Returns the number of bytes of image data sent to the X server by the last
+flush and by all of them, and the number of flushes. Any of the pointers
+may be NULL.
+*/
+-(void) getUploadStatistics: (unsigned long *)lastFlushBytes
+                 totalBytes: (unsigned long long *)totalBytes
+                    flushes: (unsigned long *)flushes;
+
 -(void) _gotShmCompletion;
 -(void) _exposeRect: (NSRect)r;
 +(void) _gotShmCompletion: (Drawable)d;
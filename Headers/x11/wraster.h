@@ -28,6 +28,13 @@
  * Default:
  * WRASTER_GAMMA 1/1/1
  * 
+ * WRASTER_SCALE_THREADS <count>
+ * number of worker threads RSmoothScaleImage() uses to scale large
+ * images in parallel, at most 16.
+ * 
+ * Default:
+ * WRASTER_SCALE_THREADS 0
+ * 
  * 
  * If you want a specific value for a screen, append the screen number
  * preceded by a hash to the variable name as in
@@ -150,6 +157,9 @@ typedef struct RContext {
     } flags;
     
     struct RHermesData *hermes_data;   /* handle for Hermes stuff */
+
+    struct RConversionCache *conversion_cache; /* tables and buffers of
+						  convert.c */
 } RContext;
 
 
@@ -370,6 +380,9 @@ RImage *RScaleImage(RImage *image, unsigned new_width, unsigned new_height);
 RImage *RSmoothScaleImage(RImage *src, unsigned new_width, 
 			  unsigned new_height);
 
+RImage *RSmoothScaleImageWithFilter(RImage *src, unsigned new_width,
+				    unsigned new_height, int filter);
+
 RImage *RRotateImage(RImage *image, float angle);
     
 
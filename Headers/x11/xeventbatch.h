@@ -0,0 +1,74 @@
+/* xeventbatch.h - batches of X events for the GNUstep X11 server. The server
+ * takes the events Xlib has queued in batches and processes them in order.
+ * Code that looks ahead at the next event while processing one (motion
+ * compression, key repeat detection) looks at the rest of the batch before
+ * the X queue, so that it needs no I/O. These functions only need Xlib for
+ * the events of the X queue: with no display they work on the batch alone,
+ * so they can be tested without one.
+ */
+#ifndef _xeventbatch_h_INCLUDE
+#define _xeventbatch_h_INCLUDE
+
+#include <X11/Xlib.h>
+
+/* The number of events read from the X queue into a batch at a time. */
+#define XEVENTBATCH_SIZE 64
+
+typedef struct {
+    /* Room for the motion an XInput2 scroll event may bring along. */
+    XEvent events[2 * XEVENTBATCH_SIZE];
+    int count;
+    int next;			/* the next event to process */
+} XEventBatch;
+
+/* Counts of the X events read, of those processed (the others were
+ * compressed, coalesced or dropped by deliver), and of the times processing
+ * stopped to let the run loop do other work. */
+typedef struct {
+    unsigned long received;
+    unsigned long delivered;
+    unsigned long yields;
+} XEventCounts;
+
+/* Sets event to the next event, from the batch or, when the batch is NULL
+ * or done, from the X queue if XEventsQueued(dpy, mode) has one. dpy may be
+ * NULL to look at the batch only. Returns 0 if there is no next event. */
+int XEventBatchPeek(XEventBatch *batch, Display *dpy, XEvent *event,
+                    int mode);
+
+/* Takes the event XEventBatchPeek found. Returns 1 if it was read from the
+ * X queue rather than the batch. */
+int XEventBatchTake(XEventBatch *batch, Display *dpy, XEvent *event);
+
+/* Drops events made redundant by later events of the batch for the same
+ * window: a ConfigureNotify followed by another one from the same source
+ * (the server or the window manager), a PropertyNotify followed by the same
+ * notification for the same property (the value is read when it's
+ * processed), and an Expose inside another Expose. The events kept stay in
+ * order. Returns the number dropped. */
+int XEventBatchCoalesce(XEventBatch *batch);
+
+/* Processes the events of the batch in order, from the first, with
+ * deliver, which returns 0 for an event it dropped. After each one expired
+ * is asked whether the time for the batch is up; if it is, the rest are
+ * left in the batch from batch->next, and 0 is returned. */
+int XEventBatchDeliver(XEventBatch *batch, XEventCounts *counts,
+                       int (*deliver)(void *context, XEvent *event),
+                       int (*expired)(void *context), void *context);
+
+/* Puts the events left in the batch back at the head of the X queue with
+ * putBack (XPutBackEvent), so that they are read again in the same order,
+ * and counts a yield. Returns the number put back. */
+int XEventBatchPutBack(XEventBatch *batch, Display *dpy, XEventCounts *counts,
+                       int (*putBack)(Display *dpy, XEvent *event));
+
+/* Compresses the motion events that follow event for the same window and
+ * subwindow, of those already read: event becomes the last of them, and
+ * those passed over are put in passed, oldest first. When there are more
+ * than max, the oldest are dropped. Returns the number put in passed, and
+ * adds those read from the X queue to received. */
+int XEventBatchCompressMotion(XEventBatch *batch, Display *dpy,
+                              XEvent *event, XMotionEvent *passed, int max,
+                              unsigned long *received);
+
+#endif
@@ -0,0 +1,34 @@
+/* xexposed.h - coalescing of the exposed parts of a window for the GNUstep
+ * X11 server. The X server sends an Expose event for each rectangle of a
+ * window that became visible, often dozens for one move of another window
+ * across it. The rectangles of a sequence are collected here, merged where
+ * they overlap or touch, and handed on as a few larger ones when the last
+ * event of the sequence arrives. They use no Xlib types, so they build and
+ * can be tested without a display.
+ */
+#ifndef _xexposed_h_INCLUDE
+#define _xexposed_h_INCLUDE
+
+/* When there are this many rectangles, the next one is merged with the
+ * rectangle that grows least. */
+#define XEXPOSED_MAX_RECTS 16
+
+typedef struct {
+    int x, y;
+    int width, height;
+} XExposedRect;
+
+typedef struct {
+    int count;
+    XExposedRect rects[XEXPOSED_MAX_RECTS];
+} XExposedRegion;
+
+/* Empties the region. */
+void XExposedReset(XExposedRegion *region);
+
+/* Adds a rectangle, in X window coordinates, to the region. A rectangle
+ * that overlaps or touches another one is merged with it, and the union may
+ * in turn be merged with others; one inside another is dropped. */
+void XExposedAdd(XExposedRegion *region, int x, int y, int width, int height);
+
+#endif
@@ -0,0 +1,62 @@
+/* xiscroll.h - scroll valuator bookkeeping for the XInput2 smooth scrolling
+ * of the GNUstep X11 server. XInput 2.1 reports wheel and touchpad scrolling
+ * as absolute valuator values in motion events; these functions keep the
+ * last value of each scroll valuator of the pointer and turn new values into
+ * deltas in wheel steps. They use no XInput2 types, so they build and can be
+ * tested without the extension.
+ */
+#ifndef _xiscroll_h_INCLUDE
+#define _xiscroll_h_INCLUDE
+
+#define XISCROLL_MAX_VALUATORS 8
+
+typedef struct {
+    int number;			/* valuator number */
+    int horizontal;		/* otherwise vertical */
+    double increment;		/* change for one wheel step */
+    double last;		/* value in the last event */
+    int valid;			/* last is known */
+} XIScrollValuator;
+
+typedef struct {
+    int deviceid;		/* -1 when not set up */
+    int count;
+    XIScrollValuator valuators[XISCROLL_MAX_VALUATORS];
+    double rootX, rootY;	/* pointer position in the last event */
+    int rootValid;		/* rootX and rootY are known */
+} XIScrollDevice;
+
+/* Forgets the valuators and the pointer position, and sets the device the
+ * valuators will be added for. */
+void XIScrollReset(XIScrollDevice *dev, int deviceid);
+
+/* Adds a scroll valuator with its current value. Returns 0 when there is
+ * no room for it or the increment is 0. */
+int XIScrollAddValuator(XIScrollDevice *dev, int number, int horizontal,
+                        double increment, double value);
+
+/* Forgets the last values, after the pointer left the windows or the device
+ * changed; the next event only records them. */
+void XIScrollInvalidate(XIScrollDevice *dev);
+
+/* Returns 1 if the core wheel buttons are to be dropped, as the scrolling
+ * they emulate comes from the valuators: the pointer has scroll valuators
+ * and is not grabbed (no XInput2 events are sent during a grab). Without
+ * XInput2 the device is never set up, and the buttons are kept. */
+int XIScrollTakesButtons(const XIScrollDevice *dev, int grabbed);
+
+/* Records the pointer position of an event, in root coordinates. Returns 1
+ * if it differs from that of the last event, or that is not known, so that
+ * an event which scrolls also has to move the pointer. */
+int XIScrollMoved(XIScrollDevice *dev, double rootX, double rootY);
+
+/* Takes the valuators of an event, in the form XInput2 gives them: a bit
+ * mask of mask_len bytes, and the values of the valuators whose bit is set,
+ * in order. Returns 1 if any of them is a scroll valuator, and sets dx and
+ * dy to the scrolling in wheel steps, with the signs of the core scroll
+ * events (up and right positive). */
+int XIScrollUpdate(XIScrollDevice *dev, const unsigned char *mask,
+                   int mask_len, const double *values,
+                   double *dx, double *dy);
+
+#endif
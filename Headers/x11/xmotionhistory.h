@@ -0,0 +1,50 @@
+/* xmotionhistory.h - the motion history of the GNUstep X11 server. When
+ * consecutive motion events are compressed into one NSEvent, the positions
+ * passed over are kept, with the final one, so that drawing code can still
+ * get them with -motionHistoryForEvent:... The positions are kept in a ring
+ * shared by the last XMOTIONHISTORY_EVENTS events, each found by the window
+ * and event numbers of its NSEvent; older histories are overwritten. They
+ * use no Xlib types, so they build and can be tested without a display.
+ */
+#ifndef _xmotionhistory_h_INCLUDE
+#define _xmotionhistory_h_INCLUDE
+
+#define XMOTIONHISTORY_SIZE 256
+#define XMOTIONHISTORY_EVENTS 16
+#define XMOTIONHISTORY_MAX 64	/* positions kept for one event */
+
+typedef struct {
+    double x, y;
+    double timestamp;
+} XMotionPosition;
+
+typedef struct {
+    XMotionPosition positions[XMOTIONHISTORY_SIZE];
+    unsigned long total;	/* positions ever stored */
+    struct {
+        long windowNumber;
+        long eventNumber;
+        unsigned long start;
+        unsigned count;
+    } events[XMOTIONHISTORY_EVENTS];
+    unsigned nextEvent;
+} XMotionHistory;
+
+/* Starts the history of an event, in place of the oldest one. */
+void XMotionHistoryBegin(XMotionHistory *history, long windowNumber,
+                         long eventNumber);
+
+/* Adds a position, newer than those already there, to the history begun
+ * last. Past XMOTIONHISTORY_MAX positions the oldest ones are dropped. */
+void XMotionHistoryAdd(XMotionHistory *history, double x, double y,
+                       double timestamp);
+
+/* Copies the positions of the history of an event to positions, oldest
+ * first, keeping the most recent when there are more than count. Returns
+ * the number copied: 0 if there is no history for the event, or it was
+ * overwritten. */
+unsigned XMotionHistoryGet(const XMotionHistory *history, long windowNumber,
+                           long eventNumber, XMotionPosition *positions,
+                           unsigned count);
+
+#endif
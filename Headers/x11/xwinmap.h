@@ -0,0 +1,43 @@
+/* xwinmap.h - the tables the GNUstep X11 server finds its windows in.
+ * Every X event is resolved to a window through them, by X window id (the
+ * window or the frame the window manager put it in) or by window number.
+ * They are open addressing hash tables with linear probing, kept at most
+ * half full, which remember the last key found, since events mostly come in
+ * runs for the same window.
+ */
+#ifndef _xwinmap_h_INCLUDE
+#define _xwinmap_h_INCLUDE
+
+typedef struct {
+    unsigned long key;
+    void *value;		/* NULL for a free slot */
+} XWinMapSlot;
+
+typedef struct {
+    XWinMapSlot *slots;
+    unsigned long mask;		/* number of slots - 1, a power of 2 */
+    unsigned long count;
+    unsigned long lastKey;	/* last key found */
+    void *lastValue;		/* its value, NULL if none */
+} XWinMap;
+
+/* Sets up an empty table. Returns 0 if out of memory. */
+int XWinMapInit(XWinMap *map);
+
+void XWinMapFree(XWinMap *map);
+
+/* Returns the value for key, or NULL. */
+void *XWinMapGet(XWinMap *map, unsigned long key);
+
+/* Sets the value for key, which must not be NULL. Returns 0 if out of
+ * memory. */
+int XWinMapInsert(XWinMap *map, unsigned long key, void *value);
+
+void XWinMapRemove(XWinMap *map, unsigned long key);
+
+/* Goes through the table: start with *index 0, and call until it returns
+ * 0. The table must not change meanwhile. */
+int XWinMapNext(XWinMap *map, unsigned long *index,
+                unsigned long *key, void **value);
+
+#endif
@@ -27,6 +27,7 @@
 
 #include <Foundation/NSDebug.h>
 #include <Foundation/NSString.h>
+#include <Foundation/NSUserDefaults.h>
 
 #include "blit.h"
 
@@ -307,6 +308,147 @@ ourself.
 /* end of pixel formats */
 
 
+/*
+Vectorized versions of some of the functions above, for CPUs that have
+them. See blit-simd.m. artcontext_setup_draw_info() picks them at run time
+unless the back-art-scalar-blit default is set.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLIT_SIMD 1
+
+#include <immintrin.h>
+
+
+/* SSE2 */
+#define SIMD_ISA sse2
+#define SIMD_TARGET __attribute__((target("sse2")))
+
+#define VEC __m128i
+#define VEC_BYTES 16
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p,v) _mm_storeu_si128((__m128i *)(p), v)
+#define V_ZERO() _mm_setzero_si128()
+#define V_SET1_8(x) _mm_set1_epi8((char)(x))
+#define V_SET1_16(x) _mm_set1_epi16(x)
+#define V_SET1_32(x) _mm_set1_epi32(x)
+#define V_AND(a,b) _mm_and_si128(a, b)
+#define V_OR(a,b) _mm_or_si128(a, b)
+#define V_XOR(a,b) _mm_xor_si128(a, b)
+#define V_ANDNOT(a,b) _mm_andnot_si128(a, b)
+#define V_ADDS_U8(a,b) _mm_adds_epu8(a, b)
+#define V_SUBS_U8(a,b) _mm_subs_epu8(a, b)
+#define V_CMPEQ32(a,b) _mm_cmpeq_epi32(a, b)
+#define V_LO16(v) _mm_unpacklo_epi8(v, _mm_setzero_si128())
+#define V_HI16(v) _mm_unpackhi_epi8(v, _mm_setzero_si128())
+#define V_PACK16(lo,hi) _mm_packus_epi16(lo, hi)
+#define V_ADD16(a,b) _mm_add_epi16(a, b)
+#define V_SUB16(a,b) _mm_sub_epi16(a, b)
+#define V_MUL16(a,b) _mm_mullo_epi16(a, b)
+#define V_SRL16(v,n) _mm_srli_epi16(v, n)
+#define V_SPLAT16(v,i) \
+  _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, (i) * 0x55), (i) * 0x55)
+
+#define ALPHA_OFS 0
+#include "blit-simd.m"
+#undef ALPHA_OFS
+#define ALPHA_OFS 3
+#include "blit-simd.m"
+#undef ALPHA_OFS
+
+#undef SIMD_ISA
+#undef SIMD_TARGET
+#undef VEC
+#undef VEC_BYTES
+#undef V_LOAD
+#undef V_STORE
+#undef V_ZERO
+#undef V_SET1_8
+#undef V_SET1_16
+#undef V_SET1_32
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_ANDNOT
+#undef V_ADDS_U8
+#undef V_SUBS_U8
+#undef V_CMPEQ32
+#undef V_LO16
+#undef V_HI16
+#undef V_PACK16
+#undef V_ADD16
+#undef V_SUB16
+#undef V_MUL16
+#undef V_SRL16
+#undef V_SPLAT16
+
+
+/* AVX2. The 256-bit unpack, pack and shuffle instructions work on each
+128-bit half separately, which is fine since they're only ever used in
+matching pairs. */
+#define SIMD_ISA avx2
+#define SIMD_TARGET __attribute__((target("avx2")))
+
+#define VEC __m256i
+#define VEC_BYTES 32
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p,v) _mm256_storeu_si256((__m256i *)(p), v)
+#define V_ZERO() _mm256_setzero_si256()
+#define V_SET1_8(x) _mm256_set1_epi8((char)(x))
+#define V_SET1_16(x) _mm256_set1_epi16(x)
+#define V_SET1_32(x) _mm256_set1_epi32(x)
+#define V_AND(a,b) _mm256_and_si256(a, b)
+#define V_OR(a,b) _mm256_or_si256(a, b)
+#define V_XOR(a,b) _mm256_xor_si256(a, b)
+#define V_ANDNOT(a,b) _mm256_andnot_si256(a, b)
+#define V_ADDS_U8(a,b) _mm256_adds_epu8(a, b)
+#define V_SUBS_U8(a,b) _mm256_subs_epu8(a, b)
+#define V_CMPEQ32(a,b) _mm256_cmpeq_epi32(a, b)
+#define V_LO16(v) _mm256_unpacklo_epi8(v, _mm256_setzero_si256())
+#define V_HI16(v) _mm256_unpackhi_epi8(v, _mm256_setzero_si256())
+#define V_PACK16(lo,hi) _mm256_packus_epi16(lo, hi)
+#define V_ADD16(a,b) _mm256_add_epi16(a, b)
+#define V_SUB16(a,b) _mm256_sub_epi16(a, b)
+#define V_MUL16(a,b) _mm256_mullo_epi16(a, b)
+#define V_SRL16(v,n) _mm256_srli_epi16(v, n)
+#define V_SPLAT16(v,i) \
+  _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, (i) * 0x55), (i) * 0x55)
+
+#define ALPHA_OFS 0
+#include "blit-simd.m"
+#undef ALPHA_OFS
+#define ALPHA_OFS 3
+#include "blit-simd.m"
+#undef ALPHA_OFS
+
+#undef SIMD_ISA
+#undef SIMD_TARGET
+#undef VEC
+#undef VEC_BYTES
+#undef V_LOAD
+#undef V_STORE
+#undef V_ZERO
+#undef V_SET1_8
+#undef V_SET1_16
+#undef V_SET1_32
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_ANDNOT
+#undef V_ADDS_U8
+#undef V_SUBS_U8
+#undef V_CMPEQ32
+#undef V_LO16
+#undef V_HI16
+#undef V_PACK16
+#undef V_ADD16
+#undef V_SUB16
+#undef V_MUL16
+#undef V_SRL16
+#undef V_SPLAT16
+
+#endif
+
+
 static draw_info_t draw_infos[DI_NUM] = {
 
 #define C(x) \
@@ -390,6 +532,102 @@ static int byte_ofs_of_mask(unsigned int m)
     return -1;
 }
 
+#ifdef BLIT_SIMD
+
+#define SIMD_32(di, pre) \
+  di->composite_sover_aa = NPRE(sover_aa, pre); \
+  di->composite_sover_ao = NPRE(sover_ao, pre); \
+  di->composite_dover_aa = NPRE(dover_aa, pre); \
+  di->composite_dover_oa = NPRE(dover_oa, pre); \
+  di->composite_din_aa = NPRE(din_aa, pre); \
+  di->composite_dout_aa = NPRE(dout_aa, pre); \
+  di->composite_plusl_aa = NPRE(plusl_aa, pre); \
+  di->composite_plusl_oa = NPRE(plusl_oa, pre); \
+  di->composite_plusl_ao = NPRE(plusl_ao_oo, pre); \
+  di->composite_plusl_oo = NPRE(plusl_ao_oo, pre); \
+  di->composite_plusd_aa = NPRE(plusd_aa, pre); \
+  di->composite_plusd_oa = NPRE(plusd_oa, pre); \
+  di->composite_plusd_ao = NPRE(plusd_ao_oo, pre); \
+  di->composite_plusd_oo = NPRE(plusd_ao_oo, pre); \
+  di->dissolve_aa = NPRE(dissolve_aa, pre); \
+  di->dissolve_ao = NPRE(dissolve_ao, pre); \
+  di->dissolve_oa = NPRE(dissolve_oa, pre); \
+  di->dissolve_oo = NPRE(dissolve_oo, pre);
+
+#define SIMD_24(di, pre) \
+  di->composite_plusl_aa = NPRE(plusl_aa_24, pre); \
+  di->composite_plusl_oa = NPRE(plusl_oa_24, pre); \
+  di->composite_plusl_ao = NPRE(plusl_ao_oo_24, pre); \
+  di->composite_plusl_oo = NPRE(plusl_ao_oo_24, pre); \
+  di->composite_plusd_aa = NPRE(plusd_aa_24, pre); \
+  di->composite_plusd_oa = NPRE(plusd_oa_24, pre); \
+  di->composite_plusd_ao = NPRE(plusd_ao_oo_24, pre); \
+  di->composite_plusd_oo = NPRE(plusd_ao_oo_24, pre); \
+  di->dissolve_oo = NPRE(dissolve_oo_24, pre);
+
+/*
+Replace the compositing functions in di with vectorized versions if the
+CPU supports them. Returns NO if di was left alone.
+*/
+static BOOL artcontext_setup_simd(draw_info_t *di)
+{
+  BOOL avx2, sse2;
+
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2") ? YES : NO;
+  sse2 = __builtin_cpu_supports("sse2") ? YES : NO;
+  if (!avx2 && !sse2)
+    return NO;
+
+  switch (di->how)
+    {
+      case DI_32_RGBA:
+      case DI_32_BGRA:
+	if (avx2)
+	  {
+	    SIMD_32(di, avx2_a3)
+	  }
+	else
+	  {
+	    SIMD_32(di, sse2_a3)
+	  }
+	break;
+      case DI_32_ARGB:
+      case DI_32_ABGR:
+	if (avx2)
+	  {
+	    SIMD_32(di, avx2_a0)
+	  }
+	else
+	  {
+	    SIMD_32(di, sse2_a0)
+	  }
+	break;
+      case DI_24_RGB:
+      case DI_24_BGR:
+	if (avx2)
+	  {
+	    SIMD_24(di, avx2)
+	  }
+	else
+	  {
+	    SIMD_24(di, sse2)
+	  }
+	break;
+      default:
+	return NO;
+    }
+
+  NSDebugLLog(@"back-art", @"using %s compositing functions",
+	      avx2 ? "avx2" : "sse2");
+  return YES;
+}
+
+#undef SIMD_32
+#undef SIMD_24
+
+#endif
+
 void artcontext_setup_draw_info(draw_info_t *di,
 	unsigned int red_mask, unsigned int green_mask, unsigned int blue_mask,
 	int bpp)
@@ -451,6 +689,14 @@ void artcontext_setup_draw_info(draw_info_t *di,
 	    @"Better: implement it and send a patch.)");
       exit(1);
     }
+
+#ifdef BLIT_SIMD
+  if (![[NSUserDefaults standardUserDefaults]
+	 boolForKey: @"back-art-scalar-blit"])
+    {
+      artcontext_setup_simd(di);
+    }
+#endif
 }
 
 void artcontext_setup_gamma(float gamma)
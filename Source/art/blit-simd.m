@@ -0,0 +1,428 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+Vectorized versions of some of the compositing functions in blit.m.
+
+Like blit.m, this file is not compiled on its own. blit-main.m defines the
+V_* vector macros for an instruction set (SSE2, AVX2), SIMD_ISA, and
+ALPHA_OFS (the byte offset of the alpha channel in a 32-bit pixel), and
+includes us once for each combination.
+
+All channels of a pixel go through the same arithmetic in these operators,
+so the order of red, green and blue doesn't matter and one instance serves
+all 32-bit formats with the alpha in the same place. The results must be
+bit-for-bit identical to the scalar functions in blit.m, including their
+rounding and the special-casing of fully transparent and fully opaque
+pixels; Tests/art/blitsimd.m checks this.
+
+The 24-bit formats keep alpha in a separate plane, so only the operators
+that work byte by byte on the color channels are done for them. They don't
+depend on ALPHA_OFS and are only instantiated with ALPHA_OFS == 3.
+*/
+
+
+#define SPRE(r) M2PRE(r, M2PRE(ALPHA_NAME, SIMD_ISA))
+#define IPRE(r) M2PRE(r, SIMD_ISA)
+
+#if ALPHA_OFS == 0
+#define ALPHA_NAME a0
+#else
+#define ALPHA_NAME a3
+#endif
+
+#define ALPHA_MASK (V_SET1_32((int)(0xffu << (8 * ALPHA_OFS))))
+
+
+/* (a * b + bias) >> 8 on 16-bit lanes; the result of an 8x8-bit multiply
+plus a bias of at most 0xff always fits in 16 bits. */
+static inline SIMD_TARGET VEC SPRE(mul8) (VEC a, VEC b, int bias)
+{
+  return V_SRL16(V_ADD16(V_MUL16(a, b), V_SET1_16(bias)), 8);
+}
+
+/* Pack two vectors of 16-bit lanes back to bytes, truncating each lane to
+8 bits like the stores in blit.m do. */
+static inline SIMD_TARGET VEC SPRE(pack8) (VEC lo, VEC hi)
+{
+  VEC m = V_SET1_16(0xff);
+
+  return V_PACK16(V_AND(lo, m), V_AND(hi, m));
+}
+
+/* Per-pixel masks: all ones where the alpha of p is 0 or 255. */
+static inline SIMD_TARGET VEC SPRE(alpha_zero) (VEC p)
+{
+  return V_CMPEQ32(V_AND(p, ALPHA_MASK), V_ZERO());
+}
+
+static inline SIMD_TARGET VEC SPRE(alpha_full) (VEC p)
+{
+  VEC am = ALPHA_MASK;
+
+  return V_CMPEQ32(V_AND(p, am), am);
+}
+
+/* a where m is set, b elsewhere */
+static inline SIMD_TARGET VEC SPRE(select) (VEC m, VEC a, VEC b)
+{
+  return V_OR(V_AND(m, a), V_ANDNOT(m, b));
+}
+
+/* Keep the alpha channel of d, take the color channels from r. Used by the
+_ao/_oo operators, which don't touch the destination alpha. */
+static inline SIMD_TARGET VEC SPRE(keep_alpha) (VEC d, VEC r)
+{
+  return SPRE(select)(ALPHA_MASK, d, r);
+}
+
+
+/* s + d * (1 - srca), all channels, no special cases */
+static inline SIMD_TARGET VEC SPRE(over) (VEC d, VEC s)
+{
+  VEC s16, d16, ia, lo, hi;
+  VEC c255 = V_SET1_16(255);
+
+  s16 = V_LO16(s);
+  d16 = V_LO16(d);
+  ia = V_SUB16(c255, V_SPLAT16(s16, ALPHA_OFS));
+  lo = V_ADD16(s16, SPRE(mul8)(d16, ia, 0xff));
+
+  s16 = V_HI16(s);
+  d16 = V_HI16(d);
+  ia = V_SUB16(c255, V_SPLAT16(s16, ALPHA_OFS));
+  hi = V_ADD16(s16, SPRE(mul8)(d16, ia, 0xff));
+
+  return SPRE(pack8)(lo, hi);
+}
+
+/* d + s * (1 - dsta), all channels, no special cases */
+static inline SIMD_TARGET VEC SPRE(under) (VEC d, VEC s)
+{
+  VEC s16, d16, ia, lo, hi;
+  VEC c255 = V_SET1_16(255);
+
+  s16 = V_LO16(s);
+  d16 = V_LO16(d);
+  ia = V_SUB16(c255, V_SPLAT16(d16, ALPHA_OFS));
+  lo = V_ADD16(d16, SPRE(mul8)(s16, ia, 0x80));
+
+  s16 = V_HI16(s);
+  d16 = V_HI16(d);
+  ia = V_SUB16(c255, V_SPLAT16(d16, ALPHA_OFS));
+  hi = V_ADD16(d16, SPRE(mul8)(s16, ia, 0x80));
+
+  return SPRE(pack8)(lo, hi);
+}
+
+/* d * a, all channels, where a is the alpha of s (or 1 - the alpha of s if
+invert is set) */
+static inline SIMD_TARGET VEC SPRE(scale_by) (VEC d, VEC s, int invert)
+{
+  VEC s16, d16, a, lo, hi;
+  VEC c255 = V_SET1_16(255);
+
+  s16 = V_LO16(s);
+  d16 = V_LO16(d);
+  a = V_SPLAT16(s16, ALPHA_OFS);
+  if (invert)
+    a = V_SUB16(c255, a);
+  lo = SPRE(mul8)(d16, a, 0x80);
+
+  s16 = V_HI16(s);
+  d16 = V_HI16(d);
+  a = V_SPLAT16(s16, ALPHA_OFS);
+  if (invert)
+    a = V_SUB16(c255, a);
+  hi = SPRE(mul8)(d16, a, 0x80);
+
+  return SPRE(pack8)(lo, hi);
+}
+
+/* s * fraction followed by s + d * (1 - srca), as dissolve_* does */
+static inline SIMD_TARGET VEC SPRE(dissolve) (VEC d, VEC s, int fraction)
+{
+  VEC s16, d16, ia, lo, hi;
+  VEC c255 = V_SET1_16(255);
+  VEC f = V_SET1_16(fraction);
+
+  s16 = SPRE(mul8)(V_LO16(s), f, 0xff);
+  d16 = V_LO16(d);
+  ia = V_SUB16(c255, V_SPLAT16(s16, ALPHA_OFS));
+  lo = V_ADD16(s16, SPRE(mul8)(d16, ia, 0xff));
+
+  s16 = SPRE(mul8)(V_HI16(s), f, 0xff);
+  d16 = V_HI16(d);
+  ia = V_SUB16(c255, V_SPLAT16(s16, ALPHA_OFS));
+  hi = V_ADD16(s16, SPRE(mul8)(d16, ia, 0xff));
+
+  return SPRE(pack8)(lo, hi);
+}
+
+
+/*
+The per-vector operators. Each one takes a vector of destination pixels
+and a vector of source pixels and returns the new destination pixels.
+*/
+
+static inline SIMD_TARGET VEC SPRE(op_sover_aa) (VEC d, VEC s, int f)
+{
+  return SPRE(select)(SPRE(alpha_zero)(s), d, SPRE(over)(d, s));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_sover_ao) (VEC d, VEC s, int f)
+{
+  return SPRE(keep_alpha)(d, SPRE(op_sover_aa)(d, s, f));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dover_aa) (VEC d, VEC s, int f)
+{
+  return SPRE(select)(SPRE(alpha_zero)(d), s, SPRE(under)(d, s));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dover_oa) (VEC d, VEC s, int f)
+{
+  VEC am = ALPHA_MASK;
+
+  return V_OR(SPRE(op_dover_aa)(d, V_OR(s, am), f), am);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_din_aa) (VEC d, VEC s, int f)
+{
+  return SPRE(select)(SPRE(alpha_full)(s), d, SPRE(scale_by)(d, s, 0));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dout_aa) (VEC d, VEC s, int f)
+{
+  return SPRE(select)(SPRE(alpha_zero)(s), d, SPRE(scale_by)(d, s, 1));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_plusl_aa) (VEC d, VEC s, int f)
+{
+  return V_ADDS_U8(d, s);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_plusl_oa) (VEC d, VEC s, int f)
+{
+  return V_OR(V_ADDS_U8(d, s), ALPHA_MASK);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_plusl_ao_oo) (VEC d, VEC s, int f)
+{
+  return SPRE(keep_alpha)(d, V_ADDS_U8(d, s));
+}
+
+/* d + s - 1 clamped to 0 is d - (1 - s) with unsigned saturation */
+static inline SIMD_TARGET VEC SPRE(op_plusd_aa) (VEC d, VEC s, int f)
+{
+  VEC c = V_SUBS_U8(d, V_XOR(s, V_SET1_8(0xff)));
+
+  return SPRE(select)(ALPHA_MASK, V_ADDS_U8(d, s), c);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_plusd_oa) (VEC d, VEC s, int f)
+{
+  return V_OR(V_SUBS_U8(d, V_XOR(s, V_SET1_8(0xff))), ALPHA_MASK);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_plusd_ao_oo) (VEC d, VEC s, int f)
+{
+  return SPRE(keep_alpha)(d, V_SUBS_U8(d, V_XOR(s, V_SET1_8(0xff))));
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dissolve_aa) (VEC d, VEC s, int f)
+{
+  return SPRE(dissolve)(d, s, f);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dissolve_ao) (VEC d, VEC s, int f)
+{
+  return SPRE(keep_alpha)(d, SPRE(dissolve)(d, s, f));
+}
+
+/* An opaque source dissolves with a coverage of exactly the fraction,
+which is what (0xff * fraction + 0xff) >> 8 gives. */
+static inline SIMD_TARGET VEC SPRE(op_dissolve_oa) (VEC d, VEC s, int f)
+{
+  return SPRE(dissolve)(d, V_OR(s, ALPHA_MASK), f);
+}
+
+static inline SIMD_TARGET VEC SPRE(op_dissolve_oo) (VEC d, VEC s, int f)
+{
+  return SPRE(keep_alpha)(d, SPRE(dissolve)(d, V_OR(s, ALPHA_MASK), f));
+}
+
+
+/*
+Wrap an operator in a composite_run_t function for 32-bit pixels. Whole
+vectors are done in place; the last partial vector goes through a buffer
+on the stack so we never read or write past the end of the run.
+*/
+#define SIMD_COMPOSITE_32(name) \
+static SIMD_TARGET void SPRE(name) (composite_run_t *c, int num) \
+{ \
+  unsigned char *s = c->src, *d = c->dst; \
+  int f = c->fraction; \
+ \
+  for (; num >= VEC_BYTES / 4; num -= VEC_BYTES / 4) \
+    { \
+      V_STORE(d, SPRE(op_##name)(V_LOAD(d), V_LOAD(s), f)); \
+      s += VEC_BYTES; \
+      d += VEC_BYTES; \
+    } \
+  if (num) \
+    { \
+      unsigned char ts[VEC_BYTES] = {0}, td[VEC_BYTES] = {0}; \
+ \
+      memcpy(ts, s, num * 4); \
+      memcpy(td, d, num * 4); \
+      V_STORE(td, SPRE(op_##name)(V_LOAD(td), V_LOAD(ts), f)); \
+      memcpy(d, td, num * 4); \
+    } \
+}
+
+SIMD_COMPOSITE_32(sover_aa)
+SIMD_COMPOSITE_32(sover_ao)
+SIMD_COMPOSITE_32(dover_aa)
+SIMD_COMPOSITE_32(dover_oa)
+SIMD_COMPOSITE_32(din_aa)
+SIMD_COMPOSITE_32(dout_aa)
+SIMD_COMPOSITE_32(plusl_aa)
+SIMD_COMPOSITE_32(plusl_oa)
+SIMD_COMPOSITE_32(plusl_ao_oo)
+SIMD_COMPOSITE_32(plusd_aa)
+SIMD_COMPOSITE_32(plusd_oa)
+SIMD_COMPOSITE_32(plusd_ao_oo)
+SIMD_COMPOSITE_32(dissolve_aa)
+SIMD_COMPOSITE_32(dissolve_ao)
+SIMD_COMPOSITE_32(dissolve_oa)
+SIMD_COMPOSITE_32(dissolve_oo)
+
+#undef SIMD_COMPOSITE_32
+
+
+#if ALPHA_OFS == 3
+
+/*
+Byte-wise operators for the 24-bit formats. These run over num * 3 color
+bytes (and num alpha bytes where there is an alpha plane) and finish the
+last few bytes with the same arithmetic in scalar code.
+*/
+
+static SIMD_TARGET void IPRE(adds_bytes) (unsigned char *d,
+	const unsigned char *s, int n)
+{
+  for (; n >= VEC_BYTES; n -= VEC_BYTES, d += VEC_BYTES, s += VEC_BYTES)
+    V_STORE(d, V_ADDS_U8(V_LOAD(d), V_LOAD(s)));
+  for (; n; n--, d++, s++)
+    {
+      int v = *d + *s;
+      *d = v > 255 ? 255 : v;
+    }
+}
+
+static SIMD_TARGET void IPRE(darken_bytes) (unsigned char *d,
+	const unsigned char *s, int n)
+{
+  VEC ones = V_SET1_8(0xff);
+
+  for (; n >= VEC_BYTES; n -= VEC_BYTES, d += VEC_BYTES, s += VEC_BYTES)
+    V_STORE(d, V_SUBS_U8(V_LOAD(d), V_XOR(V_LOAD(s), ones)));
+  for (; n; n--, d++, s++)
+    {
+      int v = *d + *s - 255;
+      *d = v < 0 ? 0 : v;
+    }
+}
+
+/* d = s * fraction + d * (1 - fraction), as dissolve_oo does per channel */
+static SIMD_TARGET void IPRE(dissolve_bytes) (unsigned char *d,
+	const unsigned char *s, int n, int fraction)
+{
+  VEC f = V_SET1_16(fraction);
+  VEC inv = V_SET1_16(255 - fraction);
+  VEC bias = V_SET1_16(0xff);
+  VEC vs, vd, lo, hi;
+
+  for (; n >= VEC_BYTES; n -= VEC_BYTES, d += VEC_BYTES, s += VEC_BYTES)
+    {
+      vs = V_LOAD(s);
+      vd = V_LOAD(d);
+      lo = V_ADD16(V_SRL16(V_ADD16(V_MUL16(V_LO16(vs), f), bias), 8),
+		   V_SRL16(V_ADD16(V_MUL16(V_LO16(vd), inv), bias), 8));
+      hi = V_ADD16(V_SRL16(V_ADD16(V_MUL16(V_HI16(vs), f), bias), 8),
+		   V_SRL16(V_ADD16(V_MUL16(V_HI16(vd), inv), bias), 8));
+      V_STORE(d, V_PACK16(V_AND(lo, bias), V_AND(hi, bias)));
+    }
+  for (; n; n--, d++, s++)
+    {
+      *d = ((*s * fraction + 0xff) >> 8)
+	+ ((*d * (255 - fraction) + 0xff) >> 8);
+    }
+}
+
+static SIMD_TARGET void IPRE(plusl_aa_24) (composite_run_t *c, int num)
+{
+  IPRE(adds_bytes)(c->dst, c->src, num * 3);
+  IPRE(adds_bytes)(c->dsta, c->srca, num);
+}
+
+static SIMD_TARGET void IPRE(plusl_oa_24) (composite_run_t *c, int num)
+{
+  IPRE(adds_bytes)(c->dst, c->src, num * 3);
+  memset(c->dsta, 0xff, num);
+}
+
+static SIMD_TARGET void IPRE(plusl_ao_oo_24) (composite_run_t *c, int num)
+{
+  IPRE(adds_bytes)(c->dst, c->src, num * 3);
+}
+
+static SIMD_TARGET void IPRE(plusd_aa_24) (composite_run_t *c, int num)
+{
+  IPRE(darken_bytes)(c->dst, c->src, num * 3);
+  IPRE(adds_bytes)(c->dsta, c->srca, num);
+}
+
+static SIMD_TARGET void IPRE(plusd_oa_24) (composite_run_t *c, int num)
+{
+  IPRE(darken_bytes)(c->dst, c->src, num * 3);
+  memset(c->dsta, 0xff, num);
+}
+
+static SIMD_TARGET void IPRE(plusd_ao_oo_24) (composite_run_t *c, int num)
+{
+  IPRE(darken_bytes)(c->dst, c->src, num * 3);
+}
+
+static SIMD_TARGET void IPRE(dissolve_oo_24) (composite_run_t *c, int num)
+{
+  IPRE(dissolve_bytes)(c->dst, c->src, num * 3, c->fraction);
+}
+
+#endif
+
+
+#undef SPRE
+#undef IPRE
+#undef ALPHA_NAME
+#undef ALPHA_MASK
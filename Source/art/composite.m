@@ -23,7 +23,10 @@
 */
 
 #include <math.h>
+#include <pthread.h>
 
+#include <Foundation/NSDebug.h>
+#include <Foundation/NSUserDefaults.h>
 #include <AppKit/NSAffineTransform.h>
 
 #include "ARTGState.h"
@@ -421,6 +424,269 @@ static BOOL _rect_advance(rect_trace_t *t, int *x0, int *x1)
 }
 
 
+/*
+Composite the rows of a rectangle whose source and destination don't
+overlap in a way that forces an order (ie. order 0 or 1 below). Row i of
+the composite starts at dst + i * dbpl etc., and covers x0 to x1 of it as
+returned by _rect_advance. Since rows don't depend on each other, they can
+be done in any order, and on any thread.
+*/
+typedef struct
+{
+  void (*blit_func)(composite_run_t *c, int num);
+  unsigned char fraction;
+
+  unsigned char *dst, *dst_alpha, *src, *src_alpha;
+  int dbpl, adbpl, sbpl, asbpl;
+
+  /* clip_span/clip_index of the gstate, or NULL; line i of the composite
+  is clip line clip_line + clip_dir * i, and x = 0 is clip_dx inside the
+  clipping rectangle. */
+  unsigned int *clip_span, *clip_index;
+  int clip_line, clip_dir, clip_dx;
+} composite_rows_t;
+
+static void _composite_row(composite_rows_t *r, int i, int x0, int x1)
+{
+  composite_run_t c;
+
+  x1 -= x0;
+  if (x1 <= 0)
+    return;
+
+  c.dst = r->dst + i * r->dbpl + x0 * DI.bytes_per_pixel;
+  c.dsta = r->dst_alpha + i * r->adbpl + x0;
+  c.src = r->src + i * r->sbpl + x0 * DI.bytes_per_pixel;
+  c.srca = r->src_alpha + i * r->asbpl + x0;
+  c.fraction = r->fraction;
+
+  if (!r->clip_span)
+    {
+      r->blit_func(&c, x1);
+    }
+  else
+    {
+      unsigned int *span, *end;
+      BOOL state = NO;
+      int line = r->clip_line + r->clip_dir * i;
+
+      span = &r->clip_span[r->clip_index[line]];
+      end = &r->clip_span[r->clip_index[line + 1]];
+
+      x0 = x0 + r->clip_dx;
+      x1 += x0;
+      while (span != end && *span < x0)
+	{
+	  state = !state;
+	  span++;
+	  if (span == end)
+	    break;
+	}
+      if (span != end)
+	{
+	  while (span != end && *span < x1)
+	    {
+	      if (state)
+		r->blit_func(&c, *span - x0);
+	      c.dst += (*span - x0) * DI.bytes_per_pixel;
+	      c.dsta += (*span - x0);
+	      c.src += (*span - x0) * DI.bytes_per_pixel;
+	      c.srca += (*span - x0);
+	      x0 = *span;
+
+	      state = !state;
+	      span++;
+	      if (span == end)
+		break;
+	    }
+	  if (state)
+	    r->blit_func(&c, x1 - x0);
+	}
+    }
+}
+
+
+/*
+Large composites can be split into horizontal bands that are done in
+parallel by a pool of worker threads (and the calling thread). This is off
+unless the back-art-composite-threads default gives the number of worker
+threads to use. Composites of fewer than back-art-composite-threshold
+pixels are always done on the calling thread, so small composites don't pay
+for waking up the workers.
+
+Only one banded composite runs at a time; if another thread is already
+using the workers, the composite is simply done on the calling thread.
+*/
+#define BAND_MAX_THREADS 16
+#define BAND_DEFAULT_THRESHOLD 65536
+
+static pthread_once_t band_once = PTHREAD_ONCE_INIT;
+static int band_threads;
+static int band_threshold;
+
+static pthread_mutex_t band_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t band_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t band_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t band_finished = PTHREAD_COND_INITIALIZER;
+
+/* The current job; protected by band_lock. */
+static struct
+{
+  composite_rows_t *rows;
+  int *x; /* x0 and x1 for each row */
+  int num_rows, band_rows;
+  int next_row; /* first row of the next band nobody has taken yet */
+  int busy; /* bands taken but not finished */
+  unsigned int generation;
+} band_job;
+
+/* Take bands of the current job and composite them until there are none
+left. Called, and returns, with band_lock held. */
+static void _band_run(void)
+{
+  while (band_job.next_row < band_job.num_rows)
+    {
+      composite_rows_t *rows = band_job.rows;
+      int *x = band_job.x;
+      int i, end;
+
+      i = band_job.next_row;
+      end = i + band_job.band_rows;
+      if (end > band_job.num_rows)
+	end = band_job.num_rows;
+      band_job.next_row = end;
+      band_job.busy++;
+      pthread_mutex_unlock(&band_lock);
+
+      for (; i < end; i++)
+	_composite_row(rows, i, x[i * 2], x[i * 2 + 1]);
+
+      pthread_mutex_lock(&band_lock);
+      band_job.busy--;
+      if (!band_job.busy && band_job.next_row >= band_job.num_rows)
+	pthread_cond_signal(&band_finished);
+    }
+}
+
+static void *_band_worker(void *arg)
+{
+  unsigned int generation = 0;
+
+  pthread_mutex_lock(&band_lock);
+  while (1)
+    {
+      while (band_job.generation == generation)
+	pthread_cond_wait(&band_start, &band_lock);
+      generation = band_job.generation;
+      _band_run();
+    }
+  return NULL;
+}
+
+static void _band_setup(void)
+{
+  NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
+  int i;
+
+  band_threads = [ud integerForKey: @"back-art-composite-threads"];
+  if (band_threads > BAND_MAX_THREADS)
+    band_threads = BAND_MAX_THREADS;
+  band_threshold = [ud integerForKey: @"back-art-composite-threshold"];
+  if (band_threshold <= 0)
+    band_threshold = BAND_DEFAULT_THRESHOLD;
+
+  for (i = 0; i < band_threads; i++)
+    {
+      pthread_t thread;
+
+      if (pthread_create(&thread, NULL, _band_worker, NULL))
+	{
+	  NSLog(@"gnustep-back(art): could only start %i of %i compositing "
+		@"threads", i, band_threads);
+	  break;
+	}
+      pthread_detach(thread);
+    }
+  band_threads = i;
+  NSDebugLLog(@"back-art", @"%i compositing threads, threshold %i pixels",
+	      band_threads, band_threshold);
+}
+
+/*
+Composite num_rows rows of width pixels described by r, getting the span
+of each row from state. If the source and destination are the same
+buffer, the rows must be done in order, so in_order must be set. Returns
+the number of rows actually done, which is less than num_rows if state
+runs out of rows first.
+*/
+static int _composite_rows(composite_rows_t *r, rect_trace_t *state,
+			   int num_rows, int width, BOOL in_order)
+{
+  int i, x0, x1;
+  int *x;
+
+  pthread_once(&band_once, _band_setup);
+
+  if (band_threads <= 0 || in_order || num_rows < 2
+      || num_rows * width < band_threshold
+      || pthread_mutex_trylock(&band_job_lock))
+    {
+      for (i = 0; i < num_rows; i++)
+	{
+	  if (!_rect_advance(state, &x0, &x1))
+	    break;
+	  _composite_row(r, i, x0, x1);
+	}
+      return i;
+    }
+
+  /* Tracing the rows is cheap but sequential, so do it up front. */
+  x = malloc(sizeof(int) * 2 * num_rows);
+  if (!x)
+    {
+      pthread_mutex_unlock(&band_job_lock);
+      for (i = 0; i < num_rows; i++)
+	{
+	  if (!_rect_advance(state, &x0, &x1))
+	    break;
+	  _composite_row(r, i, x0, x1);
+	}
+      return i;
+    }
+  for (i = 0; i < num_rows; i++)
+    {
+      if (!_rect_advance(state, &x[i * 2], &x[i * 2 + 1]))
+	break;
+    }
+  num_rows = i;
+
+  pthread_mutex_lock(&band_lock);
+  band_job.rows = r;
+  band_job.x = x;
+  band_job.num_rows = num_rows;
+  /* A couple of bands per thread so an unlucky thread doesn't hold
+  everybody up. */
+  band_job.band_rows = num_rows / ((band_threads + 1) * 2);
+  if (band_job.band_rows < 1)
+    band_job.band_rows = 1;
+  band_job.next_row = 0;
+  band_job.busy = 0;
+  band_job.generation++;
+  pthread_cond_broadcast(&band_start);
+
+  _band_run();
+  while (band_job.busy)
+    pthread_cond_wait(&band_finished, &band_lock);
+  band_job.rows = NULL;
+  band_job.x = NULL;
+  pthread_mutex_unlock(&band_lock);
+  pthread_mutex_unlock(&band_job_lock);
+
+  free(x);
+  return num_rows;
+}
+
+
 - (void) compositeGState: (GSGState *)source
                 fromRect: (NSRect)aRect
                  toPoint: (NSPoint)aPoint
@@ -745,87 +1011,32 @@ static BOOL _rect_advance(rect_trace_t *t, int *x0, int *x1)
     }
   else
     {
-      int y;
-      composite_run_t c;
-      int x0, x1;
-
-      c.dst = dst;
-      c.dsta = dst_alpha;
-      c.src = src;
-      c.srca = src_alpha;
+      composite_rows_t r;
+
+      r.blit_func = blit_func;
+      r.fraction = 0;
+      r.dst = dst;
+      r.dst_alpha = dst_alpha;
+      r.src = src;
+      r.src_alpha = src_alpha;
+      r.dbpl = dbpl;
+      r.adbpl = adbpl;
+      r.sbpl = sbpl;
+      r.asbpl = asbpl;
+      r.clip_span = clip_span;
+      r.clip_index = clip_index;
+      r.clip_dx = cx0 - clip_x0;
       if (order)
-	y = cy1 - delta - 1;
+	{
+	  r.clip_line = cy1 - delta - 1 + cy0 - clip_y0;
+	  r.clip_dir = -1;
+	}
       else
-	y = delta;
-      for (; y < cy1 && y >= 0; order? y-- : y++)
 	{
-	  if (!_rect_advance(&state,&x0,&x1))
-	      break;
-	  x1 -= x0;
-	  if (x1 <= 0)
-	    {
-	      c.dst += dbpl;
-	      c.dsta += adbpl;
-	      c.src += sbpl;
-	      c.srca += asbpl;
-	      continue;
-	    }
-	  c.dst += x0 * DI.bytes_per_pixel;
-	  c.dsta += x0;
-	  c.src += x0 * DI.bytes_per_pixel;
-	  c.srca += x0;
-	  if (!clip_span)
-	    {
-	      blit_func(&c, x1);
-	      c.dst += dbpl - x0 * DI.bytes_per_pixel;
-	      c.dsta += adbpl - x0;
-	      c.src += sbpl - x0 * DI.bytes_per_pixel;
-	      c.srca += asbpl - x0;
-	    }
-	  else
-	    {
-	      unsigned int *span, *end;
-	      BOOL state = NO;
-
-	      span = &clip_span[clip_index[y + cy0 - clip_y0]];
-	      end = &clip_span[clip_index[y + cy0 - clip_y0 + 1]];
-
-	      x0 = x0 + cx0 - clip_x0;
-	      x1 += x0;
-	      while (span != end && *span < x0)
-		{
-		  state = !state;
-		  span++;
-		  if (span == end)
-		    break;
-		}
-	      if (span != end)
-		{
-		  while (span != end && *span < x1)
-		    {
-		      if (state)
-		        blit_func(&c, *span - x0);
-		      c.dst += (*span - x0) * DI.bytes_per_pixel;
-		      c.dsta += (*span - x0);
-		      c.src += (*span - x0) * DI.bytes_per_pixel;
-		      c.srca += (*span - x0);
-		      x0 = *span;
-
-		      state = !state;
-		      span++;
-		      if (span == end)
-			break;
-		    }
-		  if (state)
-		    blit_func(&c, x1 - x0);
-		}
-	      x0 = x0 - cx0 + clip_x0;
-	      c.dst += dbpl - x0 * DI.bytes_per_pixel;
-	      c.dsta += adbpl - x0;
-	      c.src += sbpl -  x0 * DI.bytes_per_pixel;
-	      c.srca += asbpl - x0;
-	    }
+	  r.clip_line = delta + cy0 - clip_y0;
+	  r.clip_dir = 1;
 	}
+      _composite_rows(&r, &state, cy1 - delta, cx1, ags->wi == wi);
     }
   UPDATE_UNBUFFERED
 }
@@ -1119,88 +1330,32 @@ static BOOL _rect_advance(rect_trace_t *t, int *x0, int *x1)
     }
   else
     {
-      int y;
-      composite_run_t c;
-      int x0, x1;
-
-      c.dst = dst;
-      c.dsta = dst_alpha;
-      c.src = src;
-      c.srca = src_alpha;
-      c.fraction = fraction * 255;
+      composite_rows_t r;
+
+      r.blit_func = blit_func;
+      r.fraction = fraction * 255;
+      r.dst = dst;
+      r.dst_alpha = dst_alpha;
+      r.src = src;
+      r.src_alpha = src_alpha;
+      r.dbpl = dbpl;
+      r.adbpl = adbpl;
+      r.sbpl = sbpl;
+      r.asbpl = asbpl;
+      r.clip_span = clip_span;
+      r.clip_index = clip_index;
+      r.clip_dx = cx0 - clip_x0;
       if (order)
-	y = cy1 - delta - 1;
+	{
+	  r.clip_line = cy1 - delta - 1 + cy0 - clip_y0;
+	  r.clip_dir = -1;
+	}
       else
-	y = delta;
-      for (; y < cy1 && y >= 0; order? y-- : y++)
 	{
-	  if (!_rect_advance(&state,&x0,&x1))
-	      break;
-	  x1 -= x0;
-	  if (x1 <= 0)
-	    {
-	      c.dst += dbpl;
-	      c.dsta += adbpl;
-	      c.src += sbpl;
-	      c.srca += asbpl;
-	      continue;
-	    }
-	  c.dst += x0 * DI.bytes_per_pixel;
-	  c.dsta += x0;
-	  c.src += x0 * DI.bytes_per_pixel;
-	  c.srca += x0;
-	  if (!clip_span)
-	    {
-	      blit_func(&c, x1);
-	      c.dst += dbpl - x0 * DI.bytes_per_pixel;
-	      c.dsta += adbpl - x0;
-	      c.src += sbpl - x0 * DI.bytes_per_pixel;
-	      c.srca += asbpl - x0;
-	    }
-	  else
-	    {
-	      unsigned int *span, *end;
-	      BOOL state = NO;
-
-	      span = &clip_span[clip_index[y + cy0 - clip_y0]];
-	      end = &clip_span[clip_index[y + cy0 - clip_y0 + 1]];
-
-	      x0 = x0 + cx0 - clip_x0;
-	      x1 += x0;
-	      while (span != end && *span < x0)
-		{
-		  state = !state;
-		  span++;
-		  if (span == end)
-		    break;
-		}
-	      if (span != end)
-		{
-		  while (span != end && *span < x1)
-		    {
-		      if (state)
-		        blit_func(&c, *span - x0);
-		      c.dst += (*span - x0) * DI.bytes_per_pixel;
-		      c.dsta += (*span - x0);
-		      c.src += (*span - x0) * DI.bytes_per_pixel;
-		      c.srca += (*span - x0);
-		      x0 = *span;
-
-		      state = !state;
-		      span++;
-		      if (span == end)
-			break;
-		    }
-		  if (state)
-		    blit_func(&c, x1 - x0);
-		}
-	      x0 = x0 - cx0 + clip_x0;
-	      c.dst += dbpl - x0 * DI.bytes_per_pixel;
-	      c.dsta += adbpl - x0;
-	      c.src += sbpl -  x0 * DI.bytes_per_pixel;
-	      c.srca += asbpl - x0;
-	    }
+	  r.clip_line = delta + cy0 - clip_y0;
+	  r.clip_dir = 1;
 	}
+      _composite_rows(&r, &state, cy1 - delta, cx1, ags->wi == wi);
     }
   UPDATE_UNBUFFERED
 }
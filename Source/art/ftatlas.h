@@ -0,0 +1,86 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef ftatlas_h
+#define ftatlas_h
+
+#include <stddef.h>
+
+/*
+A glyph atlas keeps the coverage masks of the glyphs a font has drawn, in a
+form that can be combined into a single mask for a whole run of glyphs: one
+byte per pixel, rows packed with a pitch of width bytes, and the metrics
+needed to place it relative to the pen position.
+
+Each FTFontInfo has its own atlas, but all atlases share one memory budget
+and one least-recently-used list. When an insertion would exceed the budget,
+the least recently used masks are dropped, whichever font they belong to.
+Masks used since the last ft_atlas_begin_run() are never dropped, so a
+caller can look up all the glyphs of a run first and use the masks after.
+*/
+
+typedef struct ft_atlas_s ft_atlas_t;
+
+typedef struct ft_atlas_glyph_s
+{
+  unsigned int glyph;
+
+  int left, top;        /* offset of the mask from the pen position */
+  int width, height;    /* may be 0 for glyphs without an image */
+  int xadvance;
+
+  unsigned char *coverage;
+
+  /* private */
+  ft_atlas_t *atlas;
+  struct ft_atlas_glyph_s *hash_next;
+  struct ft_atlas_glyph_s *lru_prev, *lru_next;
+  unsigned int run;
+} ft_atlas_glyph_t;
+
+
+/* Sets the memory budget shared by all atlases, in bytes. 0 disables the
+atlases; ft_atlas_new() then returns NULL. */
+void ft_atlas_set_budget(size_t bytes);
+size_t ft_atlas_budget(void);
+
+/* Bytes currently used by all atlases together. */
+size_t ft_atlas_used(void);
+
+ft_atlas_t *ft_atlas_new(void);
+void ft_atlas_free(ft_atlas_t *atlas);
+
+/* Starts a new run. Masks looked up or inserted before this call may be
+dropped again. */
+void ft_atlas_begin_run(void);
+
+ft_atlas_glyph_t *ft_atlas_lookup(ft_atlas_t *atlas, unsigned int glyph);
+
+/* Copies a mask of width x height bytes, with rows pitch bytes apart, into
+the atlas. Returns NULL if it can't be stored; the mask of a glyph larger
+than the whole budget is never stored. */
+ft_atlas_glyph_t *ft_atlas_insert(ft_atlas_t *atlas, unsigned int glyph,
+  int left, int top, int width, int height, int xadvance,
+  const unsigned char *src, int pitch);
+
+#endif
+
@@ -0,0 +1,267 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftatlas.h"
+
+/*
+Like the FreeType caches in ftfont.m, this is only used from the thread that
+draws, so there is no locking.
+*/
+
+struct ft_atlas_s
+{
+  ft_atlas_glyph_t **buckets;
+  unsigned int num_buckets; /* a power of two */
+  unsigned int count;
+};
+
+static size_t budget = 0;
+static size_t used = 0;
+static unsigned int current_run = 1;
+
+/* Most recently used first. */
+static ft_atlas_glyph_t *lru_head, *lru_tail;
+
+
+void ft_atlas_set_budget(size_t bytes)
+{
+  budget = bytes;
+}
+
+size_t ft_atlas_budget(void)
+{
+  return budget;
+}
+
+size_t ft_atlas_used(void)
+{
+  return used;
+}
+
+void ft_atlas_begin_run(void)
+{
+  current_run++;
+  /* 0 is never a current run, so a wrap-around can't make an old mask look
+     pinned for more than one run. */
+  if (!current_run)
+    current_run = 1;
+}
+
+
+static inline unsigned int hash_glyph(ft_atlas_t *atlas, unsigned int glyph)
+{
+  return (glyph * 2654435761u) & (atlas->num_buckets - 1);
+}
+
+static inline size_t entry_size(ft_atlas_glyph_t *e)
+{
+  return sizeof(ft_atlas_glyph_t) + (size_t)e->width * e->height;
+}
+
+static void lru_unlink(ft_atlas_glyph_t *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    lru_tail = e->lru_prev;
+}
+
+static void lru_push(ft_atlas_glyph_t *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = e;
+  else
+    lru_tail = e;
+  lru_head = e;
+}
+
+static void evict(ft_atlas_glyph_t *e)
+{
+  ft_atlas_t *atlas = e->atlas;
+  ft_atlas_glyph_t **p;
+
+  for (p = &atlas->buckets[hash_glyph(atlas, e->glyph)]; *p != e;
+       p = &(*p)->hash_next)
+    ;
+  *p = e->hash_next;
+  atlas->count--;
+
+  lru_unlink(e);
+  used -= entry_size(e);
+  free(e);
+}
+
+static int grow(ft_atlas_t *atlas)
+{
+  ft_atlas_glyph_t **old = atlas->buckets;
+  unsigned int old_num = atlas->num_buckets;
+  unsigned int i;
+
+  atlas->buckets = calloc(old_num * 2, sizeof(ft_atlas_glyph_t *));
+  if (!atlas->buckets)
+    {
+      atlas->buckets = old;
+      return 0;
+    }
+  atlas->num_buckets = old_num * 2;
+
+  for (i = 0; i < old_num; i++)
+    {
+      ft_atlas_glyph_t *e, *next;
+
+      for (e = old[i]; e; e = next)
+        {
+          unsigned int h = hash_glyph(atlas, e->glyph);
+
+          next = e->hash_next;
+          e->hash_next = atlas->buckets[h];
+          atlas->buckets[h] = e;
+        }
+    }
+  free(old);
+  return 1;
+}
+
+
+ft_atlas_t *ft_atlas_new(void)
+{
+  ft_atlas_t *atlas;
+
+  if (!budget)
+    return NULL;
+
+  atlas = malloc(sizeof(ft_atlas_t));
+  if (!atlas)
+    return NULL;
+  atlas->num_buckets = 64;
+  atlas->count = 0;
+  atlas->buckets = calloc(atlas->num_buckets, sizeof(ft_atlas_glyph_t *));
+  if (!atlas->buckets)
+    {
+      free(atlas);
+      return NULL;
+    }
+  return atlas;
+}
+
+void ft_atlas_free(ft_atlas_t *atlas)
+{
+  unsigned int i;
+
+  if (!atlas)
+    return;
+
+  for (i = 0; i < atlas->num_buckets; i++)
+    {
+      ft_atlas_glyph_t *e, *next;
+
+      for (e = atlas->buckets[i]; e; e = next)
+        {
+          next = e->hash_next;
+          lru_unlink(e);
+          used -= entry_size(e);
+          free(e);
+        }
+    }
+  free(atlas->buckets);
+  free(atlas);
+}
+
+ft_atlas_glyph_t *ft_atlas_lookup(ft_atlas_t *atlas, unsigned int glyph)
+{
+  ft_atlas_glyph_t *e;
+
+  for (e = atlas->buckets[hash_glyph(atlas, glyph)]; e; e = e->hash_next)
+    {
+      if (e->glyph == glyph)
+        {
+          if (e != lru_head)
+            {
+              lru_unlink(e);
+              lru_push(e);
+            }
+          e->run = current_run;
+          return e;
+        }
+    }
+  return NULL;
+}
+
+ft_atlas_glyph_t *ft_atlas_insert(ft_atlas_t *atlas, unsigned int glyph,
+  int left, int top, int width, int height, int xadvance,
+  const unsigned char *src, int pitch)
+{
+  ft_atlas_glyph_t *e;
+  size_t size;
+  unsigned int h;
+  int y;
+
+  if (width <= 0 || height <= 0)
+    width = height = 0;
+  size = sizeof(ft_atlas_glyph_t) + (size_t)width * height;
+  if (size > budget)
+    return NULL;
+
+  while (used + size > budget && lru_tail && lru_tail->run != current_run)
+    evict(lru_tail);
+  if (used + size > budget)
+    return NULL;
+
+  if (atlas->count >= atlas->num_buckets)
+    grow(atlas);
+
+  e = malloc(size);
+  if (!e)
+    return NULL;
+
+  e->glyph = glyph;
+  e->left = left;
+  e->top = top;
+  e->width = width;
+  e->height = height;
+  e->xadvance = xadvance;
+  e->coverage = (unsigned char *)(e + 1);
+  for (y = 0; y < height; y++, src += pitch)
+    memcpy(e->coverage + y * width, src, width);
+
+  e->atlas = atlas;
+  h = hash_glyph(atlas, glyph);
+  e->hash_next = atlas->buckets[h];
+  atlas->buckets[h] = e;
+  atlas->count++;
+
+  lru_push(e);
+  e->run = current_run;
+  used += size;
+
+  return e;
+}
+
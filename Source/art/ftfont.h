@@ -73,8 +73,7 @@
 
 #import <GNUstepGUI/GSFontInfo.h>
 #import "FTFaceInfo.h"
-
-#define CACHE_SIZE 257
+#import "gsc/GSGlyphMetricsCache.h"
 
 @interface FTFontInfo : GSFontInfo <FTFontInfo>
 {
@@ -94,10 +93,13 @@
   /*
   Profiling (2003-11-14) shows that calls to -advancementForGlyph: accounted
   for roughly 20% of layout time. This cache reduces it to (currently)
-  insignificant levels.
+  insignificant levels. It is shared with other instances of the same font
+  and matrix.
   */
-  unsigned int cachedGlyph[CACHE_SIZE];
-  NSSize cachedSize[CACHE_SIZE];
+  GSGlyphMetricsCache *metrics;
+
+  /* Coverage masks of the glyphs drawn from the sbit cache, see ftatlas.h. */
+  struct ft_atlas_s *atlas;
 
   CGFloat lineHeight;
 }
@@ -22,6 +22,7 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <limits.h>
 #include <math.h>
 
 #import <Foundation/NSObject.h>
@@ -44,6 +45,7 @@
 #import "gsc/GSGState.h"
 
 #import "ftfont.h"
+#import "ftatlas.h"
 #import "FTFontEnumerator.h"
 
 #define DI (*di)
@@ -115,6 +117,197 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
 }
 
 
+/*
+Draws a run of glyphs from the font's glyph atlas. The coverage of all the
+glyphs is combined into one mask for the run, and the mask is blitted a
+scanline at a time instead of glyph by glyph.
+
+Only anti-aliased sbits are handled. Mono sbits are blitted without the gamma
+correction of the anti-aliased blitters, so they can't simply be expanded to
+coverage; if a font turns out to have any, its atlas is dropped and NO is
+returned before anything has been drawn, and the caller draws the run the
+old way.
+
+x, y and the clip rectangle (0, 0)-(x1, y1) are relative to buf (and abuf,
+if it isn't NULL).
+*/
+static unsigned char *atlas_mask;
+static int atlas_mask_size;
+
+static BOOL
+draw_atlas_glyphs(FTFontInfo *fi, const NSGlyph *glyphs, int length,
+  int x, int y, int x1, int y1,
+  unsigned char *buf, int bpl, unsigned char *abuf, int abpl,
+  unsigned char r, unsigned char g, unsigned char b, unsigned char alpha,
+  struct draw_info_s *di)
+{
+  ft_atlas_glyph_t *entries_buf[64], **entries = entries_buf;
+  int pens_buf[64], *pens = pens_buf;
+  int bx0 = INT_MAX, by0 = INT_MAX, bx1 = INT_MIN, by1 = INT_MIN;
+  int bw, bh;
+  int i, n;
+  unsigned char *dst, *adst, *m;
+  BOOL ok = NO;
+
+  if (length > 64)
+    {
+      entries = malloc(length * sizeof(ft_atlas_glyph_t *));
+      pens = malloc(length * sizeof(int));
+      if (!entries || !pens)
+        goto done;
+    }
+
+  ft_atlas_begin_run();
+  for (i = n = 0; i < length; i++)
+    {
+      unsigned int glyph = glyphs[i] - 1;
+      ft_atlas_glyph_t *e;
+
+      e = ft_atlas_lookup(fi->atlas, glyph);
+      if (!e)
+        {
+          FTC_SBit sbit;
+          FT_Error error;
+
+          if ((error = FTC_SBitCache_Lookup(ftc_sbitcache, &fi->imageType,
+            glyph, &sbit, NULL)))
+            {
+              if (glyph != 0xffffffff)
+                NSLog(@"FTC_SBitCache_Lookup() failed with error %08x "
+                  @"(%08x, %08x, %ix%i, %08x)",
+                  error, glyph, (unsigned)fi->imageType.face_id,
+                  fi->imageType.width, fi->imageType.height,
+                  fi->imageType.flags);
+              continue;
+            }
+
+          if (sbit->buffer && sbit->format != ft_pixel_mode_grays)
+            {
+              NSDebugLLog(@"ftfont", @"%@ has non-gray sbits, not using "
+                @"the glyph atlas", fi);
+              ft_atlas_free(fi->atlas);
+              fi->atlas = NULL;
+              goto done;
+            }
+
+          if (sbit->buffer)
+            e = ft_atlas_insert(fi->atlas, glyph, sbit->left, sbit->top,
+              sbit->width, sbit->height, sbit->xadvance,
+              sbit->buffer, sbit->pitch);
+          else
+            e = ft_atlas_insert(fi->atlas, glyph, 0, 0, 0, 0,
+              sbit->xadvance, NULL, 0);
+          if (!e)
+            goto done;
+        }
+
+      if (e->width)
+        {
+          int gx = x + e->left, gy = y - e->top;
+
+          if (gx < bx0)
+            bx0 = gx;
+          if (gy < by0)
+            by0 = gy;
+          if (gx + e->width > bx1)
+            bx1 = gx + e->width;
+          if (gy + e->height > by1)
+            by1 = gy + e->height;
+
+          entries[n] = e;
+          pens[n] = x;
+          n++;
+        }
+      x += e->xadvance;
+    }
+
+  ok = YES;
+
+  if (bx0 < 0)
+    bx0 = 0;
+  if (by0 < 0)
+    by0 = 0;
+  if (bx1 > x1)
+    bx1 = x1;
+  if (by1 > y1)
+    by1 = y1;
+  bw = bx1 - bx0;
+  bh = by1 - by0;
+  if (bw <= 0 || bh <= 0)
+    goto done;
+
+  if (bw * bh > atlas_mask_size)
+    {
+      unsigned char *nm = realloc(atlas_mask, bw * bh);
+
+      if (!nm)
+        {
+          ok = NO;
+          goto done;
+        }
+      atlas_mask = nm;
+      atlas_mask_size = bw * bh;
+    }
+  memset(atlas_mask, 0, bw * bh);
+
+  /* Where glyphs overlap, their coverage is combined the way blending one
+     over the other would combine it. */
+  for (i = 0; i < n; i++)
+    {
+      ft_atlas_glyph_t *e = entries[i];
+      int gx = pens[i] + e->left - bx0, gy = y - e->top - by0;
+      int sx0 = 0, sy0 = 0, sx1 = e->width, sy1 = e->height;
+      int sx, sy;
+
+      if (gx < 0)
+        sx0 = -gx;
+      if (gy < 0)
+        sy0 = -gy;
+      if (gx + sx1 > bw)
+        sx1 = bw - gx;
+      if (gy + sy1 > bh)
+        sy1 = bh - gy;
+
+      for (sy = sy0; sy < sy1; sy++)
+        {
+          const unsigned char *s = e->coverage + sy * e->width + sx0;
+          unsigned char *d = atlas_mask + (gy + sy) * bw + gx + sx0;
+
+          for (sx = sx0; sx < sx1; sx++, s++, d++)
+            {
+              if (!*d)
+                *d = *s;
+              else if (*s)
+                *d = *d + *s - (*d * *s + 127) / 255;
+            }
+        }
+    }
+
+  m = atlas_mask;
+  dst = buf + by0 * bpl + DI.bytes_per_pixel * bx0;
+  if (abuf)
+    {
+      adst = abuf + by0 * abpl + bx0;
+      for (; bh; bh--, m += bw, dst += bpl, adst += abpl)
+        RENDER_BLIT_ALPHA_A(dst, adst, m, r, g, b, alpha, bw);
+    }
+  else if (alpha >= 255)
+    for (; bh; bh--, m += bw, dst += bpl)
+      RENDER_BLIT_ALPHA_OPAQUE(dst, m, r, g, b, bw);
+  else
+    for (; bh; bh--, m += bw, dst += bpl)
+      RENDER_BLIT_ALPHA(dst, m, r, g, b, alpha, bw);
+
+done:
+  if (entries != entries_buf)
+    {
+      free(entries);
+      free(pens);
+    }
+  return ok;
+}
+
+
 @implementation FTFontInfo
 
 - (id) initWithFontName: (NSString *)name
@@ -291,18 +484,25 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
       imageType.flags = FT_LOAD_NO_HINTING;
     }
 
-  /*
-  Here, we simply need to make sure that we don't get any false matches
-  the first time a particular cache entry is used. Thus, we only need to
-  initialize the first entry. For all other entries, cachedGlyph[i] will
-  be 0, and that's a glyph that can't possibly hash to any entry except
-  entry #0, so it won't cause any false matches.
-  */
-  cachedGlyph[0] = 1;
+  metrics = GSGlyphMetricsCacheForKey(
+    [NSString stringWithFormat: @"%@ %@ %.17g %.17g %.17g %.17g %.17g %.17g %d",
+              NSStringFromClass([self class]), fontName,
+              matrix[0], matrix[1], matrix[2],
+              matrix[3], matrix[4], matrix[5], screenFont],
+    GSGlyphMetricsCacheDefaultSize());
+
+  atlas = ft_atlas_new();
 
   return self;
 }
 
+- (void) dealloc
+{
+  GSGlyphMetricsCacheRelease(metrics);
+  ft_atlas_free(atlas);
+  [super dealloc];
+}
+
 - (NSString*) displayName
 {
   return face_info->displayName;
@@ -985,6 +1185,11 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
 /*        NSLog(@"drawGlyphs: '%p' at: %i:%i  to: %i:%i:%i:%i:%p",
                 glyphs, x, y, x0, y0, x1, y1, buf);*/
 
+  if (use_sbit && atlas
+    && draw_atlas_glyphs(self, glyphs, length, x, y, x1, y1, buf, bpl,
+      NULL, 0, r, g, b, alpha, di))
+    return;
+
   for (; length; length--, glyphs++)
     {
       glyph = *glyphs - 1;
@@ -1306,6 +1511,11 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
 /*        NSLog(@"drawString: '%s' at: %i:%i  to: %i:%i:%i:%i:%p",
                 s, x, y, x0, y0, x1, y1, buf);*/
 
+  if (use_sbit && atlas
+    && draw_atlas_glyphs(self, glyphs, length, x, y, x1, y1, buf, bpl,
+      abuf, abpl, r, g, b, alpha, di))
+    return;
+
   for (; length; length--, glyphs++)
     {
       glyph = *glyphs - 1;
@@ -1575,11 +1785,11 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
     glyph--;
   if (screenFont)
     {
-      int entry = glyph % CACHE_SIZE;
       FTC_SBit sbit;
+      NSSize s;
 
-      if (cachedGlyph[entry] == glyph)
-        return cachedSize[entry];
+      if (metrics && GSGlyphMetricsCacheGetAdvancement(metrics, glyph, &s))
+        return s;
 
       if ((error = FTC_SBitCache_Lookup(ftc_sbitcache, &imageType, glyph, &sbit, NULL)))
         {
@@ -1591,9 +1801,10 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
           return NSZeroSize;
         }
 
-      cachedGlyph[entry] = glyph;
-      cachedSize[entry] = NSMakeSize(sbit->xadvance, sbit->yadvance);
-      return cachedSize[entry];
+      s = NSMakeSize(sbit->xadvance, sbit->yadvance);
+      if (metrics)
+        GSGlyphMetricsCacheSetAdvancement(metrics, glyph, s);
+      return s;
     }
   else
     {
@@ -1646,8 +1857,12 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
   FT_BBox bbox;
   FT_Glyph g;
   FT_Error error;
+  NSRect r;
 
   glyph--;
+  if (metrics && GSGlyphMetricsCacheGetBoundingRect(metrics, glyph, &r))
+    return r;
+
 /* TODO: this is ugly */
   if ((error=FTC_ImageCache_Lookup(ftc_imagecache, &imageType, glyph, &g, NULL)))
     {
@@ -1661,8 +1876,11 @@ static FT_Error ft_get_face(FTC_FaceID fid, FT_Library lib,
 /*        printf("got cbox for %04x: %i, %i - %i, %i",
                 aGlyph, bbox.xMin, bbox.yMin, bbox.xMax, bbox.yMax);*/
 
-  return NSMakeRect(bbox.xMin / 64.0, bbox.yMin / 64.0,
-                    (bbox.xMax - bbox.xMin) / 64.0, (bbox.yMax - bbox.yMin) / 64.0);
+  r = NSMakeRect(bbox.xMin / 64.0, bbox.yMin / 64.0,
+                 (bbox.xMax - bbox.xMin) / 64.0, (bbox.yMax - bbox.yMin) / 64.0);
+  if (metrics)
+    GSGlyphMetricsCacheSetBoundingRect(metrics, glyph, r);
+  return r;
 }
 
 - (NSPoint) positionOfGlyph: (NSGlyph)g
@@ -2160,6 +2378,17 @@ static int filters[3][7]=
 
     subpixel_text = [ud integerForKey: @"back-art-subpixel-text"];
 
+    /* The glyph atlas size is given in kilobytes; 0 or less turns it
+       off. */
+    if ([ud objectForKey: @"back-art-glyph-atlas-size"])
+      {
+        NSInteger kb = [ud integerForKey: @"back-art-glyph-atlas-size"];
+
+        ft_atlas_set_budget(kb > 0 ? (size_t)kb * 1024 : 0);
+      }
+    else
+      ft_atlas_set_budget(2048 * 1024);
+
     /* To make it easier to find an optimal (or at least good) filter,
     the filters are configurable (for now). */
     for (i = 0; i < 3; i++)
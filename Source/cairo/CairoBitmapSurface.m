@@ -29,38 +29,33 @@
 #include <AppKit/NSGraphics.h>
 
 #include "cairo/CairoBitmapSurface.h"
+#include "cairo/CairoPixelConversion.h"
 
-#include <stdint.h>
+#include <string.h>
 
-/* Cairo holds a pixel as a native word with the alpha in the top byte; a
- * representation holds it as four bytes with the alpha last.
- */
-static void
-readRow(const unsigned char *from, uint32_t *to, int wide)
+/* Whether length bytes are all zero. */
+static BOOL
+isClear(const unsigned char *bytes, int length)
 {
+  uint64_t word;
   int i;
 
-  for (i = 0; i < wide; i++)
+  for (i = 0; i + 8 <= length; i += 8)
     {
-      to[i] = ((uint32_t)from[3] << 24) | ((uint32_t)from[0] << 16)
-	| ((uint32_t)from[1] << 8) | (uint32_t)from[2];
-      from += 4;
+      memcpy(&word, bytes + i, 8);
+      if (word != 0)
+	{
+	  return NO;
+	}
     }
-}
-
-static void
-writeRow(const uint32_t *from, unsigned char *to, int wide)
-{
-  int i;
-
-  for (i = 0; i < wide; i++)
+  for (; i < length; i++)
     {
-      to[0] = (unsigned char)((from[i] >> 16) & 0xff);
-      to[1] = (unsigned char)((from[i] >> 8) & 0xff);
-      to[2] = (unsigned char)(from[i] & 0xff);
-      to[3] = (unsigned char)((from[i] >> 24) & 0xff);
-      to += 4;
+      if (bytes[i] != 0)
+	{
+	  return NO;
+	}
     }
+  return YES;
 }
 
 @implementation CairoBitmapSurface
@@ -69,7 +64,13 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
 {
   NSString *space;
 
-  if (rep == nil || [rep isPlanar] || [rep bitmapFormat] != 0)
+  if (rep == nil || [rep isPlanar])
+    {
+      return NO;
+    }
+  /* Cairo wants premultiplied colours; others are converted on the way. */
+  if ([rep bitmapFormat] != 0
+    && [rep bitmapFormat] != NSAlphaNonpremultipliedBitmapFormat)
     {
       return NO;
     }
@@ -103,8 +104,13 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
     }
 
   ASSIGN(_rep, rep);
+  _nonpremultiplied = ([rep bitmapFormat] != 0);
   gsDevice = device;
-  [self read];
+  /* What the representation holds is only taken up once something needs it,
+   * as drawing that replaces all of it does not.
+   */
+  _needsRead = YES;
+  _dirty = NSZeroRect;
 
   return self;
 }
@@ -132,7 +138,8 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
 }
 
 /* Take up what the representation already holds, so that drawing adds to it
- * rather than replacing it.
+ * rather than replacing it.  A new representation is all zero, which is what
+ * cairo cleared the surface to, so that is not converted.
  */
 - (void) read
 {
@@ -143,6 +150,7 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
   int high;
   int stride;
 
+  _needsRead = NO;
   to = cairo_image_surface_get_data(_surface);
   if (to == NULL)
     {
@@ -155,26 +163,77 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
     }
   wide = (int)[_rep pixelsWide];
   high = (int)[_rep pixelsHigh];
+  for (y = 0; y < high; y++)
+    {
+      if (!isClear(from + y * [_rep bytesPerRow], wide * 4))
+	{
+	  break;
+	}
+    }
+  if (y == high)
+    {
+      return;
+    }
   stride = cairo_image_surface_get_stride(_surface);
   cairo_surface_flush(_surface);
   for (y = 0; y < high; y++)
     {
-      readRow(from + y * [_rep bytesPerRow], (uint32_t *)(to + y * stride),
-	wide);
+      if (_nonpremultiplied)
+	{
+	  GSCairoPremultiplyRGBAToARGB32(from + y * [_rep bytesPerRow],
+	    (uint32_t *)(to + y * stride), wide);
+	}
+      else
+	{
+	  GSCairoRGBAToARGB32(from + y * [_rep bytesPerRow],
+	    (uint32_t *)(to + y * stride), wide);
+	}
     }
   cairo_surface_mark_dirty(_surface);
 }
 
+- (void) willDrawRect: (NSRect)rect replacing: (BOOL)replacing
+{
+  NSRect bounds;
+
+  bounds = NSMakeRect(0, 0, [_rep pixelsWide], [_rep pixelsHigh]);
+  if (_needsRead)
+    {
+      if (replacing && NSContainsRect(rect, bounds))
+	{
+	  _needsRead = NO;
+	}
+      else
+	{
+	  [self read];
+	}
+    }
+  rect = NSIntersectionRect(NSIntegralRect(rect), bounds);
+  _dirty = NSUnionRect(_dirty, rect);
+}
+
+- (void) willRead
+{
+  if (_needsRead)
+    {
+      [self read];
+    }
+}
+
+/* Write back the part of the surface drawn into since the last flush. */
 - (void) flush
 {
   const unsigned char *from;
   unsigned char *to;
   int y;
+  int left;
+  int top;
   int wide;
   int high;
   int stride;
+  int bytesPerRow;
 
-  if (_surface == NULL || _rep == nil)
+  if (_surface == NULL || _rep == nil || NSIsEmptyRect(_dirty))
     {
       return;
     }
@@ -189,14 +248,28 @@ writeRow(const uint32_t *from, unsigned char *to, int wide)
     {
       return;
     }
-  wide = (int)[_rep pixelsWide];
-  high = (int)[_rep pixelsHigh];
+  left = (int)NSMinX(_dirty);
+  top = (int)NSMinY(_dirty);
+  wide = (int)NSWidth(_dirty);
+  high = (int)NSHeight(_dirty);
   stride = cairo_image_surface_get_stride(_surface);
+  bytesPerRow = (int)[_rep bytesPerRow];
+  from += top * stride + left * 4;
+  to += top * bytesPerRow + left * 4;
   for (y = 0; y < high; y++)
     {
-      writeRow((const uint32_t *)(from + y * stride),
-	to + y * [_rep bytesPerRow], wide);
+      if (_nonpremultiplied)
+	{
+	  GSCairoUnpremultiplyARGB32ToRGBA((const uint32_t *)(from + y * stride),
+	    to + y * bytesPerRow, wide);
+	}
+      else
+	{
+	  GSCairoARGB32ToRGBA((const uint32_t *)(from + y * stride),
+	    to + y * bytesPerRow, wide);
+	}
     }
+  _dirty = NSZeroRect;
 }
 
 @end
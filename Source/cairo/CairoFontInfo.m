@@ -277,70 +277,166 @@ void set_font_options(cairo_font_options_t *options)
   return val;
 }
 
+/*
+ * The NSGlyphs of this backend are characters. Instead of converting them
+ * to UTF-8 for cairo_scaled_font_text_extents, which maps them back to
+ * glyph indices, map them to glyph indices directly (the way cairo does)
+ * and get the extents of the indices.
+ *
+ * cairo only measures runs as a whole, so each glyph is still measured on
+ * its own, but the face is locked once for the whole run.
+ */
+#define EXTENTS_CHUNK 64
+
 static
-BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
-                                cairo_text_extents_t *ctext)
+BOOL _cairo_extents_for_NSGlyphs(cairo_scaled_font_t *scaled_font,
+                                 const NSGlyph *glyphs, unsigned int count,
+                                 cairo_text_extents_t *ctext)
 {
-  unichar ustr[2];
-  char str[4];
-  unsigned char *b;
-  unsigned int size = 4;
-  int length = 1;
+  cairo_glyph_t cglyphs[EXTENTS_CHUNK];
+  FT_Face face;
+  unsigned int i, j, n;
 
-  ustr[0] = glyph;
-  ustr[1] = 0;
-
-  b = (unsigned char *)str;
-  if (!GSFromUnicode(&b, &size, ustr, length, 
-                     NSUTF8StringEncoding, NULL, GSUniTerminate))
+  for (i = 0; i < count; i += n)
     {
-      NSLog(@"Conversion failed for %@", 
-            [NSString stringWithCharacters: ustr length: length]);
-      return NO;
+      n = count - i;
+      if (n > EXTENTS_CHUNK)
+        n = EXTENTS_CHUNK;
+
+      face = cairo_ft_scaled_font_lock_face(scaled_font);
+      if (!face)
+        {
+          return NO;
+        }
+      for (j = 0; j < n; j++)
+        {
+          cglyphs[j].index = FcFreeTypeCharIndex(face, glyphs[i + j]);
+          cglyphs[j].x = 0;
+          cglyphs[j].y = 0;
+        }
+      /* cairo locks the face itself when it loads a glyph. */
+      cairo_ft_scaled_font_unlock_face(scaled_font);
+
+      for (j = 0; j < n; j++)
+        {
+          cairo_scaled_font_glyph_extents(scaled_font, &cglyphs[j], 1,
+                                          &ctext[i + j]);
+        }
     }
 
-  cairo_scaled_font_text_extents(scaled_font, str, ctext);
   return cairo_scaled_font_status(scaled_font) == CAIRO_STATUS_SUCCESS;
 }
 
+static
+BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
+                                cairo_text_extents_t *ctext)
+{
+  return _cairo_extents_for_NSGlyphs(scaled_font, &glyph, 1, ctext);
+}
+
+static inline void
+_cache_extents(GSGlyphMetricsCache *metrics, NSGlyph glyph,
+               cairo_text_extents_t *ctext)
+{
+  GSGlyphMetricsCacheSetAdvancement(metrics, glyph,
+    NSMakeSize(ctext->x_advance, ctext->y_advance));
+  GSGlyphMetricsCacheSetBoundingRect(metrics, glyph,
+    NSMakeRect(ctext->x_bearing, ctext->y_bearing,
+               ctext->width, ctext->height));
+}
+
 - (NSSize) advancementForGlyph: (NSGlyph)glyph
 {
   cairo_text_extents_t ctext;
+  NSSize advancement;
 
-  if (_cachedSizes)
+  if (_metrics
+    && GSGlyphMetricsCacheGetAdvancement(_metrics, glyph, &advancement))
     {
-      int entry = glyph % _cacheSize;
+      return advancement;
+    }
 
-      if (_cachedGlyphs[entry] == glyph)
-        {
-          return _cachedSizes[entry];
-        }
-      
-      if (_cairo_extents_for_NSGlyph(_scaled, glyph, &ctext))
+  if (_cairo_extents_for_NSGlyph(_scaled, glyph, &ctext))
+    {
+      if (_metrics)
         {
-          _cachedGlyphs[entry] = glyph;
-          _cachedSizes[entry] = NSMakeSize(ctext.x_advance, ctext.y_advance);
-          
-          return _cachedSizes[entry];
+          /* The same call gives the bounding box too. */
+          _cache_extents(_metrics, glyph, &ctext);
         }
+      return NSMakeSize(ctext.x_advance, ctext.y_advance);
     }
-  else
+
+  return NSZeroSize;
+}
+
+- (void) getAdvancements: (NSSize *)advancements
+               forGlyphs: (const NSGlyph *)glyphs
+                   count: (unsigned int)count
+{
+  NSGlyph missing[EXTENTS_CHUNK];
+  unsigned int where[EXTENTS_CHUNK];
+  cairo_text_extents_t ctext[EXTENTS_CHUNK];
+  unsigned int i, j, n;
+
+  for (i = 0; i < count; )
     {
-      if (_cairo_extents_for_NSGlyph(_scaled, glyph, &ctext))
+      /* Gather the glyphs that aren't cached and measure them together. */
+      for (n = 0; i < count && n < EXTENTS_CHUNK; i++)
+        {
+          if (_metrics
+            && GSGlyphMetricsCacheGetAdvancement(_metrics, glyphs[i],
+                                                 &advancements[i]))
+            {
+              continue;
+            }
+          missing[n] = glyphs[i];
+          where[n] = i;
+          n++;
+        }
+      if (!n)
         {
-          return NSMakeSize(ctext.x_advance, ctext.y_advance);
+          continue;
         }
-    }
 
-  return NSZeroSize;
+      if (_cairo_extents_for_NSGlyphs(_scaled, missing, n, ctext))
+        {
+          for (j = 0; j < n; j++)
+            {
+              advancements[where[j]] = NSMakeSize(ctext[j].x_advance,
+                                                  ctext[j].y_advance);
+              if (_metrics)
+                {
+                  _cache_extents(_metrics, missing[j], &ctext[j]);
+                }
+            }
+        }
+      else
+        {
+          for (j = 0; j < n; j++)
+            {
+              advancements[where[j]] = NSZeroSize;
+            }
+        }
+    }
 }
 
 - (NSRect) boundingRectForGlyph: (NSGlyph)glyph
 {
   cairo_text_extents_t ctext;
+  NSRect rect;
+
+  if (_metrics
+    && GSGlyphMetricsCacheGetBoundingRect(_metrics, glyph, &rect))
+    {
+      return rect;
+    }
 
   if (_cairo_extents_for_NSGlyph(_scaled, glyph, &ctext))
     {
+      if (_metrics)
+        {
+          _cache_extents(_metrics, glyph, &ctext);
+        }
       return NSMakeRect(ctext.x_bearing, ctext.y_bearing,
                         ctext.width, ctext.height);
     }
@@ -372,6 +468,51 @@ BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
   return 0.0;
 }
 
+/* The glyphs are drawn as the characters of their numbers, so they are
+   converted to UTF-8 for cairo the same way to draw and to measure them.
+   They are UTF-32, as they are mapped to glyph indices for measuring, so
+   characters beyond U+FFFF are kept whole.  str needs room for 4 bytes a
+   glyph and the terminating nul. */
+static void
+_utf8_for_NSGlyphs(const NSGlyph *glyphs, int length, char *str)
+{
+  unsigned char *b = (unsigned char *)str;
+  int i;
+
+  for (i = 0; i < length; i++)
+    {
+      NSGlyph c = glyphs[i];
+
+      if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+        {
+          c = 0xFFFD;
+        }
+      if (c < 0x80)
+        {
+          *b++ = c;
+        }
+      else if (c < 0x800)
+        {
+          *b++ = 0xC0 | (c >> 6);
+          *b++ = 0x80 | (c & 0x3F);
+        }
+      else if (c < 0x10000)
+        {
+          *b++ = 0xE0 | (c >> 12);
+          *b++ = 0x80 | ((c >> 6) & 0x3F);
+          *b++ = 0x80 | (c & 0x3F);
+        }
+      else
+        {
+          *b++ = 0xF0 | (c >> 18);
+          *b++ = 0x80 | ((c >> 12) & 0x3F);
+          *b++ = 0x80 | ((c >> 6) & 0x3F);
+          *b++ = 0x80 | (c & 0x3F);
+        }
+    }
+  *b = 0;
+}
+
 - (void) appendBezierPathWithGlyphs: (NSGlyph *)glyphs 
                               count: (int)length 
                        toBezierPath: (NSBezierPath *)path
@@ -383,27 +524,11 @@ BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
   int iy = 400;
   unsigned char *cdata;
   int i;
-  unichar ustr[length+1];
-  char str[3*length+1];
-  unsigned char *b;
-  unsigned int size = 3*length+1;
+  char str[4*length+1];
   cairo_status_t status;
   cairo_matrix_t font_matrix;
 
-  for (i = 0; i < length; i++)
-    {
-      ustr[i] = glyphs[i];
-    }
-  ustr[length] = 0;
-
-  b = (unsigned char *)str;
-  if (!GSFromUnicode(&b, &size, ustr, length, 
-                     NSUTF8StringEncoding, NULL, GSUniTerminate))
-    {
-      NSLog(@"Conversion failed for %@", 
-            [NSString stringWithCharacters: ustr length: length]);
-      return;
-    }
+  _utf8_for_NSGlyphs(glyphs, length, str);
 
   cdata = malloc(sizeof(char) * 4 * ix * iy);
   if (!cdata)
@@ -527,26 +652,9 @@ BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
              length: (int)length 
                  on: (cairo_t*)ct
 {
-  unichar ustr[length+1];
-  char str[3*length+1];
-  unsigned char *b;
-  int i;
-  unsigned int size = 3*length+1;
-
-  for (i = 0; i < length; i++)
-    {
-      ustr[i] = glyphs[i];
-    }
-  ustr[length] = 0;
+  char str[4*length+1];
 
-  b = (unsigned char *)str;
-  if (!GSFromUnicode(&b, &size, ustr, length, 
-                     NSUTF8StringEncoding, NULL, GSUniTerminate))
-    {
-      NSLog(@"Conversion failed for %@", 
-            [NSString stringWithCharacters: ustr length: length]);
-      return;
-    }
+  _utf8_for_NSGlyphs(glyphs, length, str);
 
   cairo_set_scaled_font(ct, _scaled);
   if (cairo_status(ct) != CAIRO_STATUS_SUCCESS)
@@ -564,4 +672,17 @@ BOOL _cairo_extents_for_NSGlyph(cairo_scaled_font_t *scaled_font, NSGlyph glyph,
     }
 }
 
+- (void) getExtents: (cairo_text_extents_t *)extents
+           ofGlyphs: (const NSGlyph*)glyphs
+             length: (int)length
+                 on: (cairo_t*)ct
+{
+  char str[4*length+1];
+
+  _utf8_for_NSGlyphs(glyphs, length, str);
+
+  cairo_set_scaled_font(ct, _scaled);
+  cairo_text_extents(ct, str, extents);
+}
+
 @end
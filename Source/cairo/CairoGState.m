@@ -34,10 +34,12 @@
 #include <AppKit/NSGradient.h>
 #include <AppKit/NSGraphics.h>
 #include <AppKit/NSShadow.h>
+#include <Foundation/NSLock.h>
 #include "cairo/CairoGState.h"
 #include "cairo/CairoFontInfo.h"
 #include "cairo/CairoSurface.h"
 #include "cairo/CairoContext.h"
+#include "cairo/CairoPixelConversion.h"
 #include <math.h>
 
 
@@ -113,6 +115,321 @@ static inline cairo_filter_t cairoFilterFromNSImageInterpolation(NSImageInterpol
     }
 }
 
+/* The image surfaces made by -DPSimage:... are kept, so that drawing the
+ * same bitmap again needs no conversion, and so that cairo can keep what it
+ * makes from the surface for a target (such as a copy on the X server).
+ * Nothing tells us when the data of a bitmap changes, so an entry is found
+ * by the address and layout of the data and a hash of its contents.  Data
+ * found changed twice in a row is taken as animated and no longer hashed.
+ */
+#define IMAGE_CACHE_SIZE 8
+#define IMAGE_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+typedef struct {
+  const unsigned char *data;
+  NSInteger width;
+  NSInteger height;
+  NSInteger bitsPerPixel;
+  NSInteger bytesPerRow;
+  uint64_t hash;
+  cairo_surface_t *surface;     /* NULL when not kept */
+  size_t bytes;
+  unsigned changes;
+  unsigned long lastUse;
+} image_cache_entry_t;
+
+static image_cache_entry_t imageCache[IMAGE_CACHE_SIZE];
+static size_t imageCacheBytes = 0;
+static unsigned long imageCacheClock = 0;
+/* Gstates of other threads draw images too. */
+static NSLock *imageCacheLock = nil;
+static const cairo_user_data_key_t imageDataKey;
+
+/* A hash of the pixels of an image, leaving out the padding of the rows.
+   Four independent lanes with the round of xxHash keep it at memory speed. */
+static inline uint64_t
+hashRound(uint64_t lane, uint64_t word)
+{
+  lane += word * 0xc2b2ae3d27d4eb4fULL;
+  lane = (lane << 31) | (lane >> 33);
+  return lane * 0x9e3779b185ebca87ULL;
+}
+
+static uint64_t
+hashImageData(const unsigned char *data, NSInteger rowBytes,
+              NSInteger rows, NSInteger bytesPerRow)
+{
+  uint64_t lane0 = 0x60ea27eeadc0b5d6ULL, lane1 = 0xc2b2ae3d27d4eb4fULL;
+  uint64_t lane2 = 0, lane3 = 0x61c8864e7a143579ULL;
+  NSInteger y;
+
+  for (y = 0; y < rows; y++, data += bytesPerRow)
+    {
+      const unsigned char *p = data;
+      const unsigned char *end = data + rowBytes;
+      uint64_t w[4];
+
+      for (; p + 32 <= end; p += 32)
+        {
+          memcpy(w, p, 32);
+          lane0 = hashRound(lane0, w[0]);
+          lane1 = hashRound(lane1, w[1]);
+          lane2 = hashRound(lane2, w[2]);
+          lane3 = hashRound(lane3, w[3]);
+        }
+      for (; p < end; p++)
+        {
+          lane0 = hashRound(lane0, *p);
+        }
+      lane1 = hashRound(lane1, (uint64_t)y);
+    }
+
+  return hashRound(hashRound(hashRound(lane0, lane1), lane2), lane3);
+}
+
+/* Converts the data of an image to a new cairo image surface, which owns
+   the converted pixels.  Returns NULL, after logging why, if it can't. */
+static cairo_surface_t *
+createImageSurface(const unsigned char *data, NSInteger pixelsWide,
+                   NSInteger pixelsHigh, NSInteger bitsPerPixel,
+                   NSInteger bytesPerRow)
+{
+  cairo_format_t format;
+  cairo_surface_t *surface;
+  const unsigned char *dataRow;
+  unsigned char *reformattedData;
+  int reformattedDataSize, rowCounter;
+  uint32_t *reformattedDataPixel;
+  cairo_status_t status;
+
+  reformattedDataSize = pixelsWide * pixelsHigh * sizeof(*reformattedDataPixel);
+
+  switch (bitsPerPixel)
+    {
+    case 32:
+      reformattedData = malloc(reformattedDataSize);
+      if (!reformattedData)
+        {
+          NSLog(@"Could not allocate drawing space for image");
+          return NULL;
+        }
+
+      dataRow = data;
+      reformattedDataPixel = (uint32_t *) reformattedData;
+
+      rowCounter = pixelsHigh;
+
+      while (rowCounter--)
+        {
+          GSCairoRGBAToARGB32(dataRow, reformattedDataPixel, pixelsWide);
+          reformattedDataPixel += pixelsWide;
+          dataRow += bytesPerRow;
+        }
+      format = CAIRO_FORMAT_ARGB32;
+      break;
+    case 24:
+      reformattedData = malloc(reformattedDataSize);
+      if (!reformattedData)
+        {
+          NSLog(@"Could not allocate drawing space for image");
+          return NULL;
+        }
+
+      dataRow = data;
+      reformattedDataPixel = (uint32_t *) reformattedData;
+
+      rowCounter = pixelsHigh;
+
+      while (rowCounter--)
+        {
+          GSCairoRGBToRGB24(dataRow, reformattedDataPixel, pixelsWide);
+          reformattedDataPixel += pixelsWide;
+          dataRow += bytesPerRow;
+        }
+      format = CAIRO_FORMAT_RGB24;
+      break;
+    default:
+      NSLog(@"Image format not support");
+      return NULL;
+    }
+
+  surface = cairo_image_surface_create_for_data((void*)reformattedData,
+						format,
+						pixelsWide,
+						pixelsHigh,
+						pixelsWide * sizeof(*reformattedDataPixel));
+  status = cairo_surface_status(surface);
+  if (status != CAIRO_STATUS_SUCCESS)
+    {
+      NSLog(@"Cairo status '%s' in DPSimage", cairo_status_to_string(status));
+      cairo_surface_destroy(surface);
+      free(reformattedData);
+      return NULL;
+    }
+  /* The pixels go with the surface, wherever it is kept. */
+  cairo_surface_set_user_data(surface, &imageDataKey, reformattedData, free);
+  return surface;
+}
+
+static void
+dropCachedImage(image_cache_entry_t *entry)
+{
+  if (entry->surface != NULL)
+    {
+      cairo_surface_destroy(entry->surface);
+      imageCacheBytes -= entry->bytes;
+    }
+  memset(entry, 0, sizeof(*entry));
+}
+
+/* Does the work of imageSurfaceForData() with the cache locked. */
+static cairo_surface_t *
+cachedImageSurface(const unsigned char *data, NSInteger pixelsWide,
+                   NSInteger pixelsHigh, NSInteger bitsPerPixel,
+                   NSInteger bytesPerRow)
+{
+  image_cache_entry_t *entry = NULL;
+  image_cache_entry_t *victim = &imageCache[0];
+  size_t bytes = (size_t)pixelsWide * pixelsHigh * 4;
+  cairo_surface_t *surface;
+  uint64_t hash;
+  int i;
+
+  if (bytes > IMAGE_CACHE_MAX_BYTES / 4)
+    {
+      return createImageSurface(data, pixelsWide, pixelsHigh,
+                                bitsPerPixel, bytesPerRow);
+    }
+
+  for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+    {
+      image_cache_entry_t *e = &imageCache[i];
+
+      if (e->data == data && e->width == pixelsWide
+          && e->height == pixelsHigh && e->bitsPerPixel == bitsPerPixel
+          && e->bytesPerRow == bytesPerRow)
+        {
+          entry = e;
+          break;
+        }
+      if (e->lastUse < victim->lastUse)
+        {
+          victim = e;
+        }
+    }
+
+  if (entry != NULL && entry->changes >= 2)
+    {
+      entry->lastUse = ++imageCacheClock;
+      return createImageSurface(data, pixelsWide, pixelsHigh,
+                                bitsPerPixel, bytesPerRow);
+    }
+
+  hash = hashImageData(data, (pixelsWide * bitsPerPixel + 7) / 8,
+                       pixelsHigh, bytesPerRow);
+  if (entry != NULL)
+    {
+      entry->lastUse = ++imageCacheClock;
+      if (entry->surface != NULL && entry->hash == hash)
+        {
+          entry->changes = 0;
+          return cairo_surface_reference(entry->surface);
+        }
+      if (entry->surface != NULL)
+        {
+          cairo_surface_destroy(entry->surface);
+          entry->surface = NULL;
+          imageCacheBytes -= entry->bytes;
+        }
+      entry->changes++;
+    }
+  else
+    {
+      entry = victim;
+      dropCachedImage(entry);
+      entry->data = data;
+      entry->width = pixelsWide;
+      entry->height = pixelsHigh;
+      entry->bitsPerPixel = bitsPerPixel;
+      entry->bytesPerRow = bytesPerRow;
+      entry->lastUse = ++imageCacheClock;
+    }
+
+  surface = createImageSurface(data, pixelsWide, pixelsHigh,
+                               bitsPerPixel, bytesPerRow);
+  if (surface == NULL || entry->changes >= 2)
+    {
+      return surface;
+    }
+
+  /* Make room, oldest first. */
+  while (imageCacheBytes + bytes > IMAGE_CACHE_MAX_BYTES)
+    {
+      image_cache_entry_t *oldest = NULL;
+
+      for (i = 0; i < IMAGE_CACHE_SIZE; i++)
+        {
+          if (imageCache[i].surface != NULL && &imageCache[i] != entry
+              && (oldest == NULL || imageCache[i].lastUse < oldest->lastUse))
+            {
+              oldest = &imageCache[i];
+            }
+        }
+      if (oldest == NULL)
+        {
+          break;
+        }
+      dropCachedImage(oldest);
+    }
+
+  entry->hash = hash;
+  entry->bytes = bytes;
+  entry->surface = cairo_surface_reference(surface);
+  imageCacheBytes += bytes;
+  return surface;
+}
+
+/* Returns a reference to an image surface for the data, from the cache if
+   it holds one for the same pixels, or NULL. */
+static cairo_surface_t *
+imageSurfaceForData(const unsigned char *data, NSInteger pixelsWide,
+                    NSInteger pixelsHigh, NSInteger bitsPerPixel,
+                    NSInteger bytesPerRow)
+{
+  cairo_surface_t *surface;
+
+  [imageCacheLock lock];
+  surface = cachedImageSurface(data, pixelsWide, pixelsHigh,
+                               bitsPerPixel, bytesPerRow);
+  [imageCacheLock unlock];
+  return surface;
+}
+
+
+/* Adds one element of an NSBezierPath to the current cairo path. */
+static inline void
+appendElement(cairo_t *ct, NSBezierPathElement type, const NSPoint *points)
+{
+  switch (type)
+    {
+      case NSMoveToBezierPathElement:
+        cairo_move_to(ct, points[0].x, points[0].y);
+        break;
+      case NSLineToBezierPathElement:
+        cairo_line_to(ct, points[0].x, points[0].y);
+        break;
+      case NSCurveToBezierPathElement:
+        cairo_curve_to(ct, points[0].x, points[0].y,
+                       points[1].x, points[1].y,
+                       points[2].x, points[2].y);
+        break;
+      case NSClosePathBezierPathElement:
+        cairo_close_path(ct);
+        break;
+      default:
+        break;
+    }
+}
 
 /* Emit a base-space bezier path onto a cairo context, resetting any current
  * path first.  Used to replay tracked clip paths onto a copied context. */
@@ -127,34 +444,208 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
     {
       NSPoint points[3];
 
-      switch ([bpath elementAtIndex: i associatedPoints: points])
+      appendElement(ct, [bpath elementAtIndex: i associatedPoints: points],
+                    points);
+    }
+}
+
+/* Paths filled or clipped to again and again, such as those of icons and
+   controls, are kept flattened, so that cairo does not have to split their
+   curves into lines each time.  NSBezierPath keeps no count of its changes,
+   so a path is found by a hash of its elements, together with the cairo
+   matrix and tolerance the flattening depends on, and its elements are
+   compared with those kept.  A path is only kept once it is seen a second
+   time.  Strokes are not flattened, as that would change their joins along
+   the curves.  Gstates of all threads share the cache, so it is locked. */
+#define PATH_CACHE_SIZE 64
+#define PATH_CACHE_MAX_ELEMENTS 512     /* elements of a kept path */
+#define PATH_CACHE_MAX_DATA 4096        /* cairo_path_data_t of a kept path */
+#define PATH_CACHE_REPORT 1000          /* lookups between hit rate reports */
+
+typedef struct {
+  NSBezierPathElement type;
+  NSPoint points[3];
+} path_element_t;
+
+typedef struct {
+  uint64_t hash;
+  NSInteger count;
+  path_element_t *elements;
+  cairo_matrix_t matrix;
+  double tolerance;
+  cairo_path_t *flat;           /* NULL until the path is seen again */
+  unsigned uses;
+  unsigned long lastUse;
+} path_cache_entry_t;
+
+static path_cache_entry_t pathCache[PATH_CACHE_SIZE];
+static unsigned long pathCacheClock = 0;
+static unsigned long pathCacheLookups = 0;
+static unsigned long pathCacheHits = 0;
+static NSLock *pathCacheLock = nil;
+
+/* The number of points that go with an element. */
+static inline int
+pointsOfElement(NSBezierPathElement type)
+{
+  switch (type)
+    {
+      case NSMoveToBezierPathElement:
+      case NSLineToBezierPathElement:
+        return 1;
+      case NSCurveToBezierPathElement:
+        return 3;
+      default:
+        return 0;
+    }
+}
+
+static uint64_t
+hashPathElements(const path_element_t *elements, NSInteger count)
+{
+  uint64_t hash = 0x27d4eb2f165667c5ULL;
+  NSInteger i;
+
+  for (i = 0; i < count; i++)
+    {
+      int n = pointsOfElement(elements[i].type);
+      int j;
+
+      hash = hashRound(hash, (uint64_t)elements[i].type);
+      for (j = 0; j < n; j++)
         {
-          case NSMoveToBezierPathElement:
-            cairo_move_to(ct, points[0].x, points[0].y);
-            break;
-          case NSLineToBezierPathElement:
-            cairo_line_to(ct, points[0].x, points[0].y);
-            break;
-          case NSCurveToBezierPathElement:
-            cairo_curve_to(ct, points[0].x, points[0].y,
-                           points[1].x, points[1].y,
-                           points[2].x, points[2].y);
-            break;
-          case NSClosePathBezierPathElement:
-            cairo_close_path(ct);
-            break;
-          default:
-            break;
+          double x = elements[i].points[j].x;
+          double y = elements[i].points[j].y;
+          uint64_t w;
+
+          memcpy(&w, &x, sizeof(w));
+          hash = hashRound(hash, w);
+          memcpy(&w, &y, sizeof(w));
+          hash = hashRound(hash, w);
         }
     }
+  return hashRound(hash, (uint64_t)count);
 }
 
+/* Compares the elements, leaving out the points that don't go with them. */
+static BOOL
+samePathElements(const path_element_t *a, const path_element_t *b,
+                 NSInteger count)
+{
+  NSInteger i;
+
+  for (i = 0; i < count; i++)
+    {
+      int n = pointsOfElement(a[i].type);
+      int j;
+
+      if (a[i].type != b[i].type)
+        {
+          return NO;
+        }
+      for (j = 0; j < n; j++)
+        {
+          if (a[i].points[j].x != b[i].points[j].x
+              || a[i].points[j].y != b[i].points[j].y)
+            {
+              return NO;
+            }
+        }
+    }
+  return YES;
+}
+
+/* Finds the entry for a path drawn with the matrix and tolerance of ct,
+   making one in place of the least recently used if there is none, or
+   returns NULL if one can't be made.  The caller holds pathCacheLock. */
+static path_cache_entry_t *
+pathCacheEntry(cairo_t *ct, const path_element_t *elements, uint64_t hash,
+               NSInteger count)
+{
+  path_cache_entry_t *victim = &pathCache[0];
+  path_cache_entry_t *entry = NULL;
+  cairo_matrix_t matrix;
+  double tolerance;
+  int i;
+
+  cairo_get_matrix(ct, &matrix);
+  tolerance = cairo_get_tolerance(ct);
+  pathCacheClock++;
+  for (i = 0; i < PATH_CACHE_SIZE; i++)
+    {
+      path_cache_entry_t *e = &pathCache[i];
+
+      if (e->uses > 0 && e->hash == hash && e->count == count
+          && e->tolerance == tolerance
+          && memcmp(&e->matrix, &matrix, sizeof(matrix)) == 0
+          && samePathElements(e->elements, elements, count))
+        {
+          entry = e;
+          break;
+        }
+      if (e->lastUse < victim->lastUse)
+        {
+          victim = e;
+        }
+    }
+
+  if (entry == NULL)
+    {
+      path_element_t *copy;
+
+      copy = malloc(count * sizeof(path_element_t));
+      if (copy == NULL)
+        {
+          return NULL;
+        }
+      memcpy(copy, elements, count * sizeof(path_element_t));
+
+      entry = victim;
+      if (entry->flat != NULL)
+        {
+          cairo_path_destroy(entry->flat);
+        }
+      free(entry->elements);
+      entry->elements = copy;
+      entry->hash = hash;
+      entry->count = count;
+      entry->matrix = matrix;
+      entry->tolerance = tolerance;
+      entry->flat = NULL;
+      entry->uses = 0;
+    }
+  entry->uses++;
+  entry->lastUse = pathCacheClock;
+
+  pathCacheLookups++;
+  if (entry->flat != NULL)
+    {
+      pathCacheHits++;
+    }
+  if (pathCacheLookups == PATH_CACHE_REPORT)
+    {
+      NSDebugLLog(@"CairoPathCache", @"Path cache hits: %lu of %lu",
+                  pathCacheHits, pathCacheLookups);
+      pathCacheLookups = 0;
+      pathCacheHits = 0;
+    }
+  return entry;
+}
+
+@interface CairoGState (Private)
+- (void) _willDrawBox: (double)x1 : (double)y1 : (double)x2 : (double)y2
+            replacing: (BOOL)replacing;
+- (void) _willPaint: (BOOL)replacing;
+@end
+
 @implementation CairoGState
 
 + (void) initialize
 {
   if (self == [CairoGState class])
     {
+      imageCacheLock = [NSLock new];
+      pathCacheLock = [NSLock new];
     }
 }
 
@@ -419,12 +910,26 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
       cairo_matrix_translate(&local_matrix, 0,  -[_surface size].height);
       cairo_transform(_ct, &local_matrix);
 
+      [self _willShowText: s];
       cairo_show_text(_ct, s);
 
       cairo_restore(_ct);
     }
 }
 
+/* Tells the surface where text drawn at the current point lands. */
+- (void) _willShowText: (const char *)s
+{
+  cairo_text_extents_t te;
+  double x, y;
+
+  cairo_text_extents(_ct, s, &te);
+  cairo_get_current_point(_ct, &x, &y);
+  [self _willDrawBox: x + te.x_bearing : y + te.y_bearing
+                    : x + te.x_bearing + te.width : y + te.y_bearing + te.height
+           replacing: NO];
+}
+
 - (void) GSSetFont: (GSFontInfo *)fontref
 {
   [super GSSetFont: fontref];
@@ -458,11 +963,32 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
       [self _setPoint];
       memcpy(chars, string, length);
       chars[length] = 0;
+      [self _willShowText: chars];
       cairo_show_text(_ct, chars);
       GS_ENDITEMBUF();
     }
 }
 
+- (void) GSShowGlyphs: (const NSGlyph *)glyphs : (size_t) length
+{
+  /* Measure the run at once rather than glyph by glyph, which also fills
+     the font's metrics cache for the whole run. */
+  if (length && [font isKindOfClass: [CairoFontInfo class]])
+    {
+      GS_BEGINITEMBUF(advances, length, NSSize);
+
+      [(CairoFontInfo *)font getAdvancements: advances
+                                   forGlyphs: glyphs
+                                       count: length];
+      [self GSShowGlyphsWithAdvances: glyphs : advances : length];
+      GS_ENDITEMBUF();
+    }
+  else
+    {
+      [super GSShowGlyphs: glyphs : length];
+    }
+}
+
 - (void) GSShowGlyphsWithAdvances: (const NSGlyph *)glyphs : (const NSSize *)advances : (size_t) length
 {
   // FIXME: this method should just be a call to cairo_show_glyphs
@@ -489,6 +1015,22 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
       cairo_matrix_translate(&local_matrix, 0,  -[_surface size].height);
       cairo_transform(_ct, &local_matrix);
 
+      if (font != nil)
+        {
+          cairo_text_extents_t te;
+          double x, y;
+
+          /* Measured as drawn, so rotated and sheared fonts are covered. */
+          [(CairoFontInfo *)font getExtents: &te
+                                   ofGlyphs: glyphs
+                                     length: length
+                                         on: _ct];
+          cairo_get_current_point(_ct, &x, &y);
+          [self _willDrawBox: x + te.x_bearing : y + te.y_bearing
+                            : x + te.x_bearing + te.width
+                            : y + te.y_bearing + te.height
+                   replacing: NO];
+        }
       [(CairoFontInfo *)font drawGlyphs: glyphs
 				 length: length
 				     on: _ct];
@@ -704,7 +1246,9 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
  * Path operations
  */
 
-- (void) _setPath
+/* Sets the current path in cairo.  When flatten is YES the path may be
+   set flattened, from the path cache. */
+- (void) _setPath: (BOOL)flatten
 {
   NSInteger count = [path elementCount];
   NSInteger i;
@@ -714,35 +1258,82 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
 
   // reset current cairo path
   cairo_new_path(_ct);
-  for (i = 0; i < count; i++) 
+  if (flatten && count > 0 && count <= PATH_CACHE_MAX_ELEMENTS)
     {
-      NSBezierPathElement type;
-      NSPoint points[3];
+      path_cache_entry_t *entry = NULL;
+      BOOL curves = NO;
+      GS_BEGINITEMBUF(elements, count, path_element_t);
+
+      for (i = 0; i < count; i++)
+        {
+          elements[i].type = (NSBezierPathElement)(*elmidx)(path, elmsel, i,
+                                                           elements[i].points);
+          if (elements[i].type == NSCurveToBezierPathElement)
+            {
+              curves = YES;
+            }
+        }
 
-      type = (NSBezierPathElement)(*elmidx)(path, elmsel, i, points);
-      switch(type) 
+      /* Without curves there is nothing to save, so the cache is left
+         alone.  The kept path is used and made with the lock held, as
+         another thread may replace it. */
+      if (curves)
         {
-          case NSMoveToBezierPathElement:
-            cairo_move_to(_ct, points[0].x, points[0].y);
-            break;
-          case NSLineToBezierPathElement:
-            cairo_line_to(_ct, points[0].x, points[0].y);
-            break;
-          case NSCurveToBezierPathElement:
-            cairo_curve_to(_ct, points[0].x, points[0].y, 
-                           points[1].x, points[1].y, 
-                           points[2].x, points[2].y);
-            break;
-          case NSClosePathBezierPathElement:
-            cairo_close_path(_ct);
-            break;
-          default:
-            break;
+          [pathCacheLock lock];
+          entry = pathCacheEntry(_ct, elements,
+                                 hashPathElements(elements, count), count);
+        }
+
+      if (entry != NULL && entry->flat != NULL)
+        {
+          cairo_append_path(_ct, entry->flat);
+        }
+      else
+        {
+          for (i = 0; i < count; i++)
+            {
+              appendElement(_ct, elements[i].type, elements[i].points);
+            }
+          if (entry != NULL && entry->uses == 2)
+            {
+              cairo_path_t *flat = cairo_copy_path_flat(_ct);
+
+              if (flat->status == CAIRO_STATUS_SUCCESS
+                  && flat->num_data <= PATH_CACHE_MAX_DATA)
+                {
+                  entry->flat = flat;
+                }
+              else
+                {
+                  cairo_path_destroy(flat);
+                }
+            }
+        }
+      if (curves)
+        {
+          [pathCacheLock unlock];
+        }
+      GS_ENDITEMBUF();
+    }
+  else
+    {
+      for (i = 0; i < count; i++)
+        {
+          NSBezierPathElement type;
+          NSPoint points[3];
+
+          type = (NSBezierPathElement)(*elmidx)(path, elmsel, i, points);
+          appendElement(_ct, type, points);
         }
     }
   cairo_set_antialias(_ct, [self shouldAntialias] ? CAIRO_ANTIALIAS_DEFAULT : CAIRO_ANTIALIAS_NONE);
 }
 
+- (void) _setPath
+{
+  [self _setPath: NO];
+}
+
 /* Remember the path just intersected with the clip so a gstate copy can
  * reproduce it exactly.  cairo only exposes its clip as a user-space rectangle
  * list, which cannot represent a non-rectangular clip, so tracking the paths
@@ -765,7 +1356,7 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
 {
   if (_ct)
     {
-      [self _setPath];
+      [self _setPath: YES];
       cairo_clip(_ct);
       [self _trackClipPath: NSNonZeroWindingRule];
      }
@@ -775,7 +1366,7 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
 {
   if (_ct)
     {
-      [self _setPath];
+      [self _setPath: YES];
       cairo_set_fill_rule(_ct, CAIRO_FILL_RULE_EVEN_ODD);
       cairo_clip(_ct);
       cairo_set_fill_rule(_ct, CAIRO_FILL_RULE_WINDING);
@@ -783,9 +1374,104 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
     }
 }
 
+/* Whether the clip is a single rectangle of user space. */
+- (BOOL) _clipIsRectangle
+{
+  cairo_rectangle_list_t *rects;
+  BOOL flag;
+
+  rects = cairo_copy_clip_rectangle_list(_ct);
+  flag = (rects->status == CAIRO_STATUS_SUCCESS && rects->num_rectangles == 1);
+  cairo_rectangle_list_destroy(rects);
+  return flag;
+}
+
+/* Tells the surface which of its pixels the drawing about to be done may
+ * change: those within the box from x1, y1 to x2, y2 in the current user
+ * space and within the clip.  The operators that also clear what lies
+ * outside the drawing keep only to the clip.  Unless the drawing replaces
+ * the whole box, the box is grown by a pixel to allow for hinted text.
+ */
+- (void) _willDrawBox: (double)x1 : (double)y1 : (double)x2 : (double)y2
+            replacing: (BOOL)replacing
+{
+  double cx1, cy1, cx2, cy2;
+  double px[4], py[4];
+  double minX, minY, maxX, maxY;
+  double ox, oy;
+  int i;
+
+  if (_surface == nil)
+    {
+      return;
+    }
+
+  cairo_clip_extents(_ct, &cx1, &cy1, &cx2, &cy2);
+  switch (cairo_get_operator(_ct))
+    {
+      case CAIRO_OPERATOR_IN:
+      case CAIRO_OPERATOR_OUT:
+      case CAIRO_OPERATOR_DEST_IN:
+      case CAIRO_OPERATOR_DEST_ATOP:
+        x1 = cx1;
+        y1 = cy1;
+        x2 = cx2;
+        y2 = cy2;
+        break;
+      default:
+        x1 = MAX(x1, cx1);
+        y1 = MAX(y1, cy1);
+        x2 = MIN(x2, cx2);
+        y2 = MIN(y2, cy2);
+        break;
+    }
+  if (x1 >= x2 || y1 >= y2)
+    {
+      return;
+    }
+
+  px[0] = x1; py[0] = y1;
+  px[1] = x2; py[1] = y1;
+  px[2] = x1; py[2] = y2;
+  px[3] = x2; py[3] = y2;
+  for (i = 0; i < 4; i++)
+    {
+      cairo_user_to_device(_ct, &px[i], &py[i]);
+    }
+  minX = maxX = px[0];
+  minY = maxY = py[0];
+  for (i = 1; i < 4; i++)
+    {
+      minX = MIN(minX, px[i]);
+      maxX = MAX(maxX, px[i]);
+      minY = MIN(minY, py[i]);
+      maxY = MAX(maxY, py[i]);
+    }
+  if (!replacing)
+    {
+      minX -= 1;
+      minY -= 1;
+      maxX += 1;
+      maxY += 1;
+    }
+
+  cairo_surface_get_device_offset([_surface surface], &ox, &oy);
+  [_surface willDrawRect: NSMakeRect(minX + ox, minY + oy,
+                                     maxX - minX, maxY - minY)
+               replacing: replacing];
+}
+
+/* The same for a paint, which keeps only to the clip. */
+- (void) _willPaint: (BOOL)replacing
+{
+  [self _willDrawBox: -HUGE_VAL : -HUGE_VAL : HUGE_VAL : HUGE_VAL
+           replacing: replacing];
+}
+
 - (void) _paintPath: (ctxt_object_t)drawType
 {
   device_color_t c;
+  double x1, y1, x2, y2;
 
   if (_ct == NULL)
     return;
@@ -794,16 +1480,20 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
   gsColorToRGB(&c);
   // The underlying concept does not allow to determine if alpha is set or not.
   cairo_set_source_rgba(_ct, c.field[0], c.field[1], c.field[2], c.field[AINDEX]);
-  [self _setPath];
+  [self _setPath: (drawType != path_stroke)];
 
   switch (drawType)
     {
       case path_eofill:
         cairo_set_fill_rule(_ct, CAIRO_FILL_RULE_EVEN_ODD);
+        cairo_fill_extents(_ct, &x1, &y1, &x2, &y2);
+        [self _willDrawBox: x1 : y1 : x2 : y2 replacing: NO];
         cairo_fill(_ct);
         cairo_set_fill_rule(_ct, CAIRO_FILL_RULE_WINDING);
         break;
       case path_fill:
+        cairo_fill_extents(_ct, &x1, &y1, &x2, &y2);
+        [self _willDrawBox: x1 : y1 : x2 : y2 replacing: NO];
         cairo_fill(_ct);
         break;
       case path_stroke:
@@ -823,6 +1513,8 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
               zeroLineWidth = YES;
             }
 
+          cairo_stroke_extents(_ct, &x1, &y1, &x2, &y2);
+          [self _willDrawBox: x1 : y1 : x2 : y2 replacing: NO];
           cairo_stroke(_ct);
 
           if (zeroLineWidth)
@@ -903,14 +1595,13 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
   int dataSize;
   NSMutableData *data;
   unsigned char *dataBytes;
-  uint32_t *dataPixel;
-  int pixelCounter;
 
   if (!_ct)
     {
       return nil;
     }
 
+  [_surface willRead];
   r = [ctm rectInMatrixSpace: r];
   x = NSWidth(r);
   y = NSHeight(r);
@@ -978,25 +1669,7 @@ appendBezierToCairo(cairo_t *ct, NSBezierPath *bpath)
   cairo_destroy(ct);
   cairo_surface_destroy(isurface);
 
-  dataPixel = (uint32_t *) dataBytes;
-  
-  pixelCounter = ix * iy;
-
-  while (pixelCounter--)
-    {
-#if GS_WORDS_BIGENDIAN
-        // ARGB -> RGBA
-      *dataPixel = (*dataPixel << 8)        // ARGB -> RGB_
-                    | (*dataPixel >> 24);   // ARGB -> ___A
-#else
-        // ARGB -> ABGR
-      *dataPixel = ((*dataPixel & 0x000000FF) << 16)    // ___B -> _B__
-                    | ((*dataPixel & 0x00FF0000) >> 16) // _R__ -> ___R
-                    | (*dataPixel & 0xFF00FF00);        // A_G_ -> A_G_
-#endif
-
-      dataPixel++; 
-    }
+  GSCairoARGB32ToRGBA((uint32_t *) dataBytes, dataBytes, ix * iy);
 
   [dict setObject: data forKey: @"Data"];
 
@@ -1075,14 +1748,9 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
 		 : (BOOL)hasAlpha : (NSString *)colorSpaceName
 		 : (const unsigned char *const[5])data
 {
-  cairo_format_t format;
   NSAffineTransformStruct tstruct;
   cairo_surface_t *surface;
-  unsigned char *dataRow, *reformattedData;
-  int reformattedDataSize, rowCounter, columnCounter;
-  uint32_t *reformattedDataPixel;
   cairo_matrix_t local_matrix;
-  cairo_status_t status;
 
   if (!_ct)
     {
@@ -1113,100 +1781,10 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
   while ((bytesPerRow * 8) < (bitsPerPixel * pixelsWide))
     bytesPerRow++;
 
-  reformattedDataSize = pixelsWide * pixelsHigh * sizeof(*reformattedDataPixel);
-
-  switch (bitsPerPixel)
-    {
-    case 32:
-      reformattedData = malloc(reformattedDataSize);
-      if (!reformattedData)
-        {
-          NSLog(@"Could not allocate drawing space for image");
-          return;
-        }
-
-      dataRow = (unsigned char *)data[0];
-      reformattedDataPixel = (uint32_t *) reformattedData;
-
-      rowCounter = pixelsHigh;
-
-      while (rowCounter--)
-        {
-          uint32_t *dataPixel = (uint32_t *) dataRow;
-
-          columnCounter = pixelsWide;
-
-          while (columnCounter--)
-            {
-#if GS_WORDS_BIGENDIAN
-                // RGBA (uint32) -> ARGB (uint32)
-              *reformattedDataPixel++ = (*dataPixel >> 8)       // RGBA -> _RGB
-                                        | (*dataPixel << 24);   // RGBA -> A___
-#else
-                // ABGR (uint32) -> ARGB (uint32)
-              *reformattedDataPixel++ = ((*dataPixel & 0x000000FF) << 16)   // ___R -> _R__
-                                        | ((*dataPixel & 0x00FF0000) >> 16) // _B__ -> ___B
-                                        | (*dataPixel & 0xFF00FF00);        // A_G_ -> A_G_
-#endif 
-              dataPixel++;
-            }
-
-          dataRow += bytesPerRow;
-        }
-      format = CAIRO_FORMAT_ARGB32;
-      break;
-    case 24:
-      reformattedData = malloc(reformattedDataSize);
-      if (!reformattedData)
-        {
-          NSLog(@"Could not allocate drawing space for image");
-          return;
-        }
-
-      dataRow = (unsigned char *)data[0];
-      reformattedDataPixel = (uint32_t *) reformattedData;
-
-      rowCounter = pixelsHigh;
-
-      while (rowCounter--)
-        {
-          unsigned char *dataPixelComponent = dataRow;
-
-          columnCounter = pixelsWide;
-
-          while (columnCounter--)
-            {
-                // R,G,B (uchar[0-2]) -> _RGB (uint32)
-              *reformattedDataPixel++ = (((uint32_t) dataPixelComponent[0]) << 16)  // R -> _R__
-                                        | (((uint32_t) dataPixelComponent[1]) << 8) // G -> __G_
-                                        | ((uint32_t) dataPixelComponent[2]);       // B -> ___B
-
-              dataPixelComponent += 3;
-            }
-
-          dataRow += bytesPerRow;
-        }
-      format = CAIRO_FORMAT_RGB24;
-      break;
-    default:
-      NSLog(@"Image format not support");
-      return;
-    }
-
-  surface = cairo_image_surface_create_for_data((void*)reformattedData,
-						format,
-						pixelsWide,
-						pixelsHigh,
-						pixelsWide * sizeof(*reformattedDataPixel));
-  status = cairo_surface_status(surface);
-  if (status != CAIRO_STATUS_SUCCESS)
+  surface = imageSurfaceForData(data[0], pixelsWide, pixelsHigh,
+                                bitsPerPixel, bytesPerRow);
+  if (surface == NULL)
     {
-      NSLog(@"Cairo status '%s' in DPSimage", cairo_status_to_string(status));
-      if (reformattedData)
-        {
-          free(reformattedData);
-        }
-
       return;
     }
 
@@ -1249,15 +1827,12 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
   }
  
   cairo_clip(_ct);
+  /* The image replaces what is under it, so a clip it fills is all new. */
+  [self _willPaint: [self _clipIsRectangle]];
   cairo_paint(_ct);
   //[self drawOrientationMarkersIn: _ct];
   cairo_surface_destroy(surface);
   cairo_restore(_ct);
-
-  if (reformattedData)
-    {
-      free(reformattedData);
-    }
 }
 
 #if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 12, 0)
@@ -1380,6 +1955,7 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
     {
       NSBezierPath *oldPath = path;
       device_color_t c;
+      BOOL replacing = NO;
 
       cairo_save(_ct);
 
@@ -1398,6 +1974,8 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
           gsColorToRGB(&c);
           // The underlying concept does not allow to determine if alpha is set or not.
           cairo_set_source_rgba(_ct, c.field[0], c.field[1], c.field[2], c.field[AINDEX]);
+          replacing = (op == NSCompositeCopy || op == NSCompositeClear
+            || (op == NSCompositeSourceOver && c.field[AINDEX] >= 1.0));
         }
 
       // This is almost a rectclip::::, but the path stays unchanged.
@@ -1405,6 +1983,7 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
       [path transformUsingAffineTransform: ctm];
       [self _setPath];
       cairo_clip(_ct);
+      [self _willPaint: replacing && [self _clipIsRectangle]];
 #if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 12, 0)
       if (NSCompositePlusDarker == op && [self _plusDarkerRect: aRect] == YES)
         {
@@ -1460,6 +2039,7 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
     }
 
   //NSLog(@"Composite surface %p source size %@ target size %@", self->_surface, NSStringFromSize([self->_surface size]), NSStringFromSize([source->_surface size]));
+  [source->_surface willRead];
   src = cairo_get_target(source->_ct);
   copyOnSelf = (src == cairo_get_target(_ct));
   srcRectAltOrigin = NSMakePoint(srcRect.origin.x, srcRect.origin.y + srcRect.size.height);
@@ -1543,6 +2123,7 @@ _set_op(cairo_t *ct, NSCompositingOperation op)
   cairo_pattern_destroy(cpattern);
   cairo_rectangle(_ct, x, y, width, height);
   cairo_clip(_ct);
+  [self _willPaint: NO];
 
   if (delta < 1.0)
     {
@@ -1590,6 +2171,7 @@ doesn't support to use the receiver cairo target as the source. */
       return;
     }
 
+  [source->_surface willRead];
   src = cairo_get_target(source->_ct);
 
   cairo_save(_ct);
@@ -1640,6 +2222,7 @@ doesn't support to use the receiver cairo target as the source. */
   cairo_pattern_destroy(cpattern);
   cairo_rectangle(_ct, aRect.origin.x, aRect.origin.y, width, height);
   cairo_clip(_ct);
+  [self _willPaint: NO];
 
   if (delta < 1.0)
     {
@@ -1784,6 +2367,7 @@ doesn't support to use the receiver cairo target as the source. */
       cairo_save(_ct);
       cairo_set_source(_ct, cpattern);
       cairo_pattern_destroy(cpattern);
+      [self _willPaint: NO];
       cairo_paint(_ct);
       cairo_restore(_ct);
     }
@@ -1848,6 +2432,7 @@ doesn't support to use the receiver cairo target as the source. */
       cairo_save(_ct);
       cairo_set_source(_ct, cpattern);
       cairo_pattern_destroy(cpattern);
+      [self _willPaint: NO];
       cairo_paint(_ct);
       cairo_restore(_ct);
     }
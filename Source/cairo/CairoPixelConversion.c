@@ -0,0 +1,483 @@
+/*
+   CairoPixelConversion.c
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+Conversions between the pixel layouts of NSBitmapImageRep and cairo; see
+CairoPixelConversion.h.
+
+The plain C versions build everywhere and work on bytes and shifts, so they
+don't depend on the byte order. The vectorized versions are for x86, which
+is little endian: there an ARGB32 word is the bytes B, G, R, A and RGBA to
+ARGB32 is a swap of the first and third byte of each pixel. They are picked
+the first time a conversion is asked for, from what the CPU supports, and
+must give the same results as the plain versions, bit for bit;
+Tests/cairo/pixelconversion.m checks this.
+*/
+
+#include "cairo/CairoPixelConversion.h"
+#include <pthread.h>
+
+/* c * a / 255, rounded to the nearest, without a division. */
+#define MUL255(c, a) \
+  ((((c) * (a) + 128) + (((c) * (a) + 128) >> 8)) >> 8)
+
+/* 2^24 / a, rounded up, for the divisions by alpha: (n * recip[a]) >> 24
+   is n / a for any n below 2^16, which covers c * 255 + a / 2. */
+static uint32_t recip[256];
+
+static void
+setupRecip(void)
+{
+  int a;
+
+  recip[0] = 0;
+  for (a = 1; a < 256; a++)
+    {
+      recip[a] = (uint32_t)(((1ULL << 24) + a - 1) / a);
+    }
+}
+
+static inline unsigned
+unpremultiply(unsigned c, unsigned a)
+{
+  unsigned v = (unsigned)(((uint64_t)(c * 255 + a / 2) * recip[a]) >> 24);
+
+  return (v > 255) ? 255 : v;
+}
+
+
+/* The plain versions. */
+
+static void
+rgbaToARGB32C(const unsigned char *from, uint32_t *to, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, from += 4)
+    {
+      to[i] = ((uint32_t)from[3] << 24) | ((uint32_t)from[0] << 16)
+	| ((uint32_t)from[1] << 8) | (uint32_t)from[2];
+    }
+}
+
+static void
+argb32ToRGBAC(const uint32_t *from, unsigned char *to, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, to += 4)
+    {
+      uint32_t p = from[i];
+
+      to[0] = (unsigned char)(p >> 16);
+      to[1] = (unsigned char)(p >> 8);
+      to[2] = (unsigned char)p;
+      to[3] = (unsigned char)(p >> 24);
+    }
+}
+
+static void
+rgbToRGB24C(const unsigned char *from, uint32_t *to, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, from += 3)
+    {
+      to[i] = ((uint32_t)from[0] << 16) | ((uint32_t)from[1] << 8)
+	| (uint32_t)from[2];
+    }
+}
+
+static void
+premultiplyRGBAToARGB32C(const unsigned char *from, uint32_t *to, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, from += 4)
+    {
+      unsigned a = from[3];
+
+      to[i] = ((uint32_t)a << 24) | ((uint32_t)MUL255(from[0], a) << 16)
+	| ((uint32_t)MUL255(from[1], a) << 8) | (uint32_t)MUL255(from[2], a);
+    }
+}
+
+static void
+unpremultiplyARGB32ToRGBAC(const uint32_t *from, unsigned char *to, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, to += 4)
+    {
+      uint32_t p = from[i];
+      unsigned a = p >> 24;
+
+      if (a == 255)
+	{
+	  to[0] = (unsigned char)(p >> 16);
+	  to[1] = (unsigned char)(p >> 8);
+	  to[2] = (unsigned char)p;
+	}
+      else
+	{
+	  to[0] = unpremultiply((p >> 16) & 0xff, a);
+	  to[1] = unpremultiply((p >> 8) & 0xff, a);
+	  to[2] = unpremultiply(p & 0xff, a);
+	}
+      to[3] = (unsigned char)a;
+    }
+}
+
+
+static void (*rgbaToARGB32)(const unsigned char *, uint32_t *, int)
+  = rgbaToARGB32C;
+static void (*argb32ToRGBA)(const uint32_t *, unsigned char *, int)
+  = argb32ToRGBAC;
+static void (*rgbToRGB24)(const unsigned char *, uint32_t *, int)
+  = rgbToRGB24C;
+static void (*premultiplyRGBAToARGB32)(const unsigned char *, uint32_t *, int)
+  = premultiplyRGBAToARGB32C;
+static void (*unpremultiplyARGB32ToRGBA)(const uint32_t *, unsigned char *,
+  int) = unpremultiplyARGB32ToRGBAC;
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_SIMD 1
+
+#include <immintrin.h>
+
+/* SSE2: swapping red and blue takes shifts and masks. */
+
+static inline __attribute__((target("sse2"))) __m128i
+swapRB_sse2(__m128i v)
+{
+  __m128i rb = _mm_set1_epi32(0xff);
+
+  return _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32((int)0xff00ff00)),
+    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), rb),
+      _mm_slli_epi32(_mm_and_si128(v, rb), 16)));
+}
+
+static __attribute__((target("sse2"))) void
+swap4_sse2(const unsigned char *from, unsigned char *to, int wide)
+{
+  int i;
+
+  for (i = 0; i + 4 <= wide; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(from + 4 * i));
+
+      _mm_storeu_si128((__m128i *)(to + 4 * i), swapRB_sse2(v));
+    }
+  /* The same swap both ways, on a little endian machine. */
+  rgbaToARGB32C(from + 4 * i, (uint32_t *)(to + 4 * i), wide - i);
+}
+
+static __attribute__((target("sse2"))) void
+rgbaToARGB32_sse2(const unsigned char *from, uint32_t *to, int wide)
+{
+  swap4_sse2(from, (unsigned char *)to, wide);
+}
+
+static __attribute__((target("sse2"))) void
+argb32ToRGBA_sse2(const uint32_t *from, unsigned char *to, int wide)
+{
+  swap4_sse2((const unsigned char *)from, to, wide);
+}
+
+/* The colours of two RGBA pixels, widened to 16 bits, times their alpha. */
+static inline __attribute__((target("sse2"))) __m128i
+premultiply2_sse2(__m128i v)
+{
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+  __m128i t;
+
+  /* The alpha itself is multiplied by 255, which leaves it as it is. */
+  a = _mm_or_si128(a, _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+  t = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static __attribute__((target("sse2"))) void
+premultiplyRGBAToARGB32_sse2(const unsigned char *from, uint32_t *to, int wide)
+{
+  __m128i zero = _mm_setzero_si128();
+  int i;
+
+  for (i = 0; i + 4 <= wide; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(from + 4 * i));
+      __m128i lo = premultiply2_sse2(_mm_unpacklo_epi8(v, zero));
+      __m128i hi = premultiply2_sse2(_mm_unpackhi_epi8(v, zero));
+
+      _mm_storeu_si128((__m128i *)(to + i),
+	swapRB_sse2(_mm_packus_epi16(lo, hi)));
+    }
+  premultiplyRGBAToARGB32C(from + 4 * i, to + i, wide - i);
+}
+
+/* The divisions by alpha are done in single precision, which gives the
+   same quotients: below 256, where they matter, they are at least 1/255
+   away from the next integer, far more than the precision. The colours of
+   transparent pixels come out 0 as for the plain version. */
+static inline __attribute__((target("sse2"))) __m128i
+unpremultiply_sse2(__m128i c, __m128 alpha, __m128i half, __m128i zeroAlpha)
+{
+  __m128i n = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), half);
+  __m128i q = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(n), alpha));
+  __m128i big = _mm_cmpgt_epi32(q, _mm_set1_epi32(255));
+
+  q = _mm_or_si128(_mm_andnot_si128(big, q),
+    _mm_and_si128(big, _mm_set1_epi32(255)));
+  return _mm_andnot_si128(zeroAlpha, q);
+}
+
+static __attribute__((target("sse2"))) void
+unpremultiplyARGB32ToRGBA_sse2(const uint32_t *from, unsigned char *to,
+                               int wide)
+{
+  __m128i ff = _mm_set1_epi32(0xff);
+  int i;
+
+  for (i = 0; i + 4 <= wide; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(from + i));
+      __m128i a = _mm_srli_epi32(v, 24);
+      __m128 alpha = _mm_cvtepi32_ps(a);
+      __m128i half = _mm_srli_epi32(a, 1);
+      __m128i zeroAlpha = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+      __m128i r, g, b;
+
+      r = unpremultiply_sse2(_mm_and_si128(_mm_srli_epi32(v, 16), ff),
+	alpha, half, zeroAlpha);
+      g = unpremultiply_sse2(_mm_and_si128(_mm_srli_epi32(v, 8), ff),
+	alpha, half, zeroAlpha);
+      b = unpremultiply_sse2(_mm_and_si128(v, ff), alpha, half, zeroAlpha);
+      _mm_storeu_si128((__m128i *)(to + 4 * i),
+	_mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+	  _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24))));
+    }
+  unpremultiplyARGB32ToRGBAC(from + i, to + 4 * i, wide - i);
+}
+
+/* SSSE3: three byte pixels are spread out with a byte shuffle. Each load
+   takes 16 bytes for the 12 of four pixels, so the last pixels of a row are
+   done by the plain version. */
+
+static __attribute__((target("ssse3"))) void
+rgbToRGB24_ssse3(const unsigned char *from, uint32_t *to, int wide)
+{
+  __m128i spread = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+				 8, 7, 6, -1, 11, 10, 9, -1);
+  int i;
+
+  for (i = 0; 3 * i + 16 <= 3 * wide; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(from + 3 * i));
+
+      _mm_storeu_si128((__m128i *)(to + i), _mm_shuffle_epi8(v, spread));
+    }
+  rgbToRGB24C(from + 3 * i, to + i, wide - i);
+}
+
+/* AVX2: the same, eight pixels at a time. The byte shuffle works on each
+   128-bit half, which is all swapping red and blue needs. */
+
+static inline __attribute__((target("avx2"))) __m256i
+swapRB_avx2(__m256i v)
+{
+  __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+				  10, 9, 8, 11, 14, 13, 12, 15,
+				  2, 1, 0, 3, 6, 5, 4, 7,
+				  10, 9, 8, 11, 14, 13, 12, 15);
+
+  return _mm256_shuffle_epi8(v, swap);
+}
+
+static __attribute__((target("avx2"))) void
+swap4_avx2(const unsigned char *from, unsigned char *to, int wide)
+{
+  int i;
+
+  for (i = 0; i + 8 <= wide; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(from + 4 * i));
+
+      _mm256_storeu_si256((__m256i *)(to + 4 * i), swapRB_avx2(v));
+    }
+  rgbaToARGB32C(from + 4 * i, (uint32_t *)(to + 4 * i), wide - i);
+}
+
+static __attribute__((target("avx2"))) void
+rgbaToARGB32_avx2(const unsigned char *from, uint32_t *to, int wide)
+{
+  swap4_avx2(from, (unsigned char *)to, wide);
+}
+
+static __attribute__((target("avx2"))) void
+argb32ToRGBA_avx2(const uint32_t *from, unsigned char *to, int wide)
+{
+  swap4_avx2((const unsigned char *)from, to, wide);
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+premultiply2_avx2(__m256i v)
+{
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xff), 0xff);
+  __m256i t;
+
+  a = _mm256_or_si256(a, _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0,
+					  255, 0, 0, 0, 255, 0, 0, 0));
+  t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+static __attribute__((target("avx2"))) void
+premultiplyRGBAToARGB32_avx2(const unsigned char *from, uint32_t *to, int wide)
+{
+  __m256i zero = _mm256_setzero_si256();
+  int i;
+
+  for (i = 0; i + 8 <= wide; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(from + 4 * i));
+      __m256i lo = premultiply2_avx2(_mm256_unpacklo_epi8(v, zero));
+      __m256i hi = premultiply2_avx2(_mm256_unpackhi_epi8(v, zero));
+
+      _mm256_storeu_si256((__m256i *)(to + i),
+	swapRB_avx2(_mm256_packus_epi16(lo, hi)));
+    }
+  premultiplyRGBAToARGB32_sse2(from + 4 * i, to + i, wide - i);
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+unpremultiply_avx2(__m256i c, __m256 alpha, __m256i half, __m256i zeroAlpha)
+{
+  __m256i n = _mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(c, 8), c),
+    half);
+  __m256i q = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(n), alpha));
+
+  q = _mm256_min_epi32(q, _mm256_set1_epi32(255));
+  return _mm256_andnot_si256(zeroAlpha, q);
+}
+
+static __attribute__((target("avx2"))) void
+unpremultiplyARGB32ToRGBA_avx2(const uint32_t *from, unsigned char *to,
+                               int wide)
+{
+  __m256i ff = _mm256_set1_epi32(0xff);
+  int i;
+
+  for (i = 0; i + 8 <= wide; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(from + i));
+      __m256i a = _mm256_srli_epi32(v, 24);
+      __m256 alpha = _mm256_cvtepi32_ps(a);
+      __m256i half = _mm256_srli_epi32(a, 1);
+      __m256i zeroAlpha = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+      __m256i r, g, b;
+
+      r = unpremultiply_avx2(_mm256_and_si256(_mm256_srli_epi32(v, 16), ff),
+	alpha, half, zeroAlpha);
+      g = unpremultiply_avx2(_mm256_and_si256(_mm256_srli_epi32(v, 8), ff),
+	alpha, half, zeroAlpha);
+      b = unpremultiply_avx2(_mm256_and_si256(v, ff), alpha, half, zeroAlpha);
+      _mm256_storeu_si256((__m256i *)(to + 4 * i),
+	_mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+	  _mm256_or_si256(_mm256_slli_epi32(b, 16),
+	    _mm256_slli_epi32(a, 24))));
+    }
+  unpremultiplyARGB32ToRGBA_sse2(from + i, to + 4 * i, wide - i);
+}
+
+#endif
+
+
+/* The kernels and recip[] are set up once, whichever thread converts
+   first; drawing may happen on more than one. */
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+static void
+setupKernels(void)
+{
+  setupRecip();
+#ifdef PIXEL_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    {
+      rgbaToARGB32 = rgbaToARGB32_avx2;
+      argb32ToRGBA = argb32ToRGBA_avx2;
+      premultiplyRGBAToARGB32 = premultiplyRGBAToARGB32_avx2;
+      unpremultiplyARGB32ToRGBA = unpremultiplyARGB32ToRGBA_avx2;
+    }
+  else if (__builtin_cpu_supports("sse2"))
+    {
+      rgbaToARGB32 = rgbaToARGB32_sse2;
+      argb32ToRGBA = argb32ToRGBA_sse2;
+      premultiplyRGBAToARGB32 = premultiplyRGBAToARGB32_sse2;
+      unpremultiplyARGB32ToRGBA = unpremultiplyARGB32ToRGBA_sse2;
+    }
+  if (__builtin_cpu_supports("ssse3"))
+    {
+      rgbToRGB24 = rgbToRGB24_ssse3;
+    }
+#endif
+}
+
+void
+GSCairoRGBAToARGB32(const unsigned char *from, uint32_t *to, int wide)
+{
+  pthread_once(&kernelsOnce, setupKernels);
+  rgbaToARGB32(from, to, wide);
+}
+
+void
+GSCairoARGB32ToRGBA(const uint32_t *from, unsigned char *to, int wide)
+{
+  pthread_once(&kernelsOnce, setupKernels);
+  argb32ToRGBA(from, to, wide);
+}
+
+void
+GSCairoRGBToRGB24(const unsigned char *from, uint32_t *to, int wide)
+{
+  pthread_once(&kernelsOnce, setupKernels);
+  rgbToRGB24(from, to, wide);
+}
+
+void
+GSCairoPremultiplyRGBAToARGB32(const unsigned char *from, uint32_t *to,
+                               int wide)
+{
+  pthread_once(&kernelsOnce, setupKernels);
+  premultiplyRGBAToARGB32(from, to, wide);
+}
+
+void
+GSCairoUnpremultiplyARGB32ToRGBA(const uint32_t *from, unsigned char *to,
+                                 int wide)
+{
+  pthread_once(&kernelsOnce, setupKernels);
+  unpremultiplyARGB32ToRGBA(from, to, wide);
+}
@@ -69,10 +69,22 @@
 {
 }
 
+- (void) present
+{
+}
+
 - (void) flush
 {
 }
 
+- (void) willDrawRect: (NSRect)rect replacing: (BOOL)replacing
+{
+}
+
+- (void) willRead
+{
+}
+
 - (BOOL) isDrawingToScreen
 {
   return YES;
@@ -27,6 +27,7 @@
 #include "x11/XGServerWindow.h"
 #include "cairo/XGCairoModernSurface.h"
 #include <cairo-xlib.h>
+#include <math.h>
 
 #define GSWINDEVICE ((gswindow_device_t *)gsDevice)
 
@@ -78,6 +79,22 @@
       GSWINDEVICE->gdriverProtocol |= GDriverHandlesExpose | GDriverHandlesBacking;
       GSWINDEVICE->gdriver = self;
 
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 10, 0)
+      // The rects flushed during a frame are collected and copied to the
+      // window together when XGServer asks for it.
+      {
+	NSUserDefaults *defs = [NSUserDefaults standardUserDefaults];
+
+	_batched = ([defs objectForKey: @"XGCairoModernSurfaceBatchedPresent"]
+		    == nil
+		    || [defs boolForKey: @"XGCairoModernSurfaceBatchedPresent"]);
+	if (_batched)
+	  {
+	    GSWINDEVICE->gdriverProtocol |= GDriverBatchesExpose;
+	  }
+      }
+#endif
+
       _windowSurface = windowsurface;
       _surface = cairo_surface_create_similar(windowsurface,
 					      CAIRO_CONTENT_COLOR_ALPHA,
@@ -101,6 +118,12 @@
     {
       cairo_surface_destroy(_windowSurface);
     }
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 10, 0)
+  if (_pending != NULL)
+    {
+      cairo_region_destroy(_pending);
+    }
+#endif
   [super dealloc];
 }
 
@@ -109,6 +132,83 @@
   return GSWINDEVICE->xframe.size;
 }
 
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 10, 0)
+
+- (void) handleExposeRect: (NSRect)rect
+{
+  cairo_rectangle_int_t r;
+
+  // The whole pixels the rect touches
+  r.x = (int)floor(NSMinX(rect));
+  r.y = (int)floor(NSMinY(rect));
+  r.width = (int)ceil(NSMaxX(rect)) - r.x;
+  r.height = (int)ceil(NSMaxY(rect)) - r.y;
+  if (r.width <= 0 || r.height <= 0)
+    {
+      return;
+    }
+
+  if (_pending == NULL)
+    {
+      _pending = cairo_region_create();
+    }
+  cairo_region_union_rectangle(_pending, &r);
+
+  if (!_batched)
+    {
+      [self present];
+    }
+}
+
+- (void) present
+{
+  cairo_t *windowCtx;
+  double backupOffsetX, backupOffsetY;
+  int i;
+  int n;
+
+  if (_pending == NULL || cairo_region_is_empty(_pending))
+    {
+      return;
+    }
+
+  windowCtx = cairo_create(_windowSurface);
+
+  // Temporairly cancel the device offset on the back buffer since
+  // we want to work with raw X11 pixel coordinates
+
+  cairo_surface_get_device_offset(_surface, &backupOffsetX, &backupOffsetY);
+  cairo_surface_set_device_offset(_surface, 0, 0);
+
+  // Copy all the rects collected from the back buffer to the front
+  // buffer at once, through a clip made of them
+
+  n = cairo_region_num_rectangles(_pending);
+  for (i = 0; i < n; i++)
+    {
+      cairo_rectangle_int_t r;
+
+      cairo_region_get_rectangle(_pending, i, &r);
+      cairo_rectangle(windowCtx, r.x, r.y, r.width, r.height);
+    }
+  cairo_clip(windowCtx);
+  cairo_set_source_surface(windowCtx, _surface, 0, 0);
+  cairo_set_operator(windowCtx, CAIRO_OPERATOR_SOURCE);
+  cairo_paint(windowCtx);
+
+  NSDebugLLog(@"XGFlush", @"Presented %d rects with cairo. Status: '%s'",
+	      n, cairo_status_to_string(cairo_status(windowCtx)));
+
+  cairo_destroy(windowCtx);
+  cairo_region_destroy(_pending);
+  _pending = NULL;
+
+  // Restore device offset
+  cairo_surface_set_device_offset(_surface, backupOffsetX, backupOffsetY);
+}
+
+#else
+
 - (void) handleExposeRect: (NSRect)rect
 {
   cairo_t *windowCtx = cairo_create(_windowSurface);
@@ -144,5 +244,7 @@
   cairo_surface_set_device_offset(_surface, backupOffsetX, backupOffsetY);
 }
 
+#endif
+
 @end
 
@@ -0,0 +1,495 @@
+/*
+   FCFontCatalogue.m
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Foundation/NSArray.h>
+#include <Foundation/NSData.h>
+#include <Foundation/NSDebug.h>
+#include <Foundation/NSDictionary.h>
+#include <Foundation/NSFileManager.h>
+#include <Foundation/NSPathUtilities.h>
+#include <Foundation/NSValue.h>
+
+#define id fontconfig_id
+#include <fontconfig/fontconfig.h>
+#undef id
+#include "fontconfig/FCFontCatalogue.h"
+
+/*
+  The file is written in native byte order; the magic number doubles as a
+  byte order mark. All offsets are from the start of the file, except the
+  string offsets, which are from the start of the string table.
+*/
+#define CATALOGUE_MAGIC 0x47534643  /* "GSFC" */
+#define CATALOGUE_VERSION 1
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t fcVersion;
+  uint32_t fileSize;
+  uint64_t stamp;
+  uint32_t numFonts;
+  uint32_t numFamilies;
+  uint32_t hashSize;        /* a power of two */
+  uint32_t fontsOffset;
+  uint32_t familiesOffset;
+  uint32_t hashOffset;
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+} catalogue_header_t;
+
+typedef struct
+{
+  uint32_t name, style, family, pattern;
+  float weight;
+  uint32_t traits;
+} catalogue_font_t;
+
+typedef struct
+{
+  uint32_t name;
+  uint32_t first, count;
+} catalogue_family_t;
+
+struct FCFontCatalogue
+{
+  void *map;
+  size_t size;
+  const catalogue_header_t *header;
+  const catalogue_font_t *fonts;
+  const catalogue_family_t *families;
+  const uint32_t *hash;       /* font index + 1, 0 for a free slot */
+  const char *strings;
+};
+
+
+/* FNV-1a */
+static inline uint32_t
+hash_string(const char *s)
+{
+  uint32_t h = 2166136261u;
+
+  while (*s)
+    {
+      h ^= (unsigned char)*s++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static inline uint64_t
+stamp_bytes(uint64_t h, const void *data, size_t length)
+{
+  const unsigned char *p = data;
+
+  while (length--)
+    {
+      h ^= *p++;
+      h *= 1099511628211ull;
+    }
+  return h;
+}
+
+static uint64_t
+stamp_path(uint64_t h, const FcChar8 *path)
+{
+  struct stat st;
+
+  h = stamp_bytes(h, path, strlen((const char *)path) + 1);
+  if (stat((const char *)path, &st) == 0)
+    {
+      int64_t t[2];
+
+      t[0] = st.st_mtime;
+      t[1] = st.st_size;
+      h = stamp_bytes(h, t, sizeof(t));
+    }
+  return h;
+}
+
+static uint64_t
+stamp_list(uint64_t h, FcStrList *list)
+{
+  FcChar8 *path;
+
+  if (list == NULL)
+    return h;
+  while ((path = FcStrListNext(list)) != NULL)
+    {
+      h = stamp_path(h, path);
+    }
+  FcStrListDone(list);
+  return h;
+}
+
+uint64_t
+FCFontCatalogueStamp(void)
+{
+  uint64_t h = 14695981039346656037ull;
+  uint32_t v = FcGetVersion();
+  FcFontSet *appFonts;
+
+  h = stamp_bytes(h, &v, sizeof(v));
+  h = stamp_list(h, FcConfigGetConfigFiles(NULL));
+  /* fontconfig rescans a directory when its time changes, and the font
+     directories include all their subdirectories. */
+  h = stamp_list(h, FcConfigGetFontDirs(NULL));
+  h = stamp_list(h, FcConfigGetCacheDirs(NULL));
+
+  /* Fonts the application added are listed too. */
+  appFonts = FcConfigGetFonts(NULL, FcSetApplication);
+  if (appFonts != NULL)
+    {
+      int i;
+
+      for (i = 0; i < appFonts->nfont; i++)
+        {
+          FcChar8 *file;
+
+          if (FcPatternGetString(appFonts->fonts[i], FC_FILE, 0, &file)
+              == FcResultMatch)
+            {
+              h = stamp_path(h, file);
+            }
+        }
+    }
+  return h;
+}
+
+NSString *
+FCFontCataloguePath(void)
+{
+  NSArray *paths;
+
+  paths = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
+                                              NSUserDomainMask, YES);
+  if (paths == nil || [paths count] == 0)
+    {
+      return nil;
+    }
+  return [[paths objectAtIndex: 0] stringByAppendingPathComponent:
+            @"Caches/gnustep-back/FontCatalogue"];
+}
+
+
+FCFontCatalogue *
+FCFontCatalogueOpen(NSString *path, uint64_t stamp)
+{
+  FCFontCatalogue *cat;
+  const catalogue_header_t *h;
+  struct stat st;
+  void *map;
+  int fd;
+
+  if (path == nil)
+    return NULL;
+
+  fd = open([path fileSystemRepresentation], O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(catalogue_header_t)
+      || st.st_size > 0x7fffffff)
+    {
+      close(fd);
+      return NULL;
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  h = map;
+  if (h->magic != CATALOGUE_MAGIC || h->version != CATALOGUE_VERSION
+      || h->fcVersion != (uint32_t)FcGetVersion() || h->stamp != stamp
+      || h->fileSize != st.st_size
+      || (h->hashSize & (h->hashSize - 1)) || h->hashSize < h->numFonts
+      || h->fontsOffset % 4 || h->familiesOffset % 4 || h->hashOffset % 4
+      || h->fontsOffset > h->fileSize
+      || (h->fileSize - h->fontsOffset) / sizeof(catalogue_font_t)
+         < h->numFonts
+      || h->familiesOffset > h->fileSize
+      || (h->fileSize - h->familiesOffset) / sizeof(catalogue_family_t)
+         < h->numFamilies
+      || h->hashOffset > h->fileSize
+      || (h->fileSize - h->hashOffset) / sizeof(uint32_t) < h->hashSize
+      || h->stringsSize == 0 || h->stringsOffset > h->fileSize
+      || h->fileSize - h->stringsOffset < h->stringsSize
+      || ((const char *)map)[h->stringsOffset + h->stringsSize - 1] != 0)
+    {
+      NSDebugLLog(@"NSFont", @"Font catalogue %@ is out of date", path);
+      munmap(map, st.st_size);
+      return NULL;
+    }
+
+  cat = malloc(sizeof(FCFontCatalogue));
+  if (cat == NULL)
+    {
+      munmap(map, st.st_size);
+      return NULL;
+    }
+  cat->map = map;
+  cat->size = st.st_size;
+  cat->header = h;
+  cat->fonts = (const catalogue_font_t *)((char *)map + h->fontsOffset);
+  cat->families = (const catalogue_family_t *)((char *)map
+                                               + h->familiesOffset);
+  cat->hash = (const uint32_t *)((char *)map + h->hashOffset);
+  cat->strings = (const char *)map + h->stringsOffset;
+  return cat;
+}
+
+void
+FCFontCatalogueClose(FCFontCatalogue *catalogue)
+{
+  if (catalogue == NULL)
+    return;
+  munmap(catalogue->map, catalogue->size);
+  free(catalogue);
+}
+
+unsigned int
+FCFontCatalogueFontCount(FCFontCatalogue *catalogue)
+{
+  return catalogue->header->numFonts;
+}
+
+unsigned int
+FCFontCatalogueFamilyCount(FCFontCatalogue *catalogue)
+{
+  return catalogue->header->numFamilies;
+}
+
+/* The string table ends with a NUL, so any offset inside it is a
+   terminated string. */
+static inline const char *
+string_at(FCFontCatalogue *catalogue, uint32_t offset)
+{
+  if (offset >= catalogue->header->stringsSize)
+    return NULL;
+  return catalogue->strings + offset;
+}
+
+const char *
+FCFontCatalogueFamily(FCFontCatalogue *catalogue, unsigned int i,
+                      unsigned int *first, unsigned int *count)
+{
+  const catalogue_family_t *f;
+
+  if (i >= catalogue->header->numFamilies)
+    return NULL;
+  f = &catalogue->families[i];
+  if (f->first > catalogue->header->numFonts
+      || f->count > catalogue->header->numFonts - f->first)
+    return NULL;
+  *first = f->first;
+  *count = f->count;
+  return string_at(catalogue, f->name);
+}
+
+BOOL
+FCFontCatalogueFont(FCFontCatalogue *catalogue, unsigned int i,
+                    FCCatalogueFont *font)
+{
+  const catalogue_font_t *f;
+
+  if (i >= catalogue->header->numFonts)
+    return NO;
+  f = &catalogue->fonts[i];
+  font->name = string_at(catalogue, f->name);
+  font->style = string_at(catalogue, f->style);
+  font->family = string_at(catalogue, f->family);
+  font->pattern = string_at(catalogue, f->pattern);
+  font->weight = f->weight;
+  font->traits = f->traits;
+  return font->name && font->style && font->family && font->pattern;
+}
+
+int
+FCFontCatalogueLookup(FCFontCatalogue *catalogue, const char *name)
+{
+  uint32_t mask = catalogue->header->hashSize - 1;
+  uint32_t slot, n;
+
+  if (!catalogue->header->hashSize)
+    return -1;
+
+  for (slot = hash_string(name) & mask, n = 0; n <= mask;
+       slot = (slot + 1) & mask, n++)
+    {
+      uint32_t i = catalogue->hash[slot];
+      const char *s;
+
+      if (i == 0)
+        break;
+      i--;
+      if (i >= catalogue->header->numFonts)
+        break;
+      s = string_at(catalogue, catalogue->fonts[i].name);
+      if (s && strcmp(s, name) == 0)
+        return i;
+    }
+  return -1;
+}
+
+
+/* Appends s to the string table, sharing equal strings. */
+static uint32_t
+add_string(NSMutableData *strings, NSMutableDictionary *offsets, NSString *s)
+{
+  NSNumber *offset = [offsets objectForKey: s];
+  const char *utf8;
+
+  if (offset != nil)
+    return [offset unsignedIntValue];
+
+  offset = [NSNumber numberWithUnsignedInt: [strings length]];
+  utf8 = [s UTF8String];
+  [strings appendBytes: utf8 length: strlen(utf8) + 1];
+  [offsets setObject: offset forKey: s];
+  return [offset unsignedIntValue];
+}
+
+BOOL
+FCFontCatalogueWrite(NSString *path, uint64_t stamp,
+                     NSDictionary *families, NSDictionary *patterns)
+{
+  NSAutoreleasePool *arp = [NSAutoreleasePool new];
+  NSMutableData *fonts = [NSMutableData data];
+  NSMutableData *fams = [NSMutableData data];
+  NSMutableData *strings = [NSMutableData data];
+  NSMutableDictionary *offsets = [NSMutableDictionary dictionary];
+  NSMutableData *file;
+  NSEnumerator *e;
+  NSString *familyName;
+  catalogue_header_t header;
+  uint32_t *hash;
+  uint32_t numFonts = 0, hashSize = 1, i;
+  BOOL ok;
+
+  if (path == nil)
+    {
+      [arp release];
+      return NO;
+    }
+
+  /* Offset 0 is the empty string. */
+  [strings appendBytes: "" length: 1];
+
+  e = [families keyEnumerator];
+  while ((familyName = [e nextObject]) != nil)
+    {
+      NSArray *members = [families objectForKey: familyName];
+      catalogue_family_t family;
+      unsigned int j;
+
+      family.name = add_string(strings, offsets, familyName);
+      family.first = numFonts;
+      family.count = 0;
+      for (j = 0; j < [members count]; j++)
+        {
+          NSArray *fa = [members objectAtIndex: j];
+          NSString *name = [fa objectAtIndex: 0];
+          NSString *pattern = [patterns objectForKey: name];
+          catalogue_font_t font;
+
+          if (pattern == nil)
+            continue;
+          font.name = add_string(strings, offsets, name);
+          font.style = add_string(strings, offsets, [fa objectAtIndex: 1]);
+          font.family = family.name;
+          font.pattern = add_string(strings, offsets, pattern);
+          font.weight = [[fa objectAtIndex: 2] floatValue];
+          font.traits = [[fa objectAtIndex: 3] unsignedIntValue];
+          [fonts appendBytes: &font length: sizeof(font)];
+          family.count++;
+          numFonts++;
+        }
+      [fams appendBytes: &family length: sizeof(family)];
+    }
+
+  /* At most half full, so probe sequences stay short. */
+  while (hashSize < numFonts * 2)
+    hashSize *= 2;
+  hash = calloc(hashSize, sizeof(uint32_t));
+  if (hash == NULL)
+    {
+      [arp release];
+      return NO;
+    }
+  for (i = 0; i < numFonts; i++)
+    {
+      const catalogue_font_t *f = (const catalogue_font_t *)[fonts bytes] + i;
+      uint32_t slot;
+
+      slot = hash_string((const char *)[strings bytes] + f->name)
+        & (hashSize - 1);
+      while (hash[slot])
+        slot = (slot + 1) & (hashSize - 1);
+      hash[slot] = i + 1;
+    }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = CATALOGUE_MAGIC;
+  header.version = CATALOGUE_VERSION;
+  header.fcVersion = FcGetVersion();
+  header.stamp = stamp;
+  header.numFonts = numFonts;
+  header.numFamilies = [fams length] / sizeof(catalogue_family_t);
+  header.hashSize = hashSize;
+  header.fontsOffset = sizeof(header);
+  header.familiesOffset = header.fontsOffset + [fonts length];
+  header.hashOffset = header.familiesOffset + [fams length];
+  header.stringsOffset = header.hashOffset + hashSize * sizeof(uint32_t);
+  header.stringsSize = [strings length];
+  header.fileSize = header.stringsOffset + header.stringsSize;
+
+  file = [NSMutableData dataWithCapacity: header.fileSize];
+  [file appendBytes: &header length: sizeof(header)];
+  [file appendData: fonts];
+  [file appendData: fams];
+  [file appendBytes: hash length: hashSize * sizeof(uint32_t)];
+  [file appendData: strings];
+  free(hash);
+
+  [[NSFileManager defaultManager]
+    createDirectoryAtPath: [path stringByDeletingLastPathComponent]
+    withIntermediateDirectories: YES
+    attributes: nil
+    error: NULL];
+  /* Written to a temporary file and renamed, so a running application that
+     has the old catalogue mapped keeps seeing it whole. */
+  ok = [file writeToFile: path atomically: YES];
+  NSDebugLLog(@"NSFont", @"Wrote font catalogue %@ with %u fonts: %@",
+              path, numFonts, ok ? @"ok" : @"failed");
+  [arp release];
+  return ok;
+}
@@ -28,6 +28,8 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <stdlib.h>
+
 #include <Foundation/NSObject.h>
 #include <Foundation/NSArray.h>
 #include <Foundation/NSSet.h>
@@ -38,6 +40,8 @@
 #include <Foundation/NSUserDefaults.h>
 #include <Foundation/NSBundle.h>
 #include <Foundation/NSDebug.h>
+#include <Foundation/NSException.h>
+#include <Foundation/NSLock.h>
 #include <GNUstepGUI/GSFontInfo.h>
 #include <AppKit/NSAffineTransform.h>
 #include <AppKit/NSBezierPath.h>
@@ -46,6 +50,7 @@
 #include "gsc/GSGState.h"
 #include "fontconfig/FCFontEnumerator.h"
 #include "fontconfig/FCFontInfo.h"
+#include "fontconfig/FCFontCatalogue.h"
 
 // Old versions of fontconfig don't have FC_WEIGHT_ULTRABLACK defined.
 // Use the maximal value instead.
@@ -134,15 +139,107 @@ sortFontFacesArray(id fontArr1, id fontArr2, void *context)
   return [style1 compare: style2];
 }
 
+/* The result of a match: the descriptors of the sorted fonts, which are
+   only created when they are asked for. */
+@interface FontconfigDescriptorArray : NSArray
+{
+  FcFontSet *_fontSet;
+  id *_descriptors;
+}
+- (id) initWithFontSet: (FcFontSet *)fontSet;
+@end
+
 @implementation FCFontEnumerator 
 
 NSMutableDictionary * __allFonts;
 
+/* The names in allFontNames, for quick membership tests. */
+static NSSet *fontNameSet;
+
+/* When the fonts come from the catalogue, their faces are only created
+   when they are first used. */
+static FCFontCatalogue *catalogue;
+static Class catalogueFaceClass;
+
+/* Fonts may be looked up from any thread, and a lookup may add a face to
+   __allFonts, so lookups hold this lock. */
+static NSLock *allFontsLock;
+
+/* The results of -matchingFontDescriptorsFor:, keyed by the attributes
+   that were matched, and those keys in order of use, oldest first. */
+static NSMutableDictionary *matchCache;
+static NSMutableArray *matchCacheOrder;
+static NSUInteger matchCacheSize;
+static FcConfig *matchCacheConfig;
+static NSLock *matchCacheLock;
+
+/* Called with allFontsLock held. */
+static FCFaceInfo *
+faceFromCatalogue(NSString *name)
+{
+  FCCatalogueFont font;
+  FCFaceInfo *face;
+  FcPattern *pat;
+  int i;
+
+  i = FCFontCatalogueLookup(catalogue, [name UTF8String]);
+  if (i < 0 || !FCFontCatalogueFont(catalogue, i, &font))
+    {
+      return nil;
+    }
+  pat = FcNameParse((const FcChar8 *)font.pattern);
+  if (pat == NULL)
+    {
+      return nil;
+    }
+  face = [[catalogueFaceClass alloc]
+           initWithfamilyName: [NSString stringWithUTF8String: font.family]
+                       weight: font.weight
+                       traits: font.traits
+                      pattern: pat];
+  FcPatternDestroy(pat);
+  if (face != nil)
+    {
+      [__allFonts setObject: face forKey: name];
+      RELEASE(face);
+    }
+  return face;
+}
+
++ (void) initialize
+{
+  if (self == [FCFontEnumerator class])
+    {
+      NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
+
+      if ([ud objectForKey: @"GSFontMatchCacheSize"] != nil)
+	{
+	  NSInteger size = [ud integerForKey: @"GSFontMatchCacheSize"];
+
+	  matchCacheSize = (size > 0) ? size : 0;
+	}
+      else
+	{
+	  matchCacheSize = 32;
+	}
+      matchCache = [NSMutableDictionary new];
+      matchCacheOrder = [NSMutableArray new];
+      matchCacheLock = [NSLock new];
+      allFontsLock = [NSLock new];
+    }
+}
+
 + (FCFaceInfo *) fontWithName: (NSString *) name
 {
   FCFaceInfo *face;
 
+  [allFontsLock lock];
   face = [__allFonts objectForKey: name];
+  if (!face && catalogue)
+    {
+      face = faceFromCatalogue(name);
+    }
+  [allFontsLock unlock];
   if (!face)
     {
       NSDebugLLog(@"NSFont", @"Font not found %@", name);
@@ -345,13 +442,99 @@ static NSArray *faFromFc(FcPattern *pat)
 		  nil];
 }
 
+/* Fills in the font names and families from the catalogue. */
+static BOOL
+readCatalogue(NSMutableArray *names, NSMutableDictionary *families)
+{
+  unsigned int i, n = FCFontCatalogueFamilyCount(catalogue);
+
+  for (i = 0; i < n; i++)
+    {
+      NSMutableArray *familyArray;
+      const char *family;
+      unsigned int first, count, j;
+
+      family = FCFontCatalogueFamily(catalogue, i, &first, &count);
+      if (family == NULL)
+        {
+          return NO;
+        }
+      familyArray = [[NSMutableArray alloc] initWithCapacity: count];
+      [families setObject: familyArray
+                   forKey: [NSString stringWithUTF8String: family]];
+      RELEASE(familyArray);
+
+      for (j = first; j < first + count; j++)
+        {
+          FCCatalogueFont font;
+          NSString *name;
+
+          if (!FCFontCatalogueFont(catalogue, j, &font))
+            {
+              return NO;
+            }
+          name = [NSString stringWithUTF8String: font.name];
+          [familyArray addObject:
+            [NSArray arrayWithObjects: name,
+                     [NSString stringWithUTF8String: font.style],
+                     [NSNumber numberWithFloat: font.weight],
+                     [NSNumber numberWithUnsignedInt: font.traits],
+                     nil]];
+          [names addObject: name];
+        }
+    }
+  return YES;
+}
+
 - (void) enumerateFontsAndFamilies
 {
   int i;
   NSMutableDictionary *fcxft_allFontFamilies = [NSMutableDictionary new];
   NSMutableDictionary *fcxft_allFonts = [NSMutableDictionary new];
   NSMutableArray *fcxft_allFontNames = [NSMutableArray new];
+  NSMutableSet *fcxft_fontNameSet;
+  NSMutableDictionary *patterns = nil;
   Class faceInfoClass = [[self class] faceInfoClass];
+  NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
+  NSString *cataloguePath = nil;
+  uint64_t stamp = 0;
+
+  /* Lookups on other threads may be reading the old catalogue. */
+  [allFontsLock lock];
+  FCFontCatalogueClose(catalogue);
+  catalogue = NULL;
+  [allFontsLock unlock];
+  catalogueFaceClass = faceInfoClass;
+
+  if ([ud objectForKey: @"GSFontCatalogue"] == nil
+      || [ud boolForKey: @"GSFontCatalogue"])
+    {
+      cataloguePath = FCFontCataloguePath();
+      stamp = FCFontCatalogueStamp();
+      catalogue = FCFontCatalogueOpen(cataloguePath, stamp);
+      if (catalogue != NULL)
+        {
+          if (readCatalogue(fcxft_allFontNames, fcxft_allFontFamilies))
+            {
+              NSDebugLLog(@"NSFont", @"Read %u fonts from the catalogue",
+                          FCFontCatalogueFontCount(catalogue));
+              allFontNames = fcxft_allFontNames;
+              allFontFamilies = fcxft_allFontFamilies;
+              __allFonts = fcxft_allFonts;
+              ASSIGN(fontNameSet, [NSSet setWithArray: allFontNames]);
+              return;
+            }
+          [allFontsLock lock];
+          FCFontCatalogueClose(catalogue);
+          catalogue = NULL;
+          [allFontsLock unlock];
+          [fcxft_allFontNames removeAllObjects];
+          [fcxft_allFontFamilies removeAllObjects];
+        }
+      patterns = [NSMutableDictionary dictionary];
+    }
+
+  fcxft_fontNameSet = [NSMutableSet set];
 
   FcPattern *pat = FcPatternCreate();
   FcObjectSet *os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FULLNAME,
@@ -378,7 +561,7 @@ static NSArray *faFromFc(FcPattern *pat)
             {
               NSString *name = [fontArray objectAtIndex: 0];
 
-              if (![fcxft_allFontNames containsObject: name])
+              if (![fcxft_fontNameSet containsObject: name])
                 {
                   NSString *familyString;
                   NSMutableArray *familyArray;
@@ -399,6 +582,24 @@ static NSArray *faFromFc(FcPattern *pat)
                   NSDebugLLog(@"NSFont", @"fc enumerator: adding font: %@", name);
                   [familyArray addObject: fontArray];
                   [fcxft_allFontNames addObject: name];
+                  [fcxft_fontNameSet addObject: name];
+                  if (patterns != nil)
+                    {
+                      FcChar8 *unparsed = FcNameUnparse(fs->fonts[i]);
+
+                      if (unparsed != NULL)
+                        {
+                          [patterns setObject: [NSString stringWithUTF8String:
+                                                  (const char *)unparsed]
+                                       forKey: name];
+                          free(unparsed);
+                        }
+                      else
+                        {
+                          /* A catalogue without this font would hide it. */
+                          patterns = nil;
+                        }
+                    }
                   aFont = [[faceInfoClass alloc] initWithfamilyName: familyString
                               weight: [[fontArray objectAtIndex: 2] floatValue]
                               traits: [[fontArray objectAtIndex: 3] unsignedIntValue]
@@ -414,6 +615,7 @@ static NSArray *faFromFc(FcPattern *pat)
   allFontNames = fcxft_allFontNames;
   allFontFamilies = fcxft_allFontFamilies;
   __allFonts = fcxft_allFonts;
+  ASSIGN(fontNameSet, fcxft_fontNameSet);
 
   // Sort font families
   {
@@ -426,6 +628,11 @@ static NSArray *faFromFc(FcPattern *pat)
         [[allFontFamilies objectForKey: key] sortUsingFunction: fontSort context: NULL];
       }
   }
+
+  if (patterns != nil)
+    {
+      FCFontCatalogueWrite(cataloguePath, stamp, allFontFamilies, patterns);
+    }
 }
 
 /* Return the first of names that was enumerated (and is therefore usable on
@@ -438,7 +645,7 @@ static NSArray *faFromFc(FcPattern *pat)
 
   while ((name = [e nextObject]) != nil)
     {
-      if ([allFontNames containsObject: name])
+      if ([fontNameSet containsObject: name])
         {
           return name;
         }
@@ -511,7 +718,7 @@ fcDefaultFontName(FcPattern *pat)
                        (char *)NULL);
   name = fcDefaultFontName(pat);
   FcPatternDestroy(pat);
-  if (name != nil && [allFontNames containsObject: name])
+  if (name != nil && [fontNameSet containsObject: name])
     {
       return name;
     }
@@ -535,7 +742,7 @@ fcDefaultFontName(FcPattern *pat)
 
   name = fcDefaultFontName(pat);
   FcPatternDestroy(pat);
-  if (name != nil && [allFontNames containsObject: name])
+  if (name != nil && [fontNameSet containsObject: name])
     {
       return name;
     }
@@ -547,19 +754,34 @@ fcDefaultFontName(FcPattern *pat)
                              fallback: @"Courier"];
 }
 
-/**
- * Overrides the implementation in GSFontInfo, and delegates the
- * matching to Fontconfig.
- */
-- (NSArray *) matchingFontDescriptorsFor: (NSDictionary *)attributes
+/* The keys of a font attributes dictionary that FontconfigPatternGenerator
+   looks at. Matches are cached by these alone. */
+static NSArray *
+matchKeys(void)
 {
-  NSMutableArray *descriptors;
+  static NSArray *keys = nil;
+
+  if (keys == nil)
+    {
+      keys = [[NSArray alloc] initWithObjects: NSFontNameAttribute,
+                              NSFontVisibleNameAttribute,
+                              NSFontFamilyAttribute,
+                              NSFontFaceAttribute,
+                              NSFontTraitsAttribute,
+                              NSFontSizeAttribute,
+                              NSFontCharacterSetAttribute,
+                              nil];
+    }
+  return keys;
+}
+
+- (NSArray *) _matchingFontDescriptorsFor: (NSDictionary *)attributes
+{
+  NSArray *descriptors = nil;
   FcResult result;
   FcPattern *matchedpat, *pat;
   FontconfigPatternGenerator *generator;
 
-  descriptors = [NSMutableArray array];
-
   generator = [[FontconfigPatternGenerator alloc] init];
   pat = [generator createPatternWithAttributes: attributes];
   DESTROY(generator);
@@ -579,28 +801,103 @@ fcDefaultFontName(FcPattern *pat)
       fontSet = FcFontSort(NULL, matchedpat, FcFalse, NULL, &result);
       if (result == FcResultMatch)
 	{
-	  int i;
-	  for (i=0; i<fontSet->nfont; i++)
-	    {
-	      FontconfigPatternParser *parser = [[FontconfigPatternParser alloc] init];
-	      // FIXME: do we need to match this pattern?
-	      FcPattern *matchingpat = fontSet->fonts[i];
-	      NSDictionary *attribs = [parser attributesFromPattern: matchingpat];
-	      [parser release];
-
-	      [descriptors addObject: [NSFontDescriptor fontDescriptorWithFontAttributes: attribs]];
-	    }
+	  // The array takes over the font set.
+	  descriptors = [[FontconfigDescriptorArray alloc]
+			  initWithFontSet: fontSet];
+	  AUTORELEASE(descriptors);
 	}
       else
 	{
 	  NSLog(@"ERROR! FcFontSort failed");
+	  FcFontSetDestroy(fontSet);
 	}
 
-      FcFontSetDestroy(fontSet);
       FcPatternDestroy(matchedpat);
     }
   
   FcPatternDestroy(pat);
+  return (descriptors != nil) ? descriptors : [NSArray array];
+}
+
+/**
+ * Overrides the implementation in GSFontInfo, and delegates the
+ * matching to Fontconfig.
+ * The last GSFontMatchCacheSize results are kept, so that asking again
+ * for the same attributes, as font fallback during layout does, doesn't
+ * sort all fonts again. The descriptors in a result are only created as
+ * they are used, since callers rarely look past the first few.
+ */
+- (NSArray *) matchingFontDescriptorsFor: (NSDictionary *)attributes
+{
+  NSMutableDictionary *key;
+  NSEnumerator *e;
+  NSString *k;
+  NSArray *descriptors;
+  FcConfig *config;
+
+  if (matchCacheSize == 0)
+    {
+      return [self _matchingFontDescriptorsFor: attributes];
+    }
+
+  key = [NSMutableDictionary dictionaryWithCapacity: 8];
+  e = [matchKeys() objectEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      id value = [attributes objectForKey: k];
+
+      if (value != nil)
+	{
+	  [key setObject: value forKey: k];
+	}
+    }
+
+  /* fontconfig has no generation count, but a new configuration (after
+     FcInitReinitialize() or FcConfigSetCurrent()) is a new object. */
+  config = FcConfigGetCurrent();
+
+  [matchCacheLock lock];
+  if (config != matchCacheConfig)
+    {
+      [matchCache removeAllObjects];
+      [matchCacheOrder removeAllObjects];
+      matchCacheConfig = config;
+    }
+  descriptors = [matchCache objectForKey: key];
+  if (descriptors != nil)
+    {
+      RETAIN(descriptors);
+      NSDebugLLog(@"FCFontMatch", @"match cache hit for %@", key);
+      if (![[matchCacheOrder lastObject] isEqual: key])
+	{
+	  NSUInteger i = [matchCacheOrder indexOfObject: key];
+
+	  k = RETAIN([matchCacheOrder objectAtIndex: i]);
+	  [matchCacheOrder removeObjectAtIndex: i];
+	  [matchCacheOrder addObject: k];
+	  RELEASE(k);
+	}
+      [matchCacheLock unlock];
+      return AUTORELEASE(descriptors);
+    }
+  [matchCacheLock unlock];
+
+  descriptors = [self _matchingFontDescriptorsFor: key];
+
+  [matchCacheLock lock];
+  if (config == matchCacheConfig && [matchCache objectForKey: key] == nil)
+    {
+      key = [key copy];
+      while ([matchCacheOrder count] >= matchCacheSize)
+	{
+	  [matchCache removeObjectForKey: [matchCacheOrder objectAtIndex: 0]];
+	  [matchCacheOrder removeObjectAtIndex: 0];
+	}
+      [matchCache setObject: descriptors forKey: key];
+      [matchCacheOrder addObject: key];
+      RELEASE(key);
+    }
+  [matchCacheLock unlock];
   return descriptors;
 }
 
@@ -1151,3 +1448,80 @@ fcDefaultFontName(FcPattern *pat)
 
 @end
 
+
+@implementation FontconfigDescriptorArray
+
+- (id) initWithFontSet: (FcFontSet *)fontSet
+{
+  if ((self = [super init]))
+    {
+      _fontSet = fontSet;
+      _descriptors = calloc(fontSet->nfont > 0 ? fontSet->nfont : 1,
+			    sizeof(id));
+      if (_descriptors == NULL)
+	{
+	  DESTROY(self);
+	}
+    }
+  else
+    {
+      FcFontSetDestroy(fontSet);
+    }
+  return self;
+}
+
+- (void) dealloc
+{
+  if (_descriptors != NULL)
+    {
+      int i;
+
+      for (i = 0; i < _fontSet->nfont; i++)
+	{
+	  RELEASE(_descriptors[i]);
+	}
+      free(_descriptors);
+    }
+  if (_fontSet != NULL)
+    {
+      FcFontSetDestroy(_fontSet);
+    }
+  [super dealloc];
+}
+
+- (NSUInteger) count
+{
+  return _fontSet->nfont;
+}
+
+- (id) objectAtIndex: (NSUInteger)index
+{
+  id descriptor;
+
+  if (index >= (NSUInteger)_fontSet->nfont)
+    {
+      [NSException raise: NSRangeException
+		  format: @"Index %lu out of bounds (%d) in %@",
+		   (unsigned long)index, _fontSet->nfont, NSStringFromSelector(_cmd)];
+    }
+
+  /* Cached results are shared between threads. */
+  [matchCacheLock lock];
+  descriptor = _descriptors[index];
+  if (descriptor == nil)
+    {
+      FontconfigPatternParser *parser;
+      NSDictionary *attribs;
+
+      parser = [[FontconfigPatternParser alloc] init];
+      // FIXME: do we need to match this pattern?
+      attribs = [parser attributesFromPattern: _fontSet->fonts[index]];
+      descriptor = [NSFontDescriptor fontDescriptorWithFontAttributes: attribs];
+      _descriptors[index] = RETAIN(descriptor);
+      [parser release];
+    }
+  [matchCacheLock unlock];
+  return descriptor;
+}
+
+@end
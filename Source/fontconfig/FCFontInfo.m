@@ -39,24 +39,20 @@
 - (void) setCacheSize: (unsigned int)size
 {
   _cacheSize = size;
-  if (_cachedSizes)
-    {
-      free(_cachedSizes);
-    }
-  if (_cachedGlyphs)
-    {
-      free(_cachedGlyphs);
-    }
-  _cachedSizes = malloc(sizeof(NSSize) * size);
-  if (_cachedSizes)
-    {
-      memset(_cachedSizes, 0, sizeof(NSSize) * size);
-    }
-  _cachedGlyphs = malloc(sizeof(unsigned int) * size);
-  if (_cachedGlyphs)
-    {
-      memset(_cachedGlyphs, 0, sizeof(unsigned int) * size);
-    }
+  GSGlyphMetricsCacheRelease(_metrics);
+
+  /* The size asked for is a minimum; the user may want larger caches. */
+  if (size < GSGlyphMetricsCacheDefaultSize())
+    size = GSGlyphMetricsCacheDefaultSize();
+
+  /* Instances of the same class with the same font name and matrix have
+     the same metrics, so they share a cache. */
+  _metrics = GSGlyphMetricsCacheForKey(
+    [NSString stringWithFormat: @"%@ %@ %.17g %.17g %.17g %.17g %.17g %.17g %d",
+              NSStringFromClass([self class]), fontName,
+              matrix[0], matrix[1], matrix[2],
+              matrix[3], matrix[4], matrix[5], _screenFont],
+    size);
 }
 
 - (BOOL) setupAttributes
@@ -119,10 +115,7 @@
 - (void) dealloc
 {
   RELEASE(_faceInfo);
-  if (_cachedSizes)
-    free(_cachedSizes);
-  if (_cachedGlyphs)
-    free(_cachedGlyphs);
+  GSGlyphMetricsCacheRelease(_metrics);
   [super dealloc];
 }
 
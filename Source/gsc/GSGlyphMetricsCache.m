@@ -0,0 +1,316 @@
+/*
+   GSGlyphMetricsCache - glyph metrics cache shared by font instances
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of GNUstep.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; see the file COPYING.LIB.
+   If not, see <http://www.gnu.org/licenses/> or write to the
+   Free Software Foundation, 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Foundation/NSDebug.h>
+#include <Foundation/NSLock.h>
+#include <Foundation/NSMapTable.h>
+#include <Foundation/NSString.h>
+#include <Foundation/NSUserDefaults.h>
+#include "gsc/GSGlyphMetricsCache.h"
+
+#define WAYS 4
+
+#define HAS_ADVANCEMENT 1
+#define HAS_BOUNDING_RECT 2
+
+typedef struct
+{
+  NSGlyph glyph;
+  unsigned int flags; /* 0 for an unused entry */
+  NSSize advancement;
+  NSRect boundingRect;
+} entry_t;
+
+struct GSGlyphMetricsCache_s
+{
+  NSString *key;
+  unsigned int refs;
+
+  /* Lookups reorder the sets, so they are locked as well as updates. */
+  NSLock *lock;
+
+  unsigned int setMask; /* number of sets - 1 */
+  entry_t *entries;     /* WAYS entries per set, most recently used first */
+
+  unsigned long hits, misses;
+};
+
+static pthread_once_t cachesOnce = PTHREAD_ONCE_INIT;
+static NSLock *cachesLock;
+static NSMapTable *caches;
+
+/* Counts of the caches that have been freed. */
+static unsigned long freedHits, freedMisses;
+
+
+unsigned int
+GSGlyphMetricsCacheDefaultSize(void)
+{
+  static unsigned int size = 0;
+
+  if (!size)
+    {
+      NSInteger s = [[NSUserDefaults standardUserDefaults]
+                      integerForKey: @"GSGlyphMetricsCacheSize"];
+
+      size = (s > 0) ? s : 1024;
+    }
+  return size;
+}
+
+/* Fonts may first be made on any thread, so this is done only once. */
+static void
+createCaches(void)
+{
+  cachesLock = [NSLock new];
+  caches = NSCreateMapTable(NSObjectMapKeyCallBacks,
+                            NSNonOwnedPointerMapValueCallBacks, 16);
+}
+
+GSGlyphMetricsCache *
+GSGlyphMetricsCacheForKey(NSString *key, unsigned int size)
+{
+  GSGlyphMetricsCache *cache;
+
+  pthread_once(&cachesOnce, createCaches);
+  [cachesLock lock];
+  cache = NSMapGet(caches, key);
+  if (cache)
+    {
+      cache->refs++;
+      [cachesLock unlock];
+      return cache;
+    }
+
+  cache = malloc(sizeof(GSGlyphMetricsCache));
+  if (cache)
+    {
+      unsigned int sets = 1;
+
+      while (sets * WAYS < size)
+        sets *= 2;
+
+      cache->entries = calloc(sets * WAYS, sizeof(entry_t));
+      if (!cache->entries)
+        {
+          free(cache);
+          cache = NULL;
+        }
+      else
+        {
+          cache->key = [key copy];
+          cache->lock = [NSLock new];
+          cache->refs = 1;
+          cache->setMask = sets - 1;
+          cache->hits = cache->misses = 0;
+          NSMapInsert(caches, cache->key, cache);
+        }
+    }
+  [cachesLock unlock];
+  return cache;
+}
+
+void
+GSGlyphMetricsCacheRelease(GSGlyphMetricsCache *cache)
+{
+  if (!cache)
+    return;
+
+  [cachesLock lock];
+  if (--cache->refs)
+    {
+      [cachesLock unlock];
+      return;
+    }
+
+  NSDebugLLog(@"GSGlyphMetricsCache", @"%@: %lu hits, %lu misses",
+              cache->key, cache->hits, cache->misses);
+  freedHits += cache->hits;
+  freedMisses += cache->misses;
+  NSMapRemove(caches, cache->key);
+  [cachesLock unlock];
+
+  RELEASE(cache->key);
+  RELEASE(cache->lock);
+  free(cache->entries);
+  free(cache);
+}
+
+
+static inline entry_t *
+set_for_glyph(GSGlyphMetricsCache *cache, NSGlyph glyph)
+{
+  /* Glyphs that are used together tend to have neighbouring numbers, so
+     this spreads them over all sets. */
+  return cache->entries + (glyph & cache->setMask) * WAYS;
+}
+
+/* Finds glyph in its set and moves it to the front of the set.  The caller
+   holds the cache's lock. */
+static inline entry_t *
+find(GSGlyphMetricsCache *cache, NSGlyph glyph)
+{
+  entry_t *set = set_for_glyph(cache, glyph);
+  int i;
+
+  for (i = 0; i < WAYS && set[i].flags; i++)
+    {
+      if (set[i].glyph == glyph)
+        {
+          if (i)
+            {
+              entry_t e = set[i];
+
+              memmove(set + 1, set, i * sizeof(entry_t));
+              set[0] = e;
+            }
+          return set;
+        }
+    }
+  return NULL;
+}
+
+/* Like find(), but makes an entry for glyph, replacing the least recently
+   used one, if it isn't there yet. */
+static entry_t *
+find_or_add(GSGlyphMetricsCache *cache, NSGlyph glyph)
+{
+  entry_t *set;
+
+  if ((set = find(cache, glyph)))
+    return set;
+
+  set = set_for_glyph(cache, glyph);
+  memmove(set + 1, set, (WAYS - 1) * sizeof(entry_t));
+  set[0].glyph = glyph;
+  set[0].flags = 0;
+  return set;
+}
+
+BOOL
+GSGlyphMetricsCacheGetAdvancement(GSGlyphMetricsCache *cache,
+                                  NSGlyph glyph, NSSize *advancement)
+{
+  entry_t *e;
+  BOOL found = NO;
+
+  [cache->lock lock];
+  e = find(cache, glyph);
+  if (e && (e->flags & HAS_ADVANCEMENT))
+    {
+      cache->hits++;
+      *advancement = e->advancement;
+      found = YES;
+    }
+  else
+    cache->misses++;
+  [cache->lock unlock];
+  return found;
+}
+
+BOOL
+GSGlyphMetricsCacheGetBoundingRect(GSGlyphMetricsCache *cache,
+                                   NSGlyph glyph, NSRect *rect)
+{
+  entry_t *e;
+  BOOL found = NO;
+
+  [cache->lock lock];
+  e = find(cache, glyph);
+  if (e && (e->flags & HAS_BOUNDING_RECT))
+    {
+      cache->hits++;
+      *rect = e->boundingRect;
+      found = YES;
+    }
+  else
+    cache->misses++;
+  [cache->lock unlock];
+  return found;
+}
+
+void
+GSGlyphMetricsCacheSetAdvancement(GSGlyphMetricsCache *cache,
+                                  NSGlyph glyph, NSSize advancement)
+{
+  entry_t *e;
+
+  [cache->lock lock];
+  e = find_or_add(cache, glyph);
+  e->advancement = advancement;
+  e->flags |= HAS_ADVANCEMENT;
+  [cache->lock unlock];
+}
+
+void
+GSGlyphMetricsCacheSetBoundingRect(GSGlyphMetricsCache *cache,
+                                   NSGlyph glyph, NSRect rect)
+{
+  entry_t *e;
+
+  [cache->lock lock];
+  e = find_or_add(cache, glyph);
+  e->boundingRect = rect;
+  e->flags |= HAS_BOUNDING_RECT;
+  [cache->lock unlock];
+}
+
+void
+GSGlyphMetricsCacheGetStatistics(GSGlyphMetricsCache *cache,
+                                 unsigned long *hits, unsigned long *misses)
+{
+  if (cache)
+    {
+      [cache->lock lock];
+      *hits = cache->hits;
+      *misses = cache->misses;
+      [cache->lock unlock];
+      return;
+    }
+
+  *hits = *misses = 0;
+  pthread_once(&cachesOnce, createCaches);
+  [cachesLock lock];
+  {
+    NSMapEnumerator en = NSEnumerateMapTable(caches);
+    void *k;
+    GSGlyphMetricsCache *c;
+
+    while (NSNextMapEnumeratorPair(&en, &k, (void **)&c))
+      {
+        [c->lock lock];
+        *hits += c->hits;
+        *misses += c->misses;
+        [c->lock unlock];
+      }
+    NSEndMapTableEnumeration(&en);
+  }
+  *hits += freedHits;
+  *misses += freedMisses;
+  [cachesLock unlock];
+}
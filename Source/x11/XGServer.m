@@ -76,6 +76,9 @@ terminate(int sig)
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
 #endif
+#ifdef HAVE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -301,41 +304,9 @@ _parse_display_name(NSString *name, int *dn, int *sn)
 
 - (void) dealloc
 {
-#if USE_WRASTER && !defined(HAVE_WRASTER_H)
-  // FIXME: context.c does not include a clean up function for Rcontext,
-  // so we try do it here.
-
-  /*
-  Note that this can be done only when we use our own version of wraster.
-  If we're using an external version of wraster, the rcontext structure
-  might be different (different fields, or differently used fields), which
-  breaks this code.
-  */
-  
-  if (rcontext)
-    {
-      XFreeGC(rcontext->dpy, rcontext->copy_gc);
-      if (rcontext->drawable)
-        {
-          XDestroyWindow(rcontext->dpy, rcontext->drawable);
-        }
-      if (rcontext->pixels)
-        {
-          free(rcontext->pixels);
-        }
-      if (rcontext->colors)
-        {
-          free(rcontext->colors);
-        }
-      if (rcontext->hermes_data)
-        {
-          free(rcontext->hermes_data);
-        }
-      free(rcontext->attribs);
-      free(rcontext);
-    }
-#endif
-#if !USE_WRASTER
+#if !USE_WRASTER || !defined(HAVE_WRASTER_H)
+  /* Both our copy of wraster (context.c) and xlibimage.c provide
+     RDestroyContext(). An external wraster's context is left alone. */
   if (rcontext)
     RDestroyContext(rcontext);
 #endif
@@ -527,6 +498,41 @@ static NSString	*startupID = nil;
 #ifdef HAVE_XRANDR
   XRRQueryExtension(dpy, &randrEventBase, &randrErrorBase);
   XRRSelectInput(dpy, RootWindow(dpy, defScreen), RRScreenChangeNotifyMask);
+#endif
+#ifdef HAVE_XINPUT2
+  /* XInput 2.1 reports smooth scrolling in the valuators of motion events.
+     It is only used when asked for; otherwise, or when the server doesn't
+     have it, scrolling comes from the core wheel buttons. */
+  generic.xiOpcode = 0;
+  if ([[NSUserDefaults standardUserDefaults]
+        boolForKey: @"GSXInputSmoothScrolling"])
+    {
+      int event, error;
+      int major = 2, minor = 1;
+
+      if (XQueryExtension(dpy, "XInputExtension", &generic.xiOpcode,
+                          &event, &error)
+          && XIQueryVersion(dpy, &major, &minor) == Success
+          && (major > 2 || (major == 2 && minor >= 1)))
+        {
+          unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+          XIEventMask mask;
+
+          NSDebugLLog(@"XInput2", @"Smooth scrolling with XInput %d.%d",
+                      major, minor);
+          /* Scroll valuators change when another device is used. */
+          memset(bits, 0, sizeof(bits));
+          XISetMask(bits, XI_DeviceChanged);
+          mask.deviceid = XIAllMasterDevices;
+          mask.mask_len = sizeof(bits);
+          mask.mask = bits;
+          XISelectEvents(dpy, RootWindow(dpy, defScreen), &mask, 1);
+        }
+      else
+        {
+          generic.xiOpcode = 0;
+        }
+    }
 #endif
   return self;
 }
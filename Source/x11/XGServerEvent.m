@@ -63,6 +63,12 @@
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
 #endif
+#ifdef HAVE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
+#include "x11/xiscroll.h"
+#include "x11/xeventbatch.h"
+#include "x11/xmotionhistory.h"
 
 #include "math.h"
 #include <X11/keysym.h>
@@ -115,6 +121,81 @@ void __objc_xgcontextevent_linking (void)
 static SEL procSel = 0;
 static void (*procEvent)(id, SEL, XEvent*) = 0;
 
+/*
+ * -receivedEvent:type:extra:forMode: takes the events Xlib has queued in
+ * batches and processes them in order.  Code that looks ahead at the next
+ * event while processing one (motion compression, key repeat detection)
+ * must look at the rest of the batch before the X queue, with
+ * peekNextEvent() and takeNextEvent().
+ */
+static XEventBatch *currentBatch = 0;
+
+/* How long, in seconds, the events of a run loop iteration may be
+ * processed before the rest are left for the next iteration, so that
+ * timers and drawing are not starved ("GSXEventTimeBudget" - in
+ * milliseconds (50), 0 for no limit). */
+static NSTimeInterval eventBudget = 0.05;
+
+/* Counts for -getEventsReceived:delivered:yields: */
+static XEventCounts eventCounts;
+
+/* The batches of one call of -receivedEvent:type:extra:forMode:. */
+typedef struct {
+  id server;
+  NSTimeInterval start;
+} gsevent_run_t;
+
+static int
+deliverEvent(void *context, XEvent *xEvent)
+{
+#ifdef USE_XIM
+  if (XFilterEvent(xEvent, None))
+    {
+      NSDebugLLog(@"NSKeyEvent", @"Event filtered (by XIM?)\n");
+      return 0;
+    }
+#endif
+  (*procEvent)(((gsevent_run_t *)context)->server, procSel, xEvent);
+  return 1;
+}
+
+static int
+budgetUsed(void *context)
+{
+  return eventBudget > 0.0
+    && [NSDate timeIntervalSinceReferenceDate]
+       - ((gsevent_run_t *)context)->start > eventBudget;
+}
+
+static BOOL
+peekNextEvent(Display *dpy, XEvent *event, int mode)
+{
+  return XEventBatchPeek(currentBatch, dpy, event, mode);
+}
+
+static void
+takeNextEvent(Display *dpy, XEvent *event)
+{
+  eventCounts.received += XEventBatchTake(currentBatch, dpy, event);
+}
+
+/*
+ * The scroll valuators of the master pointer, when XInput2 smooth
+ * scrolling is used (generic.xiOpcode is set).  Motion events with scroll
+ * valuators are turned into _GNUSTEP_SMOOTH_SCROLL client messages when
+ * they are read, with the scrolling in wheel steps as 16.16 fixed point
+ * numbers in data.l[0] (x) and data.l[1] (y), the position in the window
+ * in data.l[2] (x in the high 16 bits), the modifiers in data.l[3] and the
+ * time in data.l[4]; when the pointer moved as well, a MotionNotify event
+ * comes before it.  Other XInput2 motion events become MotionNotify
+ * events, so that they are compressed like core ones.
+ */
+static XIScrollDevice scrollDevice = { -1, 0 };
+
+/* The positions passed over by compressed motion events; see
+ * xmotionhistory.h. */
+static XMotionHistory motionHistory;
+
 #ifdef XSHM
 @interface NSGraphicsContext (SharedMemory)
 -(void) gotShmCompletion: (Drawable)d;
@@ -132,6 +213,9 @@ static void (*procEvent)(id, SEL, XEvent*) = 0;
                   forMode: (NSString*)mode;
 - (int) XGErrorHandler: (Display*)display : (XErrorEvent*)err;
 - (void) processEvent: (XEvent *) event;
+#ifdef HAVE_XINPUT2
+- (BOOL) _translateXIEvent: (XEvent *)event motion: (XEvent *)motion;
+#endif
 - (NSEvent *)_handleTakeFocusAtom: (XEvent)xEvent 
         	       forContext: (NSGraphicsContext *)gcontext;
 @end
@@ -271,6 +355,12 @@ static int check_modifier (XEvent *xEvent, KeySym key_sym)
 #endif
   if (procSel == 0)
     {
+      NSUserDefaults *defs = [NSUserDefaults standardUserDefaults];
+
+      if ([defs objectForKey: @"GSXEventTimeBudget"] != nil)
+        {
+          eventBudget = [defs integerForKey: @"GSXEventTimeBudget"] / 1000.0;
+        }
       procSel = @selector(processEvent:);
       procEvent = (void (*)(id, SEL, XEvent*))
         [self methodForSelector: procSel];
@@ -310,23 +400,62 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
                  extra: (void*)extra
                forMode: (NSString*)mode
 {
-  XEvent xEvent;
-
-  // loop and grab all of the events from the X queue
-  while (XPending(dpy) > 0)
+  XEventBatch batch;
+  XEventBatch *outer = currentBatch;
+  gsevent_run_t run;
+  int queued, i, n;
+
+  run.server = self;
+  run.start = [NSDate timeIntervalSinceReferenceDate];
+
+  /* Loop and grab all of the events from the X queue.  Those already read
+   * by Xlib are taken at once, so looking ahead at them needs no I/O. */
+  currentBatch = &batch;
+  while ((queued = XEventsQueued(dpy, QueuedAfterFlush)) > 0)
     {
-      XNextEvent(dpy, &xEvent);
-
-#ifdef USE_XIM
-      if (XFilterEvent(&xEvent, None)) 
+      if (queued > XEVENTBATCH_SIZE)
+        queued = XEVENTBATCH_SIZE;
+      for (i = batch.count = 0; i < queued; i++)
         {
-          NSDebugLLog(@"NSKeyEvent", @"Event filtered (by XIM?)\n");
-          continue;
-        }
+          XEvent *ev = &batch.events[batch.count++];
+
+          XNextEvent(dpy, ev);
+#ifdef HAVE_XINPUT2
+          /* The data of an XInput2 event is lost at the next XNextEvent. */
+          if (ev->type == GenericEvent)
+            {
+              XEvent motion;
+
+              if ([self _translateXIEvent: ev motion: &motion])
+                {
+                  batch.events[batch.count++] = *ev;
+                  *ev = motion;
+                }
+            }
 #endif
+        }
+      eventCounts.received += batch.count;
+      n = XEventBatchCoalesce(&batch);
+      NSDebugLLog(@"NSEvent", @"Event batch of %d coalesced to %d",
+                  batch.count + n, batch.count);
 
-      (*procEvent)(self, procSel, &xEvent);
+      if (!XEventBatchDeliver(&batch, &eventCounts, deliverEvent,
+                              budgetUsed, &run))
+        {
+          /* Out of time.  Put the rest back at the head of the X queue, in
+           * order, for the next run loop iteration; -runLoopShouldBlock:
+           * sees them and doesn't let the run loop wait. */
+          n = XEventBatchPutBack(&batch, dpy, &eventCounts, XPutBackEvent);
+          NSDebugLLog(@"NSEvent", @"Event budget used, %d events left", n);
+          break;
+        }
+      if (budgetUsed(&run))
+        {
+          eventCounts.yields++;
+          break;
+        }
     }
+  currentBatch = outer;
 }
 
 /*
@@ -401,6 +530,7 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
   static NSPoint eventLocation;
   NSEvent *e = nil;
   XEvent xEvent;
+  XEvent nev;
   NSWindow *nswin;
   Window xWin;
   NSEventType eventType;
@@ -539,6 +669,13 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
             break;                /* Unknown button */
           }
 
+        /* With XInput2 smooth scrolling, the wheel buttons are emulated
+           for the scrolling we already got, except while the pointer is
+           grabbed, when no XInput2 events are sent. */
+        if (eventType == NSScrollWheel && generic.xiOpcode != 0
+            && XIScrollTakesButtons(&scrollDevice, grabWindow != 0))
+          break;
+
         if (menuButtonEnabled == NO && eventType == menuMouseButton)
           break; // disabled menu button was pressed
 
@@ -690,7 +827,62 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
             }
           if (cWin == 0)
             break;
-          if (xEvent.xclient.message_type == generic.WM_PROTOCOLS_ATOM)
+          if (xEvent.xclient.message_type
+              == generic._GNUSTEP_SMOOTH_SCROLL_ATOM
+              && xEvent.xclient.send_event == False)
+            {
+              /*
+               * Scrolling from XInput2, made by -_translateXIEvent:.
+               * Scrolling events for the same window that follow are
+               * added up.
+               */
+              double dx = xEvent.xclient.data.l[0] / 65536.0;
+              double dy = xEvent.xclient.data.l[1] / 65536.0;
+
+              while (peekNextEvent(dpy, &nev, QueuedAlready)
+                     && nev.type == ClientMessage
+                     && nev.xclient.message_type
+                     == generic._GNUSTEP_SMOOTH_SCROLL_ATOM
+                     && nev.xclient.send_event == False
+                     && nev.xclient.window == xEvent.xclient.window)
+                {
+                  takeNextEvent(dpy, &xEvent);
+                  dx += xEvent.xclient.data.l[0] / 65536.0;
+                  dy += xEvent.xclient.data.l[1] / 65536.0;
+                }
+
+              if (clickTime == 0) [self initializeMouse];
+              [self setLastTime: (Time)xEvent.xclient.data.l[4]];
+              eventFlags = process_modifier_flags(xEvent.xclient.data.l[3]);
+              eventLocation = NSMakePoint(
+                (short)(xEvent.xclient.data.l[2] >> 16),
+                (short)(xEvent.xclient.data.l[2] & 0xffff));
+              eventLocation = [self _XPointToOSPoint: eventLocation
+                                                 for: cWin];
+              if (dy > 0)
+                buttonNumber = generic.upMouse;
+              else if (dy < 0)
+                buttonNumber = generic.downMouse;
+              else if (dx < 0)
+                buttonNumber = generic.scrollLeftMouse;
+              else
+                buttonNumber = generic.scrollRightMouse;
+
+              e = [NSEvent mouseEventWithType: NSScrollWheel
+                           location: eventLocation
+                           modifierFlags: eventFlags
+                           timestamp: (NSTimeInterval)generic.lastTime / 1000.0
+                           windowNumber: cWin->number
+                           context: gcontext
+                           eventNumber: xEvent.xclient.serial
+                           clickCount: 1
+                           pressure: 1.0
+                           buttonNumber: buttonNumber
+                           deltaX: dx * mouseScrollMultiplier
+                           deltaY: dy * mouseScrollMultiplier
+                           deltaZ: 0.];
+            }
+          else if (xEvent.xclient.message_type == generic.WM_PROTOCOLS_ATOM)
             {
               [self setLastTime: (Time)xEvent.xclient.data.l[1]];
               NSDebugLLog(@"NSEvent", @"WM Protocol - %s\n",
@@ -1086,6 +1278,9 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
       case EnterNotify:
         NSDebugLLog(@"NSEvent", @"%lu EnterNotify\n",
                     xEvent.xcrossing.window);
+        /* The scroll valuators may have changed while the pointer was
+           outside our windows. */
+        XIScrollInvalidate(&scrollDevice);
         break;
               
             // when the pointer leaves a window
@@ -1199,24 +1394,42 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
               if (xEvent.xexpose.count == 0)
                 [self _processExposedRectangles: cWin->number];
 #else
-              {
-                NSRect rect;
-                NSTimeInterval ts = (NSTimeInterval)generic.lastMotion;
-                
-                rect = [self _XWinRectToOSWinRect: NSMakeRect(
-                        rectangle.x, rectangle.y, rectangle.width, rectangle.height)
-                             for: cWin];
-                e = [NSEvent otherEventWithType: NSAppKitDefined
-                             location: rect.origin
-                             modifierFlags: eventFlags
-                             timestamp: ts / 1000.0
-                             windowNumber: cWin->number
-                             context: gcontext
-                             subtype: GSAppKitRegionExposed
-                             data1: rect.size.width
-                             data2: rect.size.height];
-              }
-              
+              /* Collect the rects of a sequence, and only hand on what
+                 is left of them after merging when the last one comes. */
+              XExposedAdd(&cWin->exposed, rectangle.x, rectangle.y,
+                          rectangle.width, rectangle.height);
+              if (xEvent.xexpose.count == 0)
+                {
+                  NSTimeInterval ts = (NSTimeInterval)generic.lastMotion;
+                  int i;
+
+                  NSDebugLLog(@"NSEvent", @"Expose sequence gives %d rects\n",
+                              cWin->exposed.count);
+                  for (i = 0; i < cWin->exposed.count; i++)
+                    {
+                      XExposedRect *r = &cWin->exposed.rects[i];
+                      NSRect rect;
+
+                      rect = [self _XWinRectToOSWinRect: NSMakeRect(
+                                r->x, r->y, r->width, r->height)
+                                   for: cWin];
+                      /* The last one is added below, as any event. */
+                      if (e != nil)
+                        {
+                          [event_queue addObject: e];
+                        }
+                      e = [NSEvent otherEventWithType: NSAppKitDefined
+                                   location: rect.origin
+                                   modifierFlags: eventFlags
+                                   timestamp: ts / 1000.0
+                                   windowNumber: cWin->number
+                                   context: gcontext
+                                   subtype: GSAppKitRegionExposed
+                                   data1: rect.size.width
+                                   data2: rect.size.height];
+                    }
+                  XExposedReset(&cWin->exposed);
+                }
 #endif
             }
           break;
@@ -1342,11 +1555,8 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
           event in the queue and look if they are a matching KeyRelease/KeyPress
           pair. If so, we ignore the current KeyRelease event.
         */
-        if (XEventsQueued(dpy, QueuedAfterReading))
+        if (peekNextEvent(dpy, &nev, QueuedAfterReading))
           {
-            XEvent nev;
-            XPeekEvent(dpy, &nev);
-
             if (nev.type == KeyPress && 
                 nev.xkey.window == xEvent.xkey.window &&
                 nev.xkey.time == xEvent.xkey.time &&
@@ -1519,26 +1729,17 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
                     xEvent.xmotion.window, xEvent.xmotion.x, xEvent.xmotion.y);
         {
           unsigned int        state;
+          XMotionEvent        passed[XMOTIONHISTORY_MAX - 1];
+          int                 passedCount;
+          int                 i;
 
           /*
-           * Compress motion events to avoid flooding.
+           * Compress motion events to avoid flooding, keeping the
+           * positions passed over for the motion history.  Only the
+           * events already read are looked at.
            */
-          while (XPending(xEvent.xmotion.display))
-            {
-              XEvent        peek;
-
-              XPeekEvent(xEvent.xmotion.display, &peek);
-              if (peek.type == MotionNotify
-                  && xEvent.xmotion.window == peek.xmotion.window
-                  && xEvent.xmotion.subwindow == peek.xmotion.subwindow)
-                {
-                  XNextEvent(xEvent.xmotion.display, &xEvent);
-                }
-              else
-                {
-                  break;
-                }
-            }
+          passedCount = XEventBatchCompressMotion(currentBatch, dpy,
+            &xEvent, passed, XMOTIONHISTORY_MAX - 1, &eventCounts.received);
 
           generic.lastMotion = xEvent.xmotion.time;
           [self setLastTime: generic.lastMotion];
@@ -1594,6 +1795,21 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
                        deltaX: deltaX
                        deltaY: deltaY
                        deltaZ: 0];
+
+          /* Record the positions of the compressed events and of this
+           * one. */
+          XMotionHistoryBegin(&motionHistory, cWin->number,
+                              (long)xEvent.xmotion.serial);
+          for (i = 0; i < passedCount; i++)
+            {
+              NSPoint p = [self _XPointToOSPoint:
+                NSMakePoint(passed[i].x, passed[i].y) for: cWin];
+
+              XMotionHistoryAdd(&motionHistory, p.x, p.y,
+                                (NSTimeInterval)passed[i].time / 1000.0);
+            }
+          XMotionHistoryAdd(&motionHistory, eventLocation.x, eventLocation.y,
+                            [e timestamp]);
           break;
         }
 
@@ -1695,7 +1911,7 @@ posixFileDescriptor: (NSPosixFileDescriptor*)fileDescriptor
           }
         if (cWin != 0)
           {
-            cWin->parent = xEvent.xreparent.parent;
+            [XGServer _setXParent: xEvent.xreparent.parent forWindow: cWin];
           }
 
         if (cWin != 0 && xEvent.xreparent.parent != cWin->root
@@ -2633,6 +2849,143 @@ process_modifier_flags(unsigned int state)
   return [XGDragView sharedDragView];
 }
 
+#ifdef HAVE_XINPUT2
+/* The core MotionNotify event for an XInput2 motion event. */
+static void
+xiMotionEvent(Display *dpy, XIDeviceEvent *de, XEvent *xEvent)
+{
+  unsigned int state = de->mods.effective;
+  int b;
+
+  for (b = 1; b <= 5 && b < de->buttons.mask_len * 8; b++)
+    {
+      if (XIMaskIsSet(de->buttons.mask, b))
+        state |= Button1Mask << (b - 1);
+    }
+  memset(xEvent, 0, sizeof(*xEvent));
+  xEvent->xmotion.type = MotionNotify;
+  xEvent->xmotion.serial = de->serial;
+  xEvent->xmotion.send_event = de->send_event;
+  xEvent->xmotion.display = dpy;
+  xEvent->xmotion.window = de->event;
+  xEvent->xmotion.root = de->root;
+  xEvent->xmotion.subwindow = de->child;
+  xEvent->xmotion.time = de->time;
+  xEvent->xmotion.x = (int)de->event_x;
+  xEvent->xmotion.y = (int)de->event_y;
+  xEvent->xmotion.x_root = (int)de->root_x;
+  xEvent->xmotion.y_root = (int)de->root_y;
+  xEvent->xmotion.state = state;
+  xEvent->xmotion.is_hint = NotifyNormal;
+  xEvent->xmotion.same_screen = True;
+}
+
+/*
+ * Turns an XInput2 event into the event processed in its place, as
+ * described at scrollDevice, or into an event of type 0, which is dropped
+ * from the batch.  Returns YES when the pointer moved with a scroll, with
+ * the MotionNotify event to process first in motion.  Called as soon as
+ * the event is read.
+ */
+- (BOOL) _translateXIEvent: (XEvent *)event motion: (XEvent *)motion
+{
+  XGenericEventCookie *cookie = &event->xcookie;
+  XEvent xEvent;
+  BOOL moved = NO;
+
+  if (cookie->extension != generic.xiOpcode || !XGetEventData(dpy, cookie))
+    {
+      return NO;
+    }
+
+  memset(&xEvent, 0, sizeof(xEvent));
+  if (cookie->evtype == XI_Motion)
+    {
+      XIDeviceEvent *de = (XIDeviceEvent *)cookie->data;
+      double dx, dy;
+      int scrolled;
+
+      if (de->deviceid != scrollDevice.deviceid)
+        {
+          XIDeviceInfo *info;
+          int count, i;
+
+          /* Set up the scroll valuators of this pointer. */
+          XIScrollReset(&scrollDevice, de->deviceid);
+          info = XIQueryDevice(dpy, de->deviceid, &count);
+          for (i = 0; info != NULL && i < info->num_classes; i++)
+            {
+              XIScrollClassInfo *sc;
+              double value = 0.0;
+              int j;
+
+              if (info->classes[i]->type != XIScrollClass)
+                continue;
+              sc = (XIScrollClassInfo *)info->classes[i];
+              for (j = 0; j < info->num_classes; j++)
+                {
+                  XIValuatorClassInfo *vc
+                    = (XIValuatorClassInfo *)info->classes[j];
+
+                  if (vc->type == XIValuatorClass && vc->number == sc->number)
+                    value = vc->value;
+                }
+              XIScrollAddValuator(&scrollDevice, sc->number,
+                                  sc->scroll_type == XIScrollTypeHorizontal,
+                                  sc->increment, value);
+            }
+          if (info != NULL)
+            XIFreeDeviceInfo(info);
+          NSDebugLLog(@"XInput2", @"Pointer %d has %d scroll valuators",
+                      de->deviceid, scrollDevice.count);
+        }
+
+      moved = XIScrollMoved(&scrollDevice, de->root_x, de->root_y);
+      scrolled = XIScrollUpdate(&scrollDevice, de->valuators.mask,
+                                de->valuators.mask_len, de->valuators.values,
+                                &dx, &dy);
+      if (scrolled && (dx != 0.0 || dy != 0.0))
+        {
+          if (moved)
+            {
+              xiMotionEvent(dpy, de, motion);
+            }
+          xEvent.xclient.type = ClientMessage;
+          xEvent.xclient.serial = de->serial;
+          xEvent.xclient.send_event = False;
+          xEvent.xclient.display = dpy;
+          xEvent.xclient.window = de->event;
+          xEvent.xclient.message_type = generic._GNUSTEP_SMOOTH_SCROLL_ATOM;
+          xEvent.xclient.format = 32;
+          xEvent.xclient.data.l[0] = lrint(dx * 65536.0);
+          xEvent.xclient.data.l[1] = lrint(dy * 65536.0);
+          xEvent.xclient.data.l[2] = (((long)(int)de->event_x & 0xffff) << 16)
+            | ((long)(int)de->event_y & 0xffff);
+          xEvent.xclient.data.l[3] = de->mods.effective;
+          xEvent.xclient.data.l[4] = de->time;
+        }
+      else if (!scrolled || moved)
+        {
+          /* Pointer motion, with no scrolling to go with it. */
+          xiMotionEvent(dpy, de, &xEvent);
+          moved = NO;
+        }
+    }
+  else if (cookie->evtype == XI_DeviceChanged)
+    {
+      XIDeviceChangedEvent *dc = (XIDeviceChangedEvent *)cookie->data;
+
+      /* Set up again at the next motion. */
+      if (dc->deviceid == scrollDevice.deviceid)
+        scrollDevice.deviceid = -1;
+    }
+
+  XFreeEventData(dpy, cookie);
+  *event = xEvent;
+  return moved;
+}
+#endif
+
 @end
 
 @implementation XGServer (XSync)
@@ -2806,3 +3159,45 @@ process_modifier_flags(unsigned int state)
 
 @end
 
+
+@implementation XGServer (EventStatistics)
+
+- (void) getEventsReceived: (unsigned long *)received
+                 delivered: (unsigned long *)delivered
+                    yields: (unsigned long *)yields
+{
+  if (received != NULL)
+    *received = eventCounts.received;
+  if (delivered != NULL)
+    *delivered = eventCounts.delivered;
+  if (yields != NULL)
+    *yields = eventCounts.yields;
+}
+
+@end
+
+@implementation XGServer (MotionHistory)
+
+- (NSUInteger) motionHistoryForEvent: (NSEvent *)event
+                           locations: (NSPoint *)locations
+                          timestamps: (NSTimeInterval *)timestamps
+                               count: (NSUInteger)count
+{
+  XMotionPosition positions[XMOTIONHISTORY_MAX];
+  unsigned        i, n;
+
+  n = XMotionHistoryGet(&motionHistory, [event windowNumber],
+                        [event eventNumber], positions,
+                        count < XMOTIONHISTORY_MAX
+                        ? (unsigned)count : XMOTIONHISTORY_MAX);
+  for (i = 0; i < n; i++)
+    {
+      if (locations != NULL)
+        locations[i] = NSMakePoint(positions[i].x, positions[i].y);
+      if (timestamps != NULL)
+        timestamps[i] = positions[i].timestamp;
+    }
+  return n;
+}
+
+@end
@@ -31,6 +31,7 @@
 #include <Foundation/NSDebug.h>
 #include <Foundation/NSValue.h>
 #include <Foundation/NSProcessInfo.h>
+#include <Foundation/NSRunLoop.h>
 #include <Foundation/NSUserDefaults.h>
 #include <Foundation/NSAutoreleasePool.h>
 #include <Foundation/NSDebug.h>
@@ -73,9 +74,13 @@
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
 #endif
+#ifdef HAVE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
 
 #include "x11/XGDragView.h"
 #include "x11/XGInputServer.h"
+#include "x11/xwinmap.h"
 
 #define	ROOT generic.appRootWindow
 
@@ -83,18 +88,29 @@
 static BOOL handlesWindowDecorations = YES;
 static int _wmAppIcon = -1;
 
-#define WINDOW_WITH_TAG(windowNumber) (gswindow_device_t *)NSMapGet(windowtags, (void *)(uintptr_t)windowNumber)
+#define WINDOW_WITH_TAG(windowNumber) (gswindow_device_t *)XWinMapGet(&windowtags, (unsigned long)(intptr_t)(windowNumber))
 
 /* Current mouse grab window */
 static gswindow_device_t *grab_window = NULL;
 
-/* Keep track of windows */
-static NSMapTable *windowmaps = NULL;
-static NSMapTable *windowtags = NULL;
+/* Keep track of windows, by X window, by the X window the window manager
+   reparented them to (when it is not the root), and by window number */
+static XWinMap windowmaps;
+static XWinMap windowparents;
+static XWinMap windowtags;
 
 /* Track used window numbers */
 static int	last_win_num = 0;
 
+/* Windows whose drivers batch what they show (GDriverBatchesExpose) and
+   have something to present at the end of this run loop iteration, or
+   once the oldest of it has waited for a frame. */
+#define PRESENT_INTERVAL (1.0 / 60.0)
+static long	*presentWindows = NULL;
+static int	presentCount = 0;
+static int	presentSize = 0;
+static NSTimeInterval presentSince = 0;
+
 @interface NSCursor (BackendPrivate)
 - (void *)_cid;
 @end
@@ -450,6 +466,8 @@ BOOL AtomPresentAndPointsToItself(Display *dpy, Atom atom, Atom type)
 - (void) styleoffsets: (float *) l : (float *) r : (float *) t : (float *) b
                      : (unsigned int) style : (Window) win;
 - (void) _setSupportedWMProtocols: (gswindow_device_t *) window;
+- (BOOL) _queuePresent: (gswindow_device_t *)window;
+- (void) _presentWindows;
 @end
 
 @implementation XGServer (WindowOps)
@@ -466,24 +484,36 @@ BOOL AtomPresentAndPointsToItself(Display *dpy, Atom atom, Atom type)
  */
 + (gswindow_device_t *) _windowForXParent: (Window)xWindow
 {
-  NSMapEnumerator	enumerator;
-  void		*key;
-  gswindow_device_t	*d;
+  gswindow_device_t	*d = XWinMapGet(&windowparents, xWindow);
 
-  enumerator = NSEnumerateMapTable(windowmaps);
-  while (NSNextMapEnumeratorPair(&enumerator, &key, (void**)&d) == YES)
+  if (d != 0 && d->root != d->parent && d->parent == xWindow)
     {
-      if (d->root != d->parent && d->parent == xWindow)
-	{
-	  return d;
-	}
+      return d;
     }
   return 0;
 }
 
 + (gswindow_device_t *) _windowForXWindow: (Window)xWindow
 {
-  return NSMapGet(windowmaps, (void *)xWindow);
+  return XWinMapGet(&windowmaps, xWindow);
+}
+
+/*
+ * Sets the parent of a window, keeping track of the windows that have been
+ * reparented by the wm.
+ */
++ (void) _setXParent: (Window)xParent forWindow: (gswindow_device_t *)window
+{
+  if (window->parent != window->root
+    && XWinMapGet(&windowparents, window->parent) == window)
+    {
+      XWinMapRemove(&windowparents, window->parent);
+    }
+  window->parent = xParent;
+  if (xParent != window->root)
+    {
+      XWinMapInsert(&windowparents, xParent, window);
+    }
 }
 
 + (gswindow_device_t *) _windowWithTag: (int)windowNumber
@@ -675,7 +705,7 @@ BOOL AtomPresentAndPointsToItself(Display *dpy, Atom atom, Atom type)
 }
 
 static void
-select_input(Display *display, Window w, BOOL ignoreMouse)
+select_input(Display *display, Window w, BOOL ignoreMouse, int xiOpcode)
 {
   long event_mask = ExposureMask
     | KeyPressMask
@@ -699,6 +729,23 @@ select_input(Display *display, Window w, BOOL ignoreMouse)
     }
 
   XSelectInput(display, w, event_mask);
+
+#ifdef HAVE_XINPUT2
+  if (!ignoreMouse && xiOpcode != 0)
+    {
+      /* Take the pointer motion from XInput2, which has the scroll
+         valuators, instead of the core events. */
+      unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+      XIEventMask mask;
+
+      memset(bits, 0, sizeof(bits));
+      XISetMask(bits, XI_Motion);
+      mask.deviceid = XIAllMasterDevices;
+      mask.mask_len = sizeof(bits);
+      mask.mask = bits;
+      XISelectEvents(display, w, &mask, 1);
+    }
+#endif
 }
 
 Bool
@@ -926,7 +973,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   window->gc = XCreateGC(dpy, window->ident, valuemask, &values);
 
   /* Set the X event mask */
-  select_input(dpy, window->ident, YES);
+  select_input(dpy, window->ident, YES, 0);
 
   /*
    * Initial attributes for any GNUstep window tell Window Maker not to
@@ -971,7 +1018,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
    */
   [self _setSupportedWMProtocols: window];
 
-  window->exposedRects = [NSMutableArray new];
+  XExposedReset(&window->exposed);
   window->region = XCreateRegion();
   window->buffer = 0;
   window->alpha_buffer = 0;
@@ -992,8 +1039,8 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   window->number = last_win_num;
 
   // Insert window into the mapping
-  NSMapInsert(windowmaps, (void*)(uintptr_t)window->ident, window);
-  NSMapInsert(windowtags, (void*)(uintptr_t)window->number, window);
+  XWinMapInsert(&windowmaps, window->ident, window);
+  XWinMapInsert(&windowtags, (unsigned long)(intptr_t)window->number, window);
   [self _setWindowOwnedByServer: window->number];
 
   if (![self _tryRequestFrameExtents: window])
@@ -1084,7 +1131,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   else if (repp != 0)
     {
       NSDebugLLog(@"Offset", @"Offsets retrieved from ReparentNotify");
-      window->parent = repp;
+      [[self class] _setXParent: repp forWindow: window];
       if (repp != window->root)
         {
           Window parent = repp;
@@ -1331,8 +1378,8 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
     }
 
   window->xframe = NSMakeRect(x, y, width, height);
-  NSMapInsert (windowtags, (void*)(uintptr_t)window->number, window);
-  NSMapInsert (windowmaps, (void*)(uintptr_t)window->ident,  window);
+  XWinMapInsert(&windowtags, (unsigned long)(intptr_t)window->number, window);
+  XWinMapInsert(&windowmaps, window->ident, window);
   return window;
 }
 
@@ -1340,13 +1387,12 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
    the window list as window 0 */
 - (void) _checkWindowlist
 {
-  if (windowmaps)
+  if (windowmaps.slots)
     return;
 
-  windowmaps = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
-				 NSNonOwnedPointerMapValueCallBacks, 20);
-  windowtags = NSCreateMapTable(NSIntMapKeyCallBacks,
-				 NSNonOwnedPointerMapValueCallBacks, 20);
+  XWinMapInit(&windowmaps);
+  XWinMapInit(&windowparents);
+  XWinMapInit(&windowtags);
 }
 
 - (void) _setupMouse
@@ -1767,21 +1813,28 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
    this context */
 - (void) _destroyServerWindows
 {
-  void *key;
+  unsigned long key;
+  unsigned long index = 0;
   gswindow_device_t *d;
-  NSMapEnumerator   enumerator;
-  NSMapTable        *mapcopy;
+  int *tags;
+  int count = 0;
+  int i;
 
-  /* Have to get a copy, since termwindow will remove them from
-     the map table */
-  mapcopy = NSCopyMapTableWithZone(windowtags, [self zone]);
-  enumerator = NSEnumerateMapTable(mapcopy);
-  while (NSNextMapEnumeratorPair(&enumerator, &key, (void**)&d) == YES)
+  /* Have to collect them first, since termwindow will remove them from
+     the table */
+  tags = malloc((windowtags.count + 1) * sizeof(int));
+  if (tags == NULL)
+    return;
+  while (XWinMapNext(&windowtags, &index, &key, (void**)&d))
     {
       if (d->display == dpy && d->ident != d->root)
-	[self termwindow: (int)(intptr_t)key];
+	tags[count++] = (int)(intptr_t)key;
     }
-  NSFreeMapTable(mapcopy);
+  for (i = 0; i < count; i++)
+    {
+      [self termwindow: tags[i]];
+    }
+  free(tags);
 }
 
 /* Sets up a backing pixmap when a window is created or resized.  This is
@@ -2029,7 +2082,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   window->gc = XCreateGC(dpy, window->ident, valuemask, &values);
 
   /* Set the X event mask */
-  select_input(dpy, window->ident, NO);
+  select_input(dpy, window->ident, NO, generic.xiOpcode);
 
   /*
    * Initial attributes for any GNUstep window tell Window Maker not to
@@ -2135,7 +2188,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
    */
   [self _setSupportedWMProtocols: window];
 
-  window->exposedRects = [NSMutableArray new];
+  XExposedReset(&window->exposed);
   window->region = XCreateRegion();
   window->buffer = 0;
   window->alpha_buffer = 0;
@@ -2156,8 +2209,8 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   window->number = last_win_num;
 
   // Insert window into the mapping
-  NSMapInsert(windowmaps, (void*)(uintptr_t)window->ident, window);
-  NSMapInsert(windowtags, (void*)(uintptr_t)window->number, window);
+  XWinMapInsert(&windowmaps, window->ident, window);
+  XWinMapInsert(&windowtags, (unsigned long)(intptr_t)window->number, window);
   [self _setWindowOwnedByServer: window->number];
 
   return window->number;
@@ -2242,7 +2295,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   // All the windows of a GNUstep application belong to one group.
   window->gen_hints.flags |= WindowGroupHint;
   window->gen_hints.window_group = ROOT;
-  window->exposedRects = [NSMutableArray new];
+  XExposedReset(&window->exposed);
   window->region = XCreateRegion();
   window->buffer = 0;
   window->alpha_buffer = 0;
@@ -2274,8 +2327,8 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
   window->number = last_win_num;
 
   // Insert window into the mapping
-  NSMapInsert(windowmaps, (void*)(uintptr_t)window->ident, window);
-  NSMapInsert(windowtags, (void*)(uintptr_t)window->number, window);
+  XWinMapInsert(&windowmaps, window->ident, window);
+  XWinMapInsert(&windowtags, (unsigned long)(intptr_t)window->number, window);
   [self _setWindowOwnedByServer: window->number];
   return window->number;
 }
@@ -2309,7 +2362,12 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
         {
 	  generic.cachedWindow = 0;
 	}
-      NSMapRemove(windowmaps, (void*)window->ident);
+      XWinMapRemove(&windowmaps, window->ident);
+    }
+  if (window->parent != window->root
+    && XWinMapGet(&windowparents, window->parent) == window)
+    {
+      XWinMapRemove(&windowparents, window->parent);
     }
 
   if (window->buffer)
@@ -2318,8 +2376,7 @@ _wmTestErrorHandler(Display *display, XErrorEvent *event)
     XFreePixmap (dpy, window->alpha_buffer);
   if (window->region)
     XDestroyRegion (window->region);
-  RELEASE(window->exposedRects);
-  NSMapRemove(windowtags, (void*)(uintptr_t)win);
+  XWinMapRemove(&windowtags, (unsigned long)(intptr_t)win);
   NSZoneFree(0, window);
 }
 
@@ -3798,6 +3855,7 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
 				   rectangle.width, rectangle.height);
 	  [[GSCurrentContext() class] handleExposeRect: rect
 			     forDriver: window->gdriver];
+	  [self _queuePresent: window];
 	}
       else
         {
@@ -3808,25 +3866,109 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
     }
   else
     {
-      NSRect	rect;
-
       // no backing store, so keep a list of exposed rects to be
       // processed in the _processExposedRectangles method
       // Add the rectangle to the region used in -_processExposedRectangles
       // to set the clipping path.
       XUnionRectWithRegion (&rectangle, window->region, window->region);
 
-      // Transform the rectangle's coordinates to OS coordinates and add
-      // this new rectangle to the list of exposed rectangles.
-      {
- 	rect = [self _XWinRectToOSWinRect: NSMakeRect(
-	  rectangle.x, rectangle.y, rectangle.width, rectangle.height)
-	  for: window];
-	[window->exposedRects addObject: [NSValue valueWithRect: rect]];
-      }
+      // Add this new rectangle to the exposed rectangles.
+      XExposedAdd(&window->exposed, rectangle.x, rectangle.y,
+		  rectangle.width, rectangle.height);
     }
 }
 
+/* Queues the window to present what its driver collected, if the driver
+   batches.  Answers whether that is left for later: at the end of this
+   run loop iteration, so that all the flushes of a frame go to the X
+   server together, or sooner when the batch is a frame old, for drawing
+   done without returning to the run loop. */
+- (BOOL) _queuePresent: (gswindow_device_t *)window
+{
+  NSTimeInterval now;
+  BOOL first = (presentCount == 0);
+  int i;
+
+  if ((window->gdriverProtocol & GDriverBatchesExpose) == 0)
+    {
+      return NO;
+    }
+
+  for (i = 0; i < presentCount; i++)
+    {
+      if (presentWindows[i] == window->number)
+	{
+	  break;
+	}
+    }
+  if (i == presentCount)
+    {
+      if (presentCount == presentSize)
+	{
+	  presentSize = presentSize ? presentSize * 2 : 8;
+	  presentWindows = NSZoneRealloc(0, presentWindows,
+	    presentSize * sizeof(long));
+	}
+      presentWindows[presentCount++] = window->number;
+    }
+
+  now = [NSDate timeIntervalSinceReferenceDate];
+  if (first)
+    {
+      NSRunLoop *loop = [NSRunLoop currentRunLoop];
+      NSMutableArray *modes;
+
+      modes = [NSMutableArray arrayWithObjects: NSDefaultRunLoopMode,
+	NSModalPanelRunLoopMode, NSEventTrackingRunLoopMode, nil];
+      if ([loop currentMode] != nil
+	&& ![modes containsObject: [loop currentMode]])
+	{
+	  [modes addObject: [loop currentMode]];
+	}
+      /* After the windows are displayed, which gui orders at 600000. */
+      [loop performSelector: @selector(_presentWindows)
+		     target: self
+		   argument: nil
+		      order: 700000
+		      modes: modes];
+      presentSince = now;
+    }
+  else if (now - presentSince >= PRESENT_INTERVAL)
+    {
+      [self _presentWindows];
+      return NO;
+    }
+  return YES;
+}
+
+/* Presents what the drivers of the queued windows collected, and flushes
+   the connection once for all of them. */
+- (void) _presentWindows
+{
+  int i;
+
+  if (presentCount == 0)
+    {
+      return;
+    }
+  [[NSRunLoop currentRunLoop] cancelPerformSelector: @selector(_presentWindows)
+					     target: self
+					   argument: nil];
+  for (i = 0; i < presentCount; i++)
+    {
+      gswindow_device_t *window = WINDOW_WITH_TAG(presentWindows[i]);
+
+      /* The window may have been closed since. */
+      if (window != NULL && window->gdriver != NULL
+	  && (window->gdriverProtocol & GDriverBatchesExpose))
+	{
+	  [(id<GSBatchedExposeDriver>)window->gdriver present];
+	}
+    }
+  presentCount = 0;
+  XFlush(dpy);
+}
+
 - (void) flushwindowrect: (NSRect)rect : (int)win
 {
   int xi, yi, width, height;
@@ -3834,6 +3976,7 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
   unsigned long valuemask;
   gswindow_device_t *window;
   float	l, r, t, b;
+  BOOL deferred = NO;
 
   window = WINDOW_WITH_TAG(win);
   if (win == 0 || window == NULL)
@@ -3873,6 +4016,7 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
 	  /* Temporary protocol until we standardize the backing buffer */
 	  [[GSCurrentContext() class] handleExposeRect: rect
 			     forDriver: window->gdriver];
+	  deferred = [self _queuePresent: window];
 	}
       else
         {
@@ -3889,6 +4033,14 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
       || window->net_wm_sync_request_counter_value_high != 0)
     {
       XSyncValue value;
+
+      /* The window manager waits for the counter to know the window is
+	 drawn, so what it shows has to be there first. */
+      if (deferred)
+	{
+	  [self _presentWindows];
+	  deferred = NO;
+	}
       XSyncIntsToValue(&value,
 		       window->net_wm_sync_request_counter_value_low,
 		       window->net_wm_sync_request_counter_value_high);
@@ -3898,7 +4050,10 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
     }
 #endif
 
-  XFlush(dpy);
+  if (!deferred)
+    {
+      XFlush(dpy);
+    }
 }
 
 // handle X expose events
@@ -3925,25 +4080,26 @@ swapColors(unsigned char *image_data, NSBitmapImageRep *rep)
 
   gui_win = GSWindowWithNumber(win);
 
-  n = [window->exposedRects count];
+  n = window->exposed.count;
   if (n > 0)
     {
       NSView *v;
-      NSValue *val[n];
       int i;
 
       v = [[gui_win contentView] superview];
 
-      [window->exposedRects getObjects: val];
       for (i = 0; i < n; ++i)
 	{
-	  NSRect rect = [val[i] rectValue];
-	  [v setNeedsDisplayInRect: rect];
+	  XExposedRect *r = &window->exposed.rects[i];
+
+	  // Transform the rectangle's coordinates to OS coordinates.
+	  [v setNeedsDisplayInRect: [self _XWinRectToOSWinRect:
+	    NSMakeRect(r->x, r->y, r->width, r->height) for: window]];
 	}
     }
 
   // Restore the exposed rectangles and the region
-  [window->exposedRects removeAllObjects];
+  XExposedReset(&window->exposed);
   XDestroyRegion (window->region);
   window->region = XCreateRegion();
   XSetClipMask (dpy, window->gc, None);
@@ -4233,16 +4389,15 @@ static BOOL   cursor_hidden = NO;
 
 - (void) _DPSsetcursor: (Cursor)c : (BOOL)set
 {
-  void	*key;
-  NSMapEnumerator enumerator;
+  unsigned long key;
+  unsigned long index = 0;
   gswindow_device_t  *d;
   Window root;
 
   NSDebugLLog (@"NSCursor", @"_DPSsetcursor: cursor = %lu, set = %d", c, set);
 
   root = DefaultRootWindow(dpy);
-  enumerator = NSEnumerateMapTable (windowmaps);
-  while (NSNextMapEnumeratorPair (&enumerator, &key, (void**)&d) == YES)
+  while (XWinMapNext(&windowmaps, &index, &key, (void**)&d))
     {
       Window win = (Window)key;
 
@@ -24,12 +24,14 @@
 
 #include <config.h>
 
+#include <Foundation/NSDebug.h>
 #include <Foundation/NSUserDefaults.h>
 
 #include "x11/XGServer.h"
 #include "x11/XGServerWindow.h"
 #include "x11/XWindowBuffer.h"
 
+#include <limits.h>
 #include <math.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -43,6 +45,8 @@ static int num_window_buffers;
 
 
 static int use_shape_hack = 0; /* this is an ugly hack : ) */
+static int use_double_buffer = 0;
+static int use_pixmap_present = 0;
 
 #ifdef XSHM
 
@@ -166,14 +170,137 @@ no_xshm:
     XSetErrorHandler(old_error_handler);
   }
 }
+
+/* Creates a shared image for the X server to read from. Returns NULL, after
+logging why, if it can't. */
+static XImage *create_front_image(Display *display, Visual *visual,
+                                  int drawing_depth, int width, int height,
+                                  XShmSegmentInfo *shminfo)
+{
+  XImage *ximage;
+
+  ximage = XShmCreateImage(display, visual, drawing_depth, ZPixmap, NULL,
+                           shminfo, width, height);
+  if (!ximage)
+    {
+      NSLog(@"Warning: XShmCreateImage failed for the front buffer.");
+      return NULL;
+    }
+
+  shminfo->shmid = shmget(IPC_PRIVATE, ximage->bytes_per_line * ximage->height,
+                          IPC_CREAT | 0700);
+  if (shminfo->shmid == -1)
+    {
+      NSLog(@"Warning: shmget() failed for the front buffer: %m.");
+      XDestroyImage(ximage);
+      return NULL;
+    }
+
+  shminfo->shmaddr = ximage->data = shmat(shminfo->shmid, 0, 0);
+  if ((intptr_t)shminfo->shmaddr == -1)
+    {
+      NSLog(@"Warning: shmat() failed for the front buffer: %m.");
+      XDestroyImage(ximage);
+      shmctl(shminfo->shmid, IPC_RMID, 0);
+      return NULL;
+    }
+
+  shminfo->readOnly = 1;
+  if (!XShmAttach(display, shminfo))
+    {
+      NSLog(@"Warning: XShmAttach() failed for the front buffer.");
+      XDestroyImage(ximage);
+      shmdt(shminfo->shmaddr);
+      shmctl(shminfo->shmid, IPC_RMID, 0);
+      return NULL;
+    }
+
+  /* See below, in +windowBufferForWindow:depthInfo:. */
+  XSync(display, False);
+  shmctl(shminfo->shmid, IPC_RMID, 0);
+  return ximage;
+}
+
+static void destroy_front_image(Display *display, XImage *ximage,
+                                XShmSegmentInfo *shminfo)
+{
+  XShmDetach(display, shminfo);
+  XDestroyImage(ximage);
+  shmdt(shminfo->shmaddr);
+}
 #endif
 
+/* Two damaged rectangles are merged when the part of their bounding box
+that is in neither of them is at most this many pixels; below that, a
+separate put request costs more than sending the extra pixels. */
+#define DAMAGE_MERGE_SLACK 4096
+
+static void damage_add(struct XWindowBuffer_damage_s *d,
+                       int x, int y, int w, int h)
+{
+  int i;
+
+  while (1)
+    {
+      int best = -1;
+      long best_waste = LONG_MAX;
+      int ux = 0, uy = 0, uw = 0, uh = 0;
+
+      for (i = 0; i < d->num_rects; i++)
+        {
+          int rx = d->rects[i].x, ry = d->rects[i].y;
+          int rw = d->rects[i].w, rh = d->rects[i].h;
+          int x0 = MIN(x, rx), y0 = MIN(y, ry);
+          int x1 = MAX(x + w, rx + rw), y1 = MAX(y + h, ry + rh);
+          int iw = MIN(x + w, rx + rw) - MAX(x, rx);
+          int ih = MIN(y + h, ry + rh) - MAX(y, ry);
+          long waste;
+
+          waste = (long)(x1 - x0) * (y1 - y0)
+            - (long)w * h - (long)rw * rh;
+          if (iw > 0 && ih > 0)
+            waste += (long)iw * ih;
+
+          if (waste < best_waste)
+            {
+              best = i;
+              best_waste = waste;
+              ux = x0;
+              uy = y0;
+              uw = x1 - x0;
+              uh = y1 - y0;
+            }
+        }
+
+      if (best < 0
+          || (best_waste > DAMAGE_MERGE_SLACK
+              && d->num_rects < XWINDOWBUFFER_MAX_DAMAGE))
+        break;
+
+      /* Replace the rectangle by the union, which might now be worth
+      merging with another one. */
+      d->rects[best] = d->rects[--d->num_rects];
+      x = ux;
+      y = uy;
+      w = uw;
+      h = uh;
+    }
+
+  d->rects[d->num_rects].x = x;
+  d->rects[d->num_rects].y = y;
+  d->rects[d->num_rects].w = w;
+  d->rects[d->num_rects].h = h;
+  d->num_rects++;
+}
+
 @implementation XWindowBuffer
 
 + (void) initialize
 {
   NSUserDefaults *ud = [NSUserDefaults standardUserDefaults];
   use_shape_hack = [ud boolForKey: @"XWindowBuffer-shape-hack"];
+  use_double_buffer = [ud boolForKey: @"XWindowBufferDoubleBuffer"];
+  use_pixmap_present = [ud boolForKey: @"XWindowBufferShmPixmapPresent"];
 }
 
 + windowBufferForWindow: (gswindow_device_t *)awindow
@@ -261,6 +388,20 @@ no_xshm:
 #endif
             XDestroyImage(wi->ximage);
         }
+#ifdef XSHM
+      for (i = 0; i < 2; i++)
+        {
+          if (wi->front_ximage[i])
+            {
+              destroy_front_image(wi->display, wi->front_ximage[i],
+                                  &wi->front_shminfo[i]);
+              wi->front_ximage[i] = NULL;
+            }
+          wi->front_stale[i].num_rects = 0;
+          wi->front_busy[i] = 0;
+        }
+      wi->front_last = 0;
+#endif
       if (wi->pixmap)
         {
           XFreePixmap(wi->display,wi->pixmap);
@@ -276,6 +417,7 @@ no_xshm:
         }
 
       wi->pending_put = wi->pending_event = 0;
+      wi->pending_damage.num_rects = 0;
 
       wi->ximage = NULL;
 
@@ -342,20 +484,31 @@ no_xshm:
           goto no_xshm;
         }
 
-      if (use_xshm_pixmaps)
+      if (use_xshm_pixmaps && XShmPixmapFormat(wi->display) == ZPixmap)
         {
+          int (*old_error_handler)();
+
           /* We try to create a shared pixmap using the same buffer, and set
              it as the background of the window. This allows X to handle expose
              events all by itself, which avoids white flashing when things are
              dragged across a window. */
           /* TODO: we still get and handle expose events, although we don't
              need to. */
+          num_xshm_test_errors = 0;
+          old_error_handler = XSetErrorHandler(test_xshm_error_handler);
           wi->pixmap = XShmCreatePixmap(wi->display, wi->drawable,
                                         wi->ximage->data, &wi->shminfo,
                                         wi->window->xframe.size.width,
                                         wi->window->xframe.size.height,
                                         drawing_depth);
-          if (wi->pixmap) /* TODO: this doesn't work */
+          XSync(wi->display, False);
+          XSetErrorHandler(old_error_handler);
+          if (wi->pixmap && num_xshm_test_errors)
+            {
+              NSLog(@"Warning: XShmCreatePixmap failed.");
+              wi->pixmap = 0;
+            }
+          if (wi->pixmap)
             {
               XSetWindowBackgroundPixmap(wi->display, wi->window->ident,
                                          wi->pixmap);
@@ -371,6 +524,33 @@ no_xshm:
       actually be destroyed, but if we crashed before doing this, it wouldn't
       be destroyed despite nobody being attached anymore. */
       shmctl(wi->shminfo.shmid, IPC_RMID, 0);
+
+      /* The front image is of no use when presenting from the pixmap. */
+      if (use_double_buffer && !(use_pixmap_present && wi->pixmap))
+        {
+          for (i = 0; i < 2; i++)
+            {
+              wi->front_ximage[i] = create_front_image(wi->display, visual,
+                                                       drawing_depth,
+                                                       wi->ximage->width,
+                                                       wi->ximage->height,
+                                                       &wi->front_shminfo[i]);
+              if (wi->front_ximage[i]
+                  && wi->front_ximage[i]->bytes_per_line
+                     != wi->ximage->bytes_per_line)
+                {
+                  /* Can't happen for the same size and depth, but the
+                  copy relies on it. */
+                  destroy_front_image(wi->display, wi->front_ximage[i],
+                                      &wi->front_shminfo[i]);
+                  wi->front_ximage[i] = NULL;
+                }
+              if (!wi->front_ximage[i])
+                break;
+            }
+          /* With one front image, puts still don't tear, but wait for
+          each other. The second one is always the one missing. */
+        }
 #endif
 
       if (!wi->ximage)
@@ -425,40 +605,173 @@ no_xshm:
 
 extern int XShmGetEventBase(Display *d);
 
-- (void) _gotShmCompletion
+/* Sends the damaged rectangles to the X server, each with its own put
+request. With XShm, only the last one asks for a ShmCompletion event; the
+server handles the requests in order, so when it arrives, the image isn't
+in use anymore. If there are front images, the rectangles are copied to
+one the server isn't reading, together with what it missed while the other
+one was used, and it is sent instead.
+
+With XWindowBufferShmPixmapPresent and a shared pixmap, the rectangles are
+copied from the pixmap to the window on the server side instead, and there
+is no ShmCompletion event to wait for. Drawing done meanwhile can at worst
+show up a flush early, as when drawing during a pending XShmPutImage. */
+- (void) _putDamage: (struct XWindowBuffer_damage_s *)damage
 {
+  int i, n, last;
+  unsigned long bytes = 0;
 #ifdef XSHM
-  if (!use_shm)
+  XImage *image = ximage;
+  int front = -1;
+#endif
+
+  /* The window may have shrunk since the rectangles were recorded. */
+  for (i = n = 0; i < damage->num_rects; i++)
+    {
+      int x = damage->rects[i].x, y = damage->rects[i].y;
+      int w = damage->rects[i].w, h = damage->rects[i].h;
+
+      if (x + w > window->xframe.size.width)
+        w = window->xframe.size.width - x;
+      if (y + h > window->xframe.size.height)
+        h = window->xframe.size.height - y;
+      if (x + w > sx)
+        w = sx - x;
+      if (y + h > sy)
+        h = sy - y;
+      if (w <= 0 || h <= 0)
+        continue;
+
+      damage->rects[n].x = x;
+      damage->rects[n].y = y;
+      damage->rects[n].w = w;
+      damage->rects[n].h = h;
+      n++;
+    }
+  damage->num_rects = n;
+  if (!n)
     return;
 
-  pending_event = 0;
-  if (pending_put)
+#ifdef XSHM
+  if (use_shm && front_ximage[0] && !(pixmap && use_pixmap_present))
     {
-      pending_put = 0;
-      if (pending_rect.x + pending_rect.w > window->xframe.size.width)
+      int j, k;
+
+      /* Keep to the last one while it is free, as it then has less to
+      catch up on; the caller makes sure one of them is. */
+      front = front_last;
+      if (front_ximage[1] && front_busy[front])
+        front = !front;
+
+      for (i = 0; i < n; i++)
+        damage_add(&front_stale[front], damage->rects[i].x,
+                   damage->rects[i].y, damage->rects[i].w, damage->rects[i].h);
+      for (i = 0; i < front_stale[front].num_rects; i++)
         {
-          pending_rect.w = window->xframe.size.width - pending_rect.x;
-          if (pending_rect.w <= 0)
-            return;
+          int x = front_stale[front].rects[i].x;
+          int y = front_stale[front].rects[i].y;
+          int w = front_stale[front].rects[i].w;
+          int h = front_stale[front].rects[i].h;
+          int ofs = y * bytes_per_line + (x * bits_per_pixel) / 8;
+          int len = ((x + w) * bits_per_pixel + 7) / 8
+            - (x * bits_per_pixel) / 8;
+
+          for (j = 0; j < h; j++, ofs += bytes_per_line)
+            memcpy(front_ximage[front]->data + ofs, data + ofs, len);
         }
-      if (pending_rect.y + pending_rect.h > window->xframe.size.height)
+      front_stale[front].num_rects = 0;
+
+      k = !front;
+      if (front_ximage[k])
         {
-          pending_rect.h = window->xframe.size.height - pending_rect.y;
-          if (pending_rect.h <= 0)
-            return;
+          for (i = 0; i < n; i++)
+            damage_add(&front_stale[k], damage->rects[i].x,
+                       damage->rects[i].y, damage->rects[i].w,
+                       damage->rects[i].h);
         }
-      if (!XShmPutImage(display, drawable, gc, ximage,
-                        pending_rect.x, pending_rect.y,
-                        pending_rect.x, pending_rect.y,
-                        pending_rect.w, pending_rect.h,
-                        1))
+      image = front_ximage[front];
+    }
+#endif
+
+  last = n - 1;
+  for (i = 0; i < n; i++)
+    {
+      int x = damage->rects[i].x, y = damage->rects[i].y;
+      int w = damage->rects[i].w, h = damage->rects[i].h;
+
+#ifdef XSHM
+      if (use_shm && pixmap && use_pixmap_present)
         {
-          NSLog(@"XShmPutImage failed?");
+          XCopyArea(display, pixmap, drawable, gc, x, y, w, h, x, y);
         }
-      else
+      else if (use_shm)
         {
-          pending_event = 1;
+          if (!XShmPutImage(display, drawable, gc, image,
+                            x, y, x, y, w, h, i == last))
+            {
+              NSLog(@"XShmPutImage failed?");
+              continue;
+            }
+          if (i == last)
+            {
+              if (front < 0)
+                pending_event = 1;
+              else
+                {
+                  front_busy[front] = 1;
+                  front_last = front;
+                  pending_event = front_busy[0]
+                    && (front_busy[1] || !front_ximage[1]);
+                }
+            }
         }
+      else
+#endif
+        XPutImage(display, drawable, gc, ximage, x, y, x, y, w, h);
+
+      bytes += (unsigned long)((w * bits_per_pixel + 7) / 8) * h;
+    }
+
+  flush_bytes = bytes;
+  total_bytes += bytes;
+  num_flushes++;
+  NSDebugLLog(@"XWindowBuffer", @"%p: put %d rects, %lu bytes",
+              self, n, bytes);
+}
+
+- (void) getUploadStatistics: (unsigned long *)lastFlushBytes
+                  totalBytes: (unsigned long long *)totalBytes
+                     flushes: (unsigned long *)flushes
+{
+  if (lastFlushBytes)
+    *lastFlushBytes = flush_bytes;
+  if (totalBytes)
+    *totalBytes = total_bytes;
+  if (flushes)
+    *flushes = num_flushes;
+}
+
+- (void) _gotShmCompletion
+{
+#ifdef XSHM
+  if (!use_shm)
+    return;
+
+  if (front_ximage[0])
+    {
+      /* The events come in the order of the puts, so this is for the
+      older of the two if both are in use. */
+      if (front_busy[0] && front_busy[1])
+        front_busy[!front_last] = 0;
+      else
+        front_busy[0] = front_busy[1] = 0;
+    }
+  pending_event = 0;
+  if (pending_put)
+    {
+      pending_put = 0;
+      [self _putDamage: &pending_damage];
+      pending_damage.num_rects = 0;
     }
 //        XFlush(window->display);
 #endif
@@ -596,45 +909,18 @@ static int warn = 0;
           if (!pending_put)
             {
               pending_put = 1;
-              pending_rect.x = x;
-              pending_rect.y = y;
-              pending_rect.w = w;
-              pending_rect.h = h;
-            }
-          else
-            {
-              if (x < pending_rect.x)
-                {
-                  pending_rect.w += pending_rect.x - x;
-                  pending_rect.x = x;
-                }
-              if (x + w > pending_rect.x + pending_rect.w)
-                {
-                  pending_rect.w = x + w - pending_rect.x;
-                }
-              if (y < pending_rect.y)
-                {
-                  pending_rect.h += pending_rect.y - y;
-                  pending_rect.y = y;
-                }
-              if (y + h > pending_rect.y + pending_rect.h)
-                {
-                  pending_rect.h = y + h - pending_rect.y;
-                }
+              pending_damage.num_rects = 0;
             }
+          damage_add(&pending_damage, x, y, w, h);
         }
       else
         {
+          struct XWindowBuffer_damage_s damage;
+
           pending_put = 0;
-          if (!XShmPutImage(display, drawable, gc, ximage,
-                            x, y, x, y, w, h, 1))
-            {
-              NSLog(@"XShmPutImage failed?");
-            }
-          else
-            {
-              pending_event = 1;
-            }
+          damage.num_rects = 0;
+          damage_add(&damage, x, y, w, h);
+          [self _putDamage: &damage];
         }
 
       /* Performance hack. Check right away for ShmCompletion
@@ -653,7 +939,11 @@ static int warn = 0;
 #endif
     if (ximage)
     {
-      XPutImage(display, drawable, gc, ximage, x, y, x, y, w, h);
+      struct XWindowBuffer_damage_s damage;
+
+      damage.num_rects = 0;
+      damage_add(&damage, x, y, w, h);
+      [self _putDamage: &damage];
     }
 }
 
@@ -725,6 +1015,13 @@ static int warn = 0;
 #endif
         XDestroyImage(ximage);
     }
+#ifdef XSHM
+  for (i = 0; i < 2; i++)
+    {
+      if (front_ximage[i])
+        destroy_front_image(display, front_ximage[i], &front_shminfo[i]);
+    }
+#endif
   if (alpha)
     free(alpha);
   [super dealloc];
@@ -47,6 +47,7 @@
 #endif
 
 extern void _wraster_change_filter(int type);
+extern void _wraster_set_scale_threads(int count);
 
 
 static Bool bestContext(Display *dpy, int screen_number, RContext *context);
@@ -553,6 +554,18 @@ gatherconfig(RContext *context, int screen_n)
 	}
     }
     
+    ptr = mygetenv("WRASTER_SCALE_THREADS", screen_n);
+    if (ptr) {
+	int i;
+	if (sscanf(ptr, "%d", &i)!=1 || i<0) {
+	    printf("wrlib: invalid value for scaling threads \"%s\"\n",ptr);
+	} else {
+#ifndef BENCH
+	    _wraster_set_scale_threads(i);
+#endif
+	}
+    }
+
     ptr = mygetenv("WRASTER_OPTIMIZE_FOR_SPEED", screen_n);
     if (ptr) {
 	context->flags.optimize_for_speed = 1;
@@ -815,6 +828,31 @@ RCreateContext(Display *dpy, int screen_number, RContextAttributes *attribs)
 }
 
 
+void
+RDestroyContext(RContext *context)
+{
+    if (!context)
+	return;
+
+    RDestroyConversionCache(context);
+
+    if (context->copy_gc)
+	XFreeGC(context->dpy, context->copy_gc);
+    if (context->drawable
+	&& context->drawable != RootWindow(context->dpy,
+					   context->screen_number))
+	XDestroyWindow(context->dpy, context->drawable);
+    if (context->pixels)
+	free(context->pixels);
+    if (context->colors)
+	free(context->colors);
+    if (context->hermes_data)
+	free(context->hermes_data);
+    free(context->attribs);
+    free(context);
+}
+
+
 static Bool
 bestContext(Display *dpy, int screen_number, RContext *context)
 {
@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include <assert.h>
 
@@ -70,16 +72,50 @@ typedef struct RStdConversionTable {
 
 
 
-static RConversionTable *conversionTable = NULL;
-static RStdConversionTable *stdConversionTable = NULL;
+/*
+ * The tables and dithering buffers of a context. They are made the first
+ * time a conversion needs them and kept until RDestroyContext(), so that
+ * converting many small images doesn't compute tables and allocate
+ * buffers each time. conversionLock guards them, so that images can be
+ * converted on several threads at once; the tables themselves are never
+ * changed once made and are read without it.
+ */
+typedef struct RConversionCache {
+    RConversionTable *tables;
+    RStdConversionTable *std_tables;
+
+    void *scratch;		       /* error buffers for dithering */
+    size_t scratch_size;
+    int scratch_busy;
+} RConversionCache;
+
+
+static pthread_mutex_t conversionLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Must be called with conversionLock held. */
+static RConversionCache*
+conversionCache(RContext *ctx)
+{
+    if (!ctx->conversion_cache)
+	ctx->conversion_cache = calloc(1, sizeof(RConversionCache));
+    return ctx->conversion_cache;
+}
 
 
 static unsigned short*
-computeTable(unsigned short mask)
+computeTable(RContext *ctx, unsigned short mask)
 {
-    RConversionTable *tmp = conversionTable;
+    RConversionCache *cache;
+    RConversionTable *tmp = NULL;
     int i;
 
+    pthread_mutex_lock(&conversionLock);
+    cache = conversionCache(ctx);
+    if (cache == NULL)
+	goto done;
+
+    tmp = cache->tables;
     while (tmp) {
         if (tmp->index == mask)
             break;
@@ -87,28 +123,37 @@ computeTable(unsigned short mask)
     }
 
     if (tmp)
-        return tmp->table;
+        goto done;
 
     tmp = (RConversionTable *)malloc(sizeof(RConversionTable));
     if (tmp == NULL)
-        return NULL;
+        goto done;
 
     for (i=0;i<256;i++)
         tmp->table[i] = (i*mask + 0x7f)/0xff;
 
     tmp->index = mask;
-    tmp->next = conversionTable;
-    conversionTable = tmp;
-    return tmp->table;
+    tmp->next = cache->tables;
+    cache->tables = tmp;
+done:
+    pthread_mutex_unlock(&conversionLock);
+    return tmp ? tmp->table : NULL;
 }
 
 
 static unsigned int*
-computeStdTable(unsigned int mult, unsigned int max)
+computeStdTable(RContext *ctx, unsigned int mult, unsigned int max)
 {
-    RStdConversionTable *tmp = stdConversionTable;
+    RConversionCache *cache;
+    RStdConversionTable *tmp = NULL;
     unsigned int i;
 
+    pthread_mutex_lock(&conversionLock);
+    cache = conversionCache(ctx);
+    if (cache == NULL)
+	goto done;
+
+    tmp = cache->std_tables;
     while (tmp) {
         if (tmp->mult == mult && tmp->max == max)
             break;
@@ -116,11 +161,11 @@ computeStdTable(unsigned int mult, unsigned int max)
     }
 
     if (tmp)
-        return tmp->table;
+        goto done;
 
     tmp = (RStdConversionTable *)malloc(sizeof(RStdConversionTable));
     if (tmp == NULL)
-        return NULL;
+        goto done;
 
     for (i=0; i<256; i++) {
         tmp->table[i] = (i*max)/0xff * mult;
@@ -128,14 +173,215 @@ computeStdTable(unsigned int mult, unsigned int max)
     tmp->mult = mult;
     tmp->max = max;
 
-    tmp->next = stdConversionTable;
-    stdConversionTable = tmp;
+    tmp->next = cache->std_tables;
+    cache->std_tables = tmp;
+done:
+    pthread_mutex_unlock(&conversionLock);
+    return tmp ? tmp->table : NULL;
+}
+
+
+/*
+ * Returns size bytes of zeroed memory for the error buffers of a
+ * dithering conversion: the context's own buffer, unless another thread
+ * is using it, in which case a new one is allocated.
+ */
+static void*
+getScratch(RContext *ctx, size_t size)
+{
+    RConversionCache *cache;
+    void *buf = NULL;
+
+    pthread_mutex_lock(&conversionLock);
+    cache = conversionCache(ctx);
+    if (cache && !cache->scratch_busy) {
+	if (cache->scratch_size < size) {
+	    free(cache->scratch);
+	    cache->scratch = malloc(size);
+	    cache->scratch_size = cache->scratch ? size : 0;
+	}
+	if (cache->scratch) {
+	    cache->scratch_busy = 1;
+	    buf = cache->scratch;
+	}
+    }
+    pthread_mutex_unlock(&conversionLock);
+
+    if (!buf)
+	buf = malloc(size);
+    if (buf)
+	memset(buf, 0, size);
+    return buf;
+}
+
+
+static void
+releaseScratch(RContext *ctx, void *buf)
+{
+    pthread_mutex_lock(&conversionLock);
+    if (ctx->conversion_cache && buf == ctx->conversion_cache->scratch) {
+	ctx->conversion_cache->scratch_busy = 0;
+	buf = NULL;
+    }
+    pthread_mutex_unlock(&conversionLock);
+    free(buf);
+}
+
+
+void
+RDestroyConversionCache(RContext *ctx)
+{
+    RConversionCache *cache = ctx->conversion_cache;
+
+    if (!cache)
+	return;
+
+    while (cache->tables) {
+	RConversionTable *next = cache->tables->next;
 
-    return tmp->table;
+	free(cache->tables);
+	cache->tables = next;
+    }
+    while (cache->std_tables) {
+	RStdConversionTable *next = cache->std_tables->next;
+
+	free(cache->std_tables);
+	cache->std_tables = next;
+    }
+    free(cache->scratch);
+    free(cache);
+    ctx->conversion_cache = NULL;
 }
 
 /***************************************************************************/
 
+/*
+ * How pixels are stored into a TrueColor XImage. XPutPixel() goes through
+ * a function pointer and handles every format there is, which makes it
+ * the slowest part of a conversion; the common 16 and 32 bits per pixel
+ * formats are written directly instead, in the byte order of the image.
+ */
+enum {
+    PIXEL_GENERIC,		/* use XPutPixel() */
+    PIXEL_32,			/* 32 bits, in the client's byte order */
+    PIXEL_32_SWAPPED,		/* 32 bits, in the other byte order */
+    PIXEL_16,
+    PIXEL_16_SWAPPED
+};
+
+
+static int
+pixelStoreFormat(XImage *xi)
+{
+    static const union { unsigned short s; unsigned char c[2]; } order = { 1 };
+    int swapped = (xi->byte_order == (order.c[0] ? MSBFirst : LSBFirst));
+
+    if (xi->format != ZPixmap)
+	return PIXEL_GENERIC;
+
+    switch (xi->bits_per_pixel) {
+     case 32:
+	return swapped ? PIXEL_32_SWAPPED : PIXEL_32;
+     case 16:
+	return swapped ? PIXEL_16_SWAPPED : PIXEL_16;
+     default:
+	return PIXEL_GENERIC;
+    }
+}
+
+
+static inline void
+storePixel(XImage *xi, int format, unsigned char *row, int x, int y,
+	   unsigned long pixel)
+{
+    uint32_t p32;
+    uint16_t p16;
+
+    switch (format) {
+     case PIXEL_32:
+	((uint32_t *)row)[x] = pixel;
+	break;
+     case PIXEL_32_SWAPPED:
+	p32 = pixel;
+	((uint32_t *)row)[x] = (p32 >> 24) | ((p32 >> 8) & 0xff00)
+	    | ((p32 << 8) & 0xff0000) | (p32 << 24);
+	break;
+     case PIXEL_16:
+	((uint16_t *)row)[x] = pixel;
+	break;
+     case PIXEL_16_SWAPPED:
+	p16 = pixel;
+	((uint16_t *)row)[x] = (p16 >> 8) | (p16 << 8);
+	break;
+     default:
+	XPutPixel(xi, x, y, pixel);
+	break;
+    }
+}
+
+
+/*
+ * Converts without dithering. When every channel has 8 bits and 32 bit
+ * pixels, each row is a plain shift-and-or loop over the source, which
+ * the compiler can vectorize; an image in the other byte order is the
+ * same loop with mirrored offsets.
+ */
+static void
+convertTrueColor_match(XImage *xi, int format, RImage *image,
+		       const unsigned short *rtable,
+		       const unsigned short *gtable,
+		       const unsigned short *btable,
+		       int full,
+		       unsigned short roffs,
+		       unsigned short goffs,
+		       unsigned short boffs)
+{
+    int channels = (image->format == RRGBAFormat ? 4 : 3);
+    int x, y;
+
+    if (full && format == PIXEL_32_SWAPPED
+	&& !(roffs & 7) && !(goffs & 7) && !(boffs & 7)
+	&& roffs <= 24 && goffs <= 24 && boffs <= 24) {
+	roffs = 24 - roffs;
+	goffs = 24 - goffs;
+	boffs = 24 - boffs;
+	format = PIXEL_32;
+    }
+
+    for (y = 0; y < image->height; y++) {
+	const unsigned char *ptr = image->data + y * image->width * channels;
+	unsigned char *row = (unsigned char *)xi->data + y * xi->bytes_per_line;
+
+	if (full && format == PIXEL_32) {
+	    uint32_t *dst = (uint32_t *)row;
+
+	    if (channels == 4) {
+		for (x = 0; x < image->width; x++, ptr += 4)
+		    dst[x] = ((uint32_t)ptr[0] << roffs)
+			| ((uint32_t)ptr[1] << goffs)
+			| ((uint32_t)ptr[2] << boffs);
+	    } else {
+		for (x = 0; x < image->width; x++, ptr += 3)
+		    dst[x] = ((uint32_t)ptr[0] << roffs)
+			| ((uint32_t)ptr[1] << goffs)
+			| ((uint32_t)ptr[2] << boffs);
+	    }
+	} else if (full) {
+	    for (x = 0; x < image->width; x++, ptr += channels)
+		storePixel(xi, format, row, x, y,
+			   ((unsigned long)ptr[0] << roffs)
+			   | ((unsigned long)ptr[1] << goffs)
+			   | ((unsigned long)ptr[2] << boffs));
+	} else {
+	    for (x = 0; x < image->width; x++, ptr += channels)
+		storePixel(xi, format, row, x, y,
+			   ((unsigned long)rtable[ptr[0]] << roffs)
+			   | ((unsigned long)gtable[ptr[1]] << goffs)
+			   | ((unsigned long)btable[ptr[2]] << boffs));
+	}
+    }
+}
+
 
 static void
 convertTrueColor_generic(RXImage *ximg, RImage *image,
@@ -154,9 +400,13 @@ convertTrueColor_generic(RXImage *ximg, RImage *image,
     int rer, ger, ber;
     unsigned char *ptr = image->data;
     int channels = (image->format == RRGBAFormat ? 4 : 3);
+    XImage *xi = ximg->image;
+    int format = pixelStoreFormat(xi);
+    unsigned char *row;
 
     /* convert and dither the image to XImage */
     for (y=0; y<image->height; y++) {
+	row = (unsigned char *)xi->data + y * xi->bytes_per_line;
 	nerr[0] = 0;
 	nerr[1] = 0;
 	nerr[2] = 0;
@@ -185,7 +435,7 @@ convertTrueColor_generic(RXImage *ximg, RImage *image,
 
 
 	    pixel = (r<<roffs) | (g<<goffs) | (b<<boffs);
-	    XPutPixel(ximg->image, x, y, pixel);
+	    storePixel(xi, format, row, x, y, pixel);
 
 	    /* distribute error */
 	    r = (rer*3)/8;
@@ -213,6 +463,7 @@ convertTrueColor_generic(RXImage *ximg, RImage *image,
     /* redither the 1st line to distribute error better */
     ptr=image->data;
     y=0;
+    row = (unsigned char *)xi->data;
     nerr[0] = 0;
     nerr[1] = 0;
     nerr[2] = 0;
@@ -241,7 +492,7 @@ convertTrueColor_generic(RXImage *ximg, RImage *image,
 	
 	
 	pixel = (r<<roffs) | (g<<goffs) | (b<<boffs);
-	XPutPixel(ximg->image, x, y, pixel);
+	storePixel(xi, format, row, x, y, pixel);
 	
 	/* distribute error */
 	r = (rer*3)/8;
@@ -272,7 +523,6 @@ image2TrueColor(RContext *ctx, RImage *image)
     unsigned short rmask, gmask, bmask;
     unsigned short roffs, goffs, boffs;
     unsigned short *rtable, *gtable, *btable;
-    int channels = (image->format == RRGBAFormat ? 4 : 3);
 
     ximg = RCreateXImage(ctx, ctx->depth, image->width, image->height);
     if (!ximg) {
@@ -287,9 +537,9 @@ image2TrueColor(RContext *ctx, RImage *image)
     gmask = ctx->visual->green_mask >> goffs;
     bmask = ctx->visual->blue_mask >> boffs;
 
-    rtable = computeTable(rmask);
-    gtable = computeTable(gmask);
-    btable = computeTable(bmask);
+    rtable = computeTable(ctx, rmask);
+    gtable = computeTable(ctx, gmask);
+    btable = computeTable(ctx, bmask);
 
     if (rtable==NULL || gtable==NULL || btable==NULL) {
 	RErrorCode = RERR_NOMEMORY;
@@ -303,35 +553,14 @@ image2TrueColor(RContext *ctx, RImage *image)
 #endif
 
     if (ctx->attribs->render_mode==RBestMatchRendering) {
-	int ofs, r, g, b;
-	int x, y;
-	unsigned long pixel;
-	unsigned char *ptr = image->data;
-	
         /* fake match */
 #ifdef WR_DEBUG
         puts("true color match");
 #endif
-        if (rmask==0xff && gmask==0xff && bmask==0xff) {
-            for (y=0; y < image->height; y++) {
-                for (x=0; x < image->width; x++, ptr+=channels) {
-                    /* reduce pixel */
-                    pixel = (*(ptr)<<roffs) | (*(ptr+1)<<goffs) | (*(ptr+2)<<boffs);
-                    XPutPixel(ximg->image, x, y, pixel);
-                }
-            }
-        } else {
-            for (y=0, ofs=0; y < image->height; y++) {
-                for (x=0; x < image->width; x++, ofs+=channels-3) {
-                    /* reduce pixel */
-                    r = rtable[ptr[ofs++]];
-                    g = gtable[ptr[ofs++]];
-                    b = btable[ptr[ofs++]];
-                    pixel = (r<<roffs) | (g<<goffs) | (b<<boffs);
-                    XPutPixel(ximg->image, x, y, pixel);
-                }
-            }
-        }
+	convertTrueColor_match(ximg->image, pixelStoreFormat(ximg->image),
+			       image, rtable, gtable, btable,
+			       rmask==0xff && gmask==0xff && bmask==0xff,
+			       roffs, goffs, boffs);
     } else {
         /* dither */
 	const int dr=0xff/rmask;
@@ -346,26 +575,18 @@ image2TrueColor(RContext *ctx, RImage *image)
 	    signed char *nerr;
 	    int ch = (image->format == RRGBAFormat ? 4 : 3);
 
-	    err = malloc(ch*(image->width+2));
-	    nerr = malloc(ch*(image->width+2));
-	    if (!err || !nerr) {
-		if (nerr)
-		    free(nerr);
-		if (err)
-		    free(err);
+	    err = getScratch(ctx, 2*ch*(image->width+2));
+	    if (!err) {
 		RErrorCode = RERR_NOMEMORY;
 		RDestroyXImage(ctx, ximg);
 		return NULL;
 	    }
-	    
-	    memset(err, 0, ch*(image->width+2));
-	    memset(nerr, 0, ch*(image->width+2));
+	    nerr = err + ch*(image->width+2);
 
 	    convertTrueColor_generic(ximg, image, err, nerr, 
 				     rtable, gtable, btable,
 				     dr, dg, db, roffs, goffs, boffs);
-	    free(err);
-	    free(nerr);
+	    releaseScratch(ctx, err);
 	}
 
     }
@@ -481,9 +702,9 @@ image2PseudoColor(RContext *ctx, RImage *image)
     ptr = image->data;
 
     /* Tables are same at the moment because rmask==gmask==bmask. */
-    rtable = computeTable(rmask);
-    gtable = computeTable(gmask);
-    btable = computeTable(bmask);
+    rtable = computeTable(ctx, rmask);
+    gtable = computeTable(ctx, gmask);
+    btable = computeTable(ctx, bmask);
 
     if (rtable==NULL || gtable==NULL || btable==NULL) {
 	RErrorCode = RERR_NOMEMORY;
@@ -519,26 +740,19 @@ image2PseudoColor(RContext *ctx, RImage *image)
 #ifdef WR_DEBUG
         printf("pseudo color dithering with %d colors per channel\n", cpc);
 #endif
-	err = malloc(4*(image->width+3));
-	nerr = malloc(4*(image->width+3));
-	if (!err || !nerr) {
-	    if (nerr)
-		free(nerr);
-	    if (err)
-		free(err);
+	err = getScratch(ctx, 2*4*(image->width+3));
+	if (!err) {
 	    RErrorCode = RERR_NOMEMORY;
 	    RDestroyXImage(ctx, ximg);
 	    return NULL;
 	}
-	memset(err, 0, 4*(image->width+3));
-	memset(nerr, 0, 4*(image->width+3));
+	nerr = err + 4*(image->width+3);
 
 	convertPseudoColor_to_8(ximg, image, err+4, nerr+4,
 				rtable,	gtable,	btable,
 				dr, dg, db, ctx->pixels, cpc);
 
-	free(err);
-	free(nerr);
+	releaseScratch(ctx, err);
     }
     
     return ximg;
@@ -571,13 +785,13 @@ image2StandardPseudoColor(RContext *ctx, RImage *image)
     data = (unsigned char *)ximg->image->data;
 
 
-    rtable = computeStdTable(ctx->std_rgb_map->red_mult,
+    rtable = computeStdTable(ctx, ctx->std_rgb_map->red_mult,
 			     ctx->std_rgb_map->red_max);
 
-    gtable = computeStdTable(ctx->std_rgb_map->green_mult,
+    gtable = computeStdTable(ctx, ctx->std_rgb_map->green_mult,
 			     ctx->std_rgb_map->green_max);
 
-    btable = computeStdTable(ctx->std_rgb_map->blue_mult,
+    btable = computeStdTable(ctx, ctx->std_rgb_map->blue_mult,
 			     ctx->std_rgb_map->blue_max);
 
     if (rtable==NULL || gtable==NULL || btable==NULL) {
@@ -601,23 +815,21 @@ image2StandardPseudoColor(RContext *ctx, RImage *image)
 	/* dither */
 	signed short *err, *nerr;
 	signed short *terr;
+	void *scratch;
 	int rer, ger, ber;
 	int x1, ofs;
 
 #ifdef WR_DEBUG
         printf("pseudo color dithering with %d colors per channel\n", channels);
 #endif
-	err = (short*)malloc(3*(image->width+2)*sizeof(short));
-	nerr = (short*)malloc(3*(image->width+2)*sizeof(short));
-	if (!err || !nerr) {
-	    if (err)
-		free(err);
-	    if (nerr)
-		free(nerr);
+	scratch = getScratch(ctx, 2*3*(image->width+2)*sizeof(short));
+	if (!scratch) {
 	    RErrorCode = RERR_NOMEMORY;
 	    RDestroyXImage(ctx, ximg);
 	    return NULL;
 	}
+	err = (short*)scratch;
+	nerr = err + 3*(image->width+2);
 	for (x=0, x1=0; x<image->width*3; x1+=channels-3) {
 	    err[x++] = ptr[x1++];
 	    err[x++] = ptr[x1++];
@@ -686,8 +898,7 @@ image2StandardPseudoColor(RContext *ctx, RImage *image)
 
 	    ofs += ximg->image->bytes_per_line - image->width;
 	}
-	free(err);
-	free(nerr);
+	releaseScratch(ctx, scratch);
     }
     ximg->image->data = (char*)data;
 
@@ -723,7 +934,7 @@ image2GrayScale(RContext *ctx, RImage *image)
     else
 	gmask  = cpc*cpc*cpc-1;
 
-    table = computeTable(gmask);
+    table = computeTable(ctx, gmask);
 
     if (table==NULL) {
 	RErrorCode = RERR_NOMEMORY;
@@ -750,23 +961,21 @@ image2GrayScale(RContext *ctx, RImage *image)
 	short *gerr;
 	short *ngerr;
 	short *terr;
+	void *scratch;
 	int ger;
 	const int dg=0xff/gmask;
 
 #ifdef WR_DEBUG
         printf("grayscale dither with %d colors per channel\n", cpc);
 #endif
-	gerr = (short*)malloc((image->width+2)*sizeof(short));
-	ngerr = (short*)malloc((image->width+2)*sizeof(short));
-	if (!gerr || !ngerr) {
-	    if (ngerr)
-		free(ngerr);
-	    if (gerr)
-		free(gerr);
+	scratch = getScratch(ctx, 2*(image->width+2)*sizeof(short));
+	if (!scratch) {
 	    RErrorCode = RERR_NOMEMORY;
 	    RDestroyXImage(ctx, ximg);
 	    return NULL;
 	}
+	gerr = (short*)scratch;
+	ngerr = gerr + (image->width+2);
 	for (x=0, y=0; x<image->width; x++, y+=channels) {
 	    gerr[x] = (ptr[y]*30 + ptr[y+1]*59 + ptr[y+2]*11)/100;
 	}
@@ -807,8 +1016,7 @@ image2GrayScale(RContext *ctx, RImage *image)
 	    gerr = ngerr;
 	    ngerr = terr;
 	}
-	free(gerr);
-	free(ngerr);
+	releaseScratch(ctx, scratch);
     }
     ximg->image->data = (char*)data;
 
@@ -1069,9 +1277,9 @@ RGetClosestXColor(RContext *context, RColor *color, XColor *retColor)
 	gmask = context->visual->green_mask >> goffs;
 	bmask = context->visual->blue_mask >> boffs;
 	
-	rtable = computeTable(rmask);
-	gtable = computeTable(gmask);
-	btable = computeTable(bmask);
+	rtable = computeTable(context, rmask);
+	gtable = computeTable(context, gmask);
+	btable = computeTable(context, bmask);
 
         retColor->pixel = (rtable[color->red]<<roffs) |
 	    (gtable[color->green]<<goffs) | (btable[color->blue]<<boffs);
@@ -1087,13 +1295,13 @@ RGetClosestXColor(RContext *context, RColor *color, XColor *retColor)
 	if (context->attribs->standard_colormap_mode != RIgnoreStdColormap) {
 	    unsigned int *rtable, *gtable, *btable;
 
-	    rtable = computeStdTable(context->std_rgb_map->red_mult,
+	    rtable = computeStdTable(context, context->std_rgb_map->red_mult,
 				     context->std_rgb_map->red_max);
 
-	    gtable = computeStdTable(context->std_rgb_map->green_mult,
+	    gtable = computeStdTable(context, context->std_rgb_map->green_mult,
 				     context->std_rgb_map->green_max);
 
-	    btable = computeStdTable(context->std_rgb_map->blue_mult,
+	    btable = computeStdTable(context, context->std_rgb_map->blue_mult,
 				     context->std_rgb_map->blue_max);
 
 	    if (rtable==NULL || gtable==NULL || btable==NULL) {
@@ -1119,9 +1327,9 @@ RGetClosestXColor(RContext *context, RColor *color, XColor *retColor)
 	    const int cpccpc = cpc*cpc;
 	    int index;
 
-	    rtable = computeTable(rmask);
-	    gtable = computeTable(gmask);
-	    btable = computeTable(bmask);
+	    rtable = computeTable(context, rmask);
+	    gtable = computeTable(context, gmask);
+	    btable = computeTable(context, bmask);
 
 	    if (rtable==NULL || gtable==NULL || btable==NULL) {
 		RErrorCode = RERR_NOMEMORY;
@@ -1144,7 +1352,7 @@ RGetClosestXColor(RContext *context, RColor *color, XColor *retColor)
 	else
 	    gmask  = cpc*cpc*cpc-1;
 
-	table = computeTable(gmask);
+	table = computeTable(context, gmask);
 	if (!table)
 	    return False;
 
@@ -27,6 +27,12 @@
 #include <string.h>
 #include <X11/Xlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifndef PI
 #define PI 3.14159265358979323846
@@ -348,39 +354,32 @@ Mitchell_filter(double t)
     return(0.0);
 }
 
-static double (*filterf)(double) = Mitchell_filter;
-static double fwidth = Mitchell_support;
+typedef struct {
+    double (*f)(double);
+    double support;
+} RScaleFilter;
+
+/* Indexed by the RBoxFilter... constants. */
+static const RScaleFilter filters[] = {
+    {box_filter, box_support},
+    {triangle_filter, triangle_support},
+    {bell_filter, bell_support},
+    {B_spline_filter, B_spline_support},
+    {Lanczos3_filter, Lanczos3_support},
+    {Mitchell_filter, Mitchell_support}
+};
+
+#define NFILTERS	(int)(sizeof(filters) / sizeof(filters[0]))
+
+/* The filter RSmoothScaleImage() uses. */
+static volatile int default_filter = RMitchellFilter;
 
 void
 _wraster_change_filter(int type)
 {
-    switch (type) {
-     case RBoxFilter:
-	filterf = box_filter;
-	fwidth = box_support;
-	break;
-     case RTriangleFilter:
-	filterf = triangle_filter;
-	fwidth = triangle_support;
-	break;
-     case RBellFilter:
-	filterf = bell_filter;
-	fwidth = bell_support;
-	break;
-     case RBSplineFilter:
-	filterf = B_spline_filter;
-	fwidth = B_spline_support;
-	break;
-     case RLanczos3Filter:
-	filterf = Lanczos3_filter;
-	fwidth = Lanczos3_support;
-	break;
-     default:
-     case RMitchellFilter:
-	filterf = Mitchell_filter;
-	fwidth = Mitchell_support;
-	break;
-    }
+    if (type < 0 || type >= NFILTERS)
+	type = RMitchellFilter;
+    default_filter = type;
 }
 
 
@@ -398,15 +397,23 @@ typedef struct {
     CONTRIB	*p;		/* pointer to list of contributions */
 } CLIST;
 
-CLIST	*contrib;		/* array of contribution lists */
 
 /* clamp the input to the specified range */
 #define CLAMP(v,l,h)    ((v)<(l) ? (l) : (v) > (h) ? (h) : v)
 
 
-RImage*
-RSmoothScaleImage(RImage *src, unsigned new_width, unsigned new_height)
+/*
+ * The original floating point scaler. It is still used when the filter
+ * is so wide (when shrinking an image a lot) that fixed point weights
+ * would lose too much precision.
+ */
+static RImage*
+smoothScaleDouble(RImage *src, unsigned new_width, unsigned new_height,
+		  const RScaleFilter *filter)
 {    
+    double (*filterf)(double) = filter->f;
+    double fwidth = filter->support;
+    CLIST *contrib;		       /* array of contribution lists */
     RImage *tmp;		       /* intermediate image */
     double xscale, yscale;	       /* zoom scale factors */
     int i, j, k;		       /* loop variables */
@@ -629,3 +636,597 @@ RSmoothScaleImage(RImage *src, unsigned new_width, unsigned new_height)
     return dst;
 }
 
+
+/*
+ * The fixed point scaler. It does the same separable passes as
+ * smoothScaleDouble(), with the filter contributions computed as 16 bit
+ * weights with WEIGHT_BITS fraction bits, normalized so that each set of
+ * weights adds up to exactly one. The contributions depend only on the
+ * sizes and the filter, and the last few are cached for the next image of
+ * the same size. The intermediate image has 4 bytes per pixel, so that
+ * each pixel is handled as one 4 channel vector. Large images are split
+ * in bands of rows that are scaled in parallel by the worker threads set
+ * up with _wraster_set_scale_threads().
+ */
+
+#define WEIGHT_BITS	14
+#define MAX_TAPS	256	       /* above this, use smoothScaleDouble() */
+
+
+/*
+ * Destination pixel i is the weighted sum of source pixels start[i] to
+ * start[i] + taps - 1. Pixels outside the source are mirrored at its
+ * edges, as smoothScaleDouble() does; index[] has the mirrored pixels,
+ * and pad is how far outside the source the taps reach. The weights are
+ * also kept in pairs, as one int each, for the multiply-adds.
+ */
+typedef struct {
+    int src_size;		       /* the cache key */
+    int size;			       /* number of destination pixels */
+    int filter;
+    int refs;			       /* protected by contrib_lock */
+    int taps;			       /* contributions for each, even */
+    int pad;
+    int *start;			       /* size first source pixels */
+    int *index;			       /* size*taps mirrored source pixels */
+    short *weight;		       /* size*taps weights */
+    int32_t *pairs;		       /* size*taps/2 pairs of weights */
+} RScaleContrib;
+
+
+static void
+freeContrib(RScaleContrib *c)
+{
+    if (c) {
+	free(c->start);
+	free(c->index);
+	free(c->weight);
+	free(c->pairs);
+	free(c);
+    }
+}
+
+
+static inline int
+mirror(int j, int size)
+{
+    if (j < 0)
+	j = -j;
+    else if (j >= size)
+	j = (size - j) + size - 1;
+    return CLAMP(j, 0, size - 1);
+}
+
+
+static RScaleContrib*
+makeContrib(int src_size, int dst_size, int filter)
+{
+    double (*f)(double) = filters[filter].f;
+    double support = filters[filter].support;
+    RScaleContrib *c;
+    double scale = (double)dst_size / (double)src_size;
+    double width, fscale;
+    double *w;
+    int i, j, taps;
+
+    if (scale < 1.0) {
+	width = support / scale;
+	fscale = 1.0 / scale;
+    } else {
+	width = support;
+	fscale = 1.0;
+    }
+    taps = (int)(2 * width) + 1;
+    taps += taps & 1;
+    if (taps > MAX_TAPS)
+	return NULL;
+
+    c = calloc(1, sizeof(RScaleContrib));
+    w = malloc(taps * sizeof(double));
+    if (!c || !w) {
+	free(c);
+	free(w);
+	return NULL;
+    }
+    c->src_size = src_size;
+    c->size = dst_size;
+    c->filter = filter;
+    c->refs = 1;
+    c->taps = taps;
+    c->start = calloc(dst_size, sizeof(int));
+    c->index = calloc(dst_size * taps, sizeof(int));
+    c->weight = calloc(dst_size * taps, sizeof(short));
+    c->pairs = calloc(dst_size * taps / 2, sizeof(int32_t));
+    if (!c->start || !c->index || !c->weight || !c->pairs) {
+	free(w);
+	freeContrib(c);
+	return NULL;
+    }
+
+    for (i = 0; i < dst_size; i++) {
+	short *weight = c->weight + i * taps;
+	double center = (double) i / scale;
+	int left = ceil(center - width);
+	int total = 0, biggest = 0;
+	double sum = 0;
+
+	c->start[i] = left;
+	if (-left > c->pad)
+	    c->pad = -left;
+	if (left + taps - src_size > c->pad)
+	    c->pad = left + taps - src_size;
+
+	for (j = 0; j < taps; j++) {
+	    c->index[i * taps + j] = mirror(left + j, src_size);
+	    if (left + j <= center + width)
+		w[j] = (*f)((center - (double)(left + j)) / fscale) / fscale;
+	    else
+		w[j] = 0;
+	    sum += w[j];
+	}
+	if (sum == 0)
+	    sum = 1;
+
+	/* Round the normalized weights, and give what rounding lost or
+	 * added to the biggest one, so that they add up to one exactly and
+	 * flat areas keep their colour. */
+	for (j = 0; j < taps; j++) {
+	    double v = floor(w[j] / sum * (1 << WEIGHT_BITS) + 0.5);
+
+	    if (v > 32000 || v < -32000) {
+		/* Doesn't happen with the filters we have, but the
+		 * weights must fit in a short. */
+		free(w);
+		freeContrib(c);
+		return NULL;
+	    }
+	    weight[j] = v;
+	    total += weight[j];
+	    if (weight[j] > weight[biggest])
+		biggest = j;
+	}
+	weight[biggest] += (1 << WEIGHT_BITS) - total;
+
+	for (j = 0; j < taps; j += 2)
+	    c->pairs[(i * taps + j) / 2] = (uint16_t)weight[j]
+		| ((uint32_t)(uint16_t)weight[j+1] << 16);
+    }
+
+    free(w);
+    return c;
+}
+
+
+/*
+ * The contributions cache. The most recently used are first; each
+ * entry holds one reference, and each scaling in progress another, so
+ * an entry can be dropped from the cache while it's being used.
+ */
+#define CONTRIB_CACHE_SIZE	16
+
+static RScaleContrib *contrib_cache[CONTRIB_CACHE_SIZE];
+static pthread_mutex_t contrib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void
+releaseContrib(RScaleContrib *c)
+{
+    int refs;
+
+    if (!c)
+	return;
+    pthread_mutex_lock(&contrib_lock);
+    refs = --c->refs;
+    pthread_mutex_unlock(&contrib_lock);
+    if (refs == 0)
+	freeContrib(c);
+}
+
+
+/* Looks for the contributions in the cache, and computes and adds them
+ * if they aren't there. The result must be released with
+ * releaseContrib(). */
+static RScaleContrib*
+getContrib(int src_size, int dst_size, int filter)
+{
+    RScaleContrib *c, *old;
+    int i;
+
+    pthread_mutex_lock(&contrib_lock);
+    for (i = 0; i < CONTRIB_CACHE_SIZE && contrib_cache[i]; i++) {
+	c = contrib_cache[i];
+	if (c->src_size == src_size && c->size == dst_size
+	    && c->filter == filter) {
+	    memmove(contrib_cache + 1, contrib_cache, i * sizeof(c));
+	    contrib_cache[0] = c;
+	    c->refs++;
+	    pthread_mutex_unlock(&contrib_lock);
+	    return c;
+	}
+    }
+    pthread_mutex_unlock(&contrib_lock);
+
+    /* Computed without the lock; if another thread computes the same ones
+     * meanwhile, both end up in the cache, and the older copy soon drops
+     * out of it. */
+    c = makeContrib(src_size, dst_size, filter);
+    if (!c)
+	return NULL;
+
+    pthread_mutex_lock(&contrib_lock);
+    old = contrib_cache[CONTRIB_CACHE_SIZE - 1];
+    if (old && --old->refs > 0)
+	old = NULL;
+    memmove(contrib_cache + 1, contrib_cache,
+	    (CONTRIB_CACHE_SIZE - 1) * sizeof(c));
+    contrib_cache[0] = c;
+    c->refs++;
+    pthread_mutex_unlock(&contrib_lock);
+    freeContrib(old);
+    return c;
+}
+
+
+typedef struct {
+    RImage *src;
+    unsigned char *tmp;		       /* 4 bytes per pixel */
+    RImage *dst;
+    RScaleContrib *xc, *yc;
+} RScaleJob;
+
+
+/* Horizontal pass, for source rows y0 to y1. Returns False if it could
+ * not get its row buffer. */
+static int
+scaleRows(RScaleJob *job, int y0, int y1)
+{
+    RImage *src = job->src;
+    RScaleContrib *xc = job->xc;
+    int sch = src->format == RRGBAFormat ? 4 : 3;
+    int taps = xc->taps;
+    unsigned char *row;
+    int x, y, t;
+
+    /* Each source row is copied with 4 bytes per pixel and its mirrored
+     * edges, so that the taps of a pixel are side by side. */
+    row = malloc((src->width + 2 * xc->pad) * 4);
+    if (!row)
+	return False;
+
+    for (y = y0; y < y1; y++) {
+	const unsigned char *sp = src->data + y * src->width * sch;
+	unsigned char *dp = job->tmp + y * xc->size * 4;
+
+	for (x = -xc->pad; x < src->width + xc->pad; x++) {
+	    const unsigned char *pp = sp + mirror(x, src->width) * sch;
+	    unsigned char *rp = row + (x + xc->pad) * 4;
+
+	    rp[0] = pp[0];
+	    rp[1] = pp[1];
+	    rp[2] = pp[2];
+	    rp[3] = 0;
+	}
+
+	for (x = 0; x < xc->size; x++, dp += 4) {
+	    const unsigned char *pp = row + (xc->start[x] + xc->pad) * 4;
+#ifdef __SSE2__
+	    const int32_t *pairs = xc->pairs + x * taps / 2;
+	    __m128i zero = _mm_setzero_si128();
+	    __m128i acc = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+	    int v;
+
+	    for (t = 0; t < taps; t += 2, pp += 8) {
+		__m128i ab;
+
+		/* Interleave the channels of two neighbouring pixels as 16
+		 * bit values, so that one multiply-add applies both of
+		 * their weights. */
+		ab = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pp),
+				       zero);
+		ab = _mm_unpacklo_epi16(ab, _mm_srli_si128(ab, 8));
+		acc = _mm_add_epi32(acc,
+				    _mm_madd_epi16(ab,
+						   _mm_set1_epi32(pairs[t/2])));
+	    }
+	    acc = _mm_srai_epi32(acc, WEIGHT_BITS);
+	    acc = _mm_packs_epi32(acc, acc);
+	    v = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+	    memcpy(dp, &v, 4);
+#else
+	    const short *weight = xc->weight + x * taps;
+	    int r = 1 << (WEIGHT_BITS - 1), g = r, b = r;
+
+	    for (t = 0; t < taps; t++, pp += 4) {
+		r += pp[0] * weight[t];
+		g += pp[1] * weight[t];
+		b += pp[2] * weight[t];
+	    }
+	    r >>= WEIGHT_BITS;
+	    g >>= WEIGHT_BITS;
+	    b >>= WEIGHT_BITS;
+	    dp[0] = CLAMP(r, 0, 255);
+	    dp[1] = CLAMP(g, 0, 255);
+	    dp[2] = CLAMP(b, 0, 255);
+	    dp[3] = 0;
+#endif
+	}
+    }
+    free(row);
+    return True;
+}
+
+
+/* Vertical pass, for destination rows y0 to y1. */
+static int
+scaleColumns(RScaleJob *job, int y0, int y1)
+{
+    RScaleContrib *xc = job->xc, *yc = job->yc;
+    int width = xc->size;
+    int stride = width * 4;
+    int taps = yc->taps;
+    int x, y, t;
+
+    for (y = y0; y < y1; y++) {
+	const int *index = yc->index + y * taps;
+	const short *weight = yc->weight + y * taps;
+	unsigned char *dp = job->dst->data + y * width * 3;
+
+	x = 0;
+#ifdef __SSE2__
+	/* Four pixels at a time; the interleaving is the same as in
+	 * scaleRows(), with two rows instead of two pixels. */
+	for (; x + 4 <= width; x += 4, dp += 12) {
+	    const int32_t *pairs = yc->pairs + y * taps / 2;
+	    __m128i zero = _mm_setzero_si128();
+	    __m128i acc0 = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+	    __m128i acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	    unsigned char px[16];
+
+	    for (t = 0; t < taps; t += 2) {
+		__m128i a, b, lo, hi, w = _mm_set1_epi32(pairs[t/2]);
+
+		a = _mm_loadu_si128((const __m128i *)
+				    (job->tmp + index[t] * stride + x * 4));
+		b = _mm_loadu_si128((const __m128i *)
+				    (job->tmp + index[t+1] * stride + x * 4));
+		lo = _mm_unpacklo_epi8(a, zero);
+		hi = _mm_unpacklo_epi8(b, zero);
+		acc0 = _mm_add_epi32(acc0,
+				     _mm_madd_epi16(_mm_unpacklo_epi16(lo, hi), w));
+		acc1 = _mm_add_epi32(acc1,
+				     _mm_madd_epi16(_mm_unpackhi_epi16(lo, hi), w));
+		lo = _mm_unpackhi_epi8(a, zero);
+		hi = _mm_unpackhi_epi8(b, zero);
+		acc2 = _mm_add_epi32(acc2,
+				     _mm_madd_epi16(_mm_unpacklo_epi16(lo, hi), w));
+		acc3 = _mm_add_epi32(acc3,
+				     _mm_madd_epi16(_mm_unpackhi_epi16(lo, hi), w));
+	    }
+	    acc0 = _mm_packs_epi32(_mm_srai_epi32(acc0, WEIGHT_BITS),
+				   _mm_srai_epi32(acc1, WEIGHT_BITS));
+	    acc2 = _mm_packs_epi32(_mm_srai_epi32(acc2, WEIGHT_BITS),
+				   _mm_srai_epi32(acc3, WEIGHT_BITS));
+	    _mm_storeu_si128((__m128i *)px, _mm_packus_epi16(acc0, acc2));
+	    for (t = 0; t < 4; t++) {
+		dp[t*3] = px[t*4];
+		dp[t*3+1] = px[t*4+1];
+		dp[t*3+2] = px[t*4+2];
+	    }
+	}
+#endif
+	for (; x < width; x++, dp += 3) {
+	    int r = 1 << (WEIGHT_BITS - 1), g = r, b = r;
+
+	    for (t = 0; t < taps; t++) {
+		const unsigned char *pp = job->tmp + index[t] * stride + x * 4;
+
+		r += pp[0] * weight[t];
+		g += pp[1] * weight[t];
+		b += pp[2] * weight[t];
+	    }
+	    r >>= WEIGHT_BITS;
+	    g >>= WEIGHT_BITS;
+	    b >>= WEIGHT_BITS;
+	    dp[0] = CLAMP(r, 0, 255);
+	    dp[1] = CLAMP(g, 0, 255);
+	    dp[2] = CLAMP(b, 0, 255);
+	}
+    }
+    return True;
+}
+
+
+/*
+ * The worker pool. It is off unless _wraster_set_scale_threads() was
+ * called with a positive number (RCreateContext() does it for the
+ * WRASTER_SCALE_THREADS environment variable). Scaling jobs smaller than
+ * POOL_THRESHOLD multiply-adds are done on the calling thread, and so are
+ * jobs started while another thread is using the pool. The calling
+ * thread takes bands too.
+ */
+#define POOL_MAX_THREADS	16
+#define POOL_THRESHOLD		(1 << 20)
+#define POOL_BAND		16
+
+static int pool_wanted = 0;
+static int pool_started = 0;
+
+static pthread_mutex_t pool_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_finished = PTHREAD_COND_INITIALIZER;
+
+/* The current pass; protected by pool_lock. */
+static struct {
+    int (*func)(RScaleJob *job, int y0, int y1);
+    RScaleJob *job;
+    int rows;
+    int next;			       /* first row nobody has taken yet */
+    int busy;			       /* bands taken but not finished */
+    int failed;			       /* a band returned False */
+    unsigned generation;
+} pool;
+
+
+/* Takes and does bands of the current pass until there are none left.
+ * Called with pool_lock held. */
+static void
+poolRunBands(void)
+{
+    while (pool.next < pool.rows) {
+	int y0 = pool.next;
+	int y1 = y0 + POOL_BAND < pool.rows ? y0 + POOL_BAND : pool.rows;
+	int ok;
+
+	pool.next = y1;
+	pool.busy++;
+	pthread_mutex_unlock(&pool_lock);
+	ok = pool.func(pool.job, y0, y1);
+	pthread_mutex_lock(&pool_lock);
+	if (!ok)
+	    pool.failed = 1;
+	if (--pool.busy == 0 && pool.next >= pool.rows)
+	    pthread_cond_broadcast(&pool_finished);
+    }
+}
+
+
+static void*
+poolWorker(void *arg)
+{
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+	while (pool.generation == seen)
+	    pthread_cond_wait(&pool_start, &pool_lock);
+	seen = pool.generation;
+	poolRunBands();
+    }
+    return NULL;
+}
+
+
+/* Must be called with pool_job_lock held. */
+static int
+poolStart(void)
+{
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (pool_started < pool_wanted) {
+	pthread_t thread;
+
+	if (pthread_create(&thread, &attr, poolWorker, NULL) != 0)
+	    break;
+	pool_started++;
+    }
+    pthread_attr_destroy(&attr);
+    return pool_started;
+}
+
+
+/* Returns False if a band of the pass failed. */
+static int
+poolRun(int (*func)(RScaleJob *job, int y0, int y1), RScaleJob *job,
+	int rows)
+{
+    int ok;
+
+    pthread_mutex_lock(&pool_lock);
+    pool.func = func;
+    pool.job = job;
+    pool.rows = rows;
+    pool.next = 0;
+    pool.busy = 0;
+    pool.failed = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool_start);
+    poolRunBands();
+    while (pool.busy > 0)
+	pthread_cond_wait(&pool_finished, &pool_lock);
+    ok = !pool.failed;
+    pthread_mutex_unlock(&pool_lock);
+    return ok;
+}
+
+
+void
+_wraster_set_scale_threads(int count)
+{
+    pthread_mutex_lock(&pool_job_lock);
+    pool_wanted = CLAMP(count, 0, POOL_MAX_THREADS);
+    pthread_mutex_unlock(&pool_job_lock);
+}
+
+
+RImage*
+RSmoothScaleImageWithFilter(RImage *src, unsigned new_width,
+			    unsigned new_height, int filter)
+{
+    RScaleJob job;
+    RImage *dst;
+    int parallel, ok;
+
+    if (filter < 0 || filter >= NFILTERS)
+	filter = RMitchellFilter;
+
+    dst = RCreateImage(new_width, new_height, False);
+    if (!dst)
+	return NULL;
+
+    job.src = src;
+    job.dst = dst;
+    job.xc = getContrib(src->width, new_width, filter);
+    job.yc = getContrib(src->height, new_height, filter);
+    job.tmp = malloc((size_t)new_width * src->height * 4);
+    if (!job.xc || !job.yc || !job.tmp) {
+	releaseContrib(job.xc);
+	releaseContrib(job.yc);
+	free(job.tmp);
+	RReleaseImage(dst);
+	return smoothScaleDouble(src, new_width, new_height,
+				 &filters[filter]);
+    }
+
+    parallel = 0;
+    if ((double)new_width * (src->height * job.xc->taps
+			     + new_height * job.yc->taps) >= POOL_THRESHOLD
+	&& pthread_mutex_trylock(&pool_job_lock) == 0) {
+	if (pool_wanted > 0 && poolStart() > 0)
+	    parallel = 1;
+	else
+	    pthread_mutex_unlock(&pool_job_lock);
+    }
+
+    if (parallel) {
+	ok = poolRun(scaleRows, &job, src->height);
+	if (ok)
+	    poolRun(scaleColumns, &job, new_height);
+	pthread_mutex_unlock(&pool_job_lock);
+    } else {
+	ok = scaleRows(&job, 0, src->height);
+	if (ok)
+	    scaleColumns(&job, 0, new_height);
+    }
+
+    releaseContrib(job.xc);
+    releaseContrib(job.yc);
+    free(job.tmp);
+    if (!ok) {
+	/* Some rows of tmp were never filled in. */
+	RReleaseImage(dst);
+	RErrorCode = RERR_NOMEMORY;
+	return NULL;
+    }
+    return dst;
+}
+
+
+RImage*
+RSmoothScaleImage(RImage *src, unsigned new_width, unsigned new_height)
+{
+    return RSmoothScaleImageWithFilter(src, new_width, new_height,
+				       default_filter);
+}
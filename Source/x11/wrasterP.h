@@ -39,4 +39,8 @@ typedef struct RHermesData {
 #endif
 
 
+/* Frees the conversion tables and buffers of a context (convert.c). */
+void RDestroyConversionCache(RContext *context);
+
+
 #endif
@@ -0,0 +1,137 @@
+/* xeventbatch.c - batches of X events for the GNUstep X11 server. See
+ * Headers/x11/xeventbatch.h.
+ */
+#include <string.h>
+#include "x11/xeventbatch.h"
+
+int
+XEventBatchPeek(XEventBatch *batch, Display *dpy, XEvent *event, int mode)
+{
+    if (batch != NULL && batch->next < batch->count) {
+        *event = batch->events[batch->next];
+        return 1;
+    }
+    if (dpy != NULL && XEventsQueued(dpy, mode) > 0) {
+        XPeekEvent(dpy, event);
+        return 1;
+    }
+    return 0;
+}
+
+int
+XEventBatchTake(XEventBatch *batch, Display *dpy, XEvent *event)
+{
+    if (batch != NULL && batch->next < batch->count) {
+        *event = batch->events[batch->next++];
+        return 0;
+    }
+    XNextEvent(dpy, event);
+    return 1;
+}
+
+int
+XEventBatchCoalesce(XEventBatch *batch)
+{
+    int i, j, n;
+
+    for (i = 0; i < batch->count; i++) {
+        XEvent *ev = &batch->events[i];
+
+        if (ev->type != ConfigureNotify && ev->type != PropertyNotify
+            && ev->type != Expose)
+            continue;
+        for (j = 0; j < batch->count; j++) {
+            XEvent *other = &batch->events[j];
+
+            if (j == i || other->type != ev->type
+                || other->xany.window != ev->xany.window)
+                continue;
+            if (ev->type == ConfigureNotify) {
+                if (j > i
+                    && other->xconfigure.send_event == ev->xconfigure.send_event)
+                    break;
+            } else if (ev->type == PropertyNotify) {
+                if (j > i
+                    && other->xproperty.atom == ev->xproperty.atom
+                    && other->xproperty.state == ev->xproperty.state)
+                    break;
+            } else if (other->xexpose.x <= ev->xexpose.x
+                       && other->xexpose.y <= ev->xexpose.y
+                       && other->xexpose.x + other->xexpose.width
+                          >= ev->xexpose.x + ev->xexpose.width
+                       && other->xexpose.y + other->xexpose.height
+                          >= ev->xexpose.y + ev->xexpose.height) {
+                /* Of two equal ones, keep the last. */
+                if (j > i || other->xexpose.width != ev->xexpose.width
+                    || other->xexpose.height != ev->xexpose.height)
+                    break;
+            }
+        }
+        if (j < batch->count) {
+            /* Redundant; marked with a type no event has. */
+            ev->type = 0;
+        }
+    }
+
+    for (i = n = 0; i < batch->count; i++) {
+        if (batch->events[i].type != 0)
+            batch->events[n++] = batch->events[i];
+    }
+    i = batch->count - n;
+    batch->count = n;
+    return i;
+}
+
+int
+XEventBatchDeliver(XEventBatch *batch, XEventCounts *counts,
+                   int (*deliver)(void *context, XEvent *event),
+                   int (*expired)(void *context), void *context)
+{
+    batch->next = 0;
+    while (batch->next < batch->count) {
+        /* deliver may take the events after this one from the batch. */
+        XEvent ev = batch->events[batch->next++];
+
+        if (deliver(context, &ev))
+            counts->delivered++;
+        if (batch->next < batch->count && expired(context))
+            return 0;
+    }
+    return 1;
+}
+
+int
+XEventBatchPutBack(XEventBatch *batch, Display *dpy, XEventCounts *counts,
+                   int (*putBack)(Display *dpy, XEvent *event))
+{
+    int n = batch->count - batch->next;
+
+    /* The X queue is a stack at its head: the last goes back first. */
+    while (batch->count > batch->next)
+        putBack(dpy, &batch->events[--batch->count]);
+    counts->received -= n;
+    counts->yields++;
+    return n;
+}
+
+int
+XEventBatchCompressMotion(XEventBatch *batch, Display *dpy, XEvent *event,
+                          XMotionEvent *passed, int max,
+                          unsigned long *received)
+{
+    XEvent next;
+    int count = 0;
+
+    while (XEventBatchPeek(batch, dpy, &next, QueuedAlready)
+           && next.type == MotionNotify
+           && next.xmotion.window == event->xmotion.window
+           && next.xmotion.subwindow == event->xmotion.subwindow) {
+        if (max > 0) {
+            if (count == max)
+                memmove(passed, passed + 1, --count * sizeof(XMotionEvent));
+            passed[count++] = event->xmotion;
+        }
+        *received += XEventBatchTake(batch, dpy, event);
+    }
+    return count;
+}
@@ -0,0 +1,70 @@
+/* xexposed.c - coalescing of the exposed parts of a window for the GNUstep
+ * X11 server. See Headers/x11/xexposed.h.
+ */
+#include "x11/xexposed.h"
+
+void
+XExposedReset(XExposedRegion *region)
+{
+    region->count = 0;
+}
+
+void
+XExposedAdd(XExposedRegion *region, int x, int y, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    while (region->count > 0) {
+        int i, best = -1;
+        long bestWaste = 0;
+        int ux = 0, uy = 0, ux2 = 0, uy2 = 0;
+
+        for (i = 0; i < region->count; i++) {
+            XExposedRect *r = &region->rects[i];
+            int x0, y0, x1, y1;
+            long waste;
+
+            if (r->x + r->width < x || x + width < r->x
+                || r->y + r->height < y || y + height < r->y) {
+                /* Apart: only merged when there is no room. */
+                if (region->count < XEXPOSED_MAX_RECTS)
+                    continue;
+            } else if (r->x <= x && r->y <= y
+                       && x + width <= r->x + r->width
+                       && y + height <= r->y + r->height) {
+                return;
+            }
+
+            x0 = r->x < x ? r->x : x;
+            y0 = r->y < y ? r->y : y;
+            x1 = r->x + r->width > x + width ? r->x + r->width : x + width;
+            y1 = r->y + r->height > y + height ? r->y + r->height : y + height;
+            waste = (long)(x1 - x0) * (y1 - y0) - (long)r->width * r->height;
+            if (best < 0 || waste < bestWaste) {
+                best = i;
+                bestWaste = waste;
+                ux = x0;
+                uy = y0;
+                ux2 = x1;
+                uy2 = y1;
+            }
+        }
+
+        if (best < 0)
+            break;
+
+        /* Take the union out, as it might now touch others. */
+        x = ux;
+        y = uy;
+        width = ux2 - ux;
+        height = uy2 - uy;
+        region->rects[best] = region->rects[--region->count];
+    }
+
+    region->rects[region->count].x = x;
+    region->rects[region->count].y = y;
+    region->rects[region->count].width = width;
+    region->rects[region->count].height = height;
+    region->count++;
+}
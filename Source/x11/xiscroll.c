@@ -0,0 +1,90 @@
+/* xiscroll.c - scroll valuator bookkeeping for the XInput2 smooth scrolling
+ * of the GNUstep X11 server. See Headers/x11/xiscroll.h.
+ */
+#include "x11/xiscroll.h"
+
+void
+XIScrollReset(XIScrollDevice *dev, int deviceid)
+{
+    dev->deviceid = deviceid;
+    dev->count = 0;
+    dev->rootValid = 0;
+}
+
+int
+XIScrollAddValuator(XIScrollDevice *dev, int number, int horizontal,
+                    double increment, double value)
+{
+    XIScrollValuator *v;
+
+    if (dev->count == XISCROLL_MAX_VALUATORS || increment == 0.0)
+        return 0;
+    v = &dev->valuators[dev->count++];
+    v->number = number;
+    v->horizontal = horizontal;
+    v->increment = increment;
+    v->last = value;
+    v->valid = 1;
+    return 1;
+}
+
+void
+XIScrollInvalidate(XIScrollDevice *dev)
+{
+    int i;
+
+    for (i = 0; i < dev->count; i++)
+        dev->valuators[i].valid = 0;
+    dev->rootValid = 0;
+}
+
+int
+XIScrollTakesButtons(const XIScrollDevice *dev, int grabbed)
+{
+    return dev->deviceid != -1 && dev->count > 0 && !grabbed;
+}
+
+int
+XIScrollMoved(XIScrollDevice *dev, double rootX, double rootY)
+{
+    int moved = !dev->rootValid || rootX != dev->rootX || rootY != dev->rootY;
+
+    dev->rootX = rootX;
+    dev->rootY = rootY;
+    dev->rootValid = 1;
+    return moved;
+}
+
+int
+XIScrollUpdate(XIScrollDevice *dev, const unsigned char *mask, int mask_len,
+               const double *values, double *dx, double *dy)
+{
+    int found = 0;
+    int n, i, k = 0;
+
+    *dx = *dy = 0.0;
+    for (n = 0; n < mask_len * 8; n++) {
+        if ((mask[n >> 3] & (1 << (n & 7))) == 0)
+            continue;
+        for (i = 0; i < dev->count; i++) {
+            XIScrollValuator *v = &dev->valuators[i];
+            double steps;
+
+            if (v->number != n)
+                continue;
+            found = 1;
+            if (v->valid) {
+                steps = (values[k] - v->last) / v->increment;
+                /* The valuators grow downwards and to the right. */
+                if (v->horizontal)
+                    *dx += steps;
+                else
+                    *dy -= steps;
+            }
+            v->last = values[k];
+            v->valid = 1;
+        }
+        k++;
+    }
+    return found;
+}
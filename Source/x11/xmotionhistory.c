@@ -0,0 +1,64 @@
+/* xmotionhistory.c - the motion history of the GNUstep X11 server. See
+ * Headers/x11/xmotionhistory.h.
+ */
+#include "x11/xmotionhistory.h"
+
+void
+XMotionHistoryBegin(XMotionHistory *history, long windowNumber,
+                    long eventNumber)
+{
+    unsigned n = history->nextEvent++ % XMOTIONHISTORY_EVENTS;
+
+    history->events[n].windowNumber = windowNumber;
+    history->events[n].eventNumber = eventNumber;
+    history->events[n].start = history->total;
+    history->events[n].count = 0;
+}
+
+void
+XMotionHistoryAdd(XMotionHistory *history, double x, double y,
+                  double timestamp)
+{
+    unsigned n = (history->nextEvent - 1) % XMOTIONHISTORY_EVENTS;
+    XMotionPosition *p;
+
+    p = &history->positions[history->total++ % XMOTIONHISTORY_SIZE];
+    p->x = x;
+    p->y = y;
+    p->timestamp = timestamp;
+    if (history->events[n].count == XMOTIONHISTORY_MAX)
+        history->events[n].start++;
+    else
+        history->events[n].count++;
+}
+
+unsigned
+XMotionHistoryGet(const XMotionHistory *history, long windowNumber,
+                  long eventNumber, XMotionPosition *positions,
+                  unsigned count)
+{
+    unsigned i, j;
+
+    for (i = 0; i < XMOTIONHISTORY_EVENTS; i++) {
+        unsigned long start = history->events[i].start;
+        unsigned n = history->events[i].count;
+
+        if (n == 0 || history->events[i].windowNumber != windowNumber
+            || history->events[i].eventNumber != eventNumber)
+            continue;
+        if (start + XMOTIONHISTORY_SIZE < history->total) {
+            /* Overwritten by the positions of later events. */
+            return 0;
+        }
+        if (n > count) {
+            /* Keep the most recent ones. */
+            start += n - count;
+            n = count;
+        }
+        for (j = 0; j < n; j++)
+            positions[j] = history->positions[(start + j)
+                                              % XMOTIONHISTORY_SIZE];
+        return n;
+    }
+    return 0;
+}
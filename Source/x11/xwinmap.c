@@ -0,0 +1,164 @@
+/* xwinmap.c - the tables the GNUstep X11 server finds its windows in.
+ * See Headers/x11/xwinmap.h.
+ */
+#include <stdlib.h>
+#include "x11/xwinmap.h"
+
+#define INITIAL_SLOTS 32
+
+/* X window ids are a client base with a small counter in the low bits, and
+ * window numbers are small integers; mix them so that neighbours spread. */
+static unsigned long
+hash(unsigned long key)
+{
+    key ^= key >> 16;
+    key *= 0x45d9f3bUL;
+    key ^= key >> 16;
+    return key;
+}
+
+int
+XWinMapInit(XWinMap *map)
+{
+    map->slots = calloc(INITIAL_SLOTS, sizeof(XWinMapSlot));
+    map->mask = map->slots ? INITIAL_SLOTS - 1 : 0;
+    map->count = 0;
+    map->lastKey = 0;
+    map->lastValue = NULL;
+    return map->slots != NULL;
+}
+
+void
+XWinMapFree(XWinMap *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+    map->mask = 0;
+    map->count = 0;
+    map->lastValue = NULL;
+}
+
+void *
+XWinMapGet(XWinMap *map, unsigned long key)
+{
+    unsigned long i;
+
+    if (map->lastValue != NULL && map->lastKey == key)
+        return map->lastValue;
+    if (map->slots == NULL)
+        return NULL;
+
+    for (i = hash(key) & map->mask; map->slots[i].value != NULL;
+         i = (i + 1) & map->mask) {
+        if (map->slots[i].key == key) {
+            map->lastKey = key;
+            map->lastValue = map->slots[i].value;
+            return map->lastValue;
+        }
+    }
+    return NULL;
+}
+
+static int
+grow(XWinMap *map)
+{
+    XWinMapSlot *old = map->slots;
+    unsigned long size = map->mask + 1;
+    unsigned long i, j;
+    XWinMapSlot *slots;
+
+    slots = calloc(size * 2, sizeof(XWinMapSlot));
+    if (slots == NULL)
+        return 0;
+    map->slots = slots;
+    map->mask = size * 2 - 1;
+    for (i = 0; i < size; i++) {
+        if (old[i].value == NULL)
+            continue;
+        for (j = hash(old[i].key) & map->mask; slots[j].value != NULL;
+             j = (j + 1) & map->mask)
+            ;
+        slots[j] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+int
+XWinMapInsert(XWinMap *map, unsigned long key, void *value)
+{
+    unsigned long i;
+
+    if (map->slots == NULL && !XWinMapInit(map))
+        return 0;
+    if ((map->count + 1) * 2 > map->mask + 1 && !grow(map))
+        return 0;
+
+    for (i = hash(key) & map->mask; map->slots[i].value != NULL;
+         i = (i + 1) & map->mask) {
+        if (map->slots[i].key == key)
+            break;
+    }
+    if (map->slots[i].value == NULL)
+        map->count++;
+    map->slots[i].key = key;
+    map->slots[i].value = value;
+    if (map->lastKey == key)
+        map->lastValue = value;
+    return 1;
+}
+
+void
+XWinMapRemove(XWinMap *map, unsigned long key)
+{
+    unsigned long i, j;
+
+    if (map->lastKey == key)
+        map->lastValue = NULL;
+    if (map->slots == NULL)
+        return;
+
+    for (i = hash(key) & map->mask; map->slots[i].value != NULL;
+         i = (i + 1) & map->mask) {
+        if (map->slots[i].key == key)
+            break;
+    }
+    if (map->slots[i].value == NULL)
+        return;
+    map->count--;
+
+    /* Move back the entries after it that would no longer be found, so
+     * that no deleted markers are needed. */
+    for (j = (i + 1) & map->mask; map->slots[j].value != NULL;
+         j = (j + 1) & map->mask) {
+        unsigned long home = hash(map->slots[j].key) & map->mask;
+
+        /* Leave it if its home is cyclically in (i, j]. */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        map->slots[i] = map->slots[j];
+        i = j;
+    }
+    map->slots[i].key = 0;
+    map->slots[i].value = NULL;
+}
+
+int
+XWinMapNext(XWinMap *map, unsigned long *index,
+            unsigned long *key, void **value)
+{
+    unsigned long i;
+
+    if (map->slots == NULL)
+        return 0;
+    for (i = *index; i <= map->mask; i++) {
+        if (map->slots[i].value != NULL) {
+            *key = map->slots[i].key;
+            *value = map->slots[i].value;
+            *index = i + 1;
+            return 1;
+        }
+    }
+    *index = i;
+    return 0;
+}
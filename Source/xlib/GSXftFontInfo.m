@@ -151,26 +151,21 @@
 
 - (NSSize) advancementForGlyph: (NSGlyph)glyph
 {
-  if (_cachedSizes)
-    {
-      int entry = glyph % _cacheSize;
-
-      if (_cachedGlyphs[entry] == glyph)
-        return _cachedSizes[entry];
+  NSSize advancement;
 
-      XGlyphInfo *pc = [self xGlyphInfo: glyph];
+  if (_metrics
+    && GSGlyphMetricsCacheGetAdvancement(_metrics, glyph, &advancement))
+    return advancement;
 
-      if (!pc)
-        return NSMakeSize((float)(font_info)->max_advance_width, 0);
-
-      _cachedGlyphs[entry] = glyph;
-      _cachedSizes[entry] = NSMakeSize((float)pc->xOff, (float)pc->yOff);
+  XGlyphInfo *pc = [self xGlyphInfo: glyph];
 
-      return _cachedSizes[entry];
+  if (pc && _metrics)
+    {
+      advancement = NSMakeSize((float)pc->xOff, (float)pc->yOff);
+      GSGlyphMetricsCacheSetAdvancement(_metrics, glyph, advancement);
+      return advancement;
     }
 
-  XGlyphInfo *pc = [self xGlyphInfo: glyph];
-
   // if per_char is NULL assume max bounds
   if (!pc)
     return  NSMakeSize((float)(font_info)->max_advance_width, 0);
@@ -182,6 +177,11 @@
 {
   XGlyphInfo *pc;
   FT_Face face;
+  NSRect rect;
+
+  if (_metrics
+    && GSGlyphMetricsCacheGetBoundingRect(_metrics, glyph, &rect))
+    return rect;
 
   /* The extents Xft reports are those of the image it renders, which is
      padded, so an i comes out as wide as it advances. The face has the ink
@@ -201,6 +201,8 @@
 				  m.height / 64.0);
 
 	  XftUnlockFace((XftFont *)font_info);
+	  if (_metrics)
+	    GSGlyphMetricsCacheSetBoundingRect(_metrics, glyph, box);
 	  return box;
 	}
       XftUnlockFace((XftFont *)font_info);
@@ -0,0 +1,173 @@
+/* Bit-exactness test for the vectorized compositing functions in
+ * Source/art/blit-simd.m.
+ *
+ * artcontext_setup_draw_info() replaces some of the scalar compositing
+ * functions of the 24- and 32-bit formats with SSE2 or AVX2 versions when the
+ * CPU has them.  Those must give exactly the same pixels as the scalar code in
+ * blit.m, including its rounding and its special cases for fully transparent
+ * and fully opaque pixels, for every run length (the vector loops finish a run
+ * through a partial vector).
+ *
+ * This includes blit-main.m as a whole, so both the scalar table and the
+ * selection function are at hand, and runs every replaced function and its
+ * scalar original over the same random runs.  On CPUs without SIMD support the
+ * table is left alone and the test skips.  It is art-backend code, so the test
+ * is built only when the art backend is the one being built.
+ */
+#import <Foundation/NSObject.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_art) \
+  && BUILD_GRAPHICS == GRAPHICS_art
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "art/blit-main.m"
+
+#define MAX_RUN 70
+
+#ifdef BLIT_SIMD
+
+typedef void (*composite_func_t)(composite_run_t *c, int num);
+
+/* Run f and g over the same random run of num pixels and compare.  mode
+ * picks the alpha values: 0-2 force the source alpha to 0, 255 or leave it
+ * random, with the destination alpha 0 (mode < 3) or 255 (mode < 6); other
+ * modes leave everything random. */
+static BOOL
+sameResult(composite_func_t f, composite_func_t g, draw_info_t *di,
+  int num, int mode)
+{
+  unsigned char src[MAX_RUN * 4], srca[MAX_RUN];
+  unsigned char d1[MAX_RUN * 4], da1[MAX_RUN];
+  unsigned char d2[MAX_RUN * 4], da2[MAX_RUN];
+  composite_run_t c1, c2;
+  int i;
+
+  for (i = 0; i < MAX_RUN * 4; i++)
+    {
+      src[i] = rand();
+      d1[i] = rand();
+    }
+  for (i = 0; i < MAX_RUN; i++)
+    {
+      srca[i] = rand();
+      da1[i] = rand();
+    }
+  if (mode < 6)
+    {
+      for (i = 0; i < num; i++)
+	{
+	  int sa = (mode % 3 == 0) ? 0 : (mode % 3 == 1) ? 255 : rand();
+	  int da = (mode < 3) ? 0 : 255;
+
+	  if (di->inline_alpha)
+	    {
+	      src[i * 4 + di->inline_alpha_ofs] = sa;
+	      d1[i * 4 + di->inline_alpha_ofs] = da;
+	    }
+	  else
+	    {
+	      srca[i] = sa;
+	      da1[i] = da;
+	    }
+	}
+    }
+  memcpy(d2, d1, sizeof(d1));
+  memcpy(da2, da1, sizeof(da1));
+
+  c1.src = src; c1.srca = srca; c1.dst = d1; c1.dsta = da1;
+  c1.fraction = rand();
+  c2 = c1;
+  c2.dst = d2; c2.dsta = da2;
+
+  f(&c1, num);
+  g(&c2, num);
+
+  /* The whole buffers are compared, so writing past the run fails too. */
+  return memcmp(d1, d2, sizeof(d1)) == 0
+    && memcmp(da1, da2, sizeof(da1)) == 0;
+}
+
+#define OP(name) { #name, offsetof(draw_info_t, name) }
+
+static struct
+{
+  const char *name;
+  size_t offset;
+} ops[] = {
+  OP(composite_sover_aa), OP(composite_sover_ao),
+  OP(composite_dover_aa), OP(composite_dover_oa),
+  OP(composite_din_aa), OP(composite_dout_aa),
+  OP(composite_plusl_aa), OP(composite_plusl_oa),
+  OP(composite_plusl_ao), OP(composite_plusl_oo),
+  OP(composite_plusd_aa), OP(composite_plusd_oa),
+  OP(composite_plusd_ao), OP(composite_plusd_oo),
+  OP(dissolve_aa), OP(dissolve_ao), OP(dissolve_oa), OP(dissolve_oo),
+};
+
+#endif
+
+int
+main(void)
+{
+  START_SET("art vectorized compositing")
+#ifdef BLIT_SIMD
+  int formats[] = {DI_24_RGB, DI_24_BGR,
+		   DI_32_RGBA, DI_32_BGRA, DI_32_ARGB, DI_32_ABGR};
+  unsigned int i, j;
+  BOOL any = NO;
+
+  srand(1);
+  for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+      draw_info_t scalar = draw_infos[formats[i]];
+      draw_info_t vector = scalar;
+
+      if (!artcontext_setup_simd(&vector))
+	continue;
+      any = YES;
+
+      for (j = 0; j < sizeof(ops) / sizeof(ops[0]); j++)
+	{
+	  composite_func_t f, g;
+	  BOOL same = YES;
+	  int num, mode;
+
+	  f = *(composite_func_t *)((char *)&scalar + ops[j].offset);
+	  g = *(composite_func_t *)((char *)&vector + ops[j].offset);
+	  if (f == g)
+	    continue;
+
+	  for (num = 1; num < MAX_RUN && same; num++)
+	    for (mode = 0; mode < 12 && same; mode++)
+	      same = sameResult(f, g, &scalar, num, mode);
+
+	  PASS(same, "format %i: vectorized %s matches the scalar version",
+	       formats[i], ops[j].name);
+	}
+    }
+  if (any == NO)
+    {
+      SKIP("the CPU has no supported vector instructions")
+    }
+#else
+  SKIP("no vectorized compositing functions on this architecture")
+#endif
+  END_SET("art vectorized compositing")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("art vectorized compositing")
+    SKIP("back is not built with the art graphics backend")
+  END_SET("art vectorized compositing")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,119 @@
+/* Tests for the glyph atlas in Source/art/ftatlas.m.
+ *
+ * The atlas keeps glyph coverage masks for the art backend's text drawing,
+ * under one memory budget shared by all fonts.  These tests check that masks
+ * are stored and found again, that the least recently used masks are dropped
+ * to stay within the budget, that masks used in the current run are never
+ * dropped, and that freeing an atlas gives its memory back.  The atlas is
+ * plain C, so the file is simply included.
+ */
+#import <Foundation/NSObject.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_art) \
+  && BUILD_GRAPHICS == GRAPHICS_art
+
+#include "art/ftatlas.m"
+
+/* Each test mask is 10x10, so an entry costs this many bytes. */
+#define ENTRY (sizeof(ft_atlas_glyph_t) + 100)
+
+static ft_atlas_glyph_t *
+insert(ft_atlas_t *a, unsigned int glyph)
+{
+  unsigned char src[10 * 12];
+
+  memset(src, glyph, sizeof(src));
+  /* A pitch larger than the width, as FreeType sbits may have. */
+  return ft_atlas_insert(a, glyph, 1, 8, 10, 10, 11, src, 12);
+}
+
+int
+main(void)
+{
+  START_SET("art glyph atlas")
+  ft_atlas_t *a, *b;
+  ft_atlas_glyph_t *e;
+  BOOL same;
+  int i;
+
+  ft_atlas_set_budget(0);
+  PASS(ft_atlas_new() == NULL, "no atlas with a zero budget");
+
+  ft_atlas_set_budget(4 * ENTRY);
+  a = ft_atlas_new();
+  b = ft_atlas_new();
+  PASS(a != NULL && b != NULL, "atlases can be created");
+
+  ft_atlas_begin_run();
+  e = insert(a, 7);
+  PASS(e != NULL && e->width == 10 && e->height == 10 && e->left == 1
+       && e->top == 8 && e->xadvance == 11, "a mask can be inserted");
+  same = YES;
+  for (i = 0; i < 100; i++)
+    if (e->coverage[i] != 7)
+      same = NO;
+  PASS(same, "the mask is copied without the row padding");
+  PASS(ft_atlas_lookup(a, 7) == e, "the mask is found again");
+  PASS(ft_atlas_lookup(b, 7) == NULL, "atlases don't share glyphs");
+  PASS(ft_atlas_used() == ENTRY, "the used memory is counted");
+
+  e = ft_atlas_insert(a, 8, 0, 0, 0, 0, 5, NULL, 0);
+  PASS(e != NULL && e->width == 0 && e->xadvance == 5,
+       "glyphs without an image can be inserted");
+
+  /* Fill the budget with a run that pins everything. */
+  insert(b, 1);
+  insert(b, 2);
+  PASS(insert(a, 9) == NULL && ft_atlas_lookup(a, 7) != NULL,
+       "masks used in the current run are not dropped");
+
+  /* In a new run, glyph 7 is used again and survives; the least recently
+     used masks go first: the empty glyph 8, then b's glyph 1. */
+  ft_atlas_begin_run();
+  ft_atlas_lookup(a, 7);
+  PASS(insert(a, 9) != NULL, "old masks are dropped for new ones");
+  PASS(insert(a, 10) != NULL, "masks of other fonts are dropped too");
+  PASS(ft_atlas_lookup(a, 8) == NULL && ft_atlas_lookup(b, 1) == NULL,
+       "the least recently used masks are dropped first");
+  PASS(ft_atlas_lookup(a, 7) != NULL && ft_atlas_lookup(b, 2) != NULL
+       && ft_atlas_lookup(a, 9) != NULL && ft_atlas_lookup(a, 10) != NULL,
+       "recently used masks are kept");
+  PASS(ft_atlas_used() <= ft_atlas_budget(), "the budget is kept");
+
+  ft_atlas_set_budget(ENTRY - 1);
+  ft_atlas_begin_run();
+  PASS(insert(a, 11) == NULL, "masks larger than the budget aren't stored");
+
+  /* Many glyphs in one atlas make the table grow. */
+  ft_atlas_set_budget(1000 * ENTRY);
+  ft_atlas_free(b);
+  same = YES;
+  for (i = 100; i < 600; i++)
+    if (insert(a, i) == NULL)
+      same = NO;
+  for (i = 100; i < 600; i++)
+    if (ft_atlas_lookup(a, i) == NULL)
+      same = NO;
+  PASS(same, "the atlas grows to hold many glyphs");
+
+  ft_atlas_free(a);
+  PASS(ft_atlas_used() == 0, "freeing the atlases frees their memory");
+
+  END_SET("art glyph atlas")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("art glyph atlas")
+    SKIP("back is not built with the art graphics backend")
+  END_SET("art glyph atlas")
+  return 0;
+}
+
+#endif
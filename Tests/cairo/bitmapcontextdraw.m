@@ -24,12 +24,12 @@
 #define HIGH 8
 
 static NSBitmapImageRep *
-makeRep(void)
+makeRepOfSize(int wide, int high)
 {
   return AUTORELEASE([[NSBitmapImageRep alloc]
     initWithBitmapDataPlanes: NULL
-                  pixelsWide: WIDE
-                  pixelsHigh: HIGH
+                  pixelsWide: wide
+                  pixelsHigh: high
                bitsPerSample: 8
              samplesPerPixel: 4
                     hasAlpha: YES
@@ -39,6 +39,12 @@ makeRep(void)
                 bitsPerPixel: 0]);
 }
 
+static NSBitmapImageRep *
+makeRep(void)
+{
+  return makeRepOfSize(WIDE, HIGH);
+}
+
 static unsigned char *
 pixel(NSBitmapImageRep *rep, int x, int y)
 {
@@ -65,6 +71,39 @@ fillRect(NSBitmapImageRep *rep, NSColor *colour, NSRect rect)
   [NSGraphicsContext restoreGraphicsState];
 }
 
+/* Draws text turned a quarter round into a cleared bitmap, after clearing
+ * all of it through the context too if whole is set, so that all of it is
+ * written back.
+ */
+static void
+drawTurnedText(NSBitmapImageRep *rep, BOOL whole)
+{
+  NSGraphicsContext *ctxt;
+  NSAffineTransform *turn;
+  NSDictionary *attrs;
+
+  clearRep(rep);
+  ctxt = [NSGraphicsContext graphicsContextWithBitmapImageRep: rep];
+  [NSGraphicsContext saveGraphicsState];
+  [NSGraphicsContext setCurrentContext: ctxt];
+  if (whole)
+    {
+      [[NSColor clearColor] set];
+      NSRectFillUsingOperation(NSMakeRect(0, 0, [rep pixelsWide],
+        [rep pixelsHigh]), NSCompositeCopy);
+    }
+  turn = [NSAffineTransform transform];
+  [turn translateXBy: 24 yBy: 4];
+  [turn rotateByDegrees: 90];
+  [turn concat];
+  attrs = [NSDictionary dictionaryWithObjectsAndKeys:
+    [NSFont userFontOfSize: 10], NSFontAttributeName,
+    [NSColor blackColor], NSForegroundColorAttributeName, nil];
+  [@"MWMWM" drawAtPoint: NSZeroPoint withAttributes: attrs];
+  [ctxt flushGraphics];
+  [NSGraphicsContext restoreGraphicsState];
+}
+
 static BOOL
 isColour(unsigned char *p, int r, int g, int b, int a)
 {
@@ -160,6 +199,68 @@ main(int argc, const char **argv)
   PASS(isColour(pixel(rep, 0, 0), 128, 0, 0, 128),
     "a half transparent fill is stored premultiplied");
 
+  /* Unless the bitmap says its colours are not premultiplied. */
+  rep = AUTORELEASE([[NSBitmapImageRep alloc]
+    initWithBitmapDataPlanes: NULL
+                  pixelsWide: WIDE
+                  pixelsHigh: HIGH
+               bitsPerSample: 8
+             samplesPerPixel: 4
+                    hasAlpha: YES
+                    isPlanar: NO
+              colorSpaceName: NSDeviceRGBColorSpace
+                bitmapFormat: NSAlphaNonpremultipliedBitmapFormat
+                 bytesPerRow: 0
+                bitsPerPixel: 0]);
+  clearRep(rep);
+  fillRect(rep, [NSColor colorWithDeviceRed: 1.0
+                                      green: 0.0
+                                       blue: 0.0
+                                      alpha: 0.5],
+           NSMakeRect(0, 0, WIDE, HIGH));
+  PASS(isColour(pixel(rep, 0, 0), 255, 0, 0, 128),
+    "a half transparent fill is stored unpremultiplied when asked");
+
+  /* Only what was drawn is written back, so the rest of the bitmap keeps
+   * colours that a trip through premultiplying would lose.
+   */
+  for (y = 0; y < HIGH; y++)
+    {
+      for (x = 0; x < WIDE; x++)
+        {
+          unsigned char *p = pixel(rep, x, y);
+
+          p[0] = 255; p[1] = 10; p[2] = 20; p[3] = 3;
+        }
+    }
+  fillRect(rep, [NSColor blueColor], NSMakeRect(0, 0, 1, 1));
+  PASS(isColour(pixel(rep, 0, HIGH - 1), 0, 0, 255, 255),
+    "a small fill is written back");
+  PASS(memcmp(pixel(rep, WIDE - 1, 0), "\377\012\024\003", 4) == 0,
+    "the pixels away from a small fill are left as they were");
+  rep = makeRep();
+
+  /* Text drawn turned is written back wherever it lands. */
+  {
+    NSBitmapImageRep *all = makeRepOfSize(48, 48);
+    NSBitmapImageRep *part = makeRepOfSize(48, 48);
+    BOOL inked = NO;
+    int i;
+
+    drawTurnedText(all, YES);
+    drawTurnedText(part, NO);
+    for (i = 0; i < [all bytesPerRow] * 48; i++)
+      {
+        if ([all bitmapData][i] != 0)
+          {
+            inked = YES;
+          }
+      }
+    PASS(inked && memcmp([all bitmapData], [part bitmapData],
+      [all bytesPerRow] * 48) == 0,
+      "text drawn turned is written back in full");
+  }
+
   /* A second context for the same bitmap draws over what is already there. */
   clearRep(rep);
   fillRect(rep, [NSColor redColor], NSMakeRect(0, 0, WIDE, HIGH));
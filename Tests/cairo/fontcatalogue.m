@@ -0,0 +1,126 @@
+/* Tests for the font catalogue (Source/fontconfig/FCFontCatalogue.m), the
+ * file in which the fontconfig font enumerator keeps the installed fonts
+ * between application launches.
+ *
+ * A small catalogue is written to a temporary file and mapped again: its
+ * families keep their fonts in order, fonts are found by name through the
+ * hash table, and the descriptions and patterns come back unchanged.  A
+ * catalogue written for another stamp, or a damaged one, is not used.
+ *
+ * The catalogue is plain Foundation and fontconfig code, so the source is
+ * compiled in directly; it is only built into the cairo backend's font code
+ * here, so the test guards on that backend.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#include "fontconfig/FCFontCatalogue.m"
+
+static NSArray *
+fa(NSString *name, NSString *style, float weight, unsigned int traits)
+{
+  return [NSArray arrayWithObjects: name, style,
+                  [NSNumber numberWithFloat: weight],
+                  [NSNumber numberWithUnsignedInt: traits], nil];
+}
+
+int
+main(void)
+{
+  START_SET("fontconfig font catalogue")
+  NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+    [NSString stringWithFormat: @"fontcatalogue-%d",
+              [[NSProcessInfo processInfo] processIdentifier]]];
+  NSMutableDictionary *families = [NSMutableDictionary dictionary];
+  NSMutableDictionary *patterns = [NSMutableDictionary dictionary];
+  NSMutableData *damaged;
+  FCFontCatalogue *cat;
+  FCCatalogueFont font;
+  unsigned int first, count, i;
+  BOOL found;
+  int idx;
+
+  [families setObject: [NSArray arrayWithObjects:
+                         fa(@"Sans", @"Regular", 5, 0),
+                         fa(@"Sans-Bold", @"Bold", 9, 2),
+                         nil]
+               forKey: @"Sans"];
+  [families setObject: [NSArray arrayWithObject:
+                         fa(@"Mono", @"Regular", 5, 1024)]
+               forKey: @"Mono"];
+  [patterns setObject: @"Sans:style=Regular" forKey: @"Sans"];
+  [patterns setObject: @"Sans:style=Bold:weight=200" forKey: @"Sans-Bold"];
+  [patterns setObject: @"Mono:spacing=100" forKey: @"Mono"];
+
+  PASS(FCFontCatalogueWrite(path, 42, families, patterns),
+       "a catalogue can be written");
+  PASS(FCFontCatalogueOpen(path, 43) == NULL,
+       "a catalogue for another stamp is not used");
+
+  cat = FCFontCatalogueOpen(path, 42);
+  PASS(cat != NULL, "a catalogue can be mapped");
+  if (cat != NULL)
+    {
+      PASS(FCFontCatalogueFontCount(cat) == 3
+           && FCFontCatalogueFamilyCount(cat) == 2,
+           "all fonts and families are there");
+
+      found = NO;
+      for (i = 0; i < FCFontCatalogueFamilyCount(cat); i++)
+        {
+          const char *name = FCFontCatalogueFamily(cat, i, &first, &count);
+
+          if (name != NULL && strcmp(name, "Sans") == 0 && count == 2
+              && FCFontCatalogueFont(cat, first, &font)
+              && strcmp(font.name, "Sans") == 0
+              && FCFontCatalogueFont(cat, first + 1, &font)
+              && strcmp(font.name, "Sans-Bold") == 0)
+            {
+              found = YES;
+            }
+        }
+      PASS(found, "a family keeps its fonts in order");
+
+      idx = FCFontCatalogueLookup(cat, "Sans-Bold");
+      PASS(idx >= 0 && FCFontCatalogueFont(cat, idx, &font)
+           && strcmp(font.style, "Bold") == 0
+           && strcmp(font.family, "Sans") == 0
+           && strcmp(font.pattern, "Sans:style=Bold:weight=200") == 0
+           && font.weight == 9 && font.traits == 2,
+           "a font is found by name with its description");
+      idx = FCFontCatalogueLookup(cat, "Mono");
+      PASS(idx >= 0 && FCFontCatalogueFont(cat, idx, &font)
+           && font.traits == 1024, "every font is in the name table");
+      PASS(FCFontCatalogueLookup(cat, "Serif") == -1,
+           "unknown names are not found");
+      FCFontCatalogueClose(cat);
+    }
+
+  /* Cut off the string table. */
+  damaged = [NSMutableData dataWithContentsOfFile: path];
+  [damaged setLength: [damaged length] - 4];
+  [damaged writeToFile: path atomically: NO];
+  PASS(FCFontCatalogueOpen(path, 42) == NULL,
+       "a damaged catalogue is not used");
+
+  [[NSFileManager defaultManager] removeFileAtPath: path handler: nil];
+  END_SET("fontconfig font catalogue")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("fontconfig font catalogue")
+    SKIP("back is not built with the cairo graphics backend")
+  END_SET("fontconfig font catalogue")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,164 @@
+/* The cairo font measures a run of glyphs in one call with
+ * -getAdvancements:forGlyphs:count:, which the gstate uses to show glyphs.
+ * The advancements it gives have to be those -advancementForGlyph: gives
+ * one by one, and measuring a run has to leave its glyphs in the font's
+ * metrics cache.  Characters beyond U+FFFF have to be drawn as the same
+ * character they are measured as.
+ *
+ * The font class is private to the backend, so it is reached through
+ * NSClassFromString, and its cache through the runtime.  The cache source is
+ * compiled in for its statistics.  It needs a running window server to load
+ * the backend at all, so it skips cleanly when there is none, and it guards
+ * on the cairo graphics backend.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#import <AppKit/AppKit.h>
+#include <objc/runtime.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "gsc/GSGlyphMetricsCache.m"
+
+#define COUNT 40
+
+@interface NSObject (CairoFontInfoAdvancements)
+- (id) initWithFontName: (NSString *)name
+                 matrix: (const CGFloat *)fmatrix
+             screenFont: (BOOL)screenFont;
+- (NSSize) advancementForGlyph: (NSGlyph)glyph;
+- (void) getAdvancements: (NSSize *)advancements
+               forGlyphs: (const NSGlyph *)glyphs
+                   count: (unsigned int)count;
+- (NSRect) boundingRectForGlyph: (NSGlyph)glyph;
+- (void) appendBezierPathWithGlyphs: (NSGlyph *)glyphs
+                              count: (int)count
+                       toBezierPath: (NSBezierPath *)path;
+@end
+
+/* The size of the outline the font gives for one glyph. */
+static NSSize
+outlineSize(id font, NSGlyph glyph)
+{
+  NSBezierPath *path = [NSBezierPath bezierPath];
+
+  [font appendBezierPathWithGlyphs: &glyph count: 1 toBezierPath: path];
+  return [path isEmpty] ? NSZeroSize : [path bounds].size;
+}
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("cairo glyph advancements")
+
+  Class fontClass = Nil;
+  id font = nil;
+  /* A size no other font in the test is likely to share a cache with. */
+  CGFloat m[6] = { 13.25, 0, 0, 13.25, 0, 0 };
+  GSGlyphMetricsCache *metrics;
+  NSGlyph glyphs[COUNT];
+  NSSize advancements[COUNT];
+  unsigned long hits, misses, hits1, misses1, hits2, misses2;
+  BOOL same;
+  Ivar iv;
+  int i;
+
+  if (getenv("DISPLAY") == NULL || *getenv("DISPLAY") == '\0')
+    {
+      SKIP("no window server available")
+    }
+
+  NS_DURING
+    {
+      [NSApplication sharedApplication];
+      fontClass = NSClassFromString(@"CairoFontInfo");
+      font = [[[fontClass alloc]
+                initWithFontName: [[NSFont userFontOfSize: 12] fontName]
+                          matrix: m
+                      screenFont: NO] autorelease];
+    }
+  NS_HANDLER
+    {
+      font = nil;
+    }
+  NS_ENDHANDLER
+
+  iv = fontClass ? class_getInstanceVariable(fontClass, "_metrics") : NULL;
+  if (font == nil || iv == NULL)
+    {
+      SKIP("no cairo font available")
+    }
+  metrics = *(GSGlyphMetricsCache **)((char *)font + ivar_getOffset(iv));
+  if (metrics == NULL)
+    {
+      SKIP("the font has no metrics cache")
+    }
+
+  for (i = 0; i < COUNT; i++)
+    {
+      glyphs[i] = 3 + i;
+    }
+
+  GSGlyphMetricsCacheGetStatistics(metrics, &hits, &misses);
+  [font getAdvancements: advancements forGlyphs: glyphs count: COUNT];
+  GSGlyphMetricsCacheGetStatistics(metrics, &hits1, &misses1);
+  PASS(hits1 == hits && misses1 == misses + COUNT,
+    "a new run of glyphs is looked up once each and measured");
+
+  same = YES;
+  for (i = 0; i < COUNT; i++)
+    {
+      NSSize a = [font advancementForGlyph: glyphs[i]];
+
+      if (a.width != advancements[i].width
+        || a.height != advancements[i].height)
+        {
+          same = NO;
+        }
+    }
+  GSGlyphMetricsCacheGetStatistics(metrics, &hits2, &misses2);
+  PASS(same, "a run is measured as its glyphs are one by one");
+  PASS(hits2 == hits1 + COUNT && misses2 == misses1,
+    "measuring a run leaves its glyphs in the cache");
+
+  [font getAdvancements: advancements forGlyphs: glyphs count: COUNT];
+  GSGlyphMetricsCacheGetStatistics(metrics, &hits, &misses);
+  PASS(hits == hits2 + COUNT && misses == misses2,
+    "a run measured again comes from the cache");
+
+  /* U+10041 is not 'A' cut to 16 bits: its outline is the one it is
+     measured by, and not that of 'A'. */
+  {
+    NSRect box = [font boundingRectForGlyph: 0x10041];
+    NSSize wide = outlineSize(font, 0x10041);
+    NSSize a = outlineSize(font, 'A');
+
+    PASS(fabs(wide.width - box.size.width) <= 1
+      && fabs(wide.height - box.size.height) <= 1,
+      "a character beyond U+FFFF is drawn as it is measured");
+    PASS(!NSEqualSizes(wide, a),
+      "a character beyond U+FFFF is not drawn as its low 16 bits");
+  }
+
+  END_SET("cairo glyph advancements")
+
+  return 0;
+}
+
+#else
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("cairo glyph advancements")
+    SKIP("back is not built with the cairo graphics backend")
+  END_SET("cairo glyph advancements")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,161 @@
+/* The cairo backend keeps the surfaces it makes for the bitmaps it draws, so
+ * that drawing the same bitmap again reuses them.  Nothing tells it when the
+ * pixels of a bitmap change, so it must notice that by itself: a bitmap
+ * drawn, changed in place and drawn again has to show the change, and one
+ * drawn again unchanged has to look the same.
+ *
+ * The bitmaps are drawn into a bitmap context, so the results can be read
+ * back from its bytes.  It needs a running window server to load the
+ * backend at all, so it skips cleanly when there is none, and it guards on
+ * the cairo graphics backend.
+ */
+#import <Foundation/NSObject.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#import <AppKit/AppKit.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE 16
+#define HIGH 16
+
+static NSBitmapImageRep *
+makeRep(int samples)
+{
+  return AUTORELEASE([[NSBitmapImageRep alloc]
+    initWithBitmapDataPlanes: NULL
+                  pixelsWide: WIDE
+                  pixelsHigh: HIGH
+               bitsPerSample: 8
+             samplesPerPixel: samples
+                    hasAlpha: (samples == 4)
+                    isPlanar: NO
+              colorSpaceName: NSDeviceRGBColorSpace
+                 bytesPerRow: 0
+                bitsPerPixel: 0]);
+}
+
+/* Sets every pixel of an RGB or RGBA bitmap to an opaque colour. */
+static void
+paint(NSBitmapImageRep *rep, int r, int g, int b)
+{
+  int samples = [rep samplesPerPixel];
+  int x, y;
+
+  for (y = 0; y < HIGH; y++)
+    {
+      unsigned char *p = [rep bitmapData] + y * [rep bytesPerRow];
+
+      for (x = 0; x < WIDE; x++, p += samples)
+        {
+          p[0] = r;
+          p[1] = g;
+          p[2] = b;
+          if (samples == 4)
+            p[3] = 255;
+        }
+    }
+}
+
+static void
+drawInto(NSBitmapImageRep *dest, NSBitmapImageRep *image)
+{
+  NSGraphicsContext *ctxt;
+
+  ctxt = [NSGraphicsContext graphicsContextWithBitmapImageRep: dest];
+  [NSGraphicsContext saveGraphicsState];
+  [NSGraphicsContext setCurrentContext: ctxt];
+  [image drawInRect: NSMakeRect(0, 0, WIDE, HIGH)];
+  [ctxt flushGraphics];
+  [NSGraphicsContext restoreGraphicsState];
+}
+
+static BOOL
+isColour(NSBitmapImageRep *rep, int x, int y, int r, int g, int b)
+{
+  unsigned char *p = [rep bitmapData] + y * [rep bytesPerRow] + x * 4;
+
+  return (abs((int)p[0] - r) <= 1 && abs((int)p[1] - g) <= 1
+    && abs((int)p[2] - b) <= 1 && p[3] == 255);
+}
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("image surface cache")
+
+  NSBitmapImageRep *dest;
+  NSBitmapImageRep *image;
+  NSBitmapImageRep *copy;
+  int samples;
+
+  if (getenv("DISPLAY") == NULL || *getenv("DISPLAY") == '\0')
+    {
+      SKIP("no window server available")
+    }
+
+  NS_DURING
+    {
+      [NSApplication sharedApplication];
+    }
+  NS_HANDLER
+    {
+      SKIP("It looks like the GNUstep backend is not installed")
+    }
+  NS_ENDHANDLER
+
+  dest = makeRep(4);
+  for (samples = 3; samples <= 4; samples++)
+    {
+      NSString *kind = (samples == 4) ? @"an RGBA" : @"an RGB";
+
+      image = makeRep(samples);
+      paint(image, 255, 0, 0);
+      drawInto(dest, image);
+      PASS(isColour(dest, 3, 3, 255, 0, 0),
+        "%s bitmap is drawn", [kind UTF8String]);
+
+      drawInto(dest, image);
+      PASS(isColour(dest, 3, 3, 255, 0, 0),
+        "%s bitmap drawn again unchanged looks the same", [kind UTF8String]);
+
+      paint(image, 0, 0, 255);
+      drawInto(dest, image);
+      PASS(isColour(dest, 3, 3, 0, 0, 255),
+        "%s bitmap changed in place is drawn with its new pixels",
+        [kind UTF8String]);
+
+      /* One pixel is enough; the first row of the bitmap is the top. */
+      [image bitmapData][0] = 255;
+      drawInto(dest, image);
+      PASS(isColour(dest, 0, 0, 255, 0, 255)
+        && isColour(dest, 1, 0, 0, 0, 255),
+        "%s bitmap with one pixel changed shows it", [kind UTF8String]);
+
+      copy = AUTORELEASE([image copy]);
+      drawInto(dest, copy);
+      PASS(isColour(dest, 0, 0, 255, 0, 255),
+        "a copy of %s bitmap draws the same", [kind UTF8String]);
+    }
+
+  END_SET("image surface cache")
+
+  return 0;
+}
+
+#else
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("image surface cache")
+    SKIP("back is not built with the cairo graphics backend")
+  END_SET("image surface cache")
+  return 0;
+}
+
+#endif
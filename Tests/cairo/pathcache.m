@@ -0,0 +1,157 @@
+/* The cairo backend keeps the paths it fills again and again flattened, so
+ * that their curves are not split into lines each time.  Nothing tells it
+ * when an NSBezierPath changes, so a path drawn from the cache has to look
+ * like the path drawn without it, and a path changed in place between two
+ * draws has to show the change.
+ *
+ * The paths are filled into a bitmap context, so the results can be read
+ * back from its bytes.  It needs a running window server to load the
+ * backend at all, so it skips cleanly when there is none, and it guards on
+ * the cairo graphics backend.
+ */
+#import <Foundation/NSObject.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#import <AppKit/AppKit.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE 32
+#define HIGH 32
+
+static NSBitmapImageRep *
+makeRep(void)
+{
+  return AUTORELEASE([[NSBitmapImageRep alloc]
+    initWithBitmapDataPlanes: NULL
+                  pixelsWide: WIDE
+                  pixelsHigh: HIGH
+               bitsPerSample: 8
+             samplesPerPixel: 4
+                    hasAlpha: YES
+                    isPlanar: NO
+              colorSpaceName: NSDeviceRGBColorSpace
+                 bytesPerRow: 0
+                bitsPerPixel: 0]);
+}
+
+static unsigned char *
+pixel(NSBitmapImageRep *rep, int x, int y)
+{
+  return [rep bitmapData] + y * [rep bytesPerRow] + x * 4;
+}
+
+/* Fills the path into a cleared bitmap. */
+static void
+fillPath(NSBitmapImageRep *rep, NSBezierPath *path)
+{
+  NSGraphicsContext *ctxt;
+
+  memset([rep bitmapData], 0, [rep bytesPerRow] * [rep pixelsHigh]);
+  ctxt = [NSGraphicsContext graphicsContextWithBitmapImageRep: rep];
+  [NSGraphicsContext saveGraphicsState];
+  [NSGraphicsContext setCurrentContext: ctxt];
+  [[NSColor blackColor] set];
+  [path fill];
+  [ctxt flushGraphics];
+  [NSGraphicsContext restoreGraphicsState];
+}
+
+/* Whether two bitmaps differ by no more than a step of antialiasing. */
+static BOOL
+isAlike(NSBitmapImageRep *a, NSBitmapImageRep *b)
+{
+  int x;
+  int y;
+  int i;
+
+  for (y = 0; y < HIGH; y++)
+    {
+      for (x = 0; x < WIDE; x++)
+        {
+          for (i = 0; i < 4; i++)
+            {
+              if (abs((int)pixel(a, x, y)[i] - (int)pixel(b, x, y)[i]) > 2)
+                {
+                  return NO;
+                }
+            }
+        }
+    }
+  return YES;
+}
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("path cache")
+
+  NSBitmapImageRep *first;
+  NSBitmapImageRep *again;
+  NSBezierPath *path;
+  NSAffineTransform *shift;
+  int i;
+
+  if (getenv("DISPLAY") == NULL || *getenv("DISPLAY") == '\0')
+    {
+      SKIP("no window server available")
+    }
+
+  NS_DURING
+    {
+      [NSApplication sharedApplication];
+    }
+  NS_HANDLER
+    {
+      SKIP("It looks like the GNUstep backend is not installed")
+    }
+  NS_ENDHANDLER
+
+  first = makeRep();
+  again = makeRep();
+  path = [NSBezierPath bezierPathWithOvalInRect: NSMakeRect(2, 2, 13, 21)];
+
+  /* The first fill is drawn from the curves, later ones from the cache. */
+  fillPath(first, path);
+  PASS(pixel(first, 8, HIGH - 12)[3] == 255,
+    "the inside of a filled oval is covered");
+  PASS(pixel(first, WIDE - 2, 1)[3] == 0,
+    "the outside of a filled oval is not");
+  for (i = 0; i < 3; i++)
+    {
+      fillPath(again, path);
+    }
+  PASS(isAlike(first, again),
+    "an oval filled again looks as it did the first time");
+
+  /* Moved in place, the same path object lands somewhere else. */
+  shift = [NSAffineTransform transform];
+  [shift translateXBy: 15 yBy: 0];
+  [path transformUsingAffineTransform: shift];
+  fillPath(again, path);
+  PASS(pixel(again, 8, HIGH - 12)[3] == 0,
+    "a path changed in place does not leave its old shape");
+  PASS(pixel(again, 23, HIGH - 12)[3] == 255,
+    "a path changed in place is drawn where it now is");
+
+  END_SET("path cache")
+
+  return 0;
+}
+
+#else
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("path cache")
+    SKIP("back is not built with the cairo graphics backend")
+  END_SET("path cache")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/* Speed check of the pixel conversions in Source/cairo/CairoPixelConversion.c.
+ *
+ * Each conversion is run over a full HD frame with the plain C version and
+ * with the one picked for this CPU, which must give the same bytes.  The
+ * times are logged, not tested, since they depend on the machine.
+ *
+ * Guarded and built like pixelconversion.m.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#include <stdlib.h>
+#include <string.h>
+#include "cairo/CairoPixelConversion.h"
+#include "cairo/CairoPixelConversion.c"
+
+#define	WIDE	1920
+#define	HIGH	1080
+#define	ROUNDS	10
+
+/* Times ROUNDS conversions of the frame, row by row, in milliseconds. */
+#define TIME(result, call) \
+  do { \
+    NSDate *start = [NSDate date]; \
+    int r, y; \
+    for (r = 0; r < ROUNDS; r++) \
+      for (y = 0; y < HIGH; y++) \
+	call; \
+    result = -[start timeIntervalSinceNow] * 1000.0 / ROUNDS; \
+  } while (0)
+
+int
+main(void)
+{
+  START_SET("pixelbench")
+  unsigned char		*rgba = malloc(WIDE * HIGH * 4);
+  unsigned char		*rgb = malloc(WIDE * HIGH * 3);
+  uint32_t		*argb = malloc(WIDE * HIGH * 4);
+  uint32_t		*out32 = malloc(WIDE * HIGH * 4);
+  unsigned char		*out8 = malloc(WIDE * HIGH * 4);
+  unsigned char		*ref8 = malloc(WIDE * HIGH * 4);
+  uint32_t		*ref32 = malloc(WIDE * HIGH * 4);
+  NSTimeInterval	plain, picked;
+  BOOL			same = YES;
+  int			i;
+
+  /* A frame with a third opaque, a third transparent and the rest in
+   * between, in runs as images have them. */
+  srandom(3);
+  for (i = 0; i < WIDE * HIGH; i++)
+    {
+      int	band = (i / 97) % 3;
+      int	a = (band == 0) ? 255 : (band == 1) ? 0 : random() & 0xff;
+
+      rgba[4 * i + 3] = a;
+      rgba[4 * i] = a ? random() % (a + 1) : 0;
+      rgba[4 * i + 1] = a ? random() % (a + 1) : 0;
+      rgba[4 * i + 2] = a ? random() % (a + 1) : 0;
+    }
+  for (i = 0; i < WIDE * HIGH * 3; i++)
+    rgb[i] = random() & 0xff;
+  setupKernels();
+
+  TIME(plain, rgbaToARGB32C(rgba + y * WIDE * 4, ref32 + y * WIDE, WIDE));
+  TIME(picked, GSCairoRGBAToARGB32(rgba + y * WIDE * 4, out32 + y * WIDE,
+    WIDE));
+  same = same && !memcmp(ref32, out32, WIDE * HIGH * 4);
+  NSLog(@"RGBA to ARGB32: plain %.2fms, picked %.2fms", plain, picked);
+  memcpy(argb, out32, WIDE * HIGH * 4);
+
+  TIME(plain, argb32ToRGBAC(argb + y * WIDE, ref8 + y * WIDE * 4, WIDE));
+  TIME(picked, GSCairoARGB32ToRGBA(argb + y * WIDE, out8 + y * WIDE * 4,
+    WIDE));
+  same = same && !memcmp(ref8, out8, WIDE * HIGH * 4);
+  NSLog(@"ARGB32 to RGBA: plain %.2fms, picked %.2fms", plain, picked);
+
+  TIME(plain, rgbToRGB24C(rgb + y * WIDE * 3, ref32 + y * WIDE, WIDE));
+  TIME(picked, GSCairoRGBToRGB24(rgb + y * WIDE * 3, out32 + y * WIDE, WIDE));
+  same = same && !memcmp(ref32, out32, WIDE * HIGH * 4);
+  NSLog(@"RGB to RGB24: plain %.2fms, picked %.2fms", plain, picked);
+
+  TIME(plain, premultiplyRGBAToARGB32C(rgba + y * WIDE * 4,
+    ref32 + y * WIDE, WIDE));
+  TIME(picked, GSCairoPremultiplyRGBAToARGB32(rgba + y * WIDE * 4,
+    out32 + y * WIDE, WIDE));
+  same = same && !memcmp(ref32, out32, WIDE * HIGH * 4);
+  NSLog(@"Premultiply: plain %.2fms, picked %.2fms", plain, picked);
+
+  TIME(plain, unpremultiplyARGB32ToRGBAC(argb + y * WIDE,
+    ref8 + y * WIDE * 4, WIDE));
+  TIME(picked, GSCairoUnpremultiplyARGB32ToRGBA(argb + y * WIDE,
+    out8 + y * WIDE * 4, WIDE));
+  same = same && !memcmp(ref8, out8, WIDE * HIGH * 4);
+  NSLog(@"Unpremultiply: plain %.2fms, picked %.2fms", plain, picked);
+
+  PASS(same, "the conversions picked give the same bytes as the plain ones");
+
+  free(rgba);
+  free(rgb);
+  free(argb);
+  free(out32);
+  free(out8);
+  free(ref8);
+  free(ref32);
+  END_SET("pixelbench")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("pixelbench")
+  SKIP("back is not built with the cairo graphics backend")
+  END_SET("pixelbench")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,254 @@
+/* Test for the pixel conversions in Source/cairo/CairoPixelConversion.c.
+ *
+ * The conversions between the layouts of NSBitmapImageRep and cairo have
+ * plain C versions and vectorized ones, picked from what the CPU supports.
+ * Every version this machine can run has to give the same bytes as the plain
+ * one, for every alpha and colour, for row lengths that leave tails of any
+ * size, and in place where that is allowed.  The plain versions are checked
+ * against the definitions: a swap of layout, and premultiplying and
+ * unpremultiplying rounded as the header says.  No display is needed.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_GRAPHICS) && defined(GRAPHICS_cairo) \
+  && BUILD_GRAPHICS == GRAPHICS_cairo
+
+#include <stdlib.h>
+#include <string.h>
+#include "cairo/CairoPixelConversion.h"
+#include "cairo/CairoPixelConversion.c"
+
+#define	WIDE	(256 * 256 + 13)
+
+typedef void (*from4_t)(const unsigned char *, uint32_t *, int);
+typedef void (*to4_t)(const uint32_t *, unsigned char *, int);
+
+/* Every alpha with every colour, in all channels, then some noise. */
+static void
+fill(unsigned char *p, int wide, int bytes)
+{
+  int i;
+
+  srandom(7);
+  for (i = 0; i < wide; i++, p += bytes)
+    {
+      if (i < 65536)
+	{
+	  p[0] = i & 0xff;
+	  p[1] = 255 - (i & 0xff);
+	  p[2] = (i * 7) & 0xff;
+	  if (bytes == 4)
+	    p[3] = i >> 8;
+	}
+      else
+	{
+	  int j;
+
+	  for (j = 0; j < bytes; j++)
+	    p[j] = random() & 0xff;
+	}
+    }
+}
+
+/* Premultiplied data has no colour above its alpha. */
+static void
+clampToAlpha(unsigned char *p, int wide)
+{
+  int i;
+
+  for (i = 0; i < wide; i++, p += 4)
+    {
+      if (p[0] > p[3]) p[0] = p[3];
+      if (p[1] > p[3]) p[1] = p[3];
+      if (p[2] > p[3]) p[2] = p[3];
+    }
+}
+
+static BOOL
+sameFrom(from4_t f, from4_t ref, const unsigned char *src, int bytes)
+{
+  uint32_t *a = calloc(WIDE, 4);
+  uint32_t *b = calloc(WIDE, 4);
+  BOOL same = YES;
+  int n;
+
+  /* Short rows too, so that every tail length is taken. */
+  for (n = 0; n < 40 && same; n++)
+    {
+      ref(src + n * bytes, a, n);
+      f(src + n * bytes, b, n);
+      same = (memcmp(a, b, n * 4) == 0);
+    }
+  ref(src, a, WIDE);
+  f(src, b, WIDE);
+  if (memcmp(a, b, WIDE * 4) != 0)
+    same = NO;
+  free(a);
+  free(b);
+  return same;
+}
+
+static BOOL
+sameTo(to4_t f, to4_t ref, const uint32_t *src)
+{
+  unsigned char *a = calloc(WIDE, 4);
+  unsigned char *b = calloc(WIDE, 4);
+  BOOL same = YES;
+  int n;
+
+  for (n = 0; n < 40 && same; n++)
+    {
+      ref(src + n, a, n);
+      f(src + n, b, n);
+      same = (memcmp(a, b, n * 4) == 0);
+    }
+  ref(src, a, WIDE);
+  f(src, b, WIDE);
+  if (memcmp(a, b, WIDE * 4) != 0)
+    same = NO;
+  free(a);
+  free(b);
+  return same;
+}
+
+int
+main(void)
+{
+  START_SET("pixelconversion")
+  unsigned char	*rgba = malloc(WIDE * 4);
+  unsigned char	*premul = malloc(WIDE * 4);
+  unsigned char	*rgb = malloc(WIDE * 3);
+  uint32_t	*argb = malloc(WIDE * 4);
+  unsigned char	*back = malloc(WIDE * 4);
+  BOOL		ok;
+  int		a, c, i;
+
+  setupRecip();
+  fill(rgba, WIDE, 4);
+  fill(rgb, WIDE, 3);
+  memcpy(premul, rgba, WIDE * 4);
+  clampToAlpha(premul, WIDE);
+
+  /* The plain versions against the definitions. */
+  rgbaToARGB32C(premul, argb, WIDE);
+  argb32ToRGBAC(argb, back, WIDE);
+  PASS(memcmp(back, premul, WIDE * 4) == 0
+    && argb[300] == (((uint32_t)premul[1203] << 24)
+      | ((uint32_t)premul[1200] << 16) | ((uint32_t)premul[1201] << 8)
+      | premul[1202]),
+    "RGBA to ARGB32 and back gives the same bytes");
+
+  rgbToRGB24C(rgb, argb, WIDE);
+  PASS(argb[300] == (((uint32_t)rgb[900] << 16)
+    | ((uint32_t)rgb[901] << 8) | rgb[902]),
+    "RGB to RGB24 puts red high and blue low");
+
+  ok = YES;
+  for (a = 0; a < 256; a++)
+    for (c = 0; c < 256; c++)
+      {
+	unsigned	want = (c * a + 127) / 255;
+	unsigned	got = MUL255(c, a);
+
+	if (got != want)
+	  ok = NO;
+	if (a > 0 && c <= a)
+	  {
+	    want = (c * 255 + a / 2) / a;
+	    if (unpremultiply(c, a) != (want > 255 ? 255 : want))
+	      ok = NO;
+	  }
+      }
+  PASS(ok, "premultiplying and unpremultiplying round as documented");
+
+  premultiplyRGBAToARGB32C(rgba, argb, WIDE);
+  unpremultiplyARGB32ToRGBAC(argb, back, WIDE);
+  ok = YES;
+  for (i = 0; i < WIDE * 4; i++)
+    {
+      unsigned	alpha = rgba[(i & ~3) + 3];
+
+      /* Nothing is lost when the alpha is opaque, and nothing is kept when
+       * it is transparent. */
+      if (alpha == 255 && back[i] != rgba[i])
+	ok = NO;
+      if (alpha == 0 && back[i] != 0)
+	ok = NO;
+    }
+  PASS(ok, "opaque pixels survive premultiplying and back");
+
+  /* In place. */
+  memcpy(back, premul, WIDE * 4);
+  GSCairoRGBAToARGB32(back, (uint32_t *)back, WIDE);
+  rgbaToARGB32C(premul, argb, WIDE);
+  ok = (memcmp(back, argb, WIDE * 4) == 0);
+  GSCairoARGB32ToRGBA((uint32_t *)back, back, WIDE);
+  PASS(ok && memcmp(back, premul, WIDE * 4) == 0,
+    "converting in place gives the same result");
+
+#ifdef PIXEL_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    {
+      rgbaToARGB32C(premul, argb, WIDE);
+      PASS(sameFrom(rgbaToARGB32_sse2, rgbaToARGB32C, premul, 4)
+	&& sameTo(argb32ToRGBA_sse2, argb32ToRGBAC, argb),
+	"SSE2 swaps match the plain versions");
+      PASS(sameFrom(premultiplyRGBAToARGB32_sse2, premultiplyRGBAToARGB32C,
+	rgba, 4), "SSE2 premultiplying matches the plain version");
+      PASS(sameTo(unpremultiplyARGB32ToRGBA_sse2, unpremultiplyARGB32ToRGBAC,
+	argb), "SSE2 unpremultiplying matches the plain version");
+    }
+  else
+    {
+      NSLog(@"SSE2 not available, not tested");
+    }
+  if (__builtin_cpu_supports("ssse3"))
+    {
+      PASS(sameFrom(rgbToRGB24_ssse3, rgbToRGB24C, rgb, 3),
+	"SSSE3 RGB to RGB24 matches the plain version");
+    }
+  else
+    {
+      NSLog(@"SSSE3 not available, not tested");
+    }
+  if (__builtin_cpu_supports("avx2"))
+    {
+      rgbaToARGB32C(premul, argb, WIDE);
+      PASS(sameFrom(rgbaToARGB32_avx2, rgbaToARGB32C, premul, 4)
+	&& sameTo(argb32ToRGBA_avx2, argb32ToRGBAC, argb),
+	"AVX2 swaps match the plain versions");
+      PASS(sameFrom(premultiplyRGBAToARGB32_avx2, premultiplyRGBAToARGB32C,
+	rgba, 4), "AVX2 premultiplying matches the plain version");
+      PASS(sameTo(unpremultiplyARGB32ToRGBA_avx2, unpremultiplyARGB32ToRGBAC,
+	argb), "AVX2 unpremultiplying matches the plain version");
+    }
+  else
+    {
+      NSLog(@"AVX2 not available, not tested");
+    }
+#endif
+
+  free(rgba);
+  free(premul);
+  free(rgb);
+  free(argb);
+  free(back);
+  END_SET("pixelconversion")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("pixelconversion")
+  SKIP("back is not built with the cairo graphics backend")
+  END_SET("pixelconversion")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,138 @@
+/* Tests for the shared glyph metrics cache in
+ * Source/gsc/GSGlyphMetricsCache.m.
+ *
+ * The cache is plain Foundation code, so this test compiles the source in
+ * directly and runs on every backend with no per-backend guard.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+
+#include "gsc/GSGlyphMetricsCache.m"
+
+/* Fills and reads a shared cache from another thread.  Every glyph is
+   given its own number as its width, so a torn or misplaced entry shows. */
+@interface Hammer : NSObject
+{
+@public
+  GSGlyphMetricsCache *cache;
+  volatile BOOL done;
+  BOOL ok;
+}
+- (void) run: (id)arg;
+@end
+
+@implementation Hammer
+- (void) run: (id)arg
+{
+  NSAutoreleasePool *pool = [NSAutoreleasePool new];
+  NSSize s;
+  int i;
+
+  ok = YES;
+  for (i = 0; i < 200000; i++)
+    {
+      NSGlyph g = 3000 + (i * 7) % 300;
+
+      GSGlyphMetricsCacheSetAdvancement(cache, g, NSMakeSize(g, 0));
+      if (GSGlyphMetricsCacheGetAdvancement(cache, g + 1, &s)
+          && s.width != g + 1)
+        ok = NO;
+    }
+  done = YES;
+  [pool release];
+}
+@end
+
+int
+main(void)
+{
+  START_SET("GSGlyphMetricsCache")
+  GSGlyphMetricsCache *a, *b, *c;
+  unsigned long hits, misses;
+  NSSize s;
+  NSRect r;
+  BOOL ok;
+  int i;
+
+  a = GSGlyphMetricsCacheForKey(@"Font 12", 64);
+  b = GSGlyphMetricsCacheForKey(@"Font 12", 64);
+  c = GSGlyphMetricsCacheForKey(@"Font 14", 64);
+  PASS(a != NULL && a == b, "instances with the same key share a cache");
+  PASS(c != NULL && c != a, "instances with other keys don't");
+
+  PASS(!GSGlyphMetricsCacheGetAdvancement(a, 5, &s), "empty cache misses");
+  GSGlyphMetricsCacheSetAdvancement(a, 5, NSMakeSize(7, 0));
+  PASS(GSGlyphMetricsCacheGetAdvancement(b, 5, &s) && s.width == 7,
+       "an advancement is found again");
+  PASS(!GSGlyphMetricsCacheGetBoundingRect(a, 5, &r),
+       "a bounding rect isn't there until it is set");
+  GSGlyphMetricsCacheSetBoundingRect(a, 5, NSMakeRect(1, 2, 3, 4));
+  PASS(GSGlyphMetricsCacheGetBoundingRect(a, 5, &r)
+       && NSEqualRects(r, NSMakeRect(1, 2, 3, 4))
+       && GSGlyphMetricsCacheGetAdvancement(a, 5, &s) && s.width == 7,
+       "a glyph keeps both metrics");
+  PASS(!GSGlyphMetricsCacheGetAdvancement(c, 5, &s),
+       "caches don't share glyphs");
+
+  GSGlyphMetricsCacheGetStatistics(a, &hits, &misses);
+  PASS(hits == 3 && misses == 2, "hits and misses are counted");
+
+  /* The cache holds 64 glyphs; 64 glyphs in a row don't evict each
+     other, since they are spread over all the sets. */
+  for (i = 1000; i < 1064; i++)
+    GSGlyphMetricsCacheSetAdvancement(c, i, NSMakeSize(i, 0));
+  ok = YES;
+  for (i = 1000; i < 1064; i++)
+    if (!GSGlyphMetricsCacheGetAdvancement(c, i, &s) || s.width != i)
+      ok = NO;
+  PASS(ok, "a run of glyphs as large as the cache fits");
+
+  /* A glyph that is used keeps its place when its set fills up. */
+  for (i = 0; i < 10000; i++)
+    {
+      GSGlyphMetricsCacheSetAdvancement(c, 2000 + i, NSMakeSize(1, 0));
+      GSGlyphMetricsCacheGetAdvancement(c, 1000, &s);
+    }
+  PASS(GSGlyphMetricsCacheGetAdvancement(c, 1000, &s) && s.width == 1000,
+       "recently used glyphs are not replaced");
+
+  /* Instances on two threads share the cache of their key. */
+  {
+    Hammer *h = [Hammer new];
+
+    h->cache = c;
+    [NSThread detachNewThreadSelector: @selector(run:)
+                             toTarget: h
+                           withObject: nil];
+    ok = YES;
+    while (!h->done)
+      {
+        for (i = 3000; i < 3300; i++)
+          {
+            if (GSGlyphMetricsCacheGetAdvancement(c, i, &s) && s.width != i)
+              ok = NO;
+            GSGlyphMetricsCacheSetAdvancement(c, i, NSMakeSize(i, 0));
+          }
+      }
+    PASS(ok && h->ok, "a cache used from two threads keeps its entries");
+    [h release];
+  }
+
+  GSGlyphMetricsCacheRelease(a);
+  PASS(GSGlyphMetricsCacheGetAdvancement(b, 5, &s),
+       "the cache lives until its last user releases it");
+  GSGlyphMetricsCacheRelease(b);
+  GSGlyphMetricsCacheRelease(c);
+
+  GSGlyphMetricsCacheGetStatistics(NULL, &hits, &misses);
+  PASS(hits >= 10000 + 64 + 3 && misses >= 2,
+       "the totals include freed caches");
+
+  a = GSGlyphMetricsCacheForKey(@"Font 12", 64);
+  PASS(!GSGlyphMetricsCacheGetAdvancement(a, 5, &s),
+       "a freed cache starts over");
+  GSGlyphMetricsCacheRelease(a);
+
+  END_SET("GSGlyphMetricsCache")
+  return 0;
+}
@@ -9,6 +9,10 @@
  * have produced a readable pixmap, since the conversion is intentionally lossy
  * (quantisation and dithering).
  *
+ * The direct pixel stores used for 16 and 32 bits per pixel are also
+ * compared with XPutPixel() on images in both byte orders, which needs no
+ * display.
+ *
  * The wraster sources are compiled in directly so the test does not need the
  * gui-linked back bundle.  It needs a running X server: it opens the display
  * named by $DISPLAY and skips cleanly when there is none, so the harness can
@@ -51,6 +55,63 @@ bit_count(unsigned long m)
   return n;
 }
 
+/* Converts img without dithering into an image of the given format, once
+ * with the direct stores and once through XPutPixel(), and compares the
+ * two.  The images are set up with XInitImage(), so no display is needed. */
+static BOOL
+direct_matches_generic(RImage *img, int bpp, int depth, int byte_order,
+  unsigned long rm, unsigned long gm, unsigned long bm)
+{
+  RContext	ctx;
+  XImage	a, b;
+  int		ro = trailing_zeros(rm);
+  int		go = trailing_zeros(gm);
+  int		bo = trailing_zeros(bm);
+  unsigned short *rt, *gt, *bt;
+  int		full = ((rm >> ro) == 0xff && (gm >> go) == 0xff
+		  && (bm >> bo) == 0xff);
+  BOOL		same;
+
+  /* The tables only need the context to be kept in. */
+  memset(&ctx, 0, sizeof(ctx));
+  rt = computeTable(&ctx, rm >> ro);
+  gt = computeTable(&ctx, gm >> go);
+  bt = computeTable(&ctx, bm >> bo);
+
+  memset(&a, 0, sizeof(a));
+  a.width = img->width;
+  a.height = img->height;
+  a.format = ZPixmap;
+  a.byte_order = byte_order;
+  a.bitmap_unit = 32;
+  a.bitmap_bit_order = MSBFirst;
+  a.bitmap_pad = 32;
+  a.depth = depth;
+  a.bits_per_pixel = bpp;
+  a.red_mask = rm;
+  a.green_mask = gm;
+  a.blue_mask = bm;
+  if (!XInitImage(&a))
+    {
+      RDestroyConversionCache(&ctx);
+      return NO;
+    }
+  b = a;
+  a.data = calloc(a.height, a.bytes_per_line);
+  b.data = calloc(b.height, b.bytes_per_line);
+
+  convertTrueColor_match(&a, pixelStoreFormat(&a), img, rt, gt, bt,
+    full, ro, go, bo);
+  convertTrueColor_match(&b, PIXEL_GENERIC, img, rt, gt, bt,
+    full, ro, go, bo);
+  same = (memcmp(a.data, b.data, a.height * a.bytes_per_line) == 0);
+
+  free(a.data);
+  free(b.data);
+  RDestroyConversionCache(&ctx);
+  return same;
+}
+
 int
 main(void)
 {
@@ -65,6 +126,31 @@ main(void)
   int		maxError = 0;
   BOOL		trueColor;
 
+  /* Odd sizes, so rows don't end on a whole number of words. */
+  img = RCreateImage(13, 5, 1);
+  for (x = 0; x < 13 * 5 * 4; x++)
+    img->data[x] = x * 37;
+  PASS(direct_matches_generic(img, 32, 24, LSBFirst,
+    0xff0000, 0xff00, 0xff)
+    && direct_matches_generic(img, 32, 24, MSBFirst,
+    0xff0000, 0xff00, 0xff)
+    && direct_matches_generic(img, 32, 24, LSBFirst,
+    0xff00, 0xff0000, 0xff000000),
+    "RGBA to 32-bit pixels stores what XPutPixel does, in either byte order");
+  PASS(direct_matches_generic(img, 16, 16, LSBFirst, 0xf800, 0x7e0, 0x1f)
+    && direct_matches_generic(img, 16, 16, MSBFirst, 0xf800, 0x7e0, 0x1f)
+    && direct_matches_generic(img, 16, 15, LSBFirst, 0x7c00, 0x3e0, 0x1f),
+    "RGBA to 16-bit pixels stores what XPutPixel does, in either byte order");
+  RReleaseImage(img);
+  img = RCreateImage(13, 5, 0);
+  for (x = 0; x < 13 * 5 * 3; x++)
+    img->data[x] = x * 53;
+  PASS(direct_matches_generic(img, 32, 24, MSBFirst,
+    0xff, 0xff00, 0xff0000)
+    && direct_matches_generic(img, 16, 16, MSBFirst, 0xf800, 0x7e0, 0x1f),
+    "RGB to 32- and 16-bit pixels stores what XPutPixel does");
+  RReleaseImage(img);
+
   dpy = XOpenDisplay(NULL);
   if (dpy == NULL)
     {
@@ -164,9 +250,7 @@ main(void)
       XFreePixmap(dpy, pixmap);
     }
   RReleaseImage(img);
-  /* The context is left to the display close: RDestroyContext lives in
-   * xlibimage.c, which carries its own RCreateContext and so cannot be
-   * compiled in beside context.c. */
+  RDestroyContext(ctx);
   XCloseDisplay(dpy);
 
   END_SET("convert")
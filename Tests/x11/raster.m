@@ -10,6 +10,10 @@
  * heap-buffer-overflow at the memcpy).  A symmetric underflow occurred for a
  * source entirely off the right/bottom edge (des->width - *dx, dx > width).
  *
+ * The RCombine functions blend with SSE2 kernels where available; those must
+ * give bit for bit what the plain C kernels give, for every channel count,
+ * opaqueness and row length (the C kernels do the tails of rows).
+ *
  * The real source is compiled in directly so the test does not need the
  * gui-linked back bundle.  Built with -fsanitize=address (see GNUmakefile) the
  * off-edge combine faults before the fix and is clean after it.
@@ -51,6 +55,52 @@ freeImage(RImage *im)
   free(im);
 }
 
+/* Runs a kernel and its plain C version on copies of the same random
+ * destination, for row lengths up to 40 pixels; returns NO if any differ. */
+static BOOL
+kernelsMatch(int kind, int dch, int opaqueness, int oralpha)
+{
+  unsigned char	s[40 * 4];
+  unsigned char	d1[40 * 4];
+  unsigned char	d2[40 * 4];
+  int		n, i;
+
+  for (n = 0; n <= 40; n++)
+    {
+      for (i = 0; i < (int)sizeof(s); i++)
+	{
+	  s[i] = rand();
+	  d1[i] = d2[i] = rand();
+	}
+      /* Make sure the extreme alphas are there. */
+      if (n > 2)
+	{
+	  s[3] = 0;
+	  s[7] = 255;
+	  d1[3] = d2[3] = 0;
+	  d1[7] = d2[7] = 255;
+	}
+      switch (kind)
+	{
+	  case 0:
+	    blendRow(d1, dch, s, n, opaqueness, oralpha);
+	    blendRowC(d2, dch, s, n, opaqueness, oralpha);
+	    break;
+	  case 1:
+	    blendRowOpaque(d1, dch, s, n, opaqueness);
+	    blendRowOpaqueC(d2, dch, s, n, opaqueness);
+	    break;
+	  default:
+	    blendColorRow(d1, n, s[0], s[1], s[2]);
+	    blendColorRowC(d2, n, s[0], s[1], s[2]);
+	    break;
+	}
+      if (memcmp(d1, d2, sizeof(d1)) != 0)
+	return NO;
+    }
+  return YES;
+}
+
 int
 main(void)
 {
@@ -106,6 +156,34 @@ main(void)
   RCombineArea(des, src, 0, 0, 2, 2, 0, 10);
   PASS(1, "combining an off-edge source does not read past the source buffer");
 
+  {
+    static const int	ops[] = {0, 1, 127, 128, 255, 256};
+    BOOL		alpha = YES;
+    BOOL		opaque = YES;
+    BOOL		color = YES;
+    unsigned		i;
+    int			dch, oralpha;
+
+    srand(1);
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+      for (dch = 3; dch <= 4; dch++)
+	{
+	  for (oralpha = 0; oralpha <= 1; oralpha++)
+	    if (!kernelsMatch(0, dch, ops[i], oralpha))
+	      alpha = NO;
+	  if (ops[i] <= 255 && !kernelsMatch(1, dch, ops[i], 0))
+	    opaque = NO;
+	}
+    for (i = 0; i < 16; i++)
+      if (!kernelsMatch(2, 4, 0, 0))
+	color = NO;
+    PASS(alpha, "RGBA blending gives the same result as the plain C kernel");
+    PASS(opaque,
+      "blending with opaqueness gives the same result as the plain C kernel");
+    PASS(color,
+      "blending with a colour gives the same result as the plain C kernel");
+  }
+
   freeImage(src);
   freeImage(des);
   END_SET("raster")
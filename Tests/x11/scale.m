@@ -6,6 +6,12 @@
  * the maximum image size, so scaling to an over-large size dereferenced the
  * NULL destination (segfault).  It now checks each allocation and returns NULL.
  *
+ * RSmoothScaleImageWithFilter() takes the filter per call instead of the
+ * global one set by _wraster_change_filter(), and caches the filter
+ * contributions; it must give the same results as the global filter, keep
+ * flat areas flat with every filter, and give the same results when several
+ * threads scale with different filters at once.
+ *
  * The real source is compiled in directly (with raster.c for RCreateImage and
  * friends) so the test does not need the gui-linked back bundle.
  *
@@ -26,6 +32,36 @@
 #include "x11/raster.c"
 #include "x11/scale.c"
 
+#define SCALE_THREADS	4
+
+typedef struct {
+  RImage	*src;
+  int		filter;
+  RImage	*result[8];
+} ScaleThread;
+
+static void *
+scaleThread(void *arg)
+{
+  ScaleThread	*t = arg;
+  int		i;
+
+  for (i = 0; i < 8; i++)
+    {
+      t->result[i] = RSmoothScaleImageWithFilter(t->src, 30 + i * 13,
+	20 + i * 7, t->filter);
+    }
+  return NULL;
+}
+
+static BOOL
+sameImage(RImage *a, RImage *b)
+{
+  return a != NULL && b != NULL && a->width == b->width
+    && a->height == b->height
+    && memcmp(a->data, b->data, (size_t)a->width * a->height * 3) == 0;
+}
+
 int
 main(void)
 {
@@ -34,6 +70,13 @@ main(void)
   RImage	*up;
   RImage	*sm;
   RImage	*huge;
+  RImage	*pattern;
+  ScaleThread	threads[SCALE_THREADS];
+  pthread_t	ids[SCALE_THREADS];
+  BOOL		flat = YES;
+  BOOL		same = YES;
+  int		filter;
+  int		i;
 
   memset(src->data, 0x40, (size_t)src->width * src->height * 3);
 
@@ -55,6 +98,89 @@ main(void)
   PASS(huge == NULL,
     "RSmoothScaleImage returns NULL for an over-large request");
 
+  /* Every filter keeps a flat image flat, enlarging and reducing. */
+  for (filter = RBoxFilter; filter <= RMitchellFilter; filter++)
+    {
+      RImage	*a = RSmoothScaleImageWithFilter(src, 11, 3, filter);
+      RImage	*b = RSmoothScaleImageWithFilter(a, 2, 2, filter);
+
+      if (a == NULL || b == NULL)
+	flat = NO;
+      else
+	{
+	  for (i = 0; i < a->width * a->height * 3; i++)
+	    if (a->data[i] != 0x40)
+	      flat = NO;
+	  for (i = 0; i < b->width * b->height * 3; i++)
+	    if (b->data[i] != 0x40)
+	      flat = NO;
+	}
+      if (a != NULL)
+	RReleaseImage(a);
+      if (b != NULL)
+	RReleaseImage(b);
+    }
+  PASS(flat, "every filter keeps a flat image flat");
+
+  pattern = RCreateImage(40, 30, 0);
+  for (i = 0; i < pattern->width * pattern->height * 3; i++)
+    pattern->data[i] = (i * 37) ^ (i / 120);
+
+  /* The per-call filter gives what the global one gave, and the cached
+   * contributions give what freshly computed ones do. */
+  for (filter = RBoxFilter; filter <= RMitchellFilter; filter++)
+    {
+      RImage	*a;
+      RImage	*b;
+      RImage	*c;
+
+      _wraster_change_filter(filter);
+      a = RSmoothScaleImage(pattern, 57, 19);
+      _wraster_change_filter(RMitchellFilter);
+      b = RSmoothScaleImageWithFilter(pattern, 57, 19, filter);
+      c = RSmoothScaleImageWithFilter(pattern, 57, 19, filter);
+      if (!sameImage(a, b) || !sameImage(b, c))
+	same = NO;
+      if (a != NULL)
+	RReleaseImage(a);
+      if (b != NULL)
+	RReleaseImage(b);
+      if (c != NULL)
+	RReleaseImage(c);
+    }
+  PASS(same, "RSmoothScaleImageWithFilter matches the global filter");
+
+  /* Threads scaling with different filters at once get what they would
+   * alone. */
+  for (i = 0; i < SCALE_THREADS; i++)
+    {
+      threads[i].src = pattern;
+      threads[i].filter = RLanczos3Filter + i % 2;
+      pthread_create(&ids[i], NULL, scaleThread, &threads[i]);
+    }
+  for (i = 0; i < SCALE_THREADS; i++)
+    pthread_join(ids[i], NULL);
+  same = YES;
+  for (i = 0; i < SCALE_THREADS; i++)
+    {
+      int	j;
+
+      for (j = 0; j < 8; j++)
+	{
+	  RImage	*alone = RSmoothScaleImageWithFilter(pattern,
+	    30 + j * 13, 20 + j * 7, threads[i].filter);
+
+	  if (!sameImage(alone, threads[i].result[j]))
+	    same = NO;
+	  if (alone != NULL)
+	    RReleaseImage(alone);
+	  if (threads[i].result[j] != NULL)
+	    RReleaseImage(threads[i].result[j]);
+	}
+    }
+  PASS(same, "concurrent scaling with different filters is consistent");
+
+  RReleaseImage(pattern);
   RReleaseImage(src);
   END_SET("scale")
   return 0;
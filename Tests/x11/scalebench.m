@@ -0,0 +1,127 @@
+/* Quality and speed check of RSmoothScaleImage() in Source/x11/scale.c.
+ *
+ * RSmoothScaleImage() uses fixed-point contributions, computed once for each
+ * scale, and can split its two passes over a pool of threads.  This compares
+ * it with the double precision scaler it replaced, kept in scale.c as
+ * smoothScaleDouble(): the results must differ by rounding only, and the
+ * threaded results must be the same as the single threaded ones.  The times
+ * of both are logged for a few sizes; they are not tested, since they depend
+ * on the machine.
+ *
+ * Guarded and built like scale.m.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11 && defined(USE_WRASTER) && USE_WRASTER
+
+#include <X11/Xlib.h>
+#include "x11/wraster.h"
+#include "x11/raster.c"
+#include "x11/scale.c"
+
+static int
+maxDifference(RImage *a, RImage *b)
+{
+  size_t	n = (size_t)a->width * a->height * 3;
+  size_t	i;
+  int		max = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      int	d = abs(a->data[i] - b->data[i]);
+
+      if (d > max)
+	max = d;
+    }
+  return max;
+}
+
+int
+main(void)
+{
+  static const int	sizes[][2] = {
+    {37, 23}, {200, 150}, {800, 600}, {1600, 1200}, {3200, 2400}
+  };
+  START_SET("scalebench")
+  RImage	*src = RCreateImage(1600, 1200, 0);
+  BOOL		close = YES;
+  BOOL		same = YES;
+  unsigned	i;
+  int		x, y;
+
+  /* Gradients with some detail, so that the filters have work to do. */
+  for (y = 0; y < src->height; y++)
+    for (x = 0; x < src->width; x++)
+      {
+	unsigned char	*p = src->data + (y * src->width + x) * 3;
+
+	p[0] = x * 255 / src->width;
+	p[1] = ((x / 7) ^ (y / 5)) & 0xff;
+	p[2] = (x * y) >> 6;
+      }
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      int		w = sizes[i][0];
+      int		h = sizes[i][1];
+      NSDate		*start;
+      NSTimeInterval	fixed, dbl;
+      RImage		*a, *b, *c;
+
+      _wraster_set_scale_threads(0);
+      start = [NSDate date];
+      a = RSmoothScaleImage(src, w, h);
+      fixed = -[start timeIntervalSinceNow];
+
+      start = [NSDate date];
+      b = smoothScaleDouble(src, w, h, &filters[RMitchellFilter]);
+      dbl = -[start timeIntervalSinceNow];
+
+      _wraster_set_scale_threads(4);
+      c = RSmoothScaleImage(src, w, h);
+
+      if (a == NULL || b == NULL || c == NULL)
+	{
+	  close = same = NO;
+	}
+      else
+	{
+	  if (maxDifference(a, b) > 2)
+	    close = NO;
+	  if (memcmp(a->data, c->data, (size_t)w * h * 3) != 0)
+	    same = NO;
+	  NSLog(@"%dx%d: fixed point %.1fms, double %.1fms",
+	    w, h, fixed * 1000.0, dbl * 1000.0);
+	}
+      if (a != NULL)
+	RReleaseImage(a);
+      if (b != NULL)
+	RReleaseImage(b);
+      if (c != NULL)
+	RReleaseImage(c);
+    }
+  _wraster_set_scale_threads(0);
+
+  PASS(close, "fixed point scaling differs from double by rounding only");
+  PASS(same, "threaded scaling gives the same result as single threaded");
+
+  RReleaseImage(src);
+  END_SET("scalebench")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("scalebench")
+  SKIP("back is not built with the wraster image code")
+  END_SET("scalebench")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/* Test for the assumption the shared pixmap present path of
+ * Source/x11/XWindowBuffer.m rests on, made with Xlib alone.
+ *
+ * With XWindowBufferShmPixmapPresent, a window buffer is drawn into the
+ * memory of a MIT-SHM pixmap and the damaged rectangles are copied to the
+ * window with XCopyArea, without waiting for a ShmCompletion event between
+ * flushes.  That relies on the server reading the shared memory when it
+ * handles the copy, in request order: this checks it does, by changing the
+ * memory between two copies and reading both results back.  The window
+ * buffer itself is driven through that path by shmpresent.m.
+ *
+ * It needs a running X server with shared pixmaps: it opens the display
+ * named by $DISPLAY and skips cleanly when there is none, so the harness
+ * can run it under a headless server (Xvfb) where one is available.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11 && defined(XSHM)
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+static BOOL
+filled(Display *dpy, Drawable d, int x, int y, int w, int h,
+       unsigned long pixel)
+{
+  XImage	*image = XGetImage(dpy, d, x, y, w, h, AllPlanes, ZPixmap);
+  BOOL		same = (image != NULL);
+  int		i, j;
+
+  for (j = 0; same && j < h; j++)
+    for (i = 0; same && i < w; i++)
+      if (XGetPixel(image, i, j) != pixel)
+	same = NO;
+  if (image != NULL)
+    XDestroyImage(image);
+  return same;
+}
+
+int
+main(void)
+{
+  START_SET("shmpixmap")
+  Display		*dpy;
+  int			screen, depth, major, minor;
+  Bool			pixmaps = False;
+  XShmSegmentInfo	shminfo;
+  XImage		*image;
+  Pixmap		shared, dest;
+  GC			gc;
+  unsigned int		w = 64, h = 48;
+  int			i, j;
+
+  dpy = XOpenDisplay(NULL);
+  if (dpy == NULL)
+    {
+      SKIP("no X display available")
+    }
+  if (!XShmQueryVersion(dpy, &major, &minor, &pixmaps) || !pixmaps
+    || XShmPixmapFormat(dpy) != ZPixmap)
+    {
+      XCloseDisplay(dpy);
+      SKIP("the X server has no shared pixmaps")
+    }
+  screen = DefaultScreen(dpy);
+  depth = DefaultDepth(dpy, screen);
+
+  image = XShmCreateImage(dpy, DefaultVisual(dpy, screen), depth, ZPixmap,
+    NULL, &shminfo, w, h);
+  shminfo.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height,
+    IPC_CREAT | 0700);
+  shminfo.shmaddr = image->data = shmat(shminfo.shmid, 0, 0);
+  shminfo.readOnly = False;
+  PASS(XShmAttach(dpy, &shminfo), "the segment is attached");
+  XSync(dpy, False);
+  shmctl(shminfo.shmid, IPC_RMID, 0);
+
+  shared = XShmCreatePixmap(dpy, RootWindow(dpy, screen), shminfo.shmaddr,
+    &shminfo, w, h, depth);
+  dest = XCreatePixmap(dpy, RootWindow(dpy, screen), w, h, depth);
+  gc = XCreateGC(dpy, dest, 0, NULL);
+
+  /* A first frame, presented, then a second one drawn right after, with no
+   * wait in between. */
+  for (j = 0; j < (int)h; j++)
+    for (i = 0; i < (int)w; i++)
+      XPutPixel(image, i, j, BlackPixel(dpy, screen));
+  XCopyArea(dpy, shared, dest, gc, 0, 0, w, h, 0, 0);
+  PASS(filled(dpy, dest, 0, 0, w, h, BlackPixel(dpy, screen)),
+    "a copy from the shared pixmap gives what was drawn in its memory");
+
+  for (j = 8; j < 24; j++)
+    for (i = 16; i < 40; i++)
+      XPutPixel(image, i, j, WhitePixel(dpy, screen));
+  XCopyArea(dpy, shared, dest, gc, 16, 8, 24, 16, 16, 8);
+  PASS(filled(dpy, dest, 16, 8, 24, 16, WhitePixel(dpy, screen))
+    && filled(dpy, dest, 0, 0, w, 8, BlackPixel(dpy, screen))
+    && filled(dpy, dest, 0, 24, w, h - 24, BlackPixel(dpy, screen)),
+    "copying a damaged rectangle updates just that rectangle");
+
+  XFreeGC(dpy, gc);
+  XFreePixmap(dpy, dest);
+  XFreePixmap(dpy, shared);
+  XShmDetach(dpy, &shminfo);
+  XDestroyImage(image);
+  shmdt(shminfo.shmaddr);
+  XCloseDisplay(dpy);
+  END_SET("shmpixmap")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("shmpixmap")
+  SKIP("back is not built with the x11 server and XShm")
+  END_SET("shmpixmap")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,205 @@
+/* Test for the shared pixmap present path of Source/x11/XWindowBuffer.m.
+ *
+ * With XWindowBufferShmPixmapPresent, a window buffer is drawn into the
+ * memory of a MIT-SHM pixmap and the damaged rectangles are copied to the
+ * window with XCopyArea.  When the pixmap can't be made, the buffer falls
+ * back to XShmPutImage, waiting for a ShmCompletion event between puts.
+ * This draws into the buffers of real windows, flushes parts of them as
+ * the graphics backends do, and reads the windows back: once with the
+ * shared pixmap, and once with it gone as a failed XShmCreatePixmap leaves
+ * it (the only way when the X server has shared pixmaps).
+ *
+ * The buffer and server classes are private to the backend, so they are
+ * reached through NSClassFromString, and their instance variables through
+ * the runtime.  It needs a running X server: it skips cleanly when there is
+ * none, so the harness can run it under a headless server (Xvfb).
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11 && defined(XSHM)
+
+#import <AppKit/AppKit.h>
+#import <GNUstepGUI/GSDisplayServer.h>
+#include <objc/runtime.h>
+#include <stdlib.h>
+#include "x11/XGServerWindow.h"
+#include "x11/XWindowBuffer.h"
+
+#define WIDTH	128
+#define HEIGHT	96
+
+static void *
+ivar(id object, const char *name)
+{
+  Ivar	iv = class_getInstanceVariable(object_getClass(object), name);
+
+  return iv == NULL ? NULL : (char *)object + ivar_getOffset(iv);
+}
+
+static BOOL
+filled(Display *dpy, Drawable d, int x, int y, int w, int h,
+       unsigned long pixel)
+{
+  XImage	*image = XGetImage(dpy, d, x, y, w, h, AllPlanes, ZPixmap);
+  BOOL		same = (image != NULL);
+  int		i, j;
+
+  for (j = 0; same && j < h; j++)
+    for (i = 0; same && i < w; i++)
+      if (XGetPixel(image, i, j) != pixel)
+	same = NO;
+  if (image != NULL)
+    XDestroyImage(image);
+  return same;
+}
+
+static void
+fill(XImage *image, int x, int y, int w, int h, unsigned long pixel)
+{
+  int	i, j;
+
+  for (j = y; j < y + h; j++)
+    for (i = x; i < x + w; i++)
+      XPutPixel(image, i, j, pixel);
+}
+
+/* Makes a window with a buffer, present from the shared pixmap unless
+ * noPixmap is set, draws into it, flushes, and checks what the window
+ * shows.  Returns NO if the buffer has no shared pixmap to present from. */
+static BOOL
+present(GSDisplayServer *server, BOOL noPixmap)
+{
+  Class				bufferClass = NSClassFromString(@"XWindowBuffer");
+  struct XWindowBuffer_depth_info_s	di;
+  gswindow_device_t		*window;
+  Display			*dpy;
+  id				buffer;
+  Pixmap			*pixmap;
+  XImage			*image;
+  unsigned long			black, white;
+  int				win;
+  BOOL				ok;
+
+  win = [(id)server window: NSMakeRect(0, 0, WIDTH, HEIGHT)
+			  : NSBackingStoreBuffered
+			  : NSBorderlessWindowMask
+			  : 0];
+  [server orderwindow: NSWindowAbove : 0 : win];
+  window = [NSClassFromString(@"XGServer") _windowWithTag: win];
+  dpy = window->display;
+  XSync(dpy, False);
+
+  di.drawing_depth = [(id)server screenDepth];
+  di.bytes_per_pixel = 4;
+  di.inline_alpha = NO;
+  di.inline_alpha_ofs = 0;
+  di.byte_order = ImageByteOrder(dpy);
+  buffer = [bufferClass windowBufferForWindow: window depthInfo: &di];
+  pixmap = ivar(buffer, "pixmap");
+  if (noPixmap && *pixmap != 0)
+    {
+      /* As XShmCreatePixmap failing leaves it. */
+      XSetWindowBackgroundPixmap(dpy, window->ident, None);
+      XFreePixmap(dpy, *pixmap);
+      *pixmap = 0;
+    }
+  ok = (noPixmap || *pixmap != 0);
+
+  if (ok)
+    {
+      black = BlackPixel(dpy, DefaultScreen(dpy));
+      white = WhitePixel(dpy, DefaultScreen(dpy));
+      image = XCreateImage(dpy, [(id)server screenVisual],
+	[(id)server screenDepth], ZPixmap, 0,
+	*(char **)ivar(buffer, "data"), *(int *)ivar(buffer, "sx"),
+	*(int *)ivar(buffer, "sy"), 32, *(int *)ivar(buffer, "bytes_per_line"));
+
+      fill(image, 0, 0, WIDTH, HEIGHT, black);
+      [buffer _exposeRect: NSMakeRect(0, 0, WIDTH, HEIGHT)];
+      XSync(dpy, False);
+      PASS(filled(dpy, window->ident, 0, 0, WIDTH, HEIGHT, black),
+	noPixmap ? "without the pixmap a flush shows what was drawn"
+	: "with the pixmap a flush shows what was drawn");
+
+      /* Two rectangles drawn, the first flushed right after the last
+       * flush, with no wait in between. */
+      fill(image, 16, 8, 24, 16, white);
+      fill(image, 64, 40, 16, 16, white);
+      [buffer _exposeRect: NSMakeRect(16, 8, 24, 16)];
+      XSync(dpy, False);
+      PASS(filled(dpy, window->ident, 16, 8, 24, 16, white)
+	&& filled(dpy, window->ident, 64, 40, 16, 16, black),
+	noPixmap ? "without the pixmap just the damaged rect is updated"
+	: "with the pixmap just the damaged rect is updated");
+
+      [buffer _exposeRect: NSMakeRect(64, 40, 16, 16)];
+      XSync(dpy, False);
+      PASS(filled(dpy, window->ident, 64, 40, 16, 16, white)
+	&& filled(dpy, window->ident, 0, 0, WIDTH, 8, black),
+	noPixmap ? "without the pixmap the next flush follows"
+	: "with the pixmap the next flush follows");
+
+      image->data = NULL;
+      XDestroyImage(image);
+    }
+  [server termwindow: win];
+  return ok;
+}
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("shmpresent")
+  GSDisplayServer	*server = nil;
+
+  if (getenv("DISPLAY") == NULL || *getenv("DISPLAY") == '\0')
+    {
+      SKIP("no window server available")
+    }
+
+  /* Read when the buffer class is first used; the registration domain is
+     not saved. */
+  [[NSUserDefaults standardUserDefaults] registerDefaults:
+    [NSDictionary dictionaryWithObject: @"YES"
+				forKey: @"XWindowBufferShmPixmapPresent"]];
+  NS_DURING
+    {
+      [NSApplication sharedApplication];
+      server = GSCurrentServer();
+    }
+  NS_HANDLER
+    {
+      server = nil;
+    }
+  NS_ENDHANDLER
+  if (server == nil || NSClassFromString(@"XWindowBuffer") == Nil
+    || ![server isKindOfClass: NSClassFromString(@"XGServer")])
+    {
+      SKIP("the X11 server is not running")
+    }
+
+  present(server, YES);
+  if (!present(server, NO))
+    {
+      SKIP("the X server has no shared pixmaps")
+    }
+
+  END_SET("shmpresent")
+  return 0;
+}
+
+#else
+
+int
+main(int argc, const char **argv)
+{
+  START_SET("shmpresent")
+  SKIP("back is not built with the x11 server and XShm")
+  END_SET("shmpresent")
+  return 0;
+}
+
+#endif
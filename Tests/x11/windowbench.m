@@ -0,0 +1,164 @@
+/* Speed check of the window tables in Source/x11/xwinmap.c.
+ *
+ * The X11 server resolves every X event to a window: by the X window of the
+ * event, failing that by the frame window the window manager put it in, and
+ * often by window number as well.  This replays a made up stream of events
+ * for an application with many windows (a few busy ones, many palettes and
+ * menus, and frames) through the tables, and through the NSMapTables and
+ * the walk over all windows for frames that they replaced.  Both must find
+ * the same windows; the times are logged, not tested, since they depend on
+ * the machine.
+ *
+ * Guarded and built like xwinmap.m.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include "x11/xwinmap.h"
+#include "x11/xwinmap.c"
+
+#define	NWINDOWS	300
+#define	NEVENTS		1000000
+
+typedef struct {
+  unsigned long	ident;
+  unsigned long	parent;
+  int		number;
+} window_t;
+
+static window_t		windows[NWINDOWS];
+static unsigned long	events[NEVENTS];
+
+static window_t *
+oldLookup(NSMapTable *idents, unsigned long xWindow)
+{
+  window_t	*w = NSMapGet(idents, (void *)xWindow);
+
+  if (w == NULL)
+    {
+      NSMapEnumerator	enumerator = NSEnumerateMapTable(idents);
+      void		*key;
+
+      while (NSNextMapEnumeratorPair(&enumerator, &key, (void**)&w) == YES)
+	{
+	  if (w->parent == xWindow)
+	    break;
+	  w = NULL;
+	}
+      NSEndMapTableEnumeration(&enumerator);
+    }
+  return w;
+}
+
+static window_t *
+newLookup(XWinMap *idents, XWinMap *parents, unsigned long xWindow)
+{
+  window_t	*w = XWinMapGet(idents, xWindow);
+
+  if (w == NULL)
+    w = XWinMapGet(parents, xWindow);
+  return w;
+}
+
+int
+main(void)
+{
+  START_SET("windowbench")
+  NSMapTable		*idents;
+  NSMapTable		*tags;
+  XWinMap		newIdents, newParents, newTags;
+  NSDate		*start;
+  NSTimeInterval	oldTime, newTime;
+  uintptr_t		oldSum = 0, newSum = 0;
+  int			i;
+
+  idents = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+    NSNonOwnedPointerMapValueCallBacks, 20);
+  tags = NSCreateMapTable(NSIntMapKeyCallBacks,
+    NSNonOwnedPointerMapValueCallBacks, 20);
+  XWinMapInit(&newIdents);
+  XWinMapInit(&newParents);
+  XWinMapInit(&newTags);
+  for (i = 0; i < NWINDOWS; i++)
+    {
+      windows[i].ident = 0x2a00000UL + i * 5;
+      windows[i].parent = 0x1600000UL + i * 17;
+      windows[i].number = i + 1;
+      NSMapInsert(idents, (void *)windows[i].ident, &windows[i]);
+      NSMapInsert(tags, (void *)(uintptr_t)windows[i].number, &windows[i]);
+      XWinMapInsert(&newIdents, windows[i].ident, &windows[i]);
+      XWinMapInsert(&newParents, windows[i].parent, &windows[i]);
+      XWinMapInsert(&newTags, windows[i].number, &windows[i]);
+    }
+
+  /* Runs of events for one window, mostly the first few; a frame now and
+   * then, and some windows of other clients. */
+  srandom(1);
+  for (i = 0; i < NEVENTS; )
+    {
+      int	run = 1 + random() % 8;
+      int	r = random() % 100;
+      int	w = (r < 60) ? random() % 4 : random() % NWINDOWS;
+      unsigned long	xWindow;
+
+      if (r < 90)
+	xWindow = windows[w].ident;
+      else if (r < 98)
+	xWindow = windows[w].parent;
+      else
+	xWindow = 0x3c00000UL + w;
+      while (run-- > 0 && i < NEVENTS)
+	events[i++] = xWindow;
+    }
+
+  start = [NSDate date];
+  for (i = 0; i < NEVENTS; i++)
+    {
+      window_t	*w = oldLookup(idents, events[i]);
+
+      if (w != NULL)
+	w = NSMapGet(tags, (void *)(uintptr_t)w->number);
+      oldSum += (uintptr_t)w;
+    }
+  oldTime = -[start timeIntervalSinceNow];
+
+  start = [NSDate date];
+  for (i = 0; i < NEVENTS; i++)
+    {
+      window_t	*w = newLookup(&newIdents, &newParents, events[i]);
+
+      if (w != NULL)
+	w = XWinMapGet(&newTags, w->number);
+      newSum += (uintptr_t)w;
+    }
+  newTime = -[start timeIntervalSinceNow];
+
+  NSLog(@"%d events, %d windows: map tables %.1fms, window tables %.1fms",
+    NEVENTS, NWINDOWS, oldTime * 1000.0, newTime * 1000.0);
+  PASS(oldSum == newSum, "both find the same windows");
+
+  XWinMapFree(&newIdents);
+  XWinMapFree(&newParents);
+  XWinMapFree(&newTags);
+  NSFreeMapTable(idents);
+  NSFreeMapTable(tags);
+  END_SET("windowbench")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("windowbench")
+  SKIP("back is not built with the x11 server")
+  END_SET("windowbench")
+  return 0;
+}
+
+#endif
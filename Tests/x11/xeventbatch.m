@@ -0,0 +1,246 @@
+/* Test for the coalescing and the time limited processing of the event
+ * batches in Source/x11/xeventbatch.c.
+ *
+ * The X11 server reads the events queued by Xlib in batches, drops those
+ * made redundant by later ones of the batch, and processes the rest until
+ * the time for a run loop iteration is up; what is left is put back at the
+ * head of the X queue, in order.  Batches are made up here as Xlib delivers
+ * them and taken through those steps as -receivedEvent:type:extra:forMode:
+ * does, the X queue stood in for by a list, so that no display is needed
+ * until the last check, which puts events back on a real one.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include <stdlib.h>
+#include <string.h>
+#include "x11/xeventbatch.h"
+#include "x11/xeventbatch.c"
+
+static unsigned long serial = 1;
+
+static XEvent *
+add(XEventBatch *batch, int type, Window w)
+{
+  XEvent *ev = &batch->events[batch->count++];
+
+  memset(ev, 0, sizeof(*ev));
+  ev->xany.type = type;
+  ev->xany.serial = serial++;
+  ev->xany.window = w;
+  return ev;
+}
+
+static void
+addExpose(XEventBatch *batch, Window w, int x, int y, int width, int height)
+{
+  XEvent *ev = add(batch, Expose, w);
+
+  ev->xexpose.x = x;
+  ev->xexpose.y = y;
+  ev->xexpose.width = width;
+  ev->xexpose.height = height;
+}
+
+/* Whether the serials of the events of the batch are those given. */
+static BOOL
+serials(XEventBatch *batch, int count, const unsigned long *expected)
+{
+  int i;
+
+  if (batch->count != count)
+    return NO;
+  for (i = 0; i < count; i++)
+    if (batch->events[i].xany.serial != expected[i])
+      return NO;
+  return YES;
+}
+
+/* The delivery: events are recorded, and the time is up after limit. */
+static unsigned long delivered[2 * XEVENTBATCH_SIZE];
+static int deliveredCount;
+static int limit;
+
+static int
+deliver(void *context, XEvent *ev)
+{
+  XEventBatch *batch = context;
+  XEvent next;
+
+  delivered[deliveredCount++] = ev->xany.serial;
+  /* A motion event takes the motion after it, as compression does. */
+  if (ev->type == MotionNotify
+    && XEventBatchPeek(batch, NULL, &next, QueuedAlready)
+    && next.type == MotionNotify)
+    XEventBatchTake(batch, NULL, &next);
+  /* Key releases stand in for events the input method filters. */
+  return ev->type != KeyRelease;
+}
+
+static int
+expired(void *context)
+{
+  return deliveredCount >= limit;
+}
+
+/* The head of the X queue, as XPutBackEvent leaves it. */
+static unsigned long queue[2 * XEVENTBATCH_SIZE];
+static int queued;
+
+static int
+putBack(Display *dpy, XEvent *ev)
+{
+  memmove(queue + 1, queue, queued++ * sizeof(queue[0]));
+  queue[0] = ev->xany.serial;
+  return 0;
+}
+
+int
+main(void)
+{
+  START_SET("xeventbatch")
+  static XEventBatch	batch;
+  XEventCounts		counts = { 0, 0, 0 };
+  XEvent		*ev;
+  Display		*dpy;
+  int			dropped, i;
+
+  /* Configure events: the last from each source is kept. */
+  batch.count = 0;
+  serial = 1;
+  add(&batch, ConfigureNotify, 1);                    /* 1: dropped */
+  add(&batch, ConfigureNotify, 1)->xconfigure.send_event = True; /* 2 */
+  add(&batch, ConfigureNotify, 2);                    /* 3: other window */
+  add(&batch, ConfigureNotify, 1);                    /* 4 */
+  add(&batch, KeyPress, 1);                           /* 5 */
+  dropped = XEventBatchCoalesce(&batch);
+  {
+    unsigned long kept[] = { 2, 3, 4, 5 };
+
+    PASS(dropped == 1 && serials(&batch, 4, kept),
+      "a ConfigureNotify is dropped for a later one from the same source");
+  }
+
+  /* Property events: the last for a property and state is kept. */
+  batch.count = 0;
+  serial = 1;
+  ev = add(&batch, PropertyNotify, 1);                /* 1: dropped */
+  ev->xproperty.atom = 10;
+  ev = add(&batch, PropertyNotify, 1);                /* 2: other atom */
+  ev->xproperty.atom = 11;
+  ev = add(&batch, PropertyNotify, 1);                /* 3: deleted */
+  ev->xproperty.atom = 10;
+  ev->xproperty.state = PropertyDelete;
+  ev = add(&batch, PropertyNotify, 1);                /* 4 */
+  ev->xproperty.atom = 10;
+  dropped = XEventBatchCoalesce(&batch);
+  {
+    unsigned long kept[] = { 2, 3, 4 };
+
+    PASS(dropped == 1 && serials(&batch, 3, kept),
+      "a PropertyNotify is dropped for a later one for the same property");
+  }
+
+  /* Exposes: one inside a larger one, before or after it, is dropped. */
+  batch.count = 0;
+  serial = 1;
+  addExpose(&batch, 1, 10, 10, 5, 5);                 /* 1: inside 2 */
+  addExpose(&batch, 1, 0, 0, 100, 100);               /* 2 */
+  addExpose(&batch, 1, 20, 20, 10, 10);               /* 3: inside 2 */
+  addExpose(&batch, 2, 20, 20, 10, 10);               /* 4: other window */
+  addExpose(&batch, 1, 150, 0, 10, 10);               /* 5: apart */
+  addExpose(&batch, 1, 150, 0, 10, 10);               /* 6: equal to 5 */
+  dropped = XEventBatchCoalesce(&batch);
+  {
+    unsigned long kept[] = { 2, 4, 6 };
+
+    PASS(dropped == 3 && serials(&batch, 3, kept),
+      "an Expose inside a larger one is dropped, and the last of equal ones"
+      " kept");
+  }
+
+  /* Processing with time for all of them. */
+  batch.count = 0;
+  serial = 1;
+  for (i = 0; i < 10; i++)
+    add(&batch, i == 3 ? KeyRelease : KeyPress, 1);
+  counts.received = batch.count;
+  deliveredCount = 0;
+  limit = 1000;
+  PASS(XEventBatchDeliver(&batch, &counts, deliver, expired, &batch)
+    && deliveredCount == 10 && counts.delivered == 9,
+    "a batch is processed in full, filtered events not counted");
+
+  /* Running out of time: the rest go back, in order. */
+  batch.count = 0;
+  serial = 1;
+  for (i = 0; i < 20; i++)
+    add(&batch, i == 4 || i == 5 ? MotionNotify : KeyPress, 1);
+  counts.received += batch.count;
+  counts.delivered = 0;
+  deliveredCount = 0;
+  limit = 8;
+  queued = 0;
+  queue[queued++] = 1000;                     /* already in the X queue */
+  i = XEventBatchDeliver(&batch, &counts, deliver, expired, &batch);
+  PASS(!i && deliveredCount == 8 && batch.next == 9,
+    "processing stops when the time is up");
+  i = XEventBatchPutBack(&batch, NULL, &counts, putBack);
+  {
+    BOOL inOrder = (i == 11 && queued == 12 && queue[11] == 1000);
+    int j;
+
+    for (j = 0; inOrder && j < 11; j++)
+      inOrder = (queue[j] == (unsigned long)(10 + j));
+    PASS(inOrder, "the events left are put back in order, before the queue");
+  }
+  PASS(counts.received == 10 + 9 && counts.delivered == 8
+    && counts.yields == 1,
+    "the counts leave out the events put back");
+
+  /* XPutBackEvent on a display gives them back in that order. */
+  dpy = getenv("DISPLAY") ? XOpenDisplay(NULL) : NULL;
+  if (dpy == NULL)
+    {
+      SKIP("no display to put events back on")
+    }
+  batch.count = 0;
+  serial = 1;
+  for (i = 0; i < 5; i++)
+    add(&batch, ClientMessage, DefaultRootWindow(dpy));
+  batch.next = 2;
+  XEventBatchPutBack(&batch, dpy, &counts, XPutBackEvent);
+  {
+    BOOL inOrder = YES;
+    XEvent got;
+
+    for (i = 3; i <= 5; i++)
+      {
+        XNextEvent(dpy, &got);
+        if (got.type != ClientMessage || got.xany.serial != (unsigned long)i)
+          inOrder = NO;
+      }
+    PASS(inOrder, "Xlib reads the events put back in their order");
+  }
+  XCloseDisplay(dpy);
+
+  END_SET("xeventbatch")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("xeventbatch")
+  SKIP("back is not built with the x11 server")
+  END_SET("xeventbatch")
+  return 0;
+}
+
+#endif
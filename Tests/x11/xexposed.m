@@ -0,0 +1,119 @@
+/* Test for the coalescing of exposed rectangles in Source/x11/xexposed.c.
+ *
+ * The X11 server collects the rectangles of a sequence of Expose events for
+ * a window and hands on one GSAppKitRegionExposed event for each rectangle
+ * left after merging, when the event with a count of 0 ends the sequence.
+ * The rectangles are fed in here the way a window moved across another one
+ * exposes them, and the number and extent of those that come out checked.
+ * It uses no Xlib types, so it needs no display.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include "x11/xexposed.h"
+#include "x11/xexposed.c"
+
+/* The area of the region; the rectangles of a merged region don't
+ * overlap in these tests. */
+static long
+area(XExposedRegion *region)
+{
+  long a = 0;
+  int i;
+
+  for (i = 0; i < region->count; i++)
+    a += (long)region->rects[i].width * region->rects[i].height;
+  return a;
+}
+
+int
+main(void)
+{
+  START_SET("xexposed")
+  XExposedRegion	region;
+  int			i;
+
+  /* A window dragged down across ours exposes strips that touch. */
+  XExposedReset(&region);
+  for (i = 0; i < 40; i++)
+    XExposedAdd(&region, 10, 20 + 5 * i, 200, 5);
+  PASS(region.count == 1, "forty touching strips come out as one rect");
+  PASS(region.rects[0].x == 10 && region.rects[0].y == 20
+    && region.rects[0].width == 200 && region.rects[0].height == 200,
+    "the one rect covers all the strips");
+
+  /* Overlapping rectangles in any order merge too. */
+  XExposedReset(&region);
+  XExposedAdd(&region, 50, 50, 20, 20);
+  XExposedAdd(&region, 0, 0, 60, 60);
+  XExposedAdd(&region, 65, 10, 10, 50);
+  PASS(region.count == 1, "a union that grows into another one takes it in");
+
+  /* A rectangle inside one already there changes nothing. */
+  XExposedReset(&region);
+  XExposedAdd(&region, 0, 0, 100, 100);
+  XExposedAdd(&region, 10, 10, 5, 5);
+  PASS(region.count == 1 && area(&region) == 10000,
+    "a rect inside another one is dropped");
+
+  /* Parts far apart stay apart, so no more is redrawn than exposed. */
+  XExposedReset(&region);
+  XExposedAdd(&region, 0, 0, 10, 10);
+  XExposedAdd(&region, 500, 500, 10, 10);
+  XExposedAdd(&region, 0, 500, 10, 10);
+  PASS(region.count == 3 && area(&region) == 300,
+    "rects apart are kept apart");
+
+  /* However many arrive, there are never more than the region holds. */
+  XExposedReset(&region);
+  for (i = 0; i < 100; i++)
+    XExposedAdd(&region, (i % 10) * 50, (i / 10) * 50, 10, 10);
+  PASS(region.count <= XEXPOSED_MAX_RECTS,
+    "a hundred rects apart come out as at most XEXPOSED_MAX_RECTS");
+  {
+    int covered = 1;
+    int j;
+
+    for (i = 0; i < 100 && covered; i++)
+      {
+        int x = (i % 10) * 50, y = (i / 10) * 50;
+        int in = 0;
+
+        for (j = 0; j < region.count; j++)
+          {
+            XExposedRect *r = &region.rects[j];
+
+            if (r->x <= x && r->y <= y && x + 10 <= r->x + r->width
+              && y + 10 <= r->y + r->height)
+              in = 1;
+          }
+        covered = in;
+      }
+    PASS(covered, "every exposed rect is covered by one that comes out");
+  }
+
+  /* Empty rectangles are left out. */
+  XExposedReset(&region);
+  XExposedAdd(&region, 5, 5, 0, 10);
+  PASS(region.count == 0, "an empty rect is left out");
+
+  END_SET("xexposed")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("xexposed")
+  SKIP("back is not built with the x11 server")
+  END_SET("xexposed")
+  return 0;
+}
+
+#endif
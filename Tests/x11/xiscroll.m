@@ -0,0 +1,116 @@
+/* Test for the scroll valuator bookkeeping in Source/x11/xiscroll.c.
+ *
+ * With XInput 2.1 the X11 server gets wheel and touchpad scrolling as
+ * absolute valuator values in motion events, mixed with the pointer axes.
+ * xiscroll.c keeps the last value of each scroll valuator and turns new ones
+ * into deltas in wheel steps, with the signs the core wheel buttons give.
+ * It also decides whether the core wheel buttons 4 to 7 are still used,
+ * which they must be when the server has no XInput2 (Xvfb, for one), and
+ * whether a scroll moves the pointer too.  It uses no XInput2 types, so
+ * this needs neither the extension nor a display: the events are made up
+ * here in the form XInput2 delivers them.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include "x11/xiscroll.h"
+#include "x11/xiscroll.c"
+
+int
+main(void)
+{
+  START_SET("xiscroll")
+  XIScrollDevice	none = { -1, 0 };
+  XIScrollDevice	dev;
+  unsigned char		mask[2];
+  double		values[4];
+  double		dx, dy;
+  int			found;
+
+  /* Valuators 0 and 1 are the pointer axes, 2 scrolls vertically and 3
+   * horizontally, 120 units to a wheel step. */
+  XIScrollReset(&dev, 2);
+  PASS(XIScrollAddValuator(&dev, 2, 0, 120.0, 1000.0)
+    && XIScrollAddValuator(&dev, 3, 1, 120.0, 0.0),
+    "scroll valuators are added");
+  PASS(!XIScrollAddValuator(&dev, 4, 0, 0.0, 0.0),
+    "a valuator with no increment is refused");
+
+  /* Plain motion: no scrolling. */
+  mask[0] = 0x03; mask[1] = 0;
+  values[0] = 10; values[1] = 20;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(!found && dx == 0.0 && dy == 0.0, "pointer motion does not scroll");
+
+  /* Half a step down: the core down button gives a negative deltaY. */
+  mask[0] = 0x04;
+  values[0] = 1060;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(found && dx == 0.0 && dy == -0.5, "scrolling down half a step");
+
+  /* Motion and a step and a half to the right in one event. */
+  mask[0] = 0x0b;
+  values[0] = 11; values[1] = 21; values[2] = 180;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(found && dx == 1.5 && dy == 0.0, "scrolling right among pointer axes");
+
+  /* After the pointer comes back into a window the values may have jumped;
+   * the first event only records them. */
+  XIScrollInvalidate(&dev);
+  mask[0] = 0x04;
+  values[0] = 5000;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(found && dy == 0.0, "the first value after invalidation is recorded");
+  values[0] = 4880;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(found && dy == 1.0, "scrolling up a step after invalidation");
+
+  /* A valuator above the first byte of the mask. */
+  XIScrollReset(&dev, 3);
+  XIScrollAddValuator(&dev, 9, 0, -1.0, 0.0);
+  mask[0] = 0x01; mask[1] = 0x02;
+  values[0] = 7; values[1] = 2.25;
+  found = XIScrollUpdate(&dev, mask, 2, values, &dx, &dy);
+  PASS(found && dy == 2.25, "an inverted valuator in the second mask byte");
+
+  /* Without XInput2 no motion event is ever translated, so the device
+   * stays as the server starts it, and the wheel buttons scroll. */
+  PASS(!XIScrollTakesButtons(&none, 0) && !XIScrollTakesButtons(&none, 1),
+    "without XInput2 the core wheel buttons are used");
+  XIScrollReset(&dev, 2);
+  PASS(!XIScrollTakesButtons(&dev, 0),
+    "the core wheel buttons are used for a pointer with no scroll valuators");
+  XIScrollAddValuator(&dev, 2, 0, 120.0, 0.0);
+  PASS(XIScrollTakesButtons(&dev, 0),
+    "the core wheel buttons are dropped for a pointer with scroll valuators");
+  PASS(!XIScrollTakesButtons(&dev, 1),
+    "the core wheel buttons are used while the pointer is grabbed");
+
+  /* A scroll that moves the pointer also moves it in the application. */
+  PASS(XIScrollMoved(&dev, 100, 200), "the first position is a move");
+  PASS(!XIScrollMoved(&dev, 100, 200), "the same position is not a move");
+  PASS(XIScrollMoved(&dev, 101, 200), "a new root position is a move");
+  XIScrollInvalidate(&dev);
+  PASS(XIScrollMoved(&dev, 101, 200),
+    "the first position after invalidation is a move");
+
+  END_SET("xiscroll")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("xiscroll")
+  SKIP("back is not built with the x11 server")
+  END_SET("xiscroll")
+  return 0;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/* Test for the motion compression of Source/x11/xeventbatch.c and the
+ * motion history of Source/x11/xmotionhistory.c.
+ *
+ * The X11 server processes the events read from the X queue in batches.  A
+ * motion event is compressed with the motion events after it in the batch
+ * for the same window, and the positions passed over are kept with the last
+ * one, for -motionHistoryForEvent:...  A batch is made up here as Xlib
+ * delivers it and taken through the compression as -processEvent: does,
+ * with no display, so that only the batch is looked at.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include <string.h>
+#include "x11/xeventbatch.h"
+#include "x11/xeventbatch.c"
+#include "x11/xmotionhistory.h"
+#include "x11/xmotionhistory.c"
+
+static unsigned long serial = 100;
+
+static void
+addMotion(XEventBatch *batch, Window w, int x, int y)
+{
+  XEvent *ev = &batch->events[batch->count++];
+
+  memset(ev, 0, sizeof(*ev));
+  ev->xmotion.type = MotionNotify;
+  ev->xmotion.serial = serial++;
+  ev->xmotion.window = w;
+  ev->xmotion.x = x;
+  ev->xmotion.y = y;
+  ev->xmotion.time = 1000 * x;
+}
+
+static void
+addKey(XEventBatch *batch, Window w)
+{
+  XEvent *ev = &batch->events[batch->count++];
+
+  memset(ev, 0, sizeof(*ev));
+  ev->xkey.type = KeyPress;
+  ev->xkey.serial = serial++;
+  ev->xkey.window = w;
+}
+
+/* Takes the next event of the batch as -processEvent: does: a motion event
+ * is compressed and its history recorded, with the window as the window
+ * number.  Returns the event processed. */
+static XEvent
+process(XEventBatch *batch, XMotionHistory *history,
+  unsigned long *received, int *passedCount)
+{
+  XMotionEvent	passed[XMOTIONHISTORY_MAX - 1];
+  XEvent	ev;
+  int		i;
+
+  XEventBatchTake(batch, NULL, &ev);
+  *passedCount = 0;
+  if (ev.type == MotionNotify)
+    {
+      *passedCount = XEventBatchCompressMotion(batch, NULL, &ev, passed,
+        XMOTIONHISTORY_MAX - 1, received);
+      XMotionHistoryBegin(history, ev.xmotion.window, ev.xmotion.serial);
+      for (i = 0; i < *passedCount; i++)
+        XMotionHistoryAdd(history, passed[i].x, passed[i].y,
+          passed[i].time / 1000.0);
+      XMotionHistoryAdd(history, ev.xmotion.x, ev.xmotion.y,
+        ev.xmotion.time / 1000.0);
+    }
+  return ev;
+}
+
+int
+main(void)
+{
+  START_SET("xmotionhistory")
+  static XEventBatch	batch;
+  static XMotionHistory	history;
+  XMotionPosition	pos[XMOTIONHISTORY_MAX];
+  unsigned long		received = 0;
+  unsigned long		firstSerial;
+  XEvent		ev;
+  int			passedCount, i;
+  unsigned		n;
+
+  /* Five moves in window 1, a key, three in window 2, two in window 1. */
+  batch.count = batch.next = 0;
+  for (i = 1; i <= 5; i++)
+    addMotion(&batch, 1, i, 10 * i);
+  addKey(&batch, 1);
+  for (i = 1; i <= 3; i++)
+    addMotion(&batch, 2, i, 20 * i);
+  addMotion(&batch, 1, 6, 60);
+  addMotion(&batch, 1, 7, 70);
+
+  ev = process(&batch, &history, &received, &passedCount);
+  firstSerial = ev.xmotion.serial;
+  PASS(ev.type == MotionNotify && ev.xmotion.x == 5 && passedCount == 4,
+    "consecutive moves in a window are compressed into the last one");
+  PASS(batch.next == 5, "compression stops at an event of another type");
+  ev = process(&batch, &history, &received, &passedCount);
+  PASS(ev.type == KeyPress, "the key event is processed in its place");
+  ev = process(&batch, &history, &received, &passedCount);
+  PASS(ev.type == MotionNotify && ev.xmotion.window == 2
+    && ev.xmotion.x == 3 && passedCount == 2,
+    "compression stops at a move in another window");
+  ev = process(&batch, &history, &received, &passedCount);
+  PASS(ev.type == MotionNotify && ev.xmotion.window == 1
+    && ev.xmotion.x == 7 && passedCount == 1 && batch.next == batch.count,
+    "the last moves are compressed");
+  PASS(received == 0, "nothing is read from the X queue");
+  PASS(!XEventBatchPeek(&batch, NULL, &ev, QueuedAlready),
+    "the batch is done");
+
+  /* The history of the first event: the five positions, oldest first. */
+  n = XMotionHistoryGet(&history, 1, firstSerial, pos, XMOTIONHISTORY_MAX);
+  PASS(n == 5 && pos[0].x == 1 && pos[0].y == 10 && pos[4].x == 5
+    && pos[4].y == 50 && pos[0].timestamp == 1.0 && pos[4].timestamp == 5.0,
+    "the history of a compressed event has every position passed over");
+  n = XMotionHistoryGet(&history, 1, firstSerial, pos, 2);
+  PASS(n == 2 && pos[0].x == 4 && pos[1].x == 5,
+    "a short history keeps the most recent positions");
+
+  /* The serial alone does not find a history: the window has to match. */
+  n = XMotionHistoryGet(&history, 2, firstSerial, pos, XMOTIONHISTORY_MAX);
+  PASS(n == 0, "a history is not found for another window's serial");
+  XMotionHistoryBegin(&history, 2, 500);
+  XMotionHistoryAdd(&history, 1, 1, 1);
+  XMotionHistoryBegin(&history, 3, 500);
+  XMotionHistoryAdd(&history, 2, 2, 2);
+  XMotionHistoryAdd(&history, 3, 3, 3);
+  PASS(XMotionHistoryGet(&history, 2, 500, pos, XMOTIONHISTORY_MAX) == 1
+    && pos[0].x == 1
+    && XMotionHistoryGet(&history, 3, 500, pos, XMOTIONHISTORY_MAX) == 2
+    && pos[0].x == 2,
+    "events of two windows with the same serial have their own histories");
+  PASS(XMotionHistoryGet(&history, 1, 501, pos, XMOTIONHISTORY_MAX) == 0,
+    "an event that was not compressed has no history");
+
+  /* Long runs keep the last XMOTIONHISTORY_MAX positions. */
+  batch.count = batch.next = 0;
+  for (i = 1; i <= 100; i++)
+    addMotion(&batch, 4, i, i);
+  ev = process(&batch, &history, &received, &passedCount);
+  n = XMotionHistoryGet(&history, 4, ev.xmotion.serial, pos,
+    XMOTIONHISTORY_MAX);
+  PASS(ev.xmotion.x == 100 && n == XMOTIONHISTORY_MAX
+    && pos[0].x == 100 - XMOTIONHISTORY_MAX + 1 && pos[n - 1].x == 100,
+    "a long run keeps its most recent positions");
+
+  /* The ring is shared; an old history is gone once it is overwritten. */
+  for (i = 0; i < XMOTIONHISTORY_EVENTS; i++)
+    {
+      batch.count = batch.next = 0;
+      addMotion(&batch, 5, 1, 1);
+      process(&batch, &history, &received, &passedCount);
+    }
+  PASS(XMotionHistoryGet(&history, 1, firstSerial, pos, XMOTIONHISTORY_MAX)
+    == 0, "the history of an old event is dropped");
+
+  END_SET("xmotionhistory")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("xmotionhistory")
+  SKIP("back is not built with the x11 server")
+  END_SET("xmotionhistory")
+  return 0;
+}
+
+#endif
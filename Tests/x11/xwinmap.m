@@ -0,0 +1,123 @@
+/* Test for the window tables in Source/x11/xwinmap.c.
+ *
+ * The X11 server finds the window of every X event in these tables, so
+ * they must hold up with windows coming and going in any order: entries are
+ * removed without deleted markers, by moving back the ones that follow, and
+ * the last key found is remembered.  This checks them against a plain
+ * array through a long run of random changes.  No display is needed.
+ */
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#include "config.h"
+
+#if defined(BUILD_SERVER) && defined(SERVER_x11) \
+  && BUILD_SERVER == SERVER_x11
+
+#include "x11/xwinmap.h"
+#include "x11/xwinmap.c"
+
+#define	NKEYS	500
+
+int
+main(void)
+{
+  START_SET("xwinmap")
+  static void		*values[NKEYS];
+  static unsigned long	keys[NKEYS];
+  XWinMap		map;
+  unsigned long		index, key;
+  void			*value;
+  BOOL			same = YES;
+  BOOL			all = YES;
+  int			count, i, n;
+  char			tag = 0;
+
+  PASS(XWinMapInit(&map) && XWinMapGet(&map, 0) == NULL,
+    "an empty table has nothing");
+
+  /* X window ids of one client: a base and a counter. */
+  for (i = 0; i < NKEYS; i++)
+    {
+      keys[i] = 0x2a00000UL + i * 3;
+    }
+  XWinMapInsert(&map, 0, &tag);
+  XWinMapInsert(&map, (unsigned long)(intptr_t)-1, &tag + 1);
+  PASS(XWinMapGet(&map, 0) == &tag
+    && XWinMapGet(&map, (unsigned long)(intptr_t)-1) == &tag + 1,
+    "0 and negative window numbers are keys like any other");
+  XWinMapRemove(&map, 0);
+  XWinMapRemove(&map, (unsigned long)(intptr_t)-1);
+  PASS(XWinMapGet(&map, 0) == NULL && map.count == 0,
+    "removed keys are gone");
+
+  srandom(1);
+  for (n = 0; n < 200000 && same; n++)
+    {
+      i = random() % NKEYS;
+      switch (random() % 4)
+	{
+	  case 0:
+	    values[i] = &values[i];
+	    XWinMapInsert(&map, keys[i], values[i]);
+	    break;
+	  case 1:
+	    values[i] = NULL;
+	    XWinMapRemove(&map, keys[i]);
+	    break;
+	  default:
+	    if (XWinMapGet(&map, keys[i]) != values[i])
+	      same = NO;
+	    break;
+	}
+    }
+  PASS(same, "lookups agree with the reference through random changes");
+
+  count = 0;
+  for (i = 0; i < NKEYS; i++)
+    {
+      if (values[i] != NULL)
+	count++;
+      if (XWinMapGet(&map, keys[i]) != values[i])
+	all = NO;
+    }
+  PASS(all && map.count == (unsigned long)count,
+    "the table holds exactly the keys inserted and not removed");
+  PASS(map.count * 2 <= map.mask + 1, "the table is at most half full");
+
+  n = 0;
+  index = 0;
+  while (XWinMapNext(&map, &index, &key, &value))
+    {
+      if (value != &values[(key - 0x2a00000UL) / 3])
+	all = NO;
+      n++;
+    }
+  PASS(all && n == count, "going through the table gives each entry once");
+
+  /* The last key found is remembered; it must not outlive its entry. */
+  XWinMapInsert(&map, keys[7], &tag);
+  XWinMapGet(&map, keys[7]);
+  XWinMapRemove(&map, keys[7]);
+  PASS(XWinMapGet(&map, keys[7]) == NULL,
+    "a removed key is not found through the last hit");
+  XWinMapInsert(&map, keys[7], &tag + 1);
+  PASS(XWinMapGet(&map, keys[7]) == &tag + 1,
+    "a replaced value is found through the last hit");
+
+  XWinMapFree(&map);
+  END_SET("xwinmap")
+  return 0;
+}
+
+#else
+
+int
+main(void)
+{
+  START_SET("xwinmap")
+  SKIP("back is not built with the x11 server")
+  END_SET("xwinmap")
+  return 0;
+}
+
+#endif